@@ -0,0 +1,124 @@
+#include "bench.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+
+#define CALIBRATION_NS 1000000
+
+typedef struct {
+    char name[64];
+    uint64_t iterations;
+    double median_ns;
+    double min_ns;
+    double max_ns;
+    char note_keys[BENCH_MAX_NOTES][32];
+    double note_values[BENCH_MAX_NOTES];
+    int num_notes;
+} bench_result;
+
+static struct {
+    const char * filter;
+    uint64_t min_time_ns;
+    bench_result results[BENCH_MAX_RESULTS];
+    int num_results;
+} state = { NULL, 500000000, { { { 0 }, 0, 0, 0, 0, { { 0 } }, { 0 }, 0 } }, 0 };
+
+static const void * volatile sink;
+
+static uint64_t now_ns(void);
+static uint64_t time_batch(bench_fn fn, void * arg, uint64_t iterations);
+static int compare_doubles(const void * a, const void * b);
+
+void bench_configure(const char * filter, int min_time_ms) {
+    state.filter = filter;
+    if (min_time_ms > 0) state.min_time_ns = (uint64_t) min_time_ms * 1000000;
+}
+
+int bench_selected(const char * name) {
+    return state.filter == NULL || strstr(name, state.filter) != NULL;
+}
+
+void bench_run(const char * name, bench_fn fn, void * arg) {
+    if (!bench_selected(name) || state.num_results == BENCH_MAX_RESULTS) return;
+
+    // Double the batch size until one batch takes long enough to time
+    // reliably, then size batches so all samples fill min_time_ns.
+    uint64_t iterations = 1;
+    uint64_t elapsed;
+    while ((elapsed = time_batch(fn, arg, iterations)) < CALIBRATION_NS) {
+        iterations *= 2;
+    }
+    uint64_t batch_ns = state.min_time_ns / BENCH_SAMPLES;
+    iterations = iterations * batch_ns / elapsed;
+    if (iterations == 0) iterations = 1;
+
+    double samples[BENCH_SAMPLES];
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        samples[i] = (double) time_batch(fn, arg, iterations) / iterations;
+    }
+    qsort(samples, BENCH_SAMPLES, sizeof(double), compare_doubles);
+
+    bench_result * result = &state.results[state.num_results++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->iterations = iterations * BENCH_SAMPLES;
+    result->median_ns = samples[BENCH_SAMPLES / 2];
+    result->min_ns = samples[0];
+    result->max_ns = samples[BENCH_SAMPLES - 1];
+    fprintf(stderr, "%-36s %12.1f ns/op (min %.1f, max %.1f)\n",
+            name, result->median_ns, result->min_ns, result->max_ns);
+}
+
+void bench_annotate(const char * name, const char * key, double value) {
+    if (state.num_results == 0) return;
+    bench_result * result = &state.results[state.num_results - 1];
+    if (strcmp(result->name, name) != 0 || result->num_notes == BENCH_MAX_NOTES) return;
+
+    snprintf(result->note_keys[result->num_notes], sizeof(result->note_keys[0]), "%s", key);
+    result->note_values[result->num_notes++] = value;
+    fprintf(stderr, "%-36s %12.2f %s\n", "", value, key);
+}
+
+void bench_report(FILE * out) {
+    struct utsname host;
+    uname(&host);
+
+    fprintf(out, "{\n  \"host\": \"%s\",\n  \"kernel\": \"%s\",\n  \"time\": %ld,\n  \"benchmarks\": [\n",
+            host.nodename, host.release, (long) time(NULL));
+    for (int i = 0; i < state.num_results; i++) {
+        bench_result * result = &state.results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"iterations\": %lu, \"median_ns\": %.2f, \"min_ns\": %.2f, \"max_ns\": %.2f",
+                result->name, (unsigned long) result->iterations, result->median_ns, result->min_ns, result->max_ns);
+        for (int j = 0; j < result->num_notes; j++) {
+            fprintf(out, ", \"%s\": %.2f", result->note_keys[j], result->note_values[j]);
+        }
+        fprintf(out, "}%s\n", i + 1 < state.num_results ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+void bench_consume(const void * value) {
+    sink = value;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t time_batch(bench_fn fn, void * arg, uint64_t iterations) {
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < iterations; i++) {
+        fn(arg);
+    }
+    uint64_t elapsed = now_ns() - start;
+    return elapsed > 0 ? elapsed : 1;
+}
+
+static int compare_doubles(const void * a, const void * b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
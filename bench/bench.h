@@ -0,0 +1,63 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define BENCH_MAX_RESULTS 128
+#define BENCH_SAMPLES 15
+#define BENCH_MAX_NOTES 4
+
+/**
+ * A benchmarked operation. Each call performs the operation once.
+ */
+typedef void (*bench_fn)(void * arg);
+
+/**
+ * Sets the substring a benchmark name must contain to run (NULL runs all)
+ * and the approximate time spent measuring each benchmark.
+ * @param filter - the name filter
+ * @param min_time_ms - the measuring time per benchmark
+ */
+void bench_configure(const char * filter, int min_time_ms);
+
+/**
+ * Returns whether a benchmark with the given name is selected, so setup for
+ * skipped benchmarks can be avoided.
+ * @param name - the benchmark name
+ * @return 1 if it will run
+ */
+int bench_selected(const char * name);
+
+/**
+ * Calls fn enough times to fill BENCH_SAMPLES batches of roughly equal
+ * length and records the per call time of each batch.
+ * @param name - the benchmark name, used as the key in the results
+ * @param fn - the operation
+ * @param arg - passed to fn
+ */
+void bench_run(const char * name, bench_fn fn, void * arg);
+
+/**
+ * Adds a named value to the most recent result, such as the size of what the
+ * operation produced, to be reported alongside its timings. Does nothing if
+ * that benchmark was not selected or already has BENCH_MAX_NOTES values.
+ * @param name - the benchmark the value belongs to
+ * @param key - the value's name in the results
+ * @param value - the value
+ */
+void bench_annotate(const char * name, const char * key, double value);
+
+/**
+ * Writes every recorded result as a JSON document.
+ * @param out - the stream
+ */
+void bench_report(FILE * out);
+
+/**
+ * Keeps the compiler from optimizing away the computation of value.
+ * @param value - a result of the benchmarked operation
+ */
+void bench_consume(const void * value);
+
+#endif
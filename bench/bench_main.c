@@ -0,0 +1,375 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <dc/pthread.h>
+
+#include "bench.h"
+#include "../http_protocol/compression.h"
+#include "../http_protocol/content_cache.h"
+#include "../http_protocol/config.h"
+#include "../http_protocol/encoding.h"
+#include "../http_protocol/http.h"
+#include "../http_protocol/http_date.h"
+#include "../http_protocol/metrics.h"
+#include "../http_protocol/resolve.h"
+#include "../libs/str_map.h"
+
+#define DEFAULT_MIN_TIME_MS 500
+#define DRAIN_BUFFER_LEN 65536
+#define GROWTH_KEYS 256
+
+/**
+ * Requests as sent by current browsers and by curl, the shapes the parser
+ * sees most often.
+ */
+static char chrome_request[] =
+        "GET /dogs.html HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "Connection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+        "Chrome/118.0.0.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,"
+        "image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-User: ?1\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Referer: http://localhost:8080/index.html\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: en-US,en;q=0.9\r\n"
+        "\r\n";
+
+static char firefox_image_request[] =
+        "GET /img/dogs/dog07.jpg HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:119.0) Gecko/20100101 Firefox/119.0\r\n"
+        "Accept: image/avif,image/webp,*/*\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Connection: keep-alive\r\n"
+        "Referer: http://localhost:8080/dogs.html\r\n"
+        "Sec-Fetch-Dest: image\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "\r\n";
+
+static char curl_request[] =
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "User-Agent: curl/8.4.0\r\n"
+        "Accept: */*\r\n"
+        "\r\n";
+
+static char * header_names[] = {
+        "Host", "Connection", "User-Agent", "Accept", "Accept-Encoding", "Accept-Language",
+        "Referer", "Sec-Fetch-Site", "Sec-Fetch-Mode", "Sec-Fetch-Dest", "Cache-Control", "Cookie"
+};
+#define NUM_HEADER_NAMES (sizeof(header_names) / sizeof(header_names[0]))
+
+typedef struct {
+    config * conf;
+    http_request * request;
+    http_response * response;
+    int fd;
+} response_state;
+
+typedef struct {
+    int encoding;
+    int level;
+    char * in;
+    size_t in_len;
+    size_t out_len;
+} compress_state;
+
+typedef struct {
+    config * conf;
+    unsigned long failures;
+} open_state;
+
+static void bench_parse(void * arg);
+static void bench_sm_put_get(void * arg);
+static void bench_sm_get(void * arg);
+static void bench_sm_growth(void * arg);
+static void bench_get_config(void * arg);
+static void bench_date_asctime(void * arg);
+static void bench_date_format(void * arg);
+static void bench_date_now(void * arg);
+static void bench_normalize(void * arg);
+static void bench_resolve_open(void * arg);
+static void bench_compress(void * arg);
+static void run_compress_benchmarks(config * conf, const char * path);
+static void bench_build_response(void * arg);
+static void bench_send_response(void * arg);
+static void bench_metrics_record(void * arg);
+static void run_response_benchmarks(config * cmd_conf, int fd);
+static void * drain_loop(void * arg);
+
+int main(int argc, char ** argv) {
+    const char * filter = NULL;
+    int min_time_ms = DEFAULT_MIN_TIME_MS;
+    const char * output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:o:h")) != -1) {
+        switch (opt) {
+            case 'f': filter = optarg; break;
+            case 't': min_time_ms = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-f FILTER] [-t MS_PER_BENCHMARK] [-o OUTPUT.json]\n"
+                                "Run from the build directory so ../config.cfg and ../server_directory resolve.\n",
+                        argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    bench_configure(filter, min_time_ms);
+
+    bench_run("parse_request/chrome_document", bench_parse, chrome_request);
+    bench_run("parse_request/firefox_image", bench_parse, firefox_image_request);
+    bench_run("parse_request/curl", bench_parse, curl_request);
+
+    bench_run("str_map/put_get_12", bench_sm_put_get, NULL);
+    str_map * map = sm_create(4);
+    for (size_t i = 0; i < NUM_HEADER_NAMES; i++) sm_put(map, header_names[i], "value");
+    bench_run("str_map/get_hit", bench_sm_get, map);
+    sm_destroy(map);
+    bench_run("str_map/growth_256", bench_sm_growth, NULL);
+
+    char * cmd_argv[] = { argv[0], NULL };
+    config * cmd_conf = get_cmd_config(1, cmd_argv);
+    bench_run("config/get_config", bench_get_config, cmd_conf);
+    bench_run("date/gmtime_asctime", bench_date_asctime, NULL);
+    bench_run("date/http_date_format", bench_date_format, NULL);
+    bench_run("date/http_date_now", bench_date_now, NULL);
+    bench_run("resolve/normalize", bench_normalize, "/img/dogs/./dog%2007.jpg?size=large");
+    config * conf = get_config(cmd_conf);
+    open_state open_bench = { conf, 0 };
+    bench_run("resolve/open", bench_resolve_open, &open_bench);
+    bench_annotate("resolve/open", "failures", (double) open_bench.failures);
+    run_compress_benchmarks(conf, "index.html");
+    run_compress_benchmarks(conf, "dogs.html");
+    // Responses are built as a worker builds them, with a content cache.
+    content_cache_block * content_cache = content_cache_create((size_t) conf->content_cache_size);
+    content_cache_register(content_cache);
+    destroy_config(conf);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        perror("socketpair()");
+        return EXIT_FAILURE;
+    }
+    pthread_t drain_thread;
+    dc_pthread_create(&drain_thread, NULL, drain_loop, &fds[1]);
+    run_response_benchmarks(cmd_conf, fds[0]);
+    close(fds[0]);
+    dc_pthread_join(drain_thread, NULL);
+    close(fds[1]);
+    content_cache_destroy(content_cache);
+    destroy_config(cmd_conf);
+
+    metrics_block * metrics = metrics_create(1);
+    metrics_register(metrics);
+    bench_run("metrics/record_response", bench_metrics_record, NULL);
+    metrics_destroy(metrics);
+
+    FILE * out = output != NULL ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+    bench_report(out);
+    if (out != stdout) fclose(out);
+    return EXIT_SUCCESS;
+}
+
+static void run_response_benchmarks(config * cmd_conf, int fd) {
+    const char * names[][2] = {
+            { "http/build_response/index", "GET /index.html HTTP/1.0\r\n\r\n" },
+            { "http/build_response/not_found", "GET /missing.html HTTP/1.0\r\n\r\n" },
+            { "http/build_response/index_gzip", "GET /index.html HTTP/1.0\r\nAccept-Encoding: gzip\r\n\r\n" },
+            { "http/send_response/index", "GET /index.html HTTP/1.0\r\n\r\n" },
+            { "http/send_response/index_gzip", "GET /index.html HTTP/1.0\r\nAccept-Encoding: gzip\r\n\r\n" },
+            { "http/send_response/not_found", "GET /missing.html HTTP/1.0\r\n\r\n" },
+            { "http/send_response/dog_jpg", "GET /dog.jpg HTTP/1.0\r\n\r\n" },
+            { "http/send_response/head", "HEAD /cat.jpg HTTP/1.0\r\n\r\n" },
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (!bench_selected(names[i][0])) continue;
+
+        char request_text[MAX_REQUEST_LEN];
+        snprintf(request_text, sizeof(request_text), "%s", names[i][1]);
+        response_state state;
+        state.conf = get_config(cmd_conf);
+        state.request = parse_request(request_text, strlen(request_text));
+        state.response = build_response(state.conf, state.request);
+        state.fd = fd;
+
+        if (strstr(names[i][0], "build_response") != NULL) {
+            bench_run(names[i][0], bench_build_response, &state);
+        } else {
+            bench_run(names[i][0], bench_send_response, &state);
+        }
+
+        http_response_destroy(state.response);
+        http_request_destroy(state.request);
+        destroy_config(state.conf);
+    }
+}
+
+static void bench_parse(void * arg) {
+    char * request_text = arg;
+    http_request * request = parse_request(request_text, strlen(request_text));
+    bench_consume(request);
+    http_request_destroy(request);
+}
+
+// The fields build_response and parse_request put in a map, written then read.
+static void bench_sm_put_get(void * arg) {
+    (void) arg;
+    str_map * map = sm_create(4);
+    for (size_t i = 0; i < NUM_HEADER_NAMES; i++) sm_put(map, header_names[i], "value");
+    for (size_t i = 0; i < NUM_HEADER_NAMES; i++) bench_consume(sm_get(map, header_names[i]));
+    sm_destroy(map);
+}
+
+static void bench_sm_get(void * arg) {
+    bench_consume(sm_get(arg, "Accept-Encoding"));
+}
+
+static void bench_sm_growth(void * arg) {
+    (void) arg;
+    char key[16];
+    str_map * map = sm_create(1);
+    for (int i = 0; i < GROWTH_KEYS; i++) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        sm_put(map, key, key);
+    }
+    bench_consume(map);
+    sm_destroy(map);
+}
+
+static void bench_get_config(void * arg) {
+    config * conf = get_config(arg);
+    bench_consume(conf);
+    destroy_config(conf);
+}
+
+// How the Date header used to be produced on every response.
+static void bench_date_asctime(void * arg) {
+    (void) arg;
+    time_t now = time(NULL);
+    bench_consume(asctime(gmtime(&now)));
+}
+
+static void bench_date_format(void * arg) {
+    (void) arg;
+    char date[HTTP_DATE_SIZE];
+    http_date_format(time(NULL), date);
+    bench_consume(date);
+}
+
+static void bench_date_now(void * arg) {
+    (void) arg;
+    char date[HTTP_DATE_SIZE];
+    http_date_now(date);
+    bench_consume(date);
+}
+
+static void bench_normalize(void * arg) {
+    char path[MAX_URI_PATH_LEN];
+    bench_consume((void *) (uintptr_t) resolve_normalize(arg, path, MAX_URI_PATH_LEN));
+}
+
+// Opening and stating a file beneath the root, the filesystem work of
+// every request. Failed opens, which leave st unset, are counted instead,
+// since a missing file times the failure path rather than the open.
+static void bench_resolve_open(void * arg) {
+    open_state * state = arg;
+    struct stat st;
+    int fd = resolve_open(state->conf->root_dir, "dog.jpg", &st);
+    if (fd == -1) {
+        state->failures++;
+        return;
+    }
+    close(fd);
+    bench_consume((void *) (uintptr_t) st.st_size);
+}
+
+// Compresses a page from the root at the levels worth comparing, reporting
+// the bytes saved next to the CPU time spent saving them.
+static void run_compress_benchmarks(config * conf, const char * path) {
+    const int levels[][2] = {
+            { ENCODING_GZIP, 1 }, { ENCODING_GZIP, 6 }, { ENCODING_GZIP, 9 },
+            { ENCODING_ZSTD, 1 }, { ENCODING_ZSTD, 3 }, { ENCODING_ZSTD, 19 },
+    };
+
+    struct stat st;
+    int fd = resolve_open(conf->root_dir, path, &st);
+    if (fd == -1) return;
+    compress_state state;
+    state.in_len = st.st_size;
+    state.in = malloc(state.in_len);
+    if (pread(fd, state.in, state.in_len, 0) != (ssize_t) state.in_len) state.in_len = 0;
+    close(fd);
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "compress/%s_%d/%s", encoding_name(levels[i][0]), levels[i][1], path);
+        if (!compression_supported(levels[i][0]) || !bench_selected(name) || state.in_len == 0) continue;
+
+        state.encoding = levels[i][0];
+        state.level = levels[i][1];
+        state.out_len = 0;
+        bench_run(name, bench_compress, &state);
+        bench_annotate(name, "bytes_in", (double) state.in_len);
+        bench_annotate(name, "bytes_out", (double) state.out_len);
+        bench_annotate(name, "ratio", (double) state.in_len / (double) state.out_len);
+    }
+    free(state.in);
+}
+
+static void bench_compress(void * arg) {
+    compress_state * state = arg;
+    char * out = compression_compress(state->encoding, state->level, state->in, state->in_len, &state->out_len);
+    bench_consume(out);
+    free(out);
+}
+
+static void bench_build_response(void * arg) {
+    response_state * state = arg;
+    http_response * response = build_response(state->conf, state->request);
+    bench_consume(response);
+    http_response_destroy(response);
+}
+
+static void bench_send_response(void * arg) {
+    response_state * state = arg;
+    bench_consume((void *) (uintptr_t) send_response(state->response, state->fd));
+}
+
+static void bench_metrics_record(void * arg) {
+    (void) arg;
+    metrics_record_response(HTTP_OK, 4096, metrics_now_us());
+}
+
+// Reads and discards everything written to the other end of the socketpair.
+static void * drain_loop(void * arg) {
+    int fd = *(int *) arg;
+    char * buf = malloc(DRAIN_BUFFER_LEN);
+    while (read(fd, buf, DRAIN_BUFFER_LEN) > 0);
+    free(buf);
+    return NULL;
+}
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""Compares a bench run against a stored baseline.
+
+Usage: compare.py [--threshold PERCENT] BASELINE.json CURRENT.json
+
+Prints the change in median ns/op for every benchmark present in both
+files and exits with status 1 if any got slower by more than the
+threshold (default 10%).
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        return {b["name"]: b for b in json.load(f)["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flag bench regressions against a baseline.")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="allowed slowdown in percent (default 10)")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+    regressions = []
+
+    print(f"{'benchmark':<36} {'baseline ns':>12} {'current ns':>12} {'change':>9}")
+    for name, result in current.items():
+        if name not in baseline:
+            print(f"{name:<36} {'-':>12} {result['median_ns']:>12.1f} {'new':>9}")
+            continue
+
+        before = baseline[name]["median_ns"]
+        after = result["median_ns"]
+        change = (after - before) / before * 100 if before > 0 else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions.append(name)
+        print(f"{name:<36} {before:>12.1f} {after:>12.1f} {change:>+8.1f}%{flag}")
+
+    for name in baseline:
+        if name not in current:
+            print(f"{name:<36} {baseline[name]['median_ns']:>12.1f} {'-':>12} {'missing':>9}")
+
+    if regressions:
+        print(f"\n{len(regressions)} benchmark(s) slower than the baseline by more than {args.threshold:g}%")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,333 @@
+#include "access_log.h"
+#include "http.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <dc/pthread.h>
+#include <dc/stdlib.h>
+
+#define FLUSH_INTERVAL_MS 20
+#define FLUSH_BUFFER_LEN (1 << 20)
+#define MAX_LINE_LEN (ACCESS_LOG_URI_LEN * 2 + 192)
+#define ROTATED_FILES 5
+#define MAX_IOV 1024
+
+/**
+ * State of the flusher thread in this process. Only one pool, and so only
+ * one access log, is active at a time.
+ */
+static struct {
+    access_log_block * block;
+    pthread_t thread;
+    atomic_bool running;
+    char * path;
+    int fd;
+    off_t size;
+    off_t max_size;
+    char * buffer;
+    struct iovec * iov;
+    unsigned long reported_dropped;
+    time_t cached_second;
+    char cached_time[32];
+} flusher = { .fd = -1 };
+
+static _Thread_local access_log_ring * current_ring;
+static _Thread_local access_log_block * current_block;
+
+static void * flusher_loop(void * arg);
+static int flush_rings(void);
+static char * format_entry(char * out, access_log_entry * entry);
+static char * format_time(char * out, uint64_t timestamp_us);
+static const char * method_name(int method);
+static void open_log(void);
+static void rotate_log(void);
+static void writev_all(int fd, struct iovec * iov, int iovcnt);
+static uint64_t realtime_us(void);
+
+size_t access_log_size(int max_workers) {
+    return sizeof(access_log_block) + (size_t) max_workers * sizeof(access_log_ring);
+}
+
+access_log_block * access_log_create(int max_workers) {
+    access_log_block * block = aligned_alloc(ACCESS_LOG_CACHE_LINE, access_log_size(max_workers));
+    if (block == NULL) {
+        perror("aligned_alloc()");
+        exit(EXIT_FAILURE);
+    }
+    access_log_init(block, max_workers);
+    return block;
+}
+
+void access_log_destroy(access_log_block * block) {
+    if (current_block == block) {
+        current_block = NULL;
+        current_ring = NULL;
+    }
+    free(block);
+}
+
+void access_log_init(access_log_block * block, int max_workers) {
+    memset(block, 0, access_log_size(max_workers));
+    block->max_workers = max_workers;
+}
+
+int access_log_register(access_log_block * block) {
+    int slot = atomic_fetch_add(&block->num_workers, 1);
+    current_block = block;
+    if (slot >= block->max_workers) {
+        current_ring = NULL;
+        fprintf(stderr, "access log: all %d rings are taken, a thread is not logged\n", block->max_workers);
+        return -1;
+    }
+    current_ring = &block->rings[slot];
+    return 0;
+}
+
+void access_log_start(access_log_block * block, config * conf) {
+    if (conf->access_log == NULL || conf->access_log[0] == '\0') return;
+    if (atomic_load(&flusher.running)) return;
+
+    flusher.block = block;
+    flusher.path = strdup(conf->access_log);
+    flusher.max_size = conf->access_log_max_size;
+    flusher.buffer = dc_malloc(FLUSH_BUFFER_LEN);
+    flusher.iov = dc_malloc(sizeof(struct iovec) * (size_t) (block->max_workers + 1));
+    flusher.reported_dropped = 0;
+    open_log();
+    if (flusher.fd == -1) {
+        free(flusher.path);
+        free(flusher.buffer);
+        free(flusher.iov);
+        return;
+    }
+
+    block->full_policy = conf->access_log_policy;
+    atomic_store(&block->enabled, true);
+    atomic_store(&flusher.running, true);
+    dc_pthread_create(&flusher.thread, NULL, flusher_loop, NULL);
+}
+
+void access_log_stop(access_log_block * block) {
+    if (!atomic_load(&flusher.running) || flusher.block != block) return;
+
+    atomic_store(&block->enabled, false);
+    atomic_store(&flusher.running, false);
+    dc_pthread_join(flusher.thread, NULL);
+
+    close(flusher.fd);
+    flusher.fd = -1;
+    free(flusher.path);
+    free(flusher.buffer);
+    free(flusher.iov);
+    flusher.block = NULL;
+}
+
+void access_log_record(int method, const char * uri, int status, uint64_t bytes_sent,
+                       uint64_t started_us, int cache_hit) {
+    access_log_ring * ring = current_ring;
+    if (ring == NULL || !atomic_load_explicit(&current_block->enabled, memory_order_relaxed)) return;
+
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) >= ACCESS_LOG_RING_LEN) {
+        if (current_block->full_policy != ACCESS_LOG_BLOCK ||
+            !atomic_load_explicit(&current_block->enabled, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&current_block->dropped, 1, memory_order_relaxed);
+            return;
+        }
+        sched_yield();
+    }
+
+    access_log_entry * entry = &ring->entries[tail % ACCESS_LOG_RING_LEN];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t now_us = (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+    entry->timestamp_us = realtime_us();
+    entry->duration_us = now_us > started_us ? now_us - started_us : 0;
+    entry->bytes_sent = bytes_sent;
+    entry->method = method;
+    entry->status = status;
+    entry->cache_hit = cache_hit;
+    if (uri == NULL) uri = "-";
+    size_t uri_len = strnlen(uri, ACCESS_LOG_URI_LEN - 1);
+    memcpy(entry->uri, uri, uri_len);
+    entry->uri[uri_len] = '\0';
+
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static void * flusher_loop(void * arg) {
+    (void) arg;
+    struct timespec interval = { 0, FLUSH_INTERVAL_MS * 1000000L };
+
+    while (atomic_load(&flusher.running)) {
+        nanosleep(&interval, NULL);
+        while (flush_rings());
+    }
+    while (flush_rings());
+    return NULL;
+}
+
+// Formats every pending entry into the flush buffer, one contiguous chunk
+// per ring, and writes all chunks with a single writev. Returns whether
+// entries were left behind because the buffer filled up.
+static int flush_rings(void) {
+    access_log_block * block = flusher.block;
+    struct iovec * iov = flusher.iov;
+    int iovcnt = 0;
+    int remaining = 0;
+    char * out = flusher.buffer;
+    char * end = flusher.buffer + FLUSH_BUFFER_LEN;
+
+    int num_workers = atomic_load(&block->num_workers);
+    if (num_workers > block->max_workers) num_workers = block->max_workers;
+
+    for (int i = 0; i < num_workers; i++) {
+        access_log_ring * ring = &block->rings[i];
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        char * chunk = out;
+
+        while (head < tail && end - out >= MAX_LINE_LEN) {
+            out = format_entry(out, &ring->entries[head % ACCESS_LOG_RING_LEN]);
+            head++;
+        }
+        if (head < tail) remaining = 1;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+
+        if (out > chunk) {
+            iov[iovcnt].iov_base = chunk;
+            iov[iovcnt].iov_len = out - chunk;
+            iovcnt++;
+        }
+    }
+
+    unsigned long dropped = atomic_load_explicit(&block->dropped, memory_order_relaxed);
+    if (dropped != flusher.reported_dropped && end - out >= MAX_LINE_LEN) {
+        char * chunk = out;
+        out = format_time(out + sprintf(out, "time="), realtime_us());
+        out += sprintf(out, " dropped=%lu\n", dropped - flusher.reported_dropped);
+        flusher.reported_dropped = dropped;
+        iov[iovcnt].iov_base = chunk;
+        iov[iovcnt].iov_len = out - chunk;
+        iovcnt++;
+    }
+
+    if (iovcnt > 0) {
+        writev_all(flusher.fd, iov, iovcnt);
+        flusher.size += out - flusher.buffer;
+        if (flusher.max_size > 0 && flusher.size >= flusher.max_size) {
+            rotate_log();
+        }
+    }
+    return remaining;
+}
+
+static char * format_entry(char * out, access_log_entry * entry) {
+    out += sprintf(out, "time=");
+    out = format_time(out, entry->timestamp_us);
+    out += sprintf(out, " method=%s uri=\"", method_name(entry->method));
+
+    for (const char * c = entry->uri; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            *out++ = '\\';
+            *out++ = *c;
+        } else if ((unsigned char) *c < 0x20 || *c == 0x7f) {
+            *out++ = '?';
+        } else {
+            *out++ = *c;
+        }
+    }
+
+    out += sprintf(out, "\" status=%d bytes=%lu duration_us=%lu cache=%s\n",
+                   entry->status, (unsigned long) entry->bytes_sent,
+                   (unsigned long) entry->duration_us, entry->cache_hit ? "hit" : "miss");
+    return out;
+}
+
+// Writes an ISO 8601 UTC timestamp with milliseconds. The part up to the
+// seconds is cached since consecutive entries almost always share it.
+static char * format_time(char * out, uint64_t timestamp_us) {
+    time_t second = (time_t) (timestamp_us / 1000000);
+    if (second != flusher.cached_second) {
+        struct tm utc;
+        gmtime_r(&second, &utc);
+        strftime(flusher.cached_time, sizeof(flusher.cached_time), "%Y-%m-%dT%H:%M:%S", &utc);
+        flusher.cached_second = second;
+    }
+    return out + sprintf(out, "%s.%03uZ", flusher.cached_time, (unsigned int) (timestamp_us / 1000 % 1000));
+}
+
+static const char * method_name(int method) {
+    if (method == METHOD_GET) return "GET";
+    if (method == METHOD_HEAD) return "HEAD";
+    return "-";
+}
+
+static void open_log(void) {
+    flusher.fd = open(flusher.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (flusher.fd == -1) {
+        fprintf(stderr, "access log %s: %s\n", flusher.path, strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    flusher.size = fstat(flusher.fd, &st) == 0 ? st.st_size : 0;
+}
+
+// Shifts path.1 .. path.(ROTATED_FILES - 1) up by one, moves the current
+// file to path.1 and starts a new one.
+static void rotate_log(void) {
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+
+    close(flusher.fd);
+    for (int i = ROTATED_FILES - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", flusher.path, i);
+        snprintf(to, sizeof(to), "%s.%d", flusher.path, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", flusher.path);
+    rename(flusher.path, to);
+
+    open_log();
+    if (flusher.fd == -1) {
+        flusher.fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    }
+}
+
+static void writev_all(int fd, struct iovec * iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t num_written = writev(fd, iov, iovcnt < MAX_IOV ? iovcnt : MAX_IOV);
+        if (num_written < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        while (iovcnt > 0 && (size_t) num_written >= iov->iov_len) {
+            num_written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + num_written;
+            iov->iov_len -= num_written;
+        }
+    }
+}
+
+static uint64_t realtime_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,107 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+#define ACCESS_LOG_RING_LEN 512
+#define ACCESS_LOG_URI_LEN 128
+#define ACCESS_LOG_CACHE_LINE 64
+
+#define ACCESS_LOG_DROP 0
+#define ACCESS_LOG_BLOCK 1
+
+/**
+ * One access log record, copied into a ring by the worker and formatted
+ * later by the flusher.
+ */
+typedef struct {
+    uint64_t timestamp_us;
+    uint64_t duration_us;
+    uint64_t bytes_sent;
+    int method;
+    int status;
+    int cache_hit;
+    char uri[ACCESS_LOG_URI_LEN];
+} access_log_entry;
+
+/**
+ * Single-producer single-consumer ring owned by one worker. The worker only
+ * advances tail and the flusher only advances head, each on its own cache line.
+ */
+typedef struct {
+    alignas(ACCESS_LOG_CACHE_LINE) atomic_uint_fast64_t tail;
+    alignas(ACCESS_LOG_CACHE_LINE) atomic_uint_fast64_t head;
+    access_log_entry entries[ACCESS_LOG_RING_LEN];
+} access_log_ring;
+
+/**
+ * Rings for every worker of a pool, with room for max_workers of them. In
+ * process mode the block lives in the pool's shared memory and the flusher
+ * runs in the accepting process.
+ */
+typedef struct {
+    atomic_int num_workers;
+    int max_workers;
+    atomic_bool enabled;
+    int full_policy;
+    atomic_ulong dropped;
+    access_log_ring rings[];
+} access_log_block;
+
+/**
+ * Returns the size of a block with room for max_workers rings.
+ */
+size_t access_log_size(int max_workers);
+
+/**
+ * Allocates a cache-line aligned, disabled access log block with room for
+ * max_workers rings.
+ */
+access_log_block * access_log_create(int max_workers);
+
+/**
+ * Frees a block allocated by access_log_create.
+ */
+void access_log_destroy(access_log_block * block);
+
+/**
+ * Resets a block of access_log_size(max_workers) bytes in place, e.g. one
+ * placed in shared memory.
+ */
+void access_log_init(access_log_block * block, int max_workers);
+
+/**
+ * Claims the next ring in block for the calling thread. Every later
+ * access_log_record call on this thread writes to that ring. If every ring
+ * is taken, the thread is left without one and logs nothing, since a ring
+ * has a single writer. Returns 0, or -1 if there was no ring left.
+ */
+int access_log_register(access_log_block * block);
+
+/**
+ * Starts the flusher thread in the calling process if conf names an access
+ * log file. The file is rotated once it exceeds access_log_max_size.
+ */
+void access_log_start(access_log_block * block, config * conf);
+
+/**
+ * Drains every ring one last time and stops the flusher thread.
+ */
+void access_log_stop(access_log_block * block);
+
+/**
+ * Appends a record to the calling thread's ring. When the ring is full the
+ * record is dropped or the call waits for the flusher, depending on the
+ * configured policy. Does nothing if logging is disabled.
+ */
+void access_log_record(int method, const char * uri, int status, uint64_t bytes_sent,
+                       uint64_t started_us, int cache_hit);
+
+#endif
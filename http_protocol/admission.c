@@ -0,0 +1,85 @@
+#include "admission.h"
+#include "http.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EWMA_WEIGHT 8
+#define MAX_REJECT_LEN 128
+
+static char reject_response[MAX_REJECT_LEN];
+static size_t reject_response_len;
+static int reject_retry_after = -1;
+
+static void format_reject_response(int retry_after);
+
+void admission_init(admission_control * ac) {
+    atomic_store(&ac->queue_depth, 0);
+    atomic_store(&ac->idle_workers, 0);
+    atomic_store(&ac->queue_wait_us, 0);
+    atomic_store(&ac->admitted, 0);
+    atomic_store(&ac->rejected, 0);
+}
+
+uint64_t admission_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void admission_record_wait(admission_control * ac, uint64_t accepted_us) {
+    uint64_t now = admission_now_us();
+    uint64_t wait = now > accepted_us ? now - accepted_us : 0;
+    atomic_fetch_add_explicit(&ac->admitted, 1, memory_order_relaxed);
+
+    uint_fast64_t average = atomic_load_explicit(&ac->queue_wait_us, memory_order_relaxed);
+    uint_fast64_t updated;
+    do {
+        updated = average - average / EWMA_WEIGHT + wait / EWMA_WEIGHT;
+    } while (!atomic_compare_exchange_weak_explicit(&ac->queue_wait_us, &average, updated,
+                                                    memory_order_relaxed, memory_order_relaxed));
+}
+
+int admission_admit(admission_control * ac, config * conf) {
+    int depth = atomic_load_explicit(&ac->queue_depth, memory_order_relaxed);
+    int idle = atomic_load_explicit(&ac->idle_workers, memory_order_relaxed);
+    uint64_t wait = atomic_load_explicit(&ac->queue_wait_us, memory_order_relaxed);
+
+    // An idle worker can take the client right away, which also lets the
+    // wait average recover after a burst.
+    int overloaded = idle <= depth &&
+            ((conf->max_queue_depth > 0 && depth >= conf->max_queue_depth) ||
+             (conf->max_queue_wait > 0 && wait > (uint64_t) conf->max_queue_wait * 1000));
+
+    return !overloaded;
+}
+
+void admission_reject(admission_control * ac, config * conf, int cfd) {
+    if (reject_retry_after != conf->retry_after) {
+        format_reject_response(conf->retry_after);
+    }
+
+    uint64_t started_us = metrics_now_us();
+    ssize_t sent = send(cfd, reject_response, reject_response_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(cfd, SHUT_WR);
+    close(cfd);
+
+    atomic_fetch_add_explicit(&ac->rejected, 1, memory_order_relaxed);
+    metrics_record_response(HTTP_SERVICE_UNAVAILABLE, sent > 0 ? (uint64_t) sent : 0, started_us);
+}
+
+// Only the accepting thread rejects clients, so the cached response does not
+// need to be synchronized.
+static void format_reject_response(int retry_after) {
+    int len = snprintf(reject_response, MAX_REJECT_LEN,
+                       "HTTP/1.0 503 Service Unavailable\r\n"
+                       "Server: DataComm/0.1\r\n"
+                       "Retry-After: %d\r\n"
+                       "Content-Length: 0\r\n"
+                       "\r\n", retry_after);
+    reject_response_len = (size_t) len;
+    reject_retry_after = retry_after;
+}
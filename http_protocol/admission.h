@@ -0,0 +1,55 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/**
+ * Load measurements for a worker pool. Workers report how long each client
+ * waited between accept and pickup, the accepting process tracks how many
+ * clients are waiting. All fields are lock-free atomics so the struct can be
+ * placed in memory shared between processes.
+ */
+typedef struct {
+    atomic_int queue_depth;
+    atomic_int idle_workers;
+    atomic_uint_fast64_t queue_wait_us;
+    atomic_ulong admitted;
+    atomic_ulong rejected;
+} admission_control;
+
+/**
+ * Resets all measurements.
+ */
+void admission_init(admission_control * ac);
+
+/**
+ * Returns the current CLOCK_MONOTONIC time in microseconds, used to stamp
+ * clients when they are accepted.
+ */
+uint64_t admission_now_us(void);
+
+/**
+ * Counts a client picked up by a worker and folds its queue wait into the
+ * moving average. accepted_us is the admission_now_us value taken at accept.
+ */
+void admission_record_wait(admission_control * ac, uint64_t accepted_us);
+
+/**
+ * Decides whether a newly accepted client should be queued. Clients are
+ * always admitted while there are idle workers; otherwise they are rejected
+ * once the queue depth or average queue wait exceed the configured limits.
+ * Returns 1 to admit and 0 to reject.
+ */
+int admission_admit(admission_control * ac, config * conf);
+
+/**
+ * Answers cfd with a preformatted 503 Service Unavailable carrying the
+ * configured Retry-After, closes it and counts the rejection. Never blocks
+ * and never touches the filesystem.
+ */
+void admission_reject(admission_control * ac, config * conf, int cfd);
+
+#endif
@@ -0,0 +1,209 @@
+#include "archive.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <dc/stdlib.h>
+
+/**
+ * The archive requests are served from in this process. checked is the
+ * second the file was last compared against it.
+ */
+static struct {
+    pthread_rwlock_t lock;
+    archive * current;
+    time_t checked;
+} state = { PTHREAD_RWLOCK_INITIALIZER, NULL, 0 };
+
+static int fits(uint64_t offset, uint64_t len, uint64_t limit);
+static int valid_string(const archive * arch, uint32_t offset, uint32_t len);
+static int validate(const archive * arch);
+static int same_file(const archive * arch, const struct stat * st);
+
+uint64_t archive_hash(const char * path, size_t len) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char) path[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+archive * archive_open(const char * path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(archive_header)) {
+        fprintf(stderr, "%s: not an archive\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    archive_header header;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+        memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) != 0 || header.version != ARCHIVE_VERSION ||
+        header.data_offset < sizeof(header) || header.data_offset > (uint64_t) st.st_size) {
+        fprintf(stderr, "%s: not an archive of version %d\n", path, ARCHIVE_VERSION);
+        close(fd);
+        return NULL;
+    }
+
+    // Only the index is mapped; bodies are sent from the fd.
+    void * map = mmap(NULL, header.data_offset, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap()");
+        close(fd);
+        return NULL;
+    }
+
+    archive * arch = dc_malloc(sizeof(archive));
+    atomic_init(&arch->refs, 1);
+    arch->path = strdup(path);
+    arch->fd = fd;
+    arch->dev = st.st_dev;
+    arch->ino = st.st_ino;
+    arch->mtime = st.st_mtim;
+    arch->size = st.st_size;
+    arch->map = map;
+    arch->map_len = header.data_offset;
+    arch->header = map;
+    arch->slots = (const uint32_t *) ((const char *) map + header.slots_offset);
+    arch->entries = (const archive_entry *) ((const char *) map + header.entries_offset);
+    arch->strings = (const char *) map + header.strings_offset;
+
+    if (!validate(arch)) {
+        fprintf(stderr, "%s: malformed archive\n", path);
+        archive_release(arch);
+        return NULL;
+    }
+    return arch;
+}
+
+archive * archive_acquire(const char * path) {
+    time_t now = time(NULL);
+
+    pthread_rwlock_rdlock(&state.lock);
+    archive * arch = state.current;
+    if (arch != NULL && state.checked == now && strcmp(arch->path, path) == 0) {
+        atomic_fetch_add_explicit(&arch->refs, 1, memory_order_relaxed);
+        pthread_rwlock_unlock(&state.lock);
+        return arch;
+    }
+    pthread_rwlock_unlock(&state.lock);
+
+    archive * replaced = NULL;
+    pthread_rwlock_wrlock(&state.lock);
+    arch = state.current;
+    if (arch == NULL || state.checked != now || strcmp(arch->path, path) != 0) {
+        struct stat st;
+        int unchanged = arch != NULL && strcmp(arch->path, path) == 0 && stat(path, &st) == 0 && same_file(arch, &st);
+        if (!unchanged) {
+            archive * opened = archive_open(path);
+            if (opened != NULL) {
+                replaced = arch;
+                state.current = opened;
+            } else if (arch != NULL && strcmp(arch->path, path) != 0) {
+                replaced = arch;
+                state.current = NULL;
+            }
+        }
+        state.checked = now;
+    }
+    arch = state.current;
+    if (arch != NULL) atomic_fetch_add_explicit(&arch->refs, 1, memory_order_relaxed);
+    pthread_rwlock_unlock(&state.lock);
+
+    archive_release(replaced);
+    return arch;
+}
+
+void archive_release(archive * arch) {
+    if (arch == NULL) return;
+    if (atomic_fetch_sub_explicit(&arch->refs, 1, memory_order_acq_rel) == 1) {
+        munmap(arch->map, arch->map_len);
+        close(arch->fd);
+        free(arch->path);
+        free(arch);
+    }
+}
+
+const archive_entry * archive_find(const archive * arch, const char * path) {
+    size_t len = strlen(path);
+    uint64_t hash = archive_hash(path, len);
+    uint32_t mask = arch->header->num_slots - 1;
+
+    // Linear probing; the packer keeps the table at most half full, and a
+    // probe never visits a slot twice.
+    uint32_t i = (uint32_t) hash & mask;
+    for (uint32_t probes = 0; probes <= mask && arch->slots[i] != 0; probes++, i = (i + 1) & mask) {
+        const archive_entry * entry = &arch->entries[arch->slots[i] - 1];
+        if (entry->hash == hash && entry->path_len == len &&
+            memcmp(arch->strings + entry->path_offset, path, len) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+const char * archive_type(const archive * arch, const archive_entry * entry) {
+    return arch->strings + entry->type_offset;
+}
+
+// Whether [offset, offset + len) lies within [0, limit), without overflow.
+static int fits(uint64_t offset, uint64_t len, uint64_t limit) {
+    return offset <= limit && len <= limit - offset;
+}
+
+static int valid_string(const archive * arch, uint32_t offset, uint32_t len) {
+    return fits(offset, (uint64_t) len + 1, arch->header->strings_len) && arch->strings[offset + len] == '\0';
+}
+
+// Checks every offset once, so lookups can trust the index.
+static int validate(const archive * arch) {
+    const archive_header * header = arch->header;
+    uint64_t index_len = header->data_offset;
+    uint32_t num_slots = header->num_slots;
+
+    if (num_slots == 0 || (num_slots & (num_slots - 1)) != 0 || num_slots <= header->num_entries) return 0;
+    if (header->slots_offset % sizeof(uint32_t) != 0 || header->entries_offset % sizeof(uint64_t) != 0) return 0;
+    if (!fits(header->slots_offset, (uint64_t) num_slots * sizeof(uint32_t), index_len)) return 0;
+    if (!fits(header->entries_offset, (uint64_t) header->num_entries * sizeof(archive_entry), index_len)) return 0;
+    if (!fits(header->strings_offset, header->strings_len, index_len)) return 0;
+
+    // Slots may repeat an entry, so having more slots than entries does not
+    // by itself leave one empty to end a probe.
+    uint32_t num_empty = 0;
+    for (uint32_t i = 0; i < num_slots; i++) {
+        if (arch->slots[i] > header->num_entries) return 0;
+        if (arch->slots[i] == 0) num_empty++;
+    }
+    if (num_empty == 0) return 0;
+    for (uint32_t i = 0; i < header->num_entries; i++) {
+        const archive_entry * entry = &arch->entries[i];
+        if (!valid_string(arch, entry->path_offset, entry->path_len)) return 0;
+        if (!valid_string(arch, entry->type_offset, entry->type_len) || entry->type_len > ARCHIVE_TYPE_MAX) return 0;
+        for (int v = 0; v < ARCHIVE_VARIANTS; v++) {
+            if (entry->len[v] == 0) continue;
+            if (entry->offset[v] < header->data_offset) return 0;
+            if (!fits(entry->offset[v], entry->len[v], (uint64_t) arch->size)) return 0;
+        }
+    }
+    return 1;
+}
+
+static int same_file(const archive * arch, const struct stat * st) {
+    return arch->dev == st->st_dev &&
+           arch->ino == st->st_ino &&
+           arch->size == st->st_size &&
+           arch->mtime.tv_sec == st->st_mtim.tv_sec &&
+           arch->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
@@ -0,0 +1,118 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "encoding.h"
+
+#define ARCHIVE_MAGIC "DCARCHV1"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_PAGE 4096
+#define ARCHIVE_TYPE_MAX 127
+
+/**
+ * Bodies per entry: the file itself, then one per content coding, so the
+ * body coded with encoding e is at index e + 1.
+ */
+#define ARCHIVE_VARIANTS (1 + ENCODING_COUNT)
+#define ARCHIVE_IDENTITY 0
+
+/**
+ * An archive starts with this header, followed by the hash slots, the
+ * entries, the string table and, from data_offset, the bodies. All offsets
+ * are from the start of the file and all integers are in host byte order,
+ * so an archive is read on the kind of machine that packed it.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+    uint32_t num_slots;
+    uint32_t reserved;
+    uint64_t slots_offset;
+    uint64_t entries_offset;
+    uint64_t strings_offset;
+    uint64_t strings_len;
+    uint64_t data_offset;
+} archive_header;
+
+/**
+ * A file in the archive. path and type are NUL-terminated strings in the
+ * string table; path is relative to the packed root without a leading
+ * slash, as resolve_normalize produces it. A coded variant with len 0 is
+ * absent. etag is a hash of the file's content.
+ */
+typedef struct {
+    uint64_t hash;
+    uint32_t path_offset;
+    uint32_t path_len;
+    uint32_t type_offset;
+    uint32_t type_len;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t etag;
+    uint64_t offset[ARCHIVE_VARIANTS];
+    uint64_t len[ARCHIVE_VARIANTS];
+} archive_entry;
+
+/**
+ * An open archive. The index is mapped read-only and shared; bodies are
+ * sent from fd. Immutable once opened, and kept alive by its references.
+ */
+typedef struct {
+    atomic_int refs;
+    char * path;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    void * map;
+    size_t map_len;
+    const archive_header * header;
+    const uint32_t * slots;
+    const archive_entry * entries;
+    const char * strings;
+} archive;
+
+/**
+ * Returns the hash the index is keyed by: 64-bit FNV-1a over len bytes of path.
+ */
+uint64_t archive_hash(const char * path, size_t len);
+
+/**
+ * Opens and checks the archive at path. Returns NULL, with a message on
+ * stderr, if it cannot be read or is malformed.
+ */
+archive * archive_open(const char * path);
+
+/**
+ * Returns the current archive at path, opening it on first use. At most
+ * once a second the file is checked, and if it has been replaced, e.g. by
+ * the packer renaming a new one over it, the new archive takes over for
+ * later requests while those holding the old one finish with it. If the
+ * replacement cannot be opened, the old archive stays. Returns NULL if no
+ * archive could be opened. The result must be released with archive_release.
+ */
+archive * archive_acquire(const char * path);
+
+/**
+ * Drops a reference taken by archive_acquire or archive_open.
+ */
+void archive_release(archive * arch);
+
+/**
+ * Returns the entry for path, as resolve_normalize produces it, or NULL if
+ * the archive has none.
+ */
+const archive_entry * archive_find(const archive * arch, const char * path);
+
+/**
+ * Returns an entry's Content-Type.
+ */
+const char * archive_type(const archive * arch, const archive_entry * entry);
+
+#endif
@@ -0,0 +1,114 @@
+#include "compression.h"
+#include "encoding.h"
+#include "mime.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <dc/stdlib.h>
+
+#define GZIP_WINDOW_BITS (15 + 16)
+#define GZIP_MEM_LEVEL 8
+
+/**
+ * A file to compress on a content cache miss.
+ */
+typedef struct {
+    config * conf;
+    int encoding;
+    int fd;
+    const struct stat * st;
+} compress_job;
+
+static char * compress_file(void * arg, size_t * out_len);
+static char * compress_gzip(int level, const char * in, size_t in_len, size_t * out_len);
+
+int compression_supported(int encoding) {
+#ifdef HAVE_ZSTD
+    if (encoding == ENCODING_ZSTD) return 1;
+#endif
+    return encoding == ENCODING_GZIP;
+}
+
+int compression_compressible(const char * path) {
+    const mime_entry * entry = mime_lookup(path, strlen(path));
+    return entry != NULL && entry->compressible;
+}
+
+int compression_get(config * conf, int encoding, int fd, const struct stat * st, content_body * body, int * cache_hit) {
+    compress_job job = { conf, encoding, fd, st };
+    return content_cache_load(encoding, st, compress_file, &job, body, cache_hit);
+}
+
+char * compression_compress(int encoding, int level, const char * in, size_t in_len, size_t * out_len) {
+    if (encoding == ENCODING_GZIP) return compress_gzip(level, in, in_len, out_len);
+
+#ifdef HAVE_ZSTD
+    if (encoding == ENCODING_ZSTD) {
+        size_t bound = ZSTD_compressBound(in_len);
+        char * out = dc_malloc(bound);
+        size_t len = ZSTD_compress(out, bound, in, in_len, level);
+        if (ZSTD_isError(len)) {
+            free(out);
+            return NULL;
+        }
+        *out_len = len;
+        return out;
+    }
+#endif
+    return NULL;
+}
+
+// Reads the whole file and compresses it. Returns NULL if that fails, or
+// declines the load if it does not save anything.
+static char * compress_file(void * arg, size_t * out_len) {
+    compress_job * job = arg;
+    size_t in_len = job->st->st_size;
+    char * in = dc_malloc(in_len > 0 ? in_len : 1);
+    if (pread(job->fd, in, in_len, 0) != (ssize_t) in_len) {
+        free(in);
+        return NULL;
+    }
+
+    int level = job->encoding == ENCODING_ZSTD ? job->conf->zstd_level : job->conf->gzip_level;
+    char * out = compression_compress(job->encoding, level, in, in_len, out_len);
+    free(in);
+    if (out != NULL && *out_len >= in_len) {
+        free(out);
+        *out_len = CONTENT_CACHE_DECLINED;
+        return NULL;
+    }
+    return out;
+}
+
+static char * compress_gzip(int level, const char * in, size_t in_len, size_t * out_len) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (level < 1 || level > 9) level = Z_DEFAULT_COMPRESSION;
+    if (deflateInit2(&stream, level, Z_DEFLATED, GZIP_WINDOW_BITS, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+
+    size_t bound = deflateBound(&stream, in_len);
+    char * out = dc_malloc(bound);
+    stream.next_in = (Bytef *) in;
+    stream.avail_in = (uInt) in_len;
+    stream.next_out = (Bytef *) out;
+    stream.avail_out = (uInt) bound;
+
+    int status = deflate(&stream, Z_FINISH);
+    *out_len = stream.total_out;
+    deflateEnd(&stream);
+    if (status != Z_STREAM_END) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
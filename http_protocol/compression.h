@@ -0,0 +1,41 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "content_cache.h"
+
+/**
+ * Returns whether this build can compress with encoding on the fly. gzip
+ * is always available, zstd only when built against libzstd.
+ */
+int compression_supported(int encoding);
+
+/**
+ * Returns whether the file at path is of a type worth compressing, judged
+ * by its extension in the MIME table.
+ */
+int compression_compressible(const char * path);
+
+/**
+ * Sets body to the file open as fd and described by st compressed with
+ * encoding at the level configured in conf. Results are kept in the
+ * registered content cache, shared by all workers, keyed by the file's
+ * identity and the coding, and a file is compressed by one worker at a
+ * time. A file that did not get smaller is remembered the same way, so it
+ * is not compressed again until it changes. *cache_hit is set to whether a
+ * kept result was reused. Returns 0 if the file could not be read or did
+ * not get smaller.
+ * The body must be released with content_body_release.
+ */
+int compression_get(config * conf, int encoding, int fd, const struct stat * st, content_body * body, int * cache_hit);
+
+/**
+ * Compresses in_len bytes of in with encoding at level into a new buffer
+ * and sets *out_len to its length. Returns NULL on failure.
+ */
+char * compression_compress(int encoding, int level, const char * in, size_t in_len, size_t * out_len);
+
+#endif
@@ -3,6 +3,8 @@
 #include <string.h>
 #include <getopt.h>
 #include <ctype.h>
+#include <limits.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include "config.h"
 
@@ -12,12 +14,61 @@
 #define DEFAULT_ROOT_DIR "../server_directory"
 #define DEFAULT_INDEX_PAGE "/index.html"
 #define DEFAULT_NOT_FOUND_PAGE "/404.html"
+#define DEFAULT_HEADER_TIMEOUT 10000
+#define DEFAULT_BODY_TIMEOUT 120000
+#define DEFAULT_IDLE_TIMEOUT 15000
+#define DEFAULT_MAX_QUEUE_DEPTH 32
+#define DEFAULT_MAX_QUEUE_WAIT 500
+#define DEFAULT_RETRY_AFTER 1
+#define DEFAULT_ACCESS_LOG ""
+#define DEFAULT_ACCESS_LOG_MAX_SIZE (16 * 1024 * 1024)
+#define DEFAULT_ACCESS_LOG_POLICY 0
+#define DEFAULT_TRACE_SAMPLE_RATE 0
+#define DEFAULT_TRACE_FILE "trace.json"
+#define DEFAULT_TRACE_ENDPOINT 0
+#define DEFAULT_COMPRESSION 1
+#define DEFAULT_COMPRESSION_MIN_SIZE 256
+#define DEFAULT_GZIP_LEVEL 6
+#define DEFAULT_ZSTD_LEVEL 3
+#define DEFAULT_CONTENT_CACHE_SIZE (32 * 1024 * 1024)
+#define DEFAULT_ARCHIVE ""
+#define DEFAULT_WARMUP 0
+#define DEFAULT_WARMUP_THREADS 4
+#define DEFAULT_WARMUP_MAX_SIZE (1024 * 1024)
+#define DEFAULT_WARMUP_BUDGET 10000
+#define DEFAULT_WARMUP_LOCK ""
+#define DEFAULT_PREFETCH 0
+#define DEFAULT_PREFETCH_PRELOAD 0
+#define DEFAULT_IO_THREADS 2
+#define DEFAULT_IO_QUEUE_LEN 16
+#define DEFAULT_IO_COLD_MIN_SIZE 262144
+#define DEFAULT_PACE_RATE 0
+#define DEFAULT_PACE_MIN_SIZE 65536
+#define DEFAULT_EGRESS_RATE 0
+#define DEFAULT_RATE_LIMIT 0
+#define DEFAULT_RATE_LIMIT_BURST 20
 
 static void set_default_config(config *cfg);
 static void set_file_config(config *cfg);
 static void set_env_config(config *cfg);
 static void parse_cmd_line_options(config *cfg, int argc, char **argv);
 static void set_cmd_line_config(config *cfg, config *cmd_cfg);
+static void set_file_int(config_t *lib_config, const char *path, int *value);
+static void set_env_int(const char *name, int *value);
+static int parse_access_log_policy(const char *policy);
+static void add_cache_policy(config *cfg, const char *match, const char *cache_control, int max_age);
+static void clear_cache_policies(config *cfg);
+static void set_file_cache_policies(config *cfg, config_t *lib_config);
+static void set_env_cache_policies(config *cfg, const char *policies);
+static int path_matches(const char *match, const char *path, size_t path_len);
+static void add_lane(config *cfg, const char *name, const char *match, int min_size, int threads, int queue_len);
+static void clear_lanes(config *cfg);
+static void set_file_lanes(config *cfg, config_t *lib_config);
+static void set_env_lanes(config *cfg, const char *lanes);
+static void add_pace_rule(config *cfg, const char *match, int rate);
+static void clear_pace_rules(config *cfg);
+static void set_file_pace_rules(config *cfg, config_t *lib_config);
+static void set_env_pace_rules(config *cfg, const char *rules);
 
 config *get_cmd_config(int argc, char **argv) {
     config *cfg = calloc(1, sizeof(config));
@@ -39,9 +90,63 @@ void destroy_config(config *cfg) {
     free(cfg->root_dir);
     free(cfg->not_found_page);
     free(cfg->index_page);
+    free(cfg->access_log);
+    free(cfg->trace_file);
+    free(cfg->archive);
+    free(cfg->warmup_lock);
+    clear_cache_policies(cfg);
+    free(cfg->cache_policies);
+    clear_lanes(cfg);
+    free(cfg->lanes);
+    clear_pace_rules(cfg);
+    free(cfg->pace_rules);
     free(cfg);
 }
 
+const cache_policy *config_cache_policy(const config *cfg, const char *path) {
+    size_t path_len = strlen(path);
+    for (int i = 0; i < cfg->num_cache_policies; i++) {
+        const cache_policy *policy = &cfg->cache_policies[i];
+        if (path_matches(policy->match, path, path_len)) return policy;
+    }
+    return NULL;
+}
+
+int config_lane_matches(const lane *l, const char *path, long size) {
+    if (size < l->min_size) return 0;
+    return l->match == NULL || path_matches(l->match, path, strlen(path));
+}
+
+int config_pace_rate(const config *cfg, const char *path) {
+    size_t path_len = strlen(path);
+    for (int i = 0; i < cfg->num_pace_rules; i++) {
+        if (path_matches(cfg->pace_rules[i].match, path, path_len)) return cfg->pace_rules[i].rate;
+    }
+    return cfg->pace_rate;
+}
+
+int config_transfer_threads(const config *cfg) {
+    int threads = cfg->io_threads > 0 ? cfg->io_threads : 0;
+    for (int i = 0; i < cfg->num_lanes; i++) {
+        if (cfg->lanes[i].threads > 0) threads += cfg->lanes[i].threads;
+    }
+    return threads;
+}
+
+/**
+ * Returns whether a path matches a path prefix starting with '/', an extension starting with '.', or "*".
+ * @param match - the match
+ * @param path - the path relative to the root directory, without a leading slash
+ * @param path_len - the path's length
+ * @return - whether it matches
+ */
+static int path_matches(const char *match, const char *path, size_t path_len) {
+    size_t match_len = strlen(match);
+    if (match[0] == '*') return 1;
+    if (match[0] == '/' && strncmp(path, match + 1, match_len - 1) == 0) return 1;
+    return match[0] == '.' && path_len >= match_len && strcasecmp(path + path_len - match_len, match) == 0;
+}
+
 /**
  * Returns whether the port is a valid port.
  * @param port - the port
@@ -82,6 +187,39 @@ static void set_default_config(config *cfg) {
     cfg->not_found_page = strdup(DEFAULT_NOT_FOUND_PAGE);
     cfg->mode = DEFAULT_MODE;
     cfg->port = DEFAULT_PORT;
+    cfg->header_timeout = DEFAULT_HEADER_TIMEOUT;
+    cfg->body_timeout = DEFAULT_BODY_TIMEOUT;
+    cfg->idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    cfg->max_queue_depth = DEFAULT_MAX_QUEUE_DEPTH;
+    cfg->max_queue_wait = DEFAULT_MAX_QUEUE_WAIT;
+    cfg->retry_after = DEFAULT_RETRY_AFTER;
+    cfg->access_log = strdup(DEFAULT_ACCESS_LOG);
+    cfg->access_log_max_size = DEFAULT_ACCESS_LOG_MAX_SIZE;
+    cfg->access_log_policy = DEFAULT_ACCESS_LOG_POLICY;
+    cfg->trace_sample_rate = DEFAULT_TRACE_SAMPLE_RATE;
+    cfg->trace_file = strdup(DEFAULT_TRACE_FILE);
+    cfg->trace_endpoint = DEFAULT_TRACE_ENDPOINT;
+    cfg->compression = DEFAULT_COMPRESSION;
+    cfg->compression_min_size = DEFAULT_COMPRESSION_MIN_SIZE;
+    cfg->gzip_level = DEFAULT_GZIP_LEVEL;
+    cfg->zstd_level = DEFAULT_ZSTD_LEVEL;
+    cfg->content_cache_size = DEFAULT_CONTENT_CACHE_SIZE;
+    cfg->archive = strdup(DEFAULT_ARCHIVE);
+    cfg->warmup = DEFAULT_WARMUP;
+    cfg->warmup_threads = DEFAULT_WARMUP_THREADS;
+    cfg->warmup_max_size = DEFAULT_WARMUP_MAX_SIZE;
+    cfg->warmup_budget = DEFAULT_WARMUP_BUDGET;
+    cfg->warmup_lock = strdup(DEFAULT_WARMUP_LOCK);
+    cfg->prefetch = DEFAULT_PREFETCH;
+    cfg->prefetch_preload = DEFAULT_PREFETCH_PRELOAD;
+    cfg->io_threads = DEFAULT_IO_THREADS;
+    cfg->io_queue_len = DEFAULT_IO_QUEUE_LEN;
+    cfg->io_cold_min_size = DEFAULT_IO_COLD_MIN_SIZE;
+    cfg->pace_rate = DEFAULT_PACE_RATE;
+    cfg->pace_min_size = DEFAULT_PACE_MIN_SIZE;
+    cfg->egress_rate = DEFAULT_EGRESS_RATE;
+    cfg->rate_limit = DEFAULT_RATE_LIMIT;
+    cfg->rate_limit_burst = DEFAULT_RATE_LIMIT_BURST;
 }
 
 /**
@@ -99,7 +237,8 @@ static void set_file_config(config *cfg) {
     }
 
     int port;
-    const char *root_dir, *index_page, *not_found_page, *mode;
+    const char *root_dir, *index_page, *not_found_page, *mode, *access_log, *access_log_policy, *trace_file, *archive;
+    const char *warmup_lock;
     if (config_lookup_int(&lib_config, "port", &port) != CONFIG_FALSE) {
         if (is_valid_port(port)) {
             cfg->port = port;
@@ -124,10 +263,75 @@ static void set_file_config(config *cfg) {
         free(cfg->not_found_page);
         cfg->not_found_page = strdup(not_found_page);
     }
+    set_file_int(&lib_config, "header_timeout", &cfg->header_timeout);
+    set_file_int(&lib_config, "body_timeout", &cfg->body_timeout);
+    set_file_int(&lib_config, "idle_timeout", &cfg->idle_timeout);
+    set_file_int(&lib_config, "max_queue_depth", &cfg->max_queue_depth);
+    set_file_int(&lib_config, "max_queue_wait", &cfg->max_queue_wait);
+    set_file_int(&lib_config, "retry_after", &cfg->retry_after);
+    if (config_lookup_string(&lib_config, "access_log", &access_log) != CONFIG_FALSE) {
+        free(cfg->access_log);
+        cfg->access_log = strdup(access_log);
+    }
+    set_file_int(&lib_config, "access_log_max_size", &cfg->access_log_max_size);
+    if (config_lookup_string(&lib_config, "access_log_policy", &access_log_policy) != CONFIG_FALSE) {
+        cfg->access_log_policy = parse_access_log_policy(access_log_policy);
+    }
+    set_file_int(&lib_config, "trace_sample_rate", &cfg->trace_sample_rate);
+    if (config_lookup_string(&lib_config, "trace_file", &trace_file) != CONFIG_FALSE) {
+        free(cfg->trace_file);
+        cfg->trace_file = strdup(trace_file);
+    }
+    set_file_int(&lib_config, "trace_endpoint", &cfg->trace_endpoint);
+    set_file_int(&lib_config, "compression", &cfg->compression);
+    set_file_int(&lib_config, "compression_min_size", &cfg->compression_min_size);
+    set_file_int(&lib_config, "gzip_level", &cfg->gzip_level);
+    set_file_int(&lib_config, "zstd_level", &cfg->zstd_level);
+    set_file_int(&lib_config, "content_cache_size", &cfg->content_cache_size);
+    set_file_cache_policies(cfg, &lib_config);
+    set_file_lanes(cfg, &lib_config);
+    if (config_lookup_string(&lib_config, "archive", &archive) != CONFIG_FALSE) {
+        free(cfg->archive);
+        cfg->archive = strdup(archive);
+    }
+    set_file_int(&lib_config, "warmup", &cfg->warmup);
+    set_file_int(&lib_config, "warmup_threads", &cfg->warmup_threads);
+    set_file_int(&lib_config, "warmup_max_size", &cfg->warmup_max_size);
+    set_file_int(&lib_config, "warmup_budget", &cfg->warmup_budget);
+    if (config_lookup_string(&lib_config, "warmup_lock", &warmup_lock) != CONFIG_FALSE) {
+        free(cfg->warmup_lock);
+        cfg->warmup_lock = strdup(warmup_lock);
+    }
+    set_file_int(&lib_config, "prefetch", &cfg->prefetch);
+    set_file_int(&lib_config, "prefetch_preload", &cfg->prefetch_preload);
+    set_file_int(&lib_config, "io_threads", &cfg->io_threads);
+    set_file_int(&lib_config, "io_queue_len", &cfg->io_queue_len);
+    set_file_int(&lib_config, "io_cold_min_size", &cfg->io_cold_min_size);
+    set_file_int(&lib_config, "pace_rate", &cfg->pace_rate);
+    set_file_int(&lib_config, "pace_min_size", &cfg->pace_min_size);
+    set_file_int(&lib_config, "egress_rate", &cfg->egress_rate);
+    set_file_pace_rules(cfg, &lib_config);
+    set_file_int(&lib_config, "rate_limit", &cfg->rate_limit);
+    set_file_int(&lib_config, "rate_limit_burst", &cfg->rate_limit_burst);
 
     config_destroy(&lib_config);
 }
 
+/**
+ * Sets value to the non-negative integer at path in the config file, if present.
+ * @param lib_config - the parsed config file
+ * @param path - the setting name
+ * @param value - the value to set
+ */
+static void set_file_int(config_t *lib_config, const char *path, int *value) {
+    int file_value;
+    if (config_lookup_int(lib_config, path, &file_value) != CONFIG_FALSE) {
+        if (file_value >= 0) {
+            *value = file_value;
+        }
+    }
+}
+
 /**
  * Sets the environment variables as values for the config.
  * @param cfg - the config
@@ -162,6 +366,346 @@ static void set_env_config(config *cfg) {
         free(cfg->not_found_page);
         cfg->not_found_page = strdup(env_var);
     }
+    set_env_int("DC_HTTP_HEADER_TIMEOUT", &cfg->header_timeout);
+    set_env_int("DC_HTTP_BODY_TIMEOUT", &cfg->body_timeout);
+    set_env_int("DC_HTTP_IDLE_TIMEOUT", &cfg->idle_timeout);
+    set_env_int("DC_HTTP_MAX_QUEUE_DEPTH", &cfg->max_queue_depth);
+    set_env_int("DC_HTTP_MAX_QUEUE_WAIT", &cfg->max_queue_wait);
+    set_env_int("DC_HTTP_RETRY_AFTER", &cfg->retry_after);
+    if ((env_var = getenv("DC_HTTP_ACCESS_LOG")) != NULL) {
+        free(cfg->access_log);
+        cfg->access_log = strdup(env_var);
+    }
+    set_env_int("DC_HTTP_ACCESS_LOG_MAX_SIZE", &cfg->access_log_max_size);
+    if ((env_var = getenv("DC_HTTP_ACCESS_LOG_POLICY")) != NULL) {
+        cfg->access_log_policy = parse_access_log_policy(env_var);
+    }
+    set_env_int("DC_HTTP_TRACE_SAMPLE_RATE", &cfg->trace_sample_rate);
+    if ((env_var = getenv("DC_HTTP_TRACE_FILE")) != NULL) {
+        free(cfg->trace_file);
+        cfg->trace_file = strdup(env_var);
+    }
+    set_env_int("DC_HTTP_TRACE_ENDPOINT", &cfg->trace_endpoint);
+    set_env_int("DC_HTTP_COMPRESSION", &cfg->compression);
+    set_env_int("DC_HTTP_COMPRESSION_MIN_SIZE", &cfg->compression_min_size);
+    set_env_int("DC_HTTP_GZIP_LEVEL", &cfg->gzip_level);
+    set_env_int("DC_HTTP_ZSTD_LEVEL", &cfg->zstd_level);
+    set_env_int("DC_HTTP_CONTENT_CACHE_SIZE", &cfg->content_cache_size);
+    if ((env_var = getenv("DC_HTTP_CACHE_POLICY")) != NULL) {
+        set_env_cache_policies(cfg, env_var);
+    }
+    if ((env_var = getenv("DC_HTTP_LANES")) != NULL) {
+        set_env_lanes(cfg, env_var);
+    }
+    if ((env_var = getenv("DC_HTTP_ARCHIVE")) != NULL) {
+        free(cfg->archive);
+        cfg->archive = strdup(env_var);
+    }
+    set_env_int("DC_HTTP_WARMUP", &cfg->warmup);
+    set_env_int("DC_HTTP_WARMUP_THREADS", &cfg->warmup_threads);
+    set_env_int("DC_HTTP_WARMUP_MAX_SIZE", &cfg->warmup_max_size);
+    set_env_int("DC_HTTP_WARMUP_BUDGET", &cfg->warmup_budget);
+    if ((env_var = getenv("DC_HTTP_WARMUP_LOCK")) != NULL) {
+        free(cfg->warmup_lock);
+        cfg->warmup_lock = strdup(env_var);
+    }
+    set_env_int("DC_HTTP_PREFETCH", &cfg->prefetch);
+    set_env_int("DC_HTTP_PREFETCH_PRELOAD", &cfg->prefetch_preload);
+    set_env_int("DC_HTTP_IO_THREADS", &cfg->io_threads);
+    set_env_int("DC_HTTP_IO_QUEUE_LEN", &cfg->io_queue_len);
+    set_env_int("DC_HTTP_IO_COLD_MIN_SIZE", &cfg->io_cold_min_size);
+    set_env_int("DC_HTTP_PACE_RATE", &cfg->pace_rate);
+    set_env_int("DC_HTTP_PACE_MIN_SIZE", &cfg->pace_min_size);
+    set_env_int("DC_HTTP_EGRESS_RATE", &cfg->egress_rate);
+    if ((env_var = getenv("DC_HTTP_PACE_RULES")) != NULL) {
+        set_env_pace_rules(cfg, env_var);
+    }
+    set_env_int("DC_HTTP_RATE_LIMIT", &cfg->rate_limit);
+    set_env_int("DC_HTTP_RATE_LIMIT_BURST", &cfg->rate_limit_burst);
+}
+
+/**
+ * Sets value to the non-negative integer in the environment variable name, if present.
+ * @param name - the environment variable
+ * @param value - the value to set
+ */
+static void set_env_int(const char *name, int *value) {
+    char *env_var;
+    if ((env_var = getenv(name)) != NULL) {
+        char *ptr;
+        long env_value = strtol(env_var, &ptr, 0);
+        if (*env_var != '\0' && *ptr == '\0' && env_value >= 0 && env_value <= INT_MAX) {
+            *value = (int) env_value;
+        }
+    }
+}
+
+/**
+ * Returns the access log policy for a full ring buffer.
+ * Valid policies are "drop" (0) and "block" (1); anything else drops.
+ * @param policy - the policy name
+ * @return the policy
+ */
+static int parse_access_log_policy(const char *policy) {
+    return tolower(policy[0]) == 'b' ? 1 : 0;
+}
+
+/**
+ * Appends a cache policy, ignoring it if the list is full, match is not a
+ * path, an extension or "*", or it sets neither a Cache-Control value nor
+ * a max age. Without a Cache-Control value, "public, max-age=N" is used.
+ * @param cfg - the config
+ * @param match - what the policy applies to
+ * @param cache_control - the Cache-Control value, or NULL
+ * @param max_age - the max age in seconds, or -1
+ */
+static void add_cache_policy(config *cfg, const char *match, const char *cache_control, int max_age) {
+    if (cfg->num_cache_policies == MAX_CACHE_POLICIES) return;
+    if (match[0] != '/' && match[0] != '.' && strcmp(match, "*") != 0) return;
+    if ((cache_control == NULL || cache_control[0] == '\0') && max_age < 0) return;
+    if (cache_control != NULL && strlen(cache_control) >= MAX_CACHE_CONTROL_LEN) return;
+
+    if (cfg->cache_policies == NULL) {
+        cfg->cache_policies = calloc(MAX_CACHE_POLICIES, sizeof(cache_policy));
+    }
+    cache_policy *policy = &cfg->cache_policies[cfg->num_cache_policies++];
+    policy->match = strdup(match);
+    policy->max_age = max_age;
+    if (cache_control != NULL && cache_control[0] != '\0') {
+        policy->cache_control = strdup(cache_control);
+    } else {
+        policy->cache_control = malloc(MAX_CACHE_CONTROL_LEN);
+        snprintf(policy->cache_control, MAX_CACHE_CONTROL_LEN, "public, max-age=%d", max_age);
+    }
+}
+
+/**
+ * Removes every cache policy, so a later source replaces rather than extends the list.
+ * @param cfg - the config
+ */
+static void clear_cache_policies(config *cfg) {
+    for (int i = 0; i < cfg->num_cache_policies; i++) {
+        free(cfg->cache_policies[i].match);
+        free(cfg->cache_policies[i].cache_control);
+    }
+    cfg->num_cache_policies = 0;
+}
+
+/**
+ * Sets the cache policies from the cache_policy list in the config file, if present.
+ * Each entry is a group with a match and a cache_control string and/or a max_age, e.g.
+ * { match = "/img/"; max_age = 604800; }
+ * @param cfg - the config
+ * @param lib_config - the parsed config file
+ */
+static void set_file_cache_policies(config *cfg, config_t *lib_config) {
+    config_setting_t *list = config_lookup(lib_config, "cache_policy");
+    if (list == NULL || !config_setting_is_list(list)) return;
+
+    clear_cache_policies(cfg);
+    for (int i = 0; i < config_setting_length(list); i++) {
+        config_setting_t *entry = config_setting_get_elem(list, i);
+        const char *match;
+        const char *cache_control = NULL;
+        int max_age = -1;
+        if (config_setting_lookup_string(entry, "match", &match) == CONFIG_FALSE) continue;
+        config_setting_lookup_string(entry, "cache_control", &cache_control);
+        config_setting_lookup_int(entry, "max_age", &max_age);
+        add_cache_policy(cfg, match, cache_control, max_age);
+    }
+}
+
+/**
+ * Sets the cache policies from a list of MATCH=VALUE entries separated by ';',
+ * where a numeric VALUE is a max age in seconds and anything else a Cache-Control value,
+ * e.g. "/img/=604800;.html=no-cache".
+ * @param cfg - the config
+ * @param policies - the list
+ */
+static void set_env_cache_policies(config *cfg, const char *policies) {
+    char *copy = strdup(policies);
+    char *saveptr;
+    clear_cache_policies(cfg);
+    for (char *entry = strtok_r(copy, ";", &saveptr); entry != NULL; entry = strtok_r(NULL, ";", &saveptr)) {
+        char *value = strchr(entry, '=');
+        if (value == NULL) continue;
+        *value++ = '\0';
+
+        char *ptr;
+        long max_age = strtol(value, &ptr, 10);
+        if (*value != '\0' && *ptr == '\0' && max_age >= 0 && max_age <= INT_MAX) {
+            add_cache_policy(cfg, entry, NULL, (int) max_age);
+        } else {
+            add_cache_policy(cfg, entry, value, -1);
+        }
+    }
+    free(copy);
+}
+
+/**
+ * Adds a lane, if valid and there is room for it. Names are letters, digits, '_' and '-'.
+ * @param cfg - the config
+ * @param name - the lane's name in the metrics
+ * @param match - what the lane applies to, or NULL or "" for every file
+ * @param min_size - the smallest body the lane applies to
+ * @param threads - the lane's threads per process
+ * @param queue_len - how many responses may wait for them
+ */
+static void add_lane(config *cfg, const char *name, const char *match, int min_size, int threads, int queue_len) {
+    if (cfg->num_lanes == MAX_LANES) return;
+    if (name[0] == '\0' || strlen(name) >= MAX_LANE_NAME_LEN) return;
+    for (const char *c = name; *c != '\0'; c++) {
+        if (!isalnum((unsigned char) *c) && *c != '_' && *c != '-') return;
+    }
+    if (match != NULL && match[0] == '\0') match = NULL;
+    if (match != NULL && match[0] != '/' && match[0] != '.' && strcmp(match, "*") != 0) return;
+    if (min_size < 0 || threads < 1 || queue_len < 1) return;
+
+    if (cfg->lanes == NULL) {
+        cfg->lanes = calloc(MAX_LANES, sizeof(lane));
+    }
+    lane *l = &cfg->lanes[cfg->num_lanes++];
+    l->name = strdup(name);
+    l->match = match != NULL ? strdup(match) : NULL;
+    l->min_size = min_size;
+    l->threads = threads;
+    l->queue_len = queue_len;
+}
+
+/**
+ * Removes every lane, so a later source replaces rather than extends the list.
+ * @param cfg - the config
+ */
+static void clear_lanes(config *cfg) {
+    for (int i = 0; i < cfg->num_lanes; i++) {
+        free(cfg->lanes[i].name);
+        free(cfg->lanes[i].match);
+    }
+    cfg->num_lanes = 0;
+}
+
+/**
+ * Sets the lanes from the lane list in the config file, if present. Each entry is a group
+ * with a name, an optional match and min_size, threads and queue_len, e.g.
+ * { name = "large"; min_size = 1048576; threads = 2; queue_len = 32; }
+ * @param cfg - the config
+ * @param lib_config - the parsed config file
+ */
+static void set_file_lanes(config *cfg, config_t *lib_config) {
+    config_setting_t *list = config_lookup(lib_config, "lane");
+    if (list == NULL || !config_setting_is_list(list)) return;
+
+    clear_lanes(cfg);
+    for (int i = 0; i < config_setting_length(list); i++) {
+        config_setting_t *entry = config_setting_get_elem(list, i);
+        const char *name;
+        const char *match = NULL;
+        int min_size = 0;
+        int threads = 0;
+        int queue_len = 0;
+        if (config_setting_lookup_string(entry, "name", &name) == CONFIG_FALSE) continue;
+        config_setting_lookup_string(entry, "match", &match);
+        config_setting_lookup_int(entry, "min_size", &min_size);
+        config_setting_lookup_int(entry, "threads", &threads);
+        config_setting_lookup_int(entry, "queue_len", &queue_len);
+        add_lane(cfg, name, match, min_size, threads, queue_len);
+    }
+}
+
+/**
+ * Sets the lanes from a list of NAME:MATCH:MIN_SIZE:THREADS:QUEUE_LEN entries separated by ';',
+ * where MATCH may be empty, e.g. "large::1048576:2:32;img:/img/:0:2:16".
+ * @param cfg - the config
+ * @param lanes - the list
+ */
+static void set_env_lanes(config *cfg, const char *lanes) {
+    char *copy = strdup(lanes);
+    char *saveptr;
+    clear_lanes(cfg);
+    for (char *entry = strtok_r(copy, ";", &saveptr); entry != NULL; entry = strtok_r(NULL, ";", &saveptr)) {
+        char *fields[5];
+        int num_fields = 0;
+        char *rest = entry;
+        while (rest != NULL && num_fields < 5) fields[num_fields++] = strsep(&rest, ":");
+        if (num_fields != 5 || rest != NULL) continue;
+        add_lane(cfg, fields[0], fields[1], atoi(fields[2]), atoi(fields[3]), atoi(fields[4]));
+    }
+    free(copy);
+}
+
+/**
+ * Appends a pace rule, ignoring it if the list is full, match is not a path, an extension
+ * or "*", or the rate is negative.
+ * @param cfg - the config
+ * @param match - what the rule applies to
+ * @param rate - the rate in bytes per second, 0 for unpaced
+ */
+static void add_pace_rule(config *cfg, const char *match, int rate) {
+    if (cfg->num_pace_rules == MAX_PACE_RULES) return;
+    if (match[0] != '/' && match[0] != '.' && strcmp(match, "*") != 0) return;
+    if (rate < 0) return;
+
+    if (cfg->pace_rules == NULL) {
+        cfg->pace_rules = calloc(MAX_PACE_RULES, sizeof(pace_rule));
+    }
+    pace_rule *rule = &cfg->pace_rules[cfg->num_pace_rules++];
+    rule->match = strdup(match);
+    rule->rate = rate;
+}
+
+/**
+ * Removes every pace rule, so a later source replaces rather than extends the list.
+ * @param cfg - the config
+ */
+static void clear_pace_rules(config *cfg) {
+    for (int i = 0; i < cfg->num_pace_rules; i++) {
+        free(cfg->pace_rules[i].match);
+    }
+    cfg->num_pace_rules = 0;
+}
+
+/**
+ * Sets the pace rules from the pace_rule list in the config file, if present.
+ * Each entry is a group with a match and a rate, e.g. { match = "/video/"; rate = 1048576; }
+ * @param cfg - the config
+ * @param lib_config - the parsed config file
+ */
+static void set_file_pace_rules(config *cfg, config_t *lib_config) {
+    config_setting_t *list = config_lookup(lib_config, "pace_rule");
+    if (list == NULL || !config_setting_is_list(list)) return;
+
+    clear_pace_rules(cfg);
+    for (int i = 0; i < config_setting_length(list); i++) {
+        config_setting_t *entry = config_setting_get_elem(list, i);
+        const char *match;
+        int rate = -1;
+        if (config_setting_lookup_string(entry, "match", &match) == CONFIG_FALSE) continue;
+        config_setting_lookup_int(entry, "rate", &rate);
+        add_pace_rule(cfg, match, rate);
+    }
+}
+
+/**
+ * Sets the pace rules from a list of MATCH=RATE entries separated by ';',
+ * e.g. "/video/=1048576;.html=0".
+ * @param cfg - the config
+ * @param rules - the list
+ */
+static void set_env_pace_rules(config *cfg, const char *rules) {
+    char *copy = strdup(rules);
+    char *saveptr;
+    clear_pace_rules(cfg);
+    for (char *entry = strtok_r(copy, ";", &saveptr); entry != NULL; entry = strtok_r(NULL, ";", &saveptr)) {
+        char *value = strchr(entry, '=');
+        if (value == NULL) continue;
+        *value++ = '\0';
+
+        char *ptr;
+        long rate = strtol(value, &ptr, 10);
+        if (*value == '\0' || *ptr != '\0' || rate < 0 || rate > INT_MAX) continue;
+        add_pace_rule(cfg, entry, (int) rate);
+    }
+    free(copy);
 }
 
 /**
@@ -202,7 +746,45 @@ static void parse_cmd_line_options(config *cfg, int argc, char **argv) {
             fprintf(stdout, "%s", "                                     Accepts any input which begins with 'p' or 't' (case insensitive). \n");
             fprintf(stdout, "%s", "DC_HTTP_ROOT_DIR                     Sets the directory the html files are served from.\n");
             fprintf(stdout, "%s", "DC_HTTP_INDEX_PAGE                   Sets the index page.\n");
-            fprintf(stdout, "%s", "DC_HTTP_NOT_FOUND_PAGE               Sets the 404 page.\n\n");
+            fprintf(stdout, "%s", "DC_HTTP_NOT_FOUND_PAGE               Sets the 404 page.\n");
+            fprintf(stdout, "%s", "DC_HTTP_HEADER_TIMEOUT               Sets the time in ms allowed to receive a request header.\n");
+            fprintf(stdout, "%s", "DC_HTTP_BODY_TIMEOUT                 Sets the time in ms allowed to send a response.\n");
+            fprintf(stdout, "%s", "DC_HTTP_IDLE_TIMEOUT                 Sets the time in ms a connection may make no progress.\n");
+            fprintf(stdout, "%s", "DC_HTTP_MAX_QUEUE_DEPTH              Sets how many clients may wait for a worker before new ones get a 503.\n");
+            fprintf(stdout, "%s", "DC_HTTP_MAX_QUEUE_WAIT               Sets the average wait in ms for a worker before new clients get a 503.\n");
+            fprintf(stdout, "%s", "DC_HTTP_RETRY_AFTER                  Sets the Retry-After seconds sent with a 503.\n");
+            fprintf(stdout, "%s", "DC_HTTP_ACCESS_LOG                   Sets the access log file (empty disables logging).\n");
+            fprintf(stdout, "%s", "DC_HTTP_ACCESS_LOG_MAX_SIZE          Sets the size in bytes at which the access log is rotated.\n");
+            fprintf(stdout, "%s", "DC_HTTP_ACCESS_LOG_POLICY            Sets whether workers 'drop' or 'block' when the log buffer is full.\n");
+            fprintf(stdout, "%s", "DC_HTTP_TRACE_SAMPLE_RATE            Traces every Nth request (0 disables tracing).\n");
+            fprintf(stdout, "%s", "DC_HTTP_TRACE_FILE                   Sets the file the trace is written to on SIGUSR1.\n");
+            fprintf(stdout, "%s", "DC_HTTP_TRACE_ENDPOINT               Serves the trace at /server-trace (0, the default, disables it).\n");
+            fprintf(stdout, "%s", "DC_HTTP_COMPRESSION                  Compresses text files without a precompressed sibling on the fly (0 disables).\n");
+            fprintf(stdout, "%s", "DC_HTTP_COMPRESSION_MIN_SIZE         Sets the size in bytes below which files are sent uncompressed.\n");
+            fprintf(stdout, "%s", "DC_HTTP_GZIP_LEVEL                   Sets the gzip level (1-9) used on the fly.\n");
+            fprintf(stdout, "%s", "DC_HTTP_ZSTD_LEVEL                   Sets the zstd level used on the fly.\n");
+            fprintf(stdout, "%s", "DC_HTTP_CONTENT_CACHE_SIZE           Sets the bytes of file bodies shared by all workers, at startup (0 disables).\n");
+            fprintf(stdout, "%s", "DC_HTTP_CACHE_POLICY                 Sets caching per path prefix or extension, e.g. \"/img/=604800;.html=no-cache\".\n");
+            fprintf(stdout, "%s", "                                     A number is a max age in seconds (also sets Expires), anything else a Cache-Control value.\n");
+            fprintf(stdout, "%s", "DC_HTTP_ARCHIVE                      Serves from an archive made by packer instead of the root directory (empty disables).\n");
+            fprintf(stdout, "%s", "DC_HTTP_WARMUP                       Warms the caches from the root directory before listening (0 disables).\n");
+            fprintf(stdout, "%s", "DC_HTTP_WARMUP_THREADS               Sets how many threads walk the root directory during warmup.\n");
+            fprintf(stdout, "%s", "DC_HTTP_WARMUP_MAX_SIZE              Sets the size in bytes up to which files are read ahead during warmup.\n");
+            fprintf(stdout, "%s", "DC_HTTP_WARMUP_BUDGET                Sets the time in ms warmup may take before the server listens anyway.\n");
+            fprintf(stdout, "%s", "DC_HTTP_WARMUP_LOCK                  Locks files in memory during warmup, by path prefix or extension, e.g. \"/index.html;.css\".\n");
+            fprintf(stdout, "%s", "DC_HTTP_PREFETCH                     Warms the files an HTML page links to when the page is served (0 disables).\n");
+            fprintf(stdout, "%s", "DC_HTTP_PREFETCH_PRELOAD             Sends Link preload headers for the images, styles, scripts and fonts a page uses.\n");
+            fprintf(stdout, "%s", "DC_HTTP_IO_THREADS                   Sets the threads per process that send files not in the page cache, at startup (0 disables).\n");
+            fprintf(stdout, "%s", "DC_HTTP_IO_QUEUE_LEN                 Sets how many of those sends may wait for an I/O thread, at startup.\n");
+            fprintf(stdout, "%s", "DC_HTTP_IO_COLD_MIN_SIZE             Sets the size in bytes from which a file is checked for being in the page cache.\n");
+            fprintf(stdout, "%s", "DC_HTTP_LANES                        Sets transfer lanes, at startup, e.g. \"large::1048576:2:32;img:/img/:0:2:16\".\n");
+            fprintf(stdout, "%s", "                                     Each is NAME:MATCH:MIN_SIZE:THREADS:QUEUE_LEN; a full lane answers with a 503.\n");
+            fprintf(stdout, "%s", "DC_HTTP_PACE_RATE                    Sets the bytes per second each connection's body is sent at (0 disables).\n");
+            fprintf(stdout, "%s", "DC_HTTP_PACE_RULES                   Sets the rate per path prefix or extension instead, e.g. \"/video/=1048576;.html=0\".\n");
+            fprintf(stdout, "%s", "DC_HTTP_PACE_MIN_SIZE                Sets the size in bytes below which bodies are never paced.\n");
+            fprintf(stdout, "%s", "DC_HTTP_EGRESS_RATE                  Sets the bytes per second shared evenly by all paced bodies (0 disables).\n");
+            fprintf(stdout, "%s", "DC_HTTP_RATE_LIMIT                   Sets the connections per second each client IP may open before getting a 429 (0 disables).\n");
+            fprintf(stdout, "%s", "DC_HTTP_RATE_LIMIT_BURST             Sets how many connections a client IP may open at once above that rate.\n\n");
             destroy_config(cfg);
             exit(EXIT_SUCCESS);
         }
@@ -4,6 +4,47 @@
 #include <libconfig.h>
 
 #define MAX_PORT 65535
+#define MAX_CACHE_POLICIES 32
+#define MAX_CACHE_CONTROL_LEN 128
+#define MAX_LANES 7
+#define MAX_LANE_NAME_LEN 32
+#define MAX_PACE_RULES 32
+
+/**
+ * A caching rule for successful responses. match is a path prefix starting
+ * with '/', an extension starting with '.', or "*" for every file.
+ * cache_control is the Cache-Control value sent; if max_age is not -1, an
+ * Expires that many seconds ahead is sent as well.
+ */
+typedef struct {
+    char *match;
+    char *cache_control;
+    int max_age;
+} cache_policy;
+
+/**
+ * A lane of transfer threads for responses that may take long to send.
+ * A response belongs to a lane if its file matches match, as for cache
+ * policies (NULL matches every file), and its body is at least min_size
+ * bytes. Each process has threads threads for the lane, and up to
+ * queue_len of its responses may wait for them.
+ */
+typedef struct {
+    char *name;
+    char *match;
+    int min_size;
+    int threads;
+    int queue_len;
+} lane;
+
+/**
+ * A send rate for responses whose file matches match, as for cache
+ * policies, in bytes per second; 0 leaves them unpaced.
+ */
+typedef struct {
+    char *match;
+    int rate;
+} pace_rule;
 
 /**
  * The config struct.
@@ -14,6 +55,45 @@ typedef struct {
     char *not_found_page;
     char mode;
     int port;
+    int header_timeout;
+    int body_timeout;
+    int idle_timeout;
+    int max_queue_depth;
+    int max_queue_wait;
+    int retry_after;
+    char *access_log;
+    int access_log_max_size;
+    int access_log_policy;
+    int trace_sample_rate;
+    char *trace_file;
+    int trace_endpoint;
+    int compression;
+    int compression_min_size;
+    int gzip_level;
+    int zstd_level;
+    int content_cache_size;
+    cache_policy *cache_policies;
+    int num_cache_policies;
+    char *archive;
+    int warmup;
+    int warmup_threads;
+    int warmup_max_size;
+    int warmup_budget;
+    char *warmup_lock;
+    int prefetch;
+    int prefetch_preload;
+    int io_threads;
+    int io_queue_len;
+    int io_cold_min_size;
+    lane *lanes;
+    int num_lanes;
+    int pace_rate;
+    int pace_min_size;
+    int egress_rate;
+    pace_rule *pace_rules;
+    int num_pace_rules;
+    int rate_limit;
+    int rate_limit_burst;
 } config;
 
 /**
@@ -41,4 +121,37 @@ config *get_cmd_config(int argc, char **argv);
  */
 config *get_config(config *cmd_cfg);
 
+/**
+ * Returns the first cache policy that matches a file, or NULL if none does.
+ * @param cfg - the config
+ * @param path - the file's path relative to the root directory, without a leading slash
+ * @return - the policy
+ */
+const cache_policy *config_cache_policy(const config *cfg, const char *path);
+
+/**
+ * Returns whether a response belongs to a lane.
+ * @param l - the lane
+ * @param path - the file's path relative to the root directory, without a leading slash
+ * @param size - the size of the response's body
+ * @return - whether it belongs to the lane
+ */
+int config_lane_matches(const lane *l, const char *path, long size);
+
+/**
+ * Returns the rate of the first pace rule that matches a file, or pace_rate if none does.
+ * @param cfg - the config
+ * @param path - the file's path relative to the root directory, without a leading slash
+ * @return - the rate in bytes per second, 0 for unpaced
+ */
+int config_pace_rate(const config *cfg, const char *path);
+
+/**
+ * Returns how many transfer threads each pool of transfer lanes starts: io_threads
+ * for the cold lane plus the threads of every configured lane.
+ * @param cfg - the config
+ * @return - the number of threads
+ */
+int config_transfer_threads(const config *cfg);
+
 #endif
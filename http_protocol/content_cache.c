@@ -0,0 +1,514 @@
+#include "content_cache.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ENTRIES_ALIGN 64
+
+static _Thread_local content_cache_block * current_block;
+
+static void lock(content_cache_block * block);
+static uint64_t hash_key(int encoding, const struct stat * st);
+static content_cache_entry * set_of(content_cache_block * block, uint64_t tag);
+static int find(content_cache_block * block, content_cache_entry * set, uint64_t tag, int encoding,
+                const struct stat * st, content_body * body);
+static content_cache_entry * claim(content_cache_block * block, content_cache_entry * set);
+static int evict(content_cache_block * block, content_cache_entry * entry, int keep_claimed);
+static int allocate(content_cache_block * block, content_cache_entry * entry, uint32_t num_blocks);
+static void free_chain(content_cache_block * block, uint32_t first, uint32_t num_blocks);
+static size_t max_len(const content_cache_block * block);
+static void store(content_cache_block * block, int encoding, const struct stat * st, char * data, size_t len,
+                  content_body * body);
+static int load_into(int encoding, const struct stat * st, content_loader load, void * arg, content_body * body);
+static int same_file(dev_t dev, ino_t ino, const struct timespec * mtime, off_t size, const struct stat * st);
+static content_cache_flight * find_flight(content_cache_block * block, uint64_t tag, int encoding,
+                                          const struct stat * st, uint64_t now);
+static content_cache_flight * claim_flight(content_cache_block * block, uint64_t tag, int encoding,
+                                           const struct stat * st, uint64_t now);
+static void finish_flight(content_cache_block * block, content_cache_flight * flight, unsigned int state, int ok);
+static int wait_flight(content_cache_block * block, content_cache_flight * flight, unsigned int state);
+static uint64_t now_ms(void);
+
+content_cache_block * content_cache_create(size_t size) {
+    size_t num_blocks = size / (CONTENT_CACHE_BLOCK_SIZE + sizeof(uint32_t) + sizeof(content_cache_entry));
+    if (num_blocks < CONTENT_CACHE_MIN_BLOCKS) return NULL;
+    if (num_blocks > UINT32_MAX / 2) num_blocks = UINT32_MAX / 2;
+
+    // About one entry per block, rounded up to whole sets of a power of two.
+    uint32_t num_entries = CONTENT_CACHE_WAYS;
+    while (num_entries < num_blocks) num_entries <<= 1;
+
+    size_t entries_offset = (sizeof(content_cache_block) + ENTRIES_ALIGN - 1) / ENTRIES_ALIGN * ENTRIES_ALIGN;
+    size_t next_offset = entries_offset + num_entries * sizeof(content_cache_entry);
+    size_t data_offset = next_offset + num_blocks * sizeof(uint32_t);
+    data_offset = (data_offset + CONTENT_CACHE_BLOCK_SIZE - 1) / CONTENT_CACHE_BLOCK_SIZE * CONTENT_CACHE_BLOCK_SIZE;
+    size_t map_len = data_offset + num_blocks * CONTENT_CACHE_BLOCK_SIZE;
+
+    char * map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap()");
+        return NULL;
+    }
+
+    content_cache_block * block = (content_cache_block *) map;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&block->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    block->map_len = map_len;
+    block->num_entries = num_entries;
+    block->num_blocks = (uint32_t) num_blocks;
+    block->hand = 0;
+    block->entries = (content_cache_entry *) (map + entries_offset);
+    block->next = (uint32_t *) (map + next_offset);
+    block->data = map + data_offset;
+
+    for (int i = 0; i < CONTENT_CACHE_FLIGHTS; i++) atomic_init(&block->flights[i].state, 0);
+    for (uint32_t i = 0; i < num_entries; i++) {
+        content_cache_entry * entry = &block->entries[i];
+        atomic_init(&entry->seq, 0);
+        atomic_init(&entry->refs, 0);
+        atomic_init(&entry->referenced, false);
+        atomic_init(&entry->tag, 0);
+    }
+    for (uint32_t i = 0; i < block->num_blocks; i++) {
+        block->next[i] = i + 1 < block->num_blocks ? i + 1 : CONTENT_CACHE_NONE;
+    }
+    block->free_head = 0;
+    block->free_count = block->num_blocks;
+    return block;
+}
+
+void content_cache_destroy(content_cache_block * block) {
+    if (block == NULL) return;
+    if (current_block == block) current_block = NULL;
+    pthread_mutex_destroy(&block->lock);
+    munmap(block, block->map_len);
+}
+
+void content_cache_register(content_cache_block * block) {
+    current_block = block;
+}
+
+size_t content_cache_max_len(void) {
+    return current_block != NULL ? max_len(current_block) : 0;
+}
+
+int content_cache_get(int encoding, const struct stat * st, content_body * body) {
+    content_cache_block * block = current_block;
+    if (block == NULL) return 0;
+
+    uint64_t tag = hash_key(encoding, st);
+    return find(block, set_of(block, tag), tag, encoding, st, body) == 1;
+}
+
+void content_cache_put(int encoding, const struct stat * st, char * data, size_t len, content_body * body) {
+    body->block = NULL;
+    body->entry = NULL;
+    body->data = data;
+    body->len = len;
+
+    content_cache_block * block = current_block;
+    if (block == NULL || len == 0 || len > max_len(block)) return;
+    store(block, encoding, st, data, len, body);
+}
+
+int content_cache_load(int encoding, const struct stat * st, content_loader load, void * arg, content_body * body,
+                       int * cache_hit) {
+    *cache_hit = 0;
+    content_cache_block * block = current_block;
+    if (block == NULL) return load_into(encoding, st, load, arg, body);
+
+    // A declined load is a hit too, and is not tried again.
+    uint64_t tag = hash_key(encoding, st);
+    int found = find(block, set_of(block, tag), tag, encoding, st, body);
+    if (found != 0) {
+        *cache_hit = 1;
+        return found == 1;
+    }
+
+    uint64_t now = now_ms();
+    lock(block);
+    // A load that finished since the lookup has stored the body by now.
+    found = find(block, set_of(block, tag), tag, encoding, st, body);
+    if (found != 0) {
+        pthread_mutex_unlock(&block->lock);
+        *cache_hit = 1;
+        return found == 1;
+    }
+
+    content_cache_flight * flight = find_flight(block, tag, encoding, st, now);
+    if (flight != NULL) {
+        unsigned int state = atomic_load(&flight->state);
+        pthread_mutex_unlock(&block->lock);
+        int ok = wait_flight(block, flight, state);
+        if (ok == 0) return 0;
+        *cache_hit = content_cache_get(encoding, st, body);
+        if (*cache_hit) return 1;
+        // The load was abandoned or its body could not be cached.
+        return load_into(encoding, st, load, arg, body);
+    }
+
+    // With every flight taken the body is loaded without one.
+    flight = claim_flight(block, tag, encoding, st, now);
+    unsigned int state = flight != NULL ? atomic_load(&flight->state) : 0;
+    pthread_mutex_unlock(&block->lock);
+
+    int ok = load_into(encoding, st, load, arg, body);
+    if (flight != NULL) finish_flight(block, flight, state, ok);
+    return ok;
+}
+
+int content_body_iov(const content_body * body, size_t offset, struct iovec * iov, int max) {
+    if (offset >= body->len || max <= 0) return 0;
+    if (body->entry == NULL) {
+        iov[0].iov_base = body->data + offset;
+        iov[0].iov_len = body->len - offset;
+        return 1;
+    }
+
+    const content_cache_block * block = body->block;
+    uint32_t b = body->entry->first_block;
+    size_t pos = 0;
+    while (pos + CONTENT_CACHE_BLOCK_SIZE <= offset) {
+        b = block->next[b];
+        pos += CONTENT_CACHE_BLOCK_SIZE;
+    }
+
+    // Consecutive blocks, the usual case in a young cache, share an iovec.
+    int num_iov = 0;
+    for (; pos < body->len; pos += CONTENT_CACHE_BLOCK_SIZE, b = block->next[b]) {
+        size_t start = offset > pos ? offset - pos : 0;
+        size_t end = body->len - pos < CONTENT_CACHE_BLOCK_SIZE ? body->len - pos : CONTENT_CACHE_BLOCK_SIZE;
+        char * base = block->data + (size_t) b * CONTENT_CACHE_BLOCK_SIZE + start;
+        if (num_iov > 0 && (char *) iov[num_iov - 1].iov_base + iov[num_iov - 1].iov_len == base) {
+            iov[num_iov - 1].iov_len += end - start;
+            continue;
+        }
+        if (num_iov == max) break;
+        iov[num_iov].iov_base = base;
+        iov[num_iov++].iov_len = end - start;
+    }
+    return num_iov;
+}
+
+void content_body_release(content_body * body) {
+    if (body->entry != NULL) {
+        atomic_fetch_sub_explicit(&body->entry->refs, 1, memory_order_release);
+    } else {
+        free(body->data);
+    }
+    body->block = NULL;
+    body->entry = NULL;
+    body->data = NULL;
+    body->len = 0;
+}
+
+// A worker that died holding the lock may have left a claimed entry
+// behind; that entry is lost, but the rest of the cache is consistent.
+static void lock(content_cache_block * block) {
+    if (pthread_mutex_lock(&block->lock) == EOWNERDEAD) pthread_mutex_consistent(&block->lock);
+}
+
+static uint64_t hash_key(int encoding, const struct stat * st) {
+    uint64_t hash = (uint64_t) st->st_ino * 0x9e3779b97f4a7c15ull;
+    hash ^= ((uint64_t) st->st_dev + (uint64_t) (encoding + 2)) * 0xc2b2ae3d27d4eb4full;
+    hash ^= ((uint64_t) st->st_mtim.tv_sec ^ ((uint64_t) st->st_mtim.tv_nsec << 32)) * 0x165667b19e3779f9ull;
+    hash ^= (uint64_t) st->st_size * 0x27d4eb2f165667c5ull;
+    hash ^= hash >> 29;
+    hash *= 0xbf58476d1ce4e5b9ull;
+    hash ^= hash >> 32;
+    return hash != 0 ? hash : 1;
+}
+
+static content_cache_entry * set_of(content_cache_block * block, uint64_t tag) {
+    uint32_t num_sets = block->num_entries / CONTENT_CACHE_WAYS;
+    return &block->entries[(tag & (num_sets - 1)) * CONTENT_CACHE_WAYS];
+}
+
+// Pins the entry of set holding the body, if any. The pin only counts if
+// seq did not change around it: an evictor makes seq odd before checking
+// refs, so either it sees the pin and backs off or the reader sees the
+// new seq and lets go.
+static int find(content_cache_block * block, content_cache_entry * set, uint64_t tag, int encoding,
+                const struct stat * st, content_body * body) {
+    for (int w = 0; w < CONTENT_CACHE_WAYS; w++) {
+        content_cache_entry * entry = &set[w];
+        unsigned int seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+        if ((seq & 1) != 0 || atomic_load_explicit(&entry->tag, memory_order_relaxed) != tag) continue;
+
+        atomic_fetch_add(&entry->refs, 1);
+        if (atomic_load(&entry->seq) != seq) {
+            atomic_fetch_sub_explicit(&entry->refs, 1, memory_order_release);
+            continue;
+        }
+        if (entry->encoding != encoding || !same_file(entry->dev, entry->ino, &entry->mtime, entry->size, st)) {
+            atomic_fetch_sub_explicit(&entry->refs, 1, memory_order_release);
+            continue;
+        }
+
+        if (!atomic_load_explicit(&entry->referenced, memory_order_relaxed)) {
+            atomic_store_explicit(&entry->referenced, true, memory_order_relaxed);
+        }
+        if (entry->len == 0) {
+            atomic_fetch_sub_explicit(&entry->refs, 1, memory_order_release);
+            return -1;
+        }
+        body->block = block;
+        body->entry = entry;
+        body->data = NULL;
+        body->len = entry->len;
+        return 1;
+    }
+    return 0;
+}
+
+// Claims an entry of set for a new body, leaving its seq odd: an empty one
+// if there is one, else one not used since the hand last passed, else any
+// unpinned one. Called with the lock held. Returns NULL if all are pinned.
+static content_cache_entry * claim(content_cache_block * block, content_cache_entry * set) {
+    for (int w = 0; w < CONTENT_CACHE_WAYS; w++) {
+        unsigned int seq = atomic_load(&set[w].seq);
+        if ((seq & 1) == 0 && atomic_load(&set[w].tag) == 0) {
+            atomic_store(&set[w].seq, seq + 1);
+            return &set[w];
+        }
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (int w = 0; w < CONTENT_CACHE_WAYS; w++) {
+            if (pass == 0 && atomic_load_explicit(&set[w].referenced, memory_order_relaxed)) continue;
+            if (evict(block, &set[w], 1)) return &set[w];
+        }
+    }
+    return NULL;
+}
+
+// Frees an unpinned entry's blocks. Called with the lock held. If
+// keep_claimed is set the entry is left odd for the caller to refill.
+// Returns 0 if the entry is empty, being filled or pinned.
+static int evict(content_cache_block * block, content_cache_entry * entry, int keep_claimed) {
+    unsigned int seq = atomic_load(&entry->seq);
+    if ((seq & 1) != 0 || atomic_load(&entry->tag) == 0) return 0;
+
+    atomic_store(&entry->seq, seq + 1);
+    if (atomic_load(&entry->refs) != 0) {
+        atomic_store(&entry->seq, seq + 2);
+        return 0;
+    }
+    if (entry->num_blocks > 0) free_chain(block, entry->first_block, entry->num_blocks);
+    atomic_store(&entry->tag, 0);
+    if (!keep_claimed) atomic_store(&entry->seq, seq + 2);
+    return 1;
+}
+
+// Gives entry a chain of num_blocks blocks, sweeping the CLOCK hand over
+// the entries until enough are free: a used entry only loses its bit, an
+// unused one is evicted. Called with the lock held.
+static int allocate(content_cache_block * block, content_cache_entry * entry, uint32_t num_blocks) {
+    for (uint32_t budget = 2 * block->num_entries; block->free_count < num_blocks && budget > 0; budget--) {
+        content_cache_entry * victim = &block->entries[block->hand];
+        block->hand = (block->hand + 1) % block->num_entries;
+        if (atomic_load_explicit(&victim->referenced, memory_order_relaxed)) {
+            atomic_store_explicit(&victim->referenced, false, memory_order_relaxed);
+            continue;
+        }
+        evict(block, victim, 0);
+    }
+    if (block->free_count < num_blocks) return 0;
+
+    uint32_t first = block->free_head;
+    uint32_t last = first;
+    for (uint32_t i = 1; i < num_blocks; i++) last = block->next[last];
+    block->free_head = block->next[last];
+    block->next[last] = CONTENT_CACHE_NONE;
+    block->free_count -= num_blocks;
+
+    entry->first_block = first;
+    entry->num_blocks = num_blocks;
+    return 1;
+}
+
+static void free_chain(content_cache_block * block, uint32_t first, uint32_t num_blocks) {
+    uint32_t last = first;
+    for (uint32_t i = 1; i < num_blocks; i++) last = block->next[last];
+    block->next[last] = block->free_head;
+    block->free_head = first;
+    block->free_count += num_blocks;
+}
+
+// Bodies are limited so that no single one can flush much of the cache.
+static size_t max_len(const content_cache_block * block) {
+    uint32_t num_blocks = block->num_blocks / 8;
+    if (num_blocks > CONTENT_CACHE_MAX_BLOCKS) num_blocks = CONTENT_CACHE_MAX_BLOCKS;
+    return (size_t) num_blocks * CONTENT_CACHE_BLOCK_SIZE;
+}
+
+// Stores len bytes of data as a body, or for len 0 a marker that the load
+// was declined, taking over data, and sets body to the pinned entry if it
+// is one. body must already hold data.
+static void store(content_cache_block * block, int encoding, const struct stat * st, char * data, size_t len,
+                  content_body * body) {
+    uint64_t tag = hash_key(encoding, st);
+    content_cache_entry * set = set_of(block, tag);
+    uint32_t num_blocks = (uint32_t) ((len + CONTENT_CACHE_BLOCK_SIZE - 1) / CONTENT_CACHE_BLOCK_SIZE);
+
+    lock(block);
+    // Another worker may have stored the same body meanwhile.
+    int found = find(block, set, tag, encoding, st, body);
+    if (found != 0) {
+        pthread_mutex_unlock(&block->lock);
+        if (found == 1) free(data);
+        return;
+    }
+    content_cache_entry * entry = claim(block, set);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&block->lock);
+        return;
+    }
+    unsigned int seq = atomic_load(&entry->seq);
+    if (num_blocks == 0) {
+        entry->first_block = CONTENT_CACHE_NONE;
+        entry->num_blocks = 0;
+    } else if (!allocate(block, entry, num_blocks)) {
+        atomic_store(&entry->seq, seq + 1);
+        pthread_mutex_unlock(&block->lock);
+        return;
+    }
+    entry->encoding = encoding;
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->mtime = st->st_mtim;
+    entry->size = st->st_size;
+    entry->len = len;
+    pthread_mutex_unlock(&block->lock);
+
+    // The entry is claimed, so nobody reads or evicts it while it is filled.
+    size_t copied = 0;
+    for (uint32_t b = entry->first_block; copied < len; b = block->next[b]) {
+        size_t chunk = len - copied < CONTENT_CACHE_BLOCK_SIZE ? len - copied : CONTENT_CACHE_BLOCK_SIZE;
+        memcpy(block->data + (size_t) b * CONTENT_CACHE_BLOCK_SIZE, data + copied, chunk);
+        copied += chunk;
+    }
+    free(data);
+
+    if (len > 0) atomic_fetch_add(&entry->refs, 1);
+    atomic_store_explicit(&entry->referenced, true, memory_order_relaxed);
+    atomic_store_explicit(&entry->tag, tag, memory_order_relaxed);
+    atomic_store_explicit(&entry->seq, seq + 1, memory_order_release);
+
+    if (len > 0) {
+        body->block = block;
+        body->entry = entry;
+        body->data = NULL;
+    }
+}
+
+static int load_into(int encoding, const struct stat * st, content_loader load, void * arg, content_body * body) {
+    size_t len = 0;
+    char * data = load(arg, &len);
+    if (data == NULL) {
+        // Remembering a declined load saves repeating it on every request.
+        content_cache_block * block = current_block;
+        if (len == CONTENT_CACHE_DECLINED && block != NULL) {
+            body->block = NULL;
+            body->entry = NULL;
+            body->data = NULL;
+            body->len = 0;
+            store(block, encoding, st, NULL, 0, body);
+            content_body_release(body);
+        }
+        return 0;
+    }
+    content_cache_put(encoding, st, data, len, body);
+    return 1;
+}
+
+static int same_file(dev_t dev, ino_t ino, const struct timespec * mtime, off_t size, const struct stat * st) {
+    return ino == st->st_ino && dev == st->st_dev && size == st->st_size &&
+           mtime->tv_sec == st->st_mtim.tv_sec && mtime->tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Returns the load of the body in progress, if any. Called with the lock held.
+static content_cache_flight * find_flight(content_cache_block * block, uint64_t tag, int encoding,
+                                          const struct stat * st, uint64_t now) {
+    for (int i = 0; i < CONTENT_CACHE_FLIGHTS; i++) {
+        content_cache_flight * flight = &block->flights[i];
+        if ((atomic_load(&flight->state) & 1) == 0 || flight->tag != tag || flight->encoding != encoding) continue;
+        if (now - flight->started_ms >= CONTENT_CACHE_FLIGHT_WAIT_MS) continue;
+        if (same_file(flight->dev, flight->ino, &flight->mtime, flight->size, st)) return flight;
+    }
+    return NULL;
+}
+
+// Starts a load of the body in a free or abandoned flight. Waiters on an
+// abandoned one are woken to load the body themselves. Called with the lock
+// held. Returns NULL if every flight is in use.
+static content_cache_flight * claim_flight(content_cache_block * block, uint64_t tag, int encoding,
+                                           const struct stat * st, uint64_t now) {
+    for (int i = 0; i < CONTENT_CACHE_FLIGHTS; i++) {
+        content_cache_flight * flight = &block->flights[i];
+        unsigned int state = atomic_load(&flight->state);
+        int abandoned = (state & 1) != 0 && now - flight->started_ms >= CONTENT_CACHE_FLIGHT_WAIT_MS;
+        if ((state & 1) != 0 && !abandoned) continue;
+
+        flight->tag = tag;
+        flight->encoding = encoding;
+        flight->dev = st->st_dev;
+        flight->ino = st->st_ino;
+        flight->mtime = st->st_mtim;
+        flight->size = st->st_size;
+        flight->started_ms = now;
+        atomic_store(&flight->state, state + (abandoned ? 2 : 1));
+        if (abandoned) syscall(SYS_futex, &flight->state, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+        return flight;
+    }
+    return NULL;
+}
+
+// Publishes the outcome of a load and wakes its waiters, unless the flight
+// was taken over as abandoned meanwhile.
+static void finish_flight(content_cache_block * block, content_cache_flight * flight, unsigned int state, int ok) {
+    lock(block);
+    if (atomic_load(&flight->state) == state) {
+        flight->ok = ok;
+        atomic_store(&flight->state, state + 1);
+    }
+    pthread_mutex_unlock(&block->lock);
+    syscall(SYS_futex, &flight->state, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Sleeps on the flight's futex until its load finishes, at most
+// CONTENT_CACHE_FLIGHT_WAIT_MS. The futex is not private, as waiters may be
+// in other processes. Returns whether the load succeeded, or -1 if that is
+// not known because it timed out or was taken over.
+static int wait_flight(content_cache_block * block, content_cache_flight * flight, unsigned int state) {
+    uint64_t deadline = now_ms() + CONTENT_CACHE_FLIGHT_WAIT_MS;
+    while (atomic_load(&flight->state) == state) {
+        uint64_t now = now_ms();
+        if (now >= deadline) return -1;
+        struct timespec timeout = { (time_t) ((deadline - now) / 1000), (long) ((deadline - now) % 1000) * 1000000 };
+        syscall(SYS_futex, &flight->state, FUTEX_WAIT, state, &timeout, NULL, 0);
+    }
+
+    lock(block);
+    int ok = atomic_load(&flight->state) == state + 1 ? flight->ok : -1;
+    pthread_mutex_unlock(&block->lock);
+    return ok;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
@@ -0,0 +1,169 @@
+#ifndef CONTENT_CACHE_H
+#define CONTENT_CACHE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define CONTENT_CACHE_BLOCK_SIZE 4096
+#define CONTENT_CACHE_WAYS 4
+#define CONTENT_CACHE_MIN_BLOCKS 64
+#define CONTENT_CACHE_MAX_BLOCKS 256
+#define CONTENT_CACHE_NONE UINT32_MAX
+#define CONTENT_CACHE_IDENTITY -1
+#define CONTENT_CACHE_DECLINED SIZE_MAX
+#define CONTENT_CACHE_FLIGHTS 64
+#define CONTENT_CACHE_FLIGHT_WAIT_MS 1000
+
+/**
+ * A cached body: the bytes of a file as it is, or coded with a content
+ * coding, identified by the file's device, inode, mtime and size, so a
+ * changed file is never served stale. Readers find an entry without the
+ * lock: seq is odd while the entry is being filled or evicted, and a
+ * reader that pins it with refs checks seq again afterwards. A pinned
+ * entry is never evicted. referenced is the CLOCK bit. An entry with len 0
+ * holds no blocks and records that loading the body was declined.
+ */
+typedef struct {
+    atomic_uint seq;
+    atomic_int refs;
+    atomic_bool referenced;
+    atomic_uint_fast64_t tag;
+    int encoding;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    size_t len;
+    uint32_t first_block;
+    uint32_t num_blocks;
+} content_cache_entry;
+
+/**
+ * A body being loaded by one worker while others wait for it. state is the
+ * futex word waiters sleep on: odd while loading, bumped to even when the
+ * load finishes with ok set to whether it succeeded. A load running longer
+ * than CONTENT_CACHE_FLIGHT_WAIT_MS, e.g. of a worker that died, is taken
+ * to be abandoned.
+ */
+typedef struct {
+    atomic_uint state;
+    uint64_t tag;
+    int encoding;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    uint64_t started_ms;
+    int ok;
+} content_cache_flight;
+
+/**
+ * A cache of bodies in one shared anonymous mapping, made before workers
+ * are started so every thread, or every forked worker process, sees the
+ * same cache at the same address and memory use does not grow with the
+ * number of workers. Bodies are stored in chains of fixed-size blocks.
+ * Entries are indexed by a set-associative table of CONTENT_CACHE_WAYS
+ * entries per set. lock, a process-shared robust mutex, serializes
+ * claiming entries and allocating blocks. When blocks run out, a CLOCK
+ * hand sweeps the entries and evicts unpinned ones not used since it last
+ * passed. flights are the loads in progress, also claimed under lock.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    size_t map_len;
+    uint32_t num_entries;
+    uint32_t num_blocks;
+    uint32_t free_head;
+    uint32_t free_count;
+    uint32_t hand;
+    content_cache_flight flights[CONTENT_CACHE_FLIGHTS];
+    content_cache_entry * entries;
+    uint32_t * next;
+    char * data;
+} content_cache_block;
+
+/**
+ * A body being sent: either a pinned cache entry, or, if it could not be
+ * cached, a heap buffer owned by the body.
+ */
+typedef struct {
+    content_cache_block * block;
+    content_cache_entry * entry;
+    char * data;
+    size_t len;
+} content_body;
+
+/**
+ * Loads a body on a cache miss: returns it in a new heap buffer and sets
+ * *len, or returns NULL if it cannot be loaded. A loader that finds the
+ * body not worth keeping, e.g. compressed data no smaller than the file,
+ * returns NULL and sets *len to CONTENT_CACHE_DECLINED, which is
+ * remembered for the file like a body would be.
+ */
+typedef char * (*content_loader)(void * arg, size_t * len);
+
+/**
+ * Maps a cache of about size bytes shared with processes forked later.
+ * Returns NULL, leaving caching disabled, if size is too small to be worth it.
+ */
+content_cache_block * content_cache_create(size_t size);
+
+/**
+ * Unmaps a cache made by content_cache_create.
+ */
+void content_cache_destroy(content_cache_block * block);
+
+/**
+ * Makes block the cache the calling thread's lookups and inserts use.
+ */
+void content_cache_register(content_cache_block * block);
+
+/**
+ * Returns the largest body the registered cache takes, 0 if there is none.
+ */
+size_t content_cache_max_len(void);
+
+/**
+ * Looks up the body of the file described by st, coded with encoding or
+ * CONTENT_CACHE_IDENTITY for the file as it is. On a hit the entry is
+ * pinned in body and 1 is returned; otherwise 0.
+ */
+int content_cache_get(int encoding, const struct stat * st, content_body * body);
+
+/**
+ * Stores len bytes of data, a heap buffer the cache takes over, as the body
+ * of the file described by st coded with encoding, and sets body to it. If
+ * it cannot be cached, e.g. every entry it could replace is pinned, body
+ * keeps data on the heap instead.
+ */
+void content_cache_put(int encoding, const struct stat * st, char * data, size_t len, content_body * body);
+
+/**
+ * Sets body to the body of the file described by st coded with encoding,
+ * calling load with arg and storing the result on a miss. Concurrent misses
+ * on the same body, in any worker, are coalesced: the first loads it while
+ * the rest wait for it and take it from the cache, and if the load fails
+ * they all fail without retrying it. *cache_hit is set to whether the body,
+ * or the load having been declined, was already cached. Returns 0 if it
+ * could not be loaded or the load was declined.
+ */
+int content_cache_load(int encoding, const struct stat * st, content_loader load, void * arg, content_body * body,
+                       int * cache_hit);
+
+/**
+ * Fills up to max iovecs with body's bytes from offset on. Returns how many
+ * were filled.
+ */
+int content_body_iov(const content_body * body, size_t offset, struct iovec * iov, int max);
+
+/**
+ * Unpins or frees a body, leaving it empty. Does nothing if it is empty.
+ */
+void content_body_release(content_body * body);
+
+#endif
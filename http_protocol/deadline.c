@@ -0,0 +1,132 @@
+#include "deadline.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <dc/pthread.h>
+
+#define NO_DEADLINE UINT64_MAX
+
+/**
+ * The wheel is shared by every worker in the process and guarded by lock.
+ * Workers only take the lock to begin and end a phase; progress is recorded
+ * lock-free and checked lazily when the timer fires.
+ */
+static struct {
+    timer_wheel wheel;
+    pthread_mutex_t lock;
+    pthread_t ticker;
+    atomic_bool running;
+} service = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t now_ticks(void);
+static uint64_t ms_to_ticks(int ms);
+static void * ticker_loop(void * arg);
+static void deadline_fire(tw_timer * timer);
+
+void deadline_service_start(void) {
+    if (atomic_load(&service.running)) return;
+
+    pthread_mutex_lock(&service.lock);
+    tw_init(&service.wheel, now_ticks());
+    pthread_mutex_unlock(&service.lock);
+
+    atomic_store(&service.running, true);
+    dc_pthread_create(&service.ticker, NULL, ticker_loop, NULL);
+}
+
+void deadline_service_stop(void) {
+    if (!atomic_load(&service.running)) return;
+
+    atomic_store(&service.running, false);
+    dc_pthread_join(service.ticker, NULL);
+}
+
+void deadline_begin(conn_deadline * deadline, int cfd, int phase_ms, int idle_ms) {
+    uint64_t now = now_ticks();
+
+    deadline->timer.next = NULL;
+    deadline->timer.prev = NULL;
+    deadline->timer.callback = deadline_fire;
+    deadline->cfd = cfd;
+    deadline->phase_deadline = phase_ms > 0 ? now + ms_to_ticks(phase_ms) : NO_DEADLINE;
+    deadline->idle_ticks = idle_ms > 0 ? ms_to_ticks(idle_ms) : 0;
+    atomic_store_explicit(&deadline->last_progress, now, memory_order_relaxed);
+    atomic_store(&deadline->expired, 0);
+
+    uint64_t expires = deadline->phase_deadline;
+    if (deadline->idle_ticks && now + deadline->idle_ticks < expires) {
+        expires = now + deadline->idle_ticks;
+    }
+
+    if (expires == NO_DEADLINE || !atomic_load(&service.running)) return;
+
+    pthread_mutex_lock(&service.lock);
+    tw_arm(&service.wheel, &deadline->timer, expires);
+    pthread_mutex_unlock(&service.lock);
+}
+
+void deadline_progress(conn_deadline * deadline) {
+    if (deadline == NULL || deadline->idle_ticks == 0) return;
+    atomic_store_explicit(&deadline->last_progress, now_ticks(), memory_order_relaxed);
+}
+
+void deadline_end(conn_deadline * deadline) {
+    if (deadline == NULL) return;
+
+    pthread_mutex_lock(&service.lock);
+    tw_cancel(&deadline->timer);
+    pthread_mutex_unlock(&service.lock);
+}
+
+int deadline_expired(conn_deadline * deadline) {
+    if (deadline == NULL) return 0;
+    return atomic_load(&deadline->expired);
+}
+
+static uint64_t now_ticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / DEADLINE_TICK_MS;
+}
+
+static uint64_t ms_to_ticks(int ms) {
+    return ((uint64_t) ms + DEADLINE_TICK_MS - 1) / DEADLINE_TICK_MS;
+}
+
+static void * ticker_loop(void * arg) {
+    (void) arg;
+    struct timespec tick = { 0, DEADLINE_TICK_MS * 1000000L };
+
+    while (atomic_load(&service.running)) {
+        nanosleep(&tick, NULL);
+
+        pthread_mutex_lock(&service.lock);
+        tw_advance(&service.wheel, now_ticks());
+        pthread_mutex_unlock(&service.lock);
+    }
+    return NULL;
+}
+
+// Called by the ticker with the wheel lock held.
+static void deadline_fire(tw_timer * timer) {
+    conn_deadline * deadline = (conn_deadline *) timer;
+
+    uint64_t next = deadline->phase_deadline;
+    if (deadline->idle_ticks) {
+        uint64_t last_progress = atomic_load_explicit(&deadline->last_progress, memory_order_relaxed);
+        if (last_progress + deadline->idle_ticks < next) {
+            next = last_progress + deadline->idle_ticks;
+        }
+    }
+
+    if (next >= service.wheel.current_tick) {
+        tw_arm(&service.wheel, timer, next);
+        return;
+    }
+
+    atomic_store(&deadline->expired, 1);
+    shutdown(deadline->cfd, SHUT_RDWR);
+}
@@ -0,0 +1,60 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "../libs/timer_wheel.h"
+
+#define DEADLINE_TICK_MS 10
+
+/**
+ * Tracks the deadline of a single connection phase (reading the request
+ * header or sending the response). A phase expires either when its total
+ * budget runs out or when no progress has been made for the idle budget.
+ * Expired connections are shut down so that any blocked read or write in
+ * the worker returns immediately.
+ */
+typedef struct {
+    tw_timer timer;
+    int cfd;
+    uint64_t phase_deadline;
+    uint64_t idle_ticks;
+    atomic_uint_fast64_t last_progress;
+    atomic_int expired;
+} conn_deadline;
+
+/**
+ * Starts the background thread that advances the timer wheel for this
+ * process. Must be called in every process that handles clients.
+ */
+void deadline_service_start(void);
+
+/**
+ * Stops the background thread started by deadline_service_start.
+ */
+void deadline_service_stop(void);
+
+/**
+ * Begins a new phase on cfd with a total budget of phase_ms and an idle
+ * budget of idle_ms. A budget of 0 disables that limit.
+ */
+void deadline_begin(conn_deadline * deadline, int cfd, int phase_ms, int idle_ms);
+
+/**
+ * Records that the connection made progress, pushing back the idle deadline.
+ * Lock-free, safe to call after every read or write.
+ */
+void deadline_progress(conn_deadline * deadline);
+
+/**
+ * Ends the current phase. The deadline can be reused with deadline_begin.
+ */
+void deadline_end(conn_deadline * deadline);
+
+/**
+ * Returns whether the connection was closed because a deadline expired.
+ */
+int deadline_expired(conn_deadline * deadline);
+
+#endif
@@ -0,0 +1,98 @@
+#include "encoding.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define Q_UNSET -1
+
+static const char * names[ENCODING_COUNT] = { "br", "zstd", "gzip" };
+static const char * suffixes[ENCODING_COUNT] = { ".br", ".zst", ".gz" };
+
+static int parse_q(const char * params, size_t len);
+
+// q-values are kept in thousandths so they compare as integers.
+int encoding_negotiate(const char * accept_encoding, int order[ENCODING_COUNT]) {
+    if (accept_encoding == NULL) return 0;
+
+    int q[ENCODING_COUNT] = { Q_UNSET, Q_UNSET, Q_UNSET };
+    int q_any = Q_UNSET;
+
+    const char * item = accept_encoding;
+    while (*item != '\0') {
+        size_t item_len = strcspn(item, ",");
+        size_t token_len = strcspn(item, ";,");
+        const char * token = item;
+        while (token_len > 0 && (*token == ' ' || *token == '\t')) {
+            token++;
+            token_len--;
+        }
+        while (token_len > 0 && (token[token_len - 1] == ' ' || token[token_len - 1] == '\t')) token_len--;
+
+        int value = parse_q(token + token_len, item + item_len - (token + token_len));
+        if (token_len == 1 && token[0] == '*') {
+            q_any = value;
+        } else {
+            for (int i = 0; i < ENCODING_COUNT; i++) {
+                if (strlen(names[i]) == token_len && strncasecmp(token, names[i], token_len) == 0) {
+                    q[i] = value;
+                }
+            }
+            // x-gzip is an alias kept for old clients.
+            if (token_len == 6 && strncasecmp(token, "x-gzip", 6) == 0) q[ENCODING_GZIP] = value;
+        }
+
+        item += item_len;
+        if (*item == ',') item++;
+    }
+
+    int count = 0;
+    for (int i = 0; i < ENCODING_COUNT; i++) {
+        if (q[i] == Q_UNSET) q[i] = q_any;
+        if (q[i] <= 0) continue;
+
+        // Insertion sort by descending q; equal q keeps the server's order.
+        int j = count++;
+        while (j > 0 && q[order[j - 1]] < q[i]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    return count;
+}
+
+const char * encoding_name(int encoding) {
+    return names[encoding];
+}
+
+const char * encoding_suffix(int encoding) {
+    return suffixes[encoding];
+}
+
+// Returns the q parameter among ";name=value" params in thousandths,
+// 1000 if there is none.
+static int parse_q(const char * params, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (params[i] != ';') continue;
+
+        size_t j = i + 1;
+        while (j < len && (params[j] == ' ' || params[j] == '\t')) j++;
+        if (j + 1 < len && (params[j] == 'q' || params[j] == 'Q') && params[j + 1] == '=') {
+            j += 2;
+            int value = 0;
+            int scale = 1000;
+            if (j < len && params[j] == '1') return 1000;
+            if (j < len && params[j] == '0') j++;
+            if (j < len && params[j] == '.') {
+                j++;
+                while (j < len && scale > 1 && params[j] >= '0' && params[j] <= '9') {
+                    scale /= 10;
+                    value += (params[j++] - '0') * scale;
+                }
+            }
+            return value;
+        }
+    }
+    return 1000;
+}
@@ -0,0 +1,31 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+/**
+ * Content codings the server can serve from precompressed siblings, in the
+ * order it prefers them when the client rates them equally.
+ */
+#define ENCODING_BR 0
+#define ENCODING_ZSTD 1
+#define ENCODING_GZIP 2
+#define ENCODING_COUNT 3
+
+/**
+ * Orders the codings acceptable under an Accept-Encoding header value into
+ * order, best first: by the client's q-value, then by the server's
+ * preference. Codings with q=0, or neither listed nor covered by "*", are
+ * left out. Returns how many were written, 0 if accept_encoding is NULL.
+ */
+int encoding_negotiate(const char * accept_encoding, int order[ENCODING_COUNT]);
+
+/**
+ * Returns the token for a coding, e.g. "br", as used in Content-Encoding.
+ */
+const char * encoding_name(int encoding);
+
+/**
+ * Returns the file name suffix of a coding's precompressed sibling, e.g. ".br".
+ */
+const char * encoding_suffix(int encoding);
+
+#endif
@@ -1,38 +1,134 @@
 #include "http.h"
-
+#include "access_log.h"
+#include "trace.h"
+#include "response_cache.h"
+#include "resolve.h"
+#include "negative_cache.h"
+#include "encoding.h"
+#include "compression.h"
+#include "content_cache.h"
+#include "archive.h"
+#include "prefetch.h"
+#include "transfer_pool.h"
+#include "pacing.h"
+
+#include <ctype.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <dc/unistd.h>
 #include <dc/stdlib.h>
 
-#define CRLF "\r\n"
-#define BODY_BUFFER 256
+#define SENDFILE_CHUNK 65536
+#define ETAG_SIZE 32
+#define BODY_IOV_MAX 64
+#define COLD_PROBE_LEN (4 * 1024 * 1024)
+#define COLD_PAGE_MIN 4096
+
+/**
+ * A file to read whole on a content cache miss.
+ */
+typedef struct {
+    int fd;
+    size_t len;
+} read_job;
+
+/**
+ * A response handed to a transfer lane, with what the lane's thread needs
+ * to send it and record it. cfd is a duplicate of the client socket, so it
+ * stays open after the worker closes its own.
+ */
+typedef struct {
+    int lane;
+    uint64_t queued_us;
+    int cfd;
+    int body_timeout;
+    int idle_timeout;
+    uint64_t started_us;
+    http_request * request;
+    http_response * response;
+    conn_deadline deadline;
+} transfer;
 
 static void parse_request_header(char * raw_header, http_request * request);
 static int parse_request_method(char * method);
 static char * substring(const char * string, size_t start, size_t end);
-static int parse_uri_to_filepath(config * conf, char * request_uri, char ** request_path);
-static char * get_status_phrase(int status_code);
-static char * get_utc_time();
+static int open_content(config * conf, http_request * request, http_response * response);
+static int open_encoded_sibling(config * conf, const int * order, int count, char * path, http_response * response,
+                                struct stat * st);
+static int compress_content(config * conf, const int * order, int count, const char * path, http_response * response,
+                            struct stat * st);
+static void load_content(http_request * request, http_response * response, const struct stat * st);
+static char * read_content(void * arg, size_t * len);
+static int open_archived(config * conf, http_request * request, char * path, http_response * response);
+static uint64_t send_body(http_response * response, int cfd, pacer * pace);
+static uint64_t send_file_range(http_response * response, int cfd, int fd, off_t offset, off_t len, pacer * pace);
+static off_t body_size(http_response * response);
+static void set_pacing(config * conf, http_response * response);
+static ssize_t read_request_header(int cfd, char * request_buf, size_t total_read, conn_deadline * deadline);
+static uint64_t finish_response(int cfd, int body_timeout, int idle_timeout, http_request * request,
+                                http_response * response, conn_deadline * deadline, uint64_t started_us);
+static void send_generated(config * conf, int cfd, http_request * request, const char * path,
+                           const char * content_type, char * body, size_t body_len, conn_deadline * deadline,
+                           uint64_t started_us);
+static int select_lane(config * conf, http_response * response);
+static int is_cold(config * conf, http_response * response);
+static int is_resident(int fd, off_t offset, off_t len);
+static int hand_off(config * conf, int cfd, http_request * request, http_response * response, uint64_t started_us);
+static void send_transfer(void * arg);
 
 void http_handle_client(config * conf, int cfd) {
+    http_handle_request(conf, cfd, NULL, 0);
+}
+
+void http_handle_request(config * conf, int cfd, const char * buf, size_t len) {
     char request_buf[MAX_REQUEST_LEN];
     memset(request_buf, 0, MAX_REQUEST_LEN); // You will regret removing this line
-    
-    ssize_t num_read = read(cfd, request_buf, MAX_REQUEST_LEN);
-
+    if (len > MAX_REQUEST_LEN - 1) len = MAX_REQUEST_LEN - 1;
+    if (len > 0) memcpy(request_buf, buf, len);
+    uint64_t started_us = metrics_now_us();
+    conn_deadline deadline;
+
+    uint64_t phase_start = trace_now();
+    deadline_begin(&deadline, cfd, conf->header_timeout, conf->idle_timeout);
+    ssize_t num_read = read_request_header(cfd, request_buf, len, &deadline);
+    deadline_end(&deadline);
+    trace_record(TRACE_READ, phase_start, trace_now());
+    if (deadline_expired(&deadline)) metrics_record_timeout();
+    if (num_read <= 0 || deadline_expired(&deadline)) return;
+
+    phase_start = trace_now();
     http_request * request = parse_request(request_buf, num_read);
+    trace_record(TRACE_PARSE, phase_start, trace_now());
+    if (request != NULL && metrics_is_status_uri(request->request_uri)) {
+        size_t body_len;
+        const char * content_type;
+        char * body = metrics_format_status(request->request_uri, &body_len, &content_type);
+        send_generated(conf, cfd, request, METRICS_STATUS_URI, content_type, body, body_len, &deadline, started_us);
+        return;
+    }
+    if (request != NULL && conf->trace_endpoint && trace_is_trace_uri(request->request_uri)) {
+        size_t body_len;
+        char * body = trace_format(&body_len);
+        send_generated(conf, cfd, request, TRACE_URI, "application/json", body, body_len, &deadline, started_us);
+        return;
+    }
+
+    phase_start = trace_now();
     http_response * response = build_response(conf, request);
-    send_response(response, cfd);
+    trace_record(TRACE_RESOLVE, phase_start, trace_now());
+    set_pacing(conf, response);
 
-    http_request_destroy(request);
-    http_response_destroy(response);
+    if (hand_off(conf, cfd, request, response, started_us)) return;
+    finish_response(cfd, conf->body_timeout, conf->idle_timeout, request, response, &deadline, started_us);
 }
 
 http_request * parse_request(char * request_text, size_t request_len) {
@@ -58,81 +154,57 @@ http_request * parse_request(char * request_text, size_t request_len) {
 }
 
 http_response * build_response(config * conf, http_request * request) {
-    str_map * header_fields = sm_create(4);
-    sm_put(header_fields, "Server", "DataComm/0.1");
-    sm_put(header_fields, "Date", get_utc_time());
-
-    http_response * response = malloc(sizeof(http_response));
-    response->header_fields = header_fields;
+    http_response * response = calloc(1, sizeof(http_response));
+    response->content_fd = -1;
 
     if (request == NULL) {
-        response->response_code = 400;
+        response->response_code = HTTP_BAD_REQUEST;
+        response->header = response_cache_error(HTTP_BAD_REQUEST);
         return response;
     }
 
     response->method = request->method;
-    int path_status = parse_uri_to_filepath(conf, request->request_uri, &response->request_path);
+    int content_status = open_content(conf, request, response);
 
-    if (path_status == -1) {
+    if (content_status == -1) {
+        response->response_code = HTTP_BAD_REQUEST;
+        response->header = response_cache_error(HTTP_BAD_REQUEST);
+        return response;
+    } else if (content_status == -2) {
         response->response_code = HTTP_SERVER_ERROR;
+        response->header = response_cache_error(HTTP_SERVER_ERROR);
         return response;
-    } else if (path_status == 0) {
+    } else if (content_status == 0) {
         response->response_code = HTTP_NOT_FOUND;
     } else {
         response->response_code = HTTP_OK;
     }
-
-    struct stat st;
-    int stat_status = stat(response->request_path, &st);
-
-    if (stat_status) {
-        response->response_code = HTTP_SERVER_ERROR;
-        return response;
-    } else {
-        long size = st.st_size;
-        char size_buffer[15];
-        sprintf(size_buffer, "%ld", size);
-
-        sm_put(header_fields, "Content-Length", size_buffer);
-    }
-
     return response;
 }
 
-void send_response(http_response * response, int cfd) {
-    const char * version = "HTTP/1.0 ";
-    write(cfd, version, strlen(version));
-    const char * status_phrase = get_status_phrase(response->response_code);
-    write(cfd, status_phrase, strlen(status_phrase));
-    write(cfd, CRLF, 2);
-
-    str_map * header_fields = response->header_fields;
-    size_t header_lines = sm_size(header_fields);
-    char ** header_keys = sm_get_keys(header_fields);
-    for (size_t i = 0; i < header_lines; i++) {
-        char buf[MAX_HEADER_VALUE_LEN];
-        sprintf(buf, "%s: %s", header_keys[i], sm_get(header_fields, header_keys[i]));
-        int len = strlen(buf);
-        write(cfd, buf, len);
-        write(cfd, CRLF, 2);
-    }
-
-    write(cfd, CRLF, 2);
+uint64_t send_response(http_response * response, int cfd) {
+    uint64_t sent = response_header_send(response->header, cfd, response->method != METHOD_HEAD);
 
-    if (response->method == METHOD_HEAD) return;
-    if (response->response_code == HTTP_SERVER_ERROR) return;
+    if (response->method == METHOD_HEAD) return sent;
+    if (response->response_code == HTTP_SERVER_ERROR) return sent;
+    if (response->response_code == HTTP_BAD_REQUEST) return sent;
+    if (response->response_code == HTTP_SERVICE_UNAVAILABLE) return sent;
+    if (response->header->body_len > 0) return sent;
 
-    const char * content_filepath = response->request_path;
-    int content_fd = open(content_filepath, O_RDONLY);
+    if (response->body.len == 0 && response->archive == NULL && response->content_fd == -1) return sent;
 
-    ssize_t num_read;
-    char buf[BODY_BUFFER];
-    num_read = read(content_fd, buf, BODY_BUFFER);
-    while (num_read > 0) {
-        write(cfd, buf, num_read);
-        num_read = read(content_fd, buf, BODY_BUFFER);
+    pacer pace;
+    pacer_begin(&pace, cfd, (uint64_t) response->pace_rate, (uint64_t) response->egress_rate);
+    if (response->body.len > 0) {
+        sent += send_body(response, cfd, &pace);
+    } else if (response->archive != NULL) {
+        sent += send_file_range(response, cfd, response->archive->fd, response->archive_offset,
+                                response->archive_len, &pace);
+    } else {
+        sent += send_file_range(response, cfd, response->content_fd, 0, response->header->size, &pace);
     }
-    close(content_fd);
+    pacer_end(&pace);
+    return sent;
 }
 
 void http_request_destroy(http_request * request) {
@@ -149,8 +221,12 @@ void http_response_destroy(http_response * response) {
     if (response == NULL) return;
     if (response->request_path != NULL)
         free(response->request_path);
+    if (response->content_fd != -1)
+        close(response->content_fd);
 
-    sm_destroy(response->header_fields);
+    response_header_release(response->header);
+    content_body_release(&response->body);
+    archive_release(response->archive);
     free(response);
 }
 
@@ -176,37 +252,235 @@ static int parse_request_method(char * method) {
     return METHOD_UNSUPPORTED;
 }
 
-static char * get_status_phrase(int status_code) {
-    if (status_code == HTTP_OK) {
-        return "200 OK";
+// Sends the response within the body timeouts, records it and frees it
+// and its request. Returns the number of bytes sent.
+static uint64_t finish_response(int cfd, int body_timeout, int idle_timeout, http_request * request,
+                                http_response * response, conn_deadline * deadline, uint64_t started_us) {
+    uint64_t phase_start = trace_now();
+    deadline_begin(deadline, cfd, body_timeout, idle_timeout);
+    response->deadline = deadline;
+    uint64_t sent = send_response(response, cfd);
+    deadline_end(deadline);
+    trace_record(TRACE_SEND, phase_start, trace_now());
+
+    if (deadline_expired(deadline)) metrics_record_timeout();
+    metrics_record_response(response->response_code, sent, started_us);
+    access_log_record(response->method, request != NULL ? request->request_uri : NULL,
+                      response->response_code, sent, started_us, response->cache_hit);
+
+    http_request_destroy(request);
+    http_response_destroy(response);
+    return sent;
+}
+
+// Sends a page generated for this request, taking ownership of body, like
+// any other response: under the body and idle deadlines, and counted in the
+// metrics and the access log.
+static void send_generated(config * conf, int cfd, http_request * request, const char * path,
+                           const char * content_type, char * body, size_t body_len, conn_deadline * deadline,
+                           uint64_t started_us) {
+    http_response * response = calloc(1, sizeof(http_response));
+    response->method = request->method;
+    response->response_code = HTTP_OK;
+    response->content_fd = -1;
+    response->header = response_cache_generated(path, content_type, body_len);
+    response->body.data = body;
+    response->body.len = body_len;
+    finish_response(cfd, conf->body_timeout, conf->idle_timeout, request, response, deadline, started_us);
+}
+
+// Picks the transfer lane for a response: the first configured lane its
+// file and body size match, else the cold lane if its file is not in the
+// page cache. Responses sent from memory or from the header alone stay
+// with the worker. Returns -1 for none.
+static int select_lane(config * conf, http_response * response) {
+    if (response->method != METHOD_GET || response->request_path == NULL) return -1;
+    if (response->response_code != HTTP_OK && response->response_code != HTTP_NOT_FOUND) return -1;
+    if (response->header->body_len > 0 || response->body.len > 0) return -1;
+
+    int lane = transfer_lanes_classify(response->request_path, body_size(response));
+    if (lane != -1) return lane;
+    if (transfer_lanes_active(TRANSFER_COLD_LANE) && is_cold(conf, response)) return TRANSFER_COLD_LANE;
+    return -1;
+}
+
+// Whether sending the response's body would likely block on the disk: it
+// is sent from a file, is at least io_cold_min_size bytes, and some of its
+// first COLD_PROBE_LEN bytes are not in the page cache.
+static int is_cold(config * conf, http_response * response) {
+    if (conf->io_cold_min_size <= 0) return 0;
+
+    int fd = response->content_fd;
+    off_t offset = 0;
+    off_t len = response->header->size;
+    if (response->archive != NULL) {
+        fd = response->archive->fd;
+        offset = response->archive_offset;
+        len = response->archive_len;
     }
-    
-    if (status_code == HTTP_NOT_FOUND) {
-        return "404 Not Found";
+    if (fd == -1 || len < conf->io_cold_min_size) return 0;
+    return !is_resident(fd, offset, len < COLD_PROBE_LEN ? len : COLD_PROBE_LEN);
+}
+
+// Maps the range just long enough to ask mincore whether all of its pages
+// are cached. If that cannot be told, the range is taken to be cached.
+static int is_resident(int fd, off_t offset, off_t len) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size < COLD_PAGE_MIN) return 1;
+    off_t start = offset - offset % page_size;
+    size_t map_len = (size_t) (len + (offset - start));
+    void * addr = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, start);
+    if (addr == MAP_FAILED) return 1;
+
+    unsigned char pages[COLD_PROBE_LEN / COLD_PAGE_MIN + 1];
+    size_t num_pages = (map_len + (size_t) page_size - 1) / (size_t) page_size;
+    int resident = 1;
+    if (mincore(addr, map_len, pages) == 0) {
+        for (size_t i = 0; i < num_pages && resident; i++) resident = pages[i] & 1;
+    }
+    munmap(addr, map_len);
+    return resident;
+}
+
+// Queues the response on its lane, if it has one. Returns 0, leaving the
+// response to the caller, if it has none or the lane has no room, counting
+// every process's responses in flight in it. A full configured lane turns
+// the response into a 503 with the configured Retry-After, so its large
+// transfers never take the workers; the cold lane leaves it to the worker
+// as it is.
+static int hand_off(config * conf, int cfd, http_request * request, http_response * response, uint64_t started_us) {
+    int lane = select_lane(conf, response);
+    if (lane == -1) return 0;
+
+    int transfer_fd = dup(cfd);
+    if (transfer_fd == -1) return 0;
+
+    transfer * t = dc_malloc(sizeof(transfer));
+    t->lane = lane;
+    t->queued_us = metrics_now_us();
+    t->cfd = transfer_fd;
+    t->body_timeout = conf->body_timeout;
+    t->idle_timeout = conf->idle_timeout;
+    t->started_us = started_us;
+    t->request = request;
+    t->response = response;
+    int queued = metrics_lane_enter(lane, transfer_lanes_limit(lane));
+    if (queued && !transfer_lanes_submit(lane, send_transfer, t)) {
+        metrics_lane_cancel(lane);
+        queued = 0;
     }
+    if (!queued) {
+        close(transfer_fd);
+        free(t);
+        if (lane != TRANSFER_COLD_LANE) {
+            response_header_release(response->header);
+            response->header = response_cache_unavailable(conf->retry_after);
+            response->response_code = HTTP_SERVICE_UNAVAILABLE;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+static void send_transfer(void * arg) {
+    transfer * t = arg;
+    uint64_t started_us = metrics_now_us();
+    metrics_lane_started(t->lane, started_us - t->queued_us);
+
+    uint64_t sent = finish_response(t->cfd, t->body_timeout, t->idle_timeout, t->request, t->response, &t->deadline,
+                                    t->started_us);
+    metrics_lane_finished(t->lane, sent, metrics_now_us() - started_us);
+    close(t->cfd);
+    free(t);
+}
+
+// Reads until the end of the request header, a full buffer, or the client
+// stops sending, after the total_read bytes already in request_buf. Returns
+// the number of bytes read, or -1 on error.
+static ssize_t read_request_header(int cfd, char * request_buf, size_t total_read, conn_deadline * deadline) {
+    while (total_read < MAX_REQUEST_LEN - 1) {
+        if (strstr(request_buf, "\r\n\r\n") != NULL) break;
+        if (strstr(request_buf, "\n\n") != NULL) break;
+
+        ssize_t num_read = read(cfd, request_buf + total_read, MAX_REQUEST_LEN - 1 - total_read);
+        if (num_read < 0) return total_read > 0 ? (ssize_t) total_read : -1;
+        if (num_read == 0) break;
 
-    if (status_code == HTTP_BAD_REQUEST) {
-        return "400 Bad Request";
+        total_read += num_read;
+        deadline_progress(deadline);
     }
 
-    return "500 Internal Server Error";
+    return total_read;
 }
 
-static char * get_utc_time() {
-    time_t raw;
-    struct tm *utc;
+// Sends a body held in memory, a block chain in the content cache or a
+// heap buffer, with writev. Returns the number of bytes sent.
+static uint64_t send_body(http_response * response, int cfd, pacer * pace) {
+    struct iovec iov[BODY_IOV_MAX];
+    size_t offset = 0;
+    while (offset < response->body.len) {
+        int num_iov = content_body_iov(&response->body, offset, iov, BODY_IOV_MAX);
+        size_t allowed = pacer_allow(pace, response->body.len - offset);
+        for (int i = 0; i < num_iov; i++) {
+            if (iov[i].iov_len >= allowed) {
+                iov[i].iov_len = allowed;
+                num_iov = i + 1;
+                break;
+            }
+            allowed -= iov[i].iov_len;
+        }
+        ssize_t num_sent = writev(cfd, iov, num_iov);
+        if (num_sent <= 0) break;
+        pacer_sent(pace, (size_t) num_sent);
+        offset += num_sent;
+        deadline_progress(response->deadline);
+        if (deadline_expired(response->deadline)) break;
+    }
+    return offset;
+}
+
+// Sends len bytes of fd from offset with sendfile, which leaves the file's
+// own offset alone, so a response can be sent again and an archive shared.
+// Returns the number of bytes sent.
+static uint64_t send_file_range(http_response * response, int cfd, int fd, off_t offset, off_t len, pacer * pace) {
+    uint64_t sent = 0;
+    off_t end = offset + len;
+    while (offset < end) {
+        size_t chunk = end - offset < SENDFILE_CHUNK ? (size_t) (end - offset) : SENDFILE_CHUNK;
+        chunk = pacer_allow(pace, chunk);
+        ssize_t num_sent = sendfile(cfd, fd, &offset, chunk);
+        if (num_sent <= 0) break;
+        pacer_sent(pace, (size_t) num_sent);
+        sent += num_sent;
+        deadline_progress(response->deadline);
+        if (deadline_expired(response->deadline)) break;
+    }
+    return sent;
+}
 
-    time(&raw);
-    utc = gmtime(&raw);
+// Returns the size of the body a response sends from memory, the archive
+// or its file.
+static off_t body_size(http_response * response) {
+    if (response->body.len > 0) return (off_t) response->body.len;
+    return response->archive != NULL ? response->archive_len : response->header->size;
+}
 
-    char * time_text = asctime(utc);
-    time_text[24] = '\0';
-    return time_text;
+// Sets the rates a response's body is paced at: its path's rate and the
+// egress cap, for bodies of at least pace_min_size bytes. The rate is that
+// of the file asked for, also when a coded sibling is sent. Headers and
+// smaller bodies, such as most pages, are sent as fast as the client takes
+// them.
+static void set_pacing(config * conf, http_response * response) {
+    if (response->request_path == NULL || response->header->body_len > 0) return;
+    if (body_size(response) < conf->pace_min_size) return;
+
+    response->pace_rate = config_pace_rate(conf, response->request_path);
+    response->egress_rate = conf->egress_rate;
 }
 
 // Parsing according to example at: https://linux.die.net/man/3/strtok_r
 static void parse_request_header(char * raw_header, http_request * request) {
-    char * saveptr1, * saveptr2, * saveptr3;
+    char * saveptr1, * saveptr2;
     char * request_line = strtok_r(raw_header, "\r\n", &saveptr1);
     
     char * method_str = strtok_r(request_line, " ", &saveptr2);
@@ -216,9 +490,20 @@ static void parse_request_header(char * raw_header, http_request * request) {
     str_map * fields_map = sm_create(4);
     char * header_field = strtok_r(NULL, "\r\n", &saveptr1);
     while (header_field != NULL) {
-        char * lhs = strtok_r(header_field, ":", &saveptr3);
-        char * rhs = strtok_r(NULL, ":", &saveptr3);
-        sm_put(fields_map, lhs, rhs);
+        // Names are case-insensitive, so they are stored lowercased; values
+        // are stored without surrounding whitespace.
+        char * colon = strchr(header_field, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+            for (char * c = header_field; *c != '\0'; c++) *c = (char) tolower((unsigned char) *c);
+
+            char * value = colon + 1;
+            while (*value == ' ' || *value == '\t') value++;
+            char * value_end = value + strlen(value);
+            while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) value_end--;
+            *value_end = '\0';
+            sm_put(fields_map, header_field, value);
+        }
         header_field = strtok_r(NULL, "\r\n", &saveptr1);
     }
 
@@ -228,45 +513,212 @@ static void parse_request_header(char * raw_header, http_request * request) {
     request->header_fields = fields_map;
 }
 
+// Opens the file a request addresses, or the not found page, beneath the
+// root directory and sets the response header for it. request_path is set
+// to the file's path relative to the root, without the suffix of a coded
+// sibling sent in its place, so lanes match it as cache policies do. Paths
+// recently found missing are answered from the negative cache without
+// touching the filesystem. The links of HTML pages are queued for
+// prefetch, or sent as preload headers, when configured.
 // Returns 1 if able to open request_uri
 // Returns 0 if can't open request_uri but can open not found page
-// Returns -1 if can't open either (Server Error)
-static int parse_uri_to_filepath(config * conf, char * request_uri, char ** request_path) {
-    if (request_uri == NULL) {
-        *request_path = NULL;
-        return -1;
+// Returns -1 if request_uri is malformed or escapes the root (Bad Request)
+// Returns -2 if can't open either (Server Error)
+static int open_content(config * conf, http_request * request, http_response * response) {
+    char path[MAX_URI_PATH_LEN];
+    if (resolve_normalize(request->request_uri, path, MAX_URI_PATH_LEN) == -1) return -1;
+
+    if (path[0] == '\0' && resolve_normalize(conf->index_page, path, MAX_URI_PATH_LEN) == -1) {
+        path[0] = '\0';
     }
 
-    // TODO: Get these from settings
-    char * serving_directory = conf->root_dir;
-    char * not_found_page = conf->not_found_page;
-    char * index_page = conf->index_page;
+    if (conf->archive[0] != '\0') return open_archived(conf, request, path, response);
 
-    if (strcmp(request_uri, "/") == 0) {
-        request_uri = index_page;
+    char not_found_path[MAX_URI_PATH_LEN];
+    if (negative_cache_contains(conf->root_dir, path) &&
+        resolve_normalize(conf->not_found_page, not_found_path, MAX_URI_PATH_LEN) != -1) {
+        response->header = negative_cache_not_found(conf->root_dir, not_found_path);
+        if (response->header != NULL) {
+            response->cache_hit = 1;
+            return 0;
+        }
     }
 
-    char filepath_buf[MAX_URI_PATH_LEN];
-    memset(filepath_buf, 0, MAX_URI_PATH_LEN);
-    sprintf(filepath_buf, "%s%s", serving_directory, request_uri);
-
-    if( access( filepath_buf, F_OK ) != -1 ) {
-        size_t filepath_len = strlen(filepath_buf);
-        *request_path = calloc(filepath_len + 1, sizeof(char));
-        strcpy(*request_path, filepath_buf);
-        return 1;
+    // Taken before the lookup so a file created meanwhile is not cached as missing.
+    uint64_t generation = negative_cache_generation();
+    struct stat st;
+    response->content_fd = resolve_open(conf->root_dir, path, &st);
+
+    if (response->content_fd == -1) {
+        negative_cache_insert(conf->root_dir, path, generation);
+        if (resolve_normalize(conf->not_found_page, path, MAX_URI_PATH_LEN) == -1) return -2;
+        response->content_fd = resolve_open(conf->root_dir, path, &st);
+        if (response->content_fd == -1) return -2;
+
+        response_spec spec = { HTTP_NOT_FOUND, path, -1, NULL, NULL, NULL, NULL };
+        response->header = response_cache_get(&spec, response->content_fd, &st, &response->cache_hit);
+        negative_cache_set_not_found(conf->root_dir, path, response->header, generation);
+        response->request_path = strdup(path);
+        return 0;
     }
 
-    memset(filepath_buf, 0, MAX_URI_PATH_LEN);
-    sprintf(filepath_buf, "%s%s", serving_directory, not_found_page);
+    const char * accept_encoding = sm_get(request->header_fields, "accept-encoding");
+    prefetch_links * links = NULL;
+    if (conf->prefetch || conf->prefetch_preload) links = prefetch_scan(path, response->content_fd, &st);
+    if (links != NULL && conf->prefetch && request->method == METHOD_GET) prefetch_queue(links, accept_encoding);
+
+    const cache_policy * policy = config_cache_policy(conf, path);
+    response->request_path = strdup(path);
+    int order[ENCODING_COUNT];
+    int count = encoding_negotiate(accept_encoding, order);
+    int encoding = open_encoded_sibling(conf, order, count, path, response, &st);
+    int compressed = 0;
+    if (encoding == -1) {
+        encoding = compress_content(conf, order, count, path, response, &st);
+        compressed = encoding != -1;
+    }
+    if (response->body.len == 0) load_content(request, response, &st);
+    response_spec spec = { HTTP_OK, path, encoding, policy, NULL, NULL,
+                           links != NULL && conf->prefetch_preload ? links->preload : NULL };
+    int header_hit;
+    response->header = response_cache_get(&spec, response->content_fd, &st, &header_hit);
+    // A body compressed on the fly is logged by its own lookup, as a miss
+    // there costs far more than rendering the header.
+    if (!compressed) response->cache_hit = header_hit;
+    prefetch_links_release(links);
+    return 1;
+}
 
-    if( access( filepath_buf, F_OK ) != -1 ) {
-        size_t filepath_len = strlen(filepath_buf);
-        *request_path = calloc(filepath_len + 1, sizeof(char));
-        strcpy(*request_path, filepath_buf);
-        return 0;
+// Switches the response to the best precompressed sibling of path (e.g.
+// path.br) that the client accepts, skipping siblings older than the file
+// itself. On success path, content_fd and st describe the sibling.
+// Returns the sibling's coding, or -1 to send the file as it is.
+static int open_encoded_sibling(config * conf, const int * order, int count, char * path, http_response * response,
+                                struct stat * st) {
+    size_t path_len = strlen(path);
+
+    for (int i = 0; i < count; i++) {
+        const char * suffix = encoding_suffix(order[i]);
+        if (path_len + strlen(suffix) >= MAX_URI_PATH_LEN) break;
+        strcpy(path + path_len, suffix);
+        if (negative_cache_contains(conf->root_dir, path)) continue;
+
+        uint64_t generation = negative_cache_generation();
+        struct stat sibling_st;
+        int fd = resolve_open(conf->root_dir, path, &sibling_st);
+        if (fd == -1) {
+            negative_cache_insert(conf->root_dir, path, generation);
+            continue;
+        }
+        if (sibling_st.st_mtim.tv_sec < st->st_mtim.tv_sec ||
+            (sibling_st.st_mtim.tv_sec == st->st_mtim.tv_sec && sibling_st.st_mtim.tv_nsec < st->st_mtim.tv_nsec)) {
+            close(fd);
+            continue;
+        }
+
+        close(response->content_fd);
+        response->content_fd = fd;
+        *st = sibling_st;
+        return order[i];
     }
 
-    *request_path = NULL;
+    path[path_len] = '\0';
+    return -1;
+}
+
+// Compresses a text file that has no usable sibling with the best coding
+// the client accepts that can be done on the fly. Files smaller than
+// compression_min_size or too large for the content cache are left alone.
+// On success response->body holds the result, st->st_size its length and
+// response->cache_hit whether the content cache already had it.
+// Returns the coding, or -1 to send the file as it is.
+static int compress_content(config * conf, const int * order, int count, const char * path, http_response * response,
+                            struct stat * st) {
+    if (!conf->compression || !compression_compressible(path)) return -1;
+    if (st->st_size < conf->compression_min_size || (size_t) st->st_size > content_cache_max_len()) return -1;
+
+    for (int i = 0; i < count; i++) {
+        if (!compression_supported(order[i])) continue;
+
+        if (!compression_get(conf, order[i], response->content_fd, st, &response->body, &response->cache_hit)) {
+            return -1;
+        }
+        st->st_size = (off_t) response->body.len;
+        return order[i];
+    }
     return -1;
 }
+
+// Serves a file, or sibling, small enough for the content cache from it,
+// reading it in on a miss, so every worker sends it from the same copy in
+// memory and concurrent misses read it once. The file is still sent with
+// sendfile if it cannot be read whole.
+static void load_content(http_request * request, http_response * response, const struct stat * st) {
+    if (request->method != METHOD_GET || st->st_size == 0 || (size_t) st->st_size > content_cache_max_len()) return;
+
+    int cache_hit;
+    read_job job = { response->content_fd, (size_t) st->st_size };
+    content_cache_load(CONTENT_CACHE_IDENTITY, st, read_content, &job, &response->body, &cache_hit);
+}
+
+static char * read_content(void * arg, size_t * len) {
+    read_job * job = arg;
+    *len = job->len;
+    char * data = dc_malloc(*len);
+    if (pread(job->fd, data, *len, 0) != (ssize_t) *len) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+// Answers a request from the archive instead of the root directory: one
+// index lookup, with the body later sent from the archive's fd. The
+// response keeps the archive it was answered from alive, so swapping in a
+// new archive does not disturb it. Return values are as for open_content.
+static int open_archived(config * conf, http_request * request, char * path, http_response * response) {
+    response->archive = archive_acquire(conf->archive);
+    if (response->archive == NULL) return -2;
+
+    int status = HTTP_OK;
+    const archive_entry * entry = archive_find(response->archive, path);
+    if (entry == NULL) {
+        status = HTTP_NOT_FOUND;
+        if (resolve_normalize(conf->not_found_page, path, MAX_URI_PATH_LEN) == -1) return -2;
+        entry = archive_find(response->archive, path);
+        if (entry == NULL) return -2;
+    }
+
+    int encoding = -1;
+    const cache_policy * policy = NULL;
+    char etag[ETAG_SIZE];
+    if (status == HTTP_OK) {
+        int order[ENCODING_COUNT];
+        int count = encoding_negotiate(sm_get(request->header_fields, "accept-encoding"), order);
+        for (int i = 0; i < count && encoding == -1; i++) {
+            if (entry->len[order[i] + 1] > 0) encoding = order[i];
+        }
+        policy = config_cache_policy(conf, path);
+        // Each coding is a different representation, so it gets its own tag.
+        snprintf(etag, sizeof(etag), "\"%016llx%s%s\"", (unsigned long long) entry->etag,
+                 encoding >= 0 ? "-" : "", encoding >= 0 ? encoding_name(encoding) : "");
+    }
+
+    // The archive's identity and the entry's mtime stand in for the file's,
+    // so a cached header is re-rendered once a new archive is swapped in.
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_dev = response->archive->dev;
+    st.st_ino = response->archive->ino;
+    st.st_mtim.tv_sec = entry->mtime_sec;
+    st.st_mtim.tv_nsec = entry->mtime_nsec;
+    st.st_size = (off_t) entry->len[encoding + 1];
+
+    response_spec spec = { status, path, encoding, policy, archive_type(response->archive, entry),
+                           status == HTTP_OK ? etag : NULL, NULL };
+    response->header = response_cache_get(&spec, -1, &st, &response->cache_hit);
+    response->archive_offset = (off_t) entry->offset[encoding + 1];
+    response->archive_len = (off_t) entry->len[encoding + 1];
+    response->request_path = strdup(path);
+    return status == HTTP_OK ? 1 : 0;
+}
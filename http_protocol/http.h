@@ -1,7 +1,13 @@
 #ifndef HTTP_H
 #define HTTP_H
 
+#include "archive.h"
+#include "compression.h"
 #include "config.h"
+#include "content_cache.h"
+#include "deadline.h"
+#include "metrics.h"
+#include "response_cache.h"
 
 #include "../libs/str_map.h"
 #include <stdint.h>
@@ -13,7 +19,9 @@
 #define HTTP_OK 200
 #define HTTP_BAD_REQUEST 400
 #define HTTP_NOT_FOUND 404
+#define HTTP_TOO_MANY_REQUESTS 429
 #define HTTP_SERVER_ERROR 500
+#define HTTP_SERVICE_UNAVAILABLE 503
 
 #define MAX_REQUEST_LEN 2048
 #define MAX_HEADER_VALUE_LEN 1024
@@ -23,7 +31,16 @@ typedef struct  {
     int method;
     int response_code;
     char * request_path;
-    str_map * header_fields;
+    int content_fd;
+    response_header * header;
+    content_body body;
+    archive * archive;
+    off_t archive_offset;
+    off_t archive_len;
+    int cache_hit;
+    conn_deadline * deadline;
+    int pace_rate;
+    int egress_rate;
 } http_response;
 
 typedef struct  {
@@ -46,9 +63,12 @@ http_request * parse_request(char * request_text, size_t request_len);
 http_response * build_response(config * conf, http_request * request);
 
 /**
- * Sends an http_response to the socket file descriptor specified by cfd
+ * Sends an http_response to the socket file descriptor specified by cfd.
+ * If the response has a deadline, progress is reported to it after every
+ * write and sending stops once it expires. The body is paced at pace_rate
+ * and a share of egress_rate, if set. Returns the number of bytes sent.
  */
-void send_response(http_response * response, int cfd);
+uint64_t send_response(http_response * response, int cfd);
 
 /**
  * Destroys an http_request and performs any other necessary clean up.
@@ -63,8 +83,23 @@ void http_response_destroy(http_response * response);
 /**
  * High-level interface to handle an http request from a client on socket. This function
  * makes use of parse_request, build_response, and send_response to handle a request
- * from a socket specified by cfd.
+ * from a socket specified by cfd. Reading the header and sending the response are
+ * bounded by the timeouts in conf. Requests for METRICS_STATUS_URI are answered
+ * with the server metrics, and every response is recorded in them. Responses
+ * sent from a file that belong to a configured lane, or from a large file
+ * that is not in the page cache, are handed to that lane of the calling
+ * thread's transfer lanes, which sends them on a duplicate of cfd, so cfd
+ * may be closed as soon as this returns. A full configured lane answers
+ * with a 503. Bodies of at least pace_min_size bytes are paced as conf
+ * sets for their path.
  */
 void http_handle_client(config * conf, int cfd);
 
+/**
+ * Like http_handle_client, for a client the first len bytes of whose
+ * request, at buf, have already been read. The rest of the header, if any,
+ * is read from cfd.
+ */
+void http_handle_request(config * conf, int cfd, const char * buf, size_t len);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "http_date.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DATE_WORDS (HTTP_DATE_SIZE / sizeof(uint64_t) + 1)
+
+static const char day_names[7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char month_names[12][4] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/**
+ * The cached date. seq is odd while the text is being rewritten; readers
+ * retry or fall back to formatting their own copy if it changes under them.
+ * The text is stored as atomic words so copying it is never a data race.
+ */
+static struct {
+    atomic_uint seq;
+    atomic_long second;
+    atomic_flag refreshing;
+    atomic_uint_fast64_t words[DATE_WORDS];
+} cache = { 0, -1, ATOMIC_FLAG_INIT, { 0 } };
+
+static void refresh(time_t now);
+static int read_cached(time_t now, char * out);
+static char * put_two_digits(char * out, int value);
+
+void http_date_now(char * out) {
+    time_t now = time(NULL);
+    if (read_cached(now, out)) return;
+
+    // Only one thread reformats; the others format their own copy rather
+    // than wait for it.
+    if (!atomic_flag_test_and_set_explicit(&cache.refreshing, memory_order_acquire)) {
+        if (atomic_load_explicit(&cache.second, memory_order_relaxed) != (long) now) refresh(now);
+        atomic_flag_clear_explicit(&cache.refreshing, memory_order_release);
+        if (read_cached(now, out)) return;
+    }
+    http_date_format(now, out);
+}
+
+void http_date_format(time_t t, char * out) {
+    struct tm utc;
+    gmtime_r(&t, &utc);
+
+    memcpy(out, day_names[utc.tm_wday], 3);
+    out[3] = ',';
+    out[4] = ' ';
+    char * p = put_two_digits(out + 5, utc.tm_mday);
+    *p++ = ' ';
+    memcpy(p, month_names[utc.tm_mon], 3);
+    p += 3;
+    *p++ = ' ';
+    int year = utc.tm_year + 1900;
+    p = put_two_digits(p, year / 100 % 100);
+    p = put_two_digits(p, year % 100);
+    *p++ = ' ';
+    p = put_two_digits(p, utc.tm_hour);
+    *p++ = ':';
+    p = put_two_digits(p, utc.tm_min);
+    *p++ = ':';
+    p = put_two_digits(p, utc.tm_sec);
+    memcpy(p, " GMT", 5);
+}
+
+static void refresh(time_t now) {
+    union {
+        char text[DATE_WORDS * sizeof(uint64_t)];
+        uint64_t words[DATE_WORDS];
+    } date;
+    memset(&date, 0, sizeof(date));
+    http_date_format(now, date.text);
+
+    unsigned int seq = atomic_load_explicit(&cache.seq, memory_order_relaxed);
+    atomic_store_explicit(&cache.seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (size_t i = 0; i < DATE_WORDS; i++) {
+        atomic_store_explicit(&cache.words[i], date.words[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&cache.second, (long) now, memory_order_relaxed);
+    atomic_store_explicit(&cache.seq, seq + 2, memory_order_release);
+}
+
+// Copies the cached text if it is for the second now and was not being
+// rewritten during the copy. Returns whether it was copied.
+static int read_cached(time_t now, char * out) {
+    unsigned int seq = atomic_load_explicit(&cache.seq, memory_order_acquire);
+    if (seq & 1) return 0;
+    if (atomic_load_explicit(&cache.second, memory_order_relaxed) != (long) now) return 0;
+
+    union {
+        char text[DATE_WORDS * sizeof(uint64_t)];
+        uint64_t words[DATE_WORDS];
+    } date;
+    for (size_t i = 0; i < DATE_WORDS; i++) {
+        date.words[i] = atomic_load_explicit(&cache.words[i], memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&cache.seq, memory_order_relaxed) != seq) return 0;
+
+    memcpy(out, date.text, HTTP_DATE_SIZE);
+    return 1;
+}
+
+static char * put_two_digits(char * out, int value) {
+    out[0] = (char) ('0' + value / 10);
+    out[1] = (char) ('0' + value % 10);
+    return out + 2;
+}
@@ -0,0 +1,29 @@
+#ifndef HTTP_DATE_H
+#define HTTP_DATE_H
+
+#include <time.h>
+
+/**
+ * Length of an IMF-fixdate such as "Sun, 06 Nov 1994 08:49:37 GMT" and the
+ * size of a buffer that holds one with its terminator.
+ */
+#define HTTP_DATE_LEN 29
+#define HTTP_DATE_SIZE (HTTP_DATE_LEN + 1)
+
+/**
+ * Copies the current time as an RFC 7231 IMF-fixdate into out, which must
+ * hold HTTP_DATE_SIZE bytes.
+ *
+ * The string is formatted at most once per second per process. The first
+ * thread to see a new second reformats it and publishes it through a
+ * seqlock; every other thread only copies it, without taking a lock.
+ */
+void http_date_now(char * out);
+
+/**
+ * Formats t as an IMF-fixdate into out, which must hold HTTP_DATE_SIZE
+ * bytes. Does not depend on the locale.
+ */
+void http_date_format(time_t t, char * out);
+
+#endif
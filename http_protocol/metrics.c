@@ -0,0 +1,296 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <dc/stdlib.h>
+
+static const int status_codes[] = METRICS_STATUS_CODES;
+
+static _Thread_local metrics_block * current_block;
+static _Thread_local metrics_worker * current_worker;
+
+typedef struct {
+    uint64_t requests;
+    uint64_t bytes_sent;
+    uint64_t timeouts;
+    uint64_t status[METRICS_NUM_STATUS];
+    histogram * latency_us;
+} metrics_totals;
+
+static int status_index(int status_code);
+static void add_relaxed(atomic_uint_fast64_t * counter, uint64_t amount);
+static uint64_t load_relaxed(atomic_uint_fast64_t * counter);
+static void aggregate(metrics_block * block, metrics_totals * totals);
+static metrics_lane * get_lane(int lane);
+static void format_text(FILE * out, metrics_block * block, metrics_totals * totals);
+static void format_json(FILE * out, metrics_block * block, metrics_totals * totals);
+
+size_t metrics_size(int max_workers) {
+    size_t size = sizeof(metrics_block) + (size_t) max_workers * sizeof(metrics_worker);
+    return (size + METRICS_CACHE_LINE - 1) & ~(size_t) (METRICS_CACHE_LINE - 1);
+}
+
+metrics_block * metrics_create(int max_workers) {
+    metrics_block * block = aligned_alloc(METRICS_CACHE_LINE, metrics_size(max_workers));
+    if (block == NULL) {
+        perror("aligned_alloc()");
+        exit(EXIT_FAILURE);
+    }
+    metrics_init(block, max_workers);
+    return block;
+}
+
+void metrics_destroy(metrics_block * block) {
+    if (current_block == block) {
+        current_block = NULL;
+        current_worker = NULL;
+    }
+    free(block);
+}
+
+void metrics_init(metrics_block * block, int max_workers) {
+    memset(block, 0, metrics_size(max_workers));
+    block->max_workers = max_workers;
+    block->started_us = metrics_now_us();
+}
+
+int metrics_register(metrics_block * block) {
+    int slot = atomic_fetch_add(&block->num_workers, 1);
+    current_block = block;
+    if (slot >= block->max_workers) {
+        current_worker = NULL;
+        fprintf(stderr, "metrics: all %d worker slots are taken, a thread is not counted\n", block->max_workers);
+        return -1;
+    }
+    current_worker = &block->workers[slot];
+    return 0;
+}
+
+uint64_t metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void metrics_record_response(int status_code, uint64_t bytes_sent, uint64_t started_us) {
+    metrics_worker * worker = current_worker;
+    if (worker == NULL) return;
+
+    uint64_t now = metrics_now_us();
+    add_relaxed(&worker->requests, 1);
+    add_relaxed(&worker->bytes_sent, bytes_sent);
+    add_relaxed(&worker->status[status_index(status_code)], 1);
+    hist_record(&worker->latency_us, now > started_us ? now - started_us : 0);
+}
+
+void metrics_record_timeout(void) {
+    if (current_worker == NULL) return;
+    add_relaxed(&current_worker->timeouts, 1);
+}
+
+void metrics_define_lane(int lane, const char * name) {
+    metrics_lane * l = get_lane(lane);
+    if (l == NULL) return;
+
+    snprintf(l->name, sizeof(l->name), "%s", name);
+    int num_lanes = atomic_load(&current_block->num_lanes);
+    while (num_lanes <= lane && !atomic_compare_exchange_weak(&current_block->num_lanes, &num_lanes, lane + 1));
+}
+
+int metrics_lane_enter(int lane, int limit) {
+    metrics_lane * l = get_lane(lane);
+    if (l == NULL) return 1;
+
+    int in_flight = atomic_load_explicit(&l->in_flight, memory_order_relaxed);
+    do {
+        if (limit > 0 && in_flight >= limit) {
+            atomic_fetch_add_explicit(&l->overflowed, 1, memory_order_relaxed);
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&l->in_flight, &in_flight, in_flight + 1,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    atomic_fetch_add_explicit(&l->queued, 1, memory_order_relaxed);
+    return 1;
+}
+
+void metrics_lane_cancel(int lane) {
+    metrics_lane * l = get_lane(lane);
+    if (l == NULL) return;
+    atomic_fetch_sub_explicit(&l->in_flight, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&l->queued, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&l->overflowed, 1, memory_order_relaxed);
+}
+
+void metrics_lane_started(int lane, uint64_t wait_us) {
+    metrics_lane * l = get_lane(lane);
+    if (l == NULL) return;
+    atomic_fetch_sub_explicit(&l->queued, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&l->active, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&l->wait_us, wait_us, memory_order_relaxed);
+}
+
+void metrics_lane_finished(int lane, uint64_t bytes_sent, uint64_t send_us) {
+    metrics_lane * l = get_lane(lane);
+    if (l == NULL) return;
+    atomic_fetch_sub_explicit(&l->active, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&l->in_flight, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&l->requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&l->bytes_sent, bytes_sent, memory_order_relaxed);
+    atomic_fetch_add_explicit(&l->send_us, send_us, memory_order_relaxed);
+}
+
+int metrics_is_status_uri(const char * request_uri) {
+    if (request_uri == NULL) return 0;
+
+    size_t len = strlen(METRICS_STATUS_URI);
+    if (strncmp(request_uri, METRICS_STATUS_URI, len) != 0) return 0;
+    return request_uri[len] == '\0' || request_uri[len] == '?';
+}
+
+char * metrics_format_status(const char * request_uri, size_t * len, const char ** content_type) {
+    metrics_block * block = current_block;
+    int json = strstr(request_uri, "json") != NULL;
+
+    char * body = NULL;
+    size_t body_len = 0;
+    FILE * out = open_memstream(&body, &body_len);
+
+    if (block != NULL) {
+        metrics_totals totals;
+        memset(&totals, 0, sizeof(totals));
+        totals.latency_us = dc_malloc(sizeof(histogram));
+        hist_reset(totals.latency_us);
+
+        aggregate(block, &totals);
+        if (json) {
+            format_json(out, block, &totals);
+        } else {
+            format_text(out, block, &totals);
+        }
+        free(totals.latency_us);
+    }
+    fclose(out);
+
+    *len = body_len;
+    *content_type = json ? "application/json" : "text/plain";
+    return body;
+}
+
+static int status_index(int status_code) {
+    for (int i = 0; i < METRICS_NUM_STATUS - 1; i++) {
+        if (status_codes[i] == status_code) return i;
+    }
+    return METRICS_NUM_STATUS - 1;
+}
+
+static void add_relaxed(atomic_uint_fast64_t * counter, uint64_t amount) {
+    atomic_store_explicit(counter, load_relaxed(counter) + amount, memory_order_relaxed);
+}
+
+static uint64_t load_relaxed(atomic_uint_fast64_t * counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void aggregate(metrics_block * block, metrics_totals * totals) {
+    int num_workers = atomic_load(&block->num_workers);
+    if (num_workers > block->max_workers) num_workers = block->max_workers;
+
+    for (int i = 0; i < num_workers; i++) {
+        metrics_worker * worker = &block->workers[i];
+        totals->requests += load_relaxed(&worker->requests);
+        totals->bytes_sent += load_relaxed(&worker->bytes_sent);
+        totals->timeouts += load_relaxed(&worker->timeouts);
+        for (int s = 0; s < METRICS_NUM_STATUS; s++) {
+            totals->status[s] += load_relaxed(&worker->status[s]);
+        }
+        hist_merge(totals->latency_us, &worker->latency_us);
+    }
+}
+
+static metrics_lane * get_lane(int lane) {
+    if (current_block == NULL || lane < 0 || lane >= METRICS_MAX_LANES) return NULL;
+    return &current_block->lanes[lane];
+}
+
+static void format_text(FILE * out, metrics_block * block, metrics_totals * totals) {
+    int num_workers = atomic_load(&block->num_workers);
+    if (num_workers > block->max_workers) num_workers = block->max_workers;
+
+    fprintf(out, "uptime_seconds: %lu\n", (unsigned long) ((metrics_now_us() - block->started_us) / 1000000));
+    fprintf(out, "workers: %d\n", num_workers);
+    fprintf(out, "requests: %lu\n", (unsigned long) totals->requests);
+    fprintf(out, "bytes_sent: %lu\n", (unsigned long) totals->bytes_sent);
+    fprintf(out, "timeouts: %lu\n", (unsigned long) totals->timeouts);
+    for (int s = 0; s < METRICS_NUM_STATUS - 1; s++) {
+        fprintf(out, "status_%d: %lu\n", status_codes[s], (unsigned long) totals->status[s]);
+    }
+    fprintf(out, "status_other: %lu\n", (unsigned long) totals->status[METRICS_NUM_STATUS - 1]);
+    fprintf(out, "latency_us_mean: %.1f\n", hist_mean(totals->latency_us));
+    fprintf(out, "latency_us_p50: %lu\n", (unsigned long) hist_percentile(totals->latency_us, 50));
+    fprintf(out, "latency_us_p90: %lu\n", (unsigned long) hist_percentile(totals->latency_us, 90));
+    fprintf(out, "latency_us_p99: %lu\n", (unsigned long) hist_percentile(totals->latency_us, 99));
+    fprintf(out, "latency_us_p999: %lu\n", (unsigned long) hist_percentile(totals->latency_us, 99.9));
+    fprintf(out, "latency_us_max: %lu\n", (unsigned long) hist_max(totals->latency_us));
+    for (int i = 0; i < atomic_load(&block->num_lanes); i++) {
+        metrics_lane * lane = &block->lanes[i];
+        uint64_t requests = load_relaxed(&lane->requests);
+        fprintf(out, "lane_%s_queued: %d\n", lane->name, atomic_load(&lane->queued));
+        fprintf(out, "lane_%s_active: %d\n", lane->name, atomic_load(&lane->active));
+        fprintf(out, "lane_%s_requests: %lu\n", lane->name, (unsigned long) requests);
+        fprintf(out, "lane_%s_bytes_sent: %lu\n", lane->name, (unsigned long) load_relaxed(&lane->bytes_sent));
+        fprintf(out, "lane_%s_overflowed: %lu\n", lane->name, (unsigned long) load_relaxed(&lane->overflowed));
+        fprintf(out, "lane_%s_wait_us_mean: %.1f\n", lane->name,
+                requests > 0 ? (double) load_relaxed(&lane->wait_us) / (double) requests : 0.0);
+        fprintf(out, "lane_%s_send_us_mean: %.1f\n", lane->name,
+                requests > 0 ? (double) load_relaxed(&lane->send_us) / (double) requests : 0.0);
+    }
+}
+
+static void format_json(FILE * out, metrics_block * block, metrics_totals * totals) {
+    int num_workers = atomic_load(&block->num_workers);
+    if (num_workers > block->max_workers) num_workers = block->max_workers;
+
+    fprintf(out, "{\"uptime_seconds\":%lu,", (unsigned long) ((metrics_now_us() - block->started_us) / 1000000));
+    fprintf(out, "\"workers\":%d,", num_workers);
+    fprintf(out, "\"requests\":%lu,", (unsigned long) totals->requests);
+    fprintf(out, "\"bytes_sent\":%lu,", (unsigned long) totals->bytes_sent);
+    fprintf(out, "\"timeouts\":%lu,", (unsigned long) totals->timeouts);
+    fprintf(out, "\"status\":{");
+    for (int s = 0; s < METRICS_NUM_STATUS - 1; s++) {
+        fprintf(out, "\"%d\":%lu,", status_codes[s], (unsigned long) totals->status[s]);
+    }
+    fprintf(out, "\"other\":%lu},", (unsigned long) totals->status[METRICS_NUM_STATUS - 1]);
+    fprintf(out, "\"latency_us\":{\"mean\":%.1f,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p999\":%lu,\"max\":%lu},",
+            hist_mean(totals->latency_us),
+            (unsigned long) hist_percentile(totals->latency_us, 50),
+            (unsigned long) hist_percentile(totals->latency_us, 90),
+            (unsigned long) hist_percentile(totals->latency_us, 99),
+            (unsigned long) hist_percentile(totals->latency_us, 99.9),
+            (unsigned long) hist_max(totals->latency_us));
+    fprintf(out, "\"lanes\":[");
+    for (int i = 0; i < atomic_load(&block->num_lanes); i++) {
+        metrics_lane * lane = &block->lanes[i];
+        uint64_t requests = load_relaxed(&lane->requests);
+        fprintf(out, "%s{\"name\":\"%s\",\"queued\":%d,\"active\":%d,\"requests\":%lu,\"bytes_sent\":%lu,"
+                     "\"overflowed\":%lu,\"wait_us_mean\":%.1f,\"send_us_mean\":%.1f}",
+                i > 0 ? "," : "", lane->name, atomic_load(&lane->queued), atomic_load(&lane->active),
+                (unsigned long) requests,
+                (unsigned long) load_relaxed(&lane->bytes_sent),
+                (unsigned long) load_relaxed(&lane->overflowed),
+                requests > 0 ? (double) load_relaxed(&lane->wait_us) / (double) requests : 0.0,
+                requests > 0 ? (double) load_relaxed(&lane->send_us) / (double) requests : 0.0);
+    }
+    fprintf(out, "],");
+    fprintf(out, "\"per_worker\":[");
+    for (int i = 0; i < num_workers; i++) {
+        metrics_worker * worker = &block->workers[i];
+        fprintf(out, "%s{\"requests\":%lu,\"bytes_sent\":%lu,\"p99_us\":%lu}", i > 0 ? "," : "",
+                (unsigned long) load_relaxed(&worker->requests),
+                (unsigned long) load_relaxed(&worker->bytes_sent),
+                (unsigned long) hist_percentile(&worker->latency_us, 99));
+    }
+    fprintf(out, "]}\n");
+}
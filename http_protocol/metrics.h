@@ -0,0 +1,160 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../libs/histogram.h"
+
+#define METRICS_MAX_LANES 8
+#define METRICS_LANE_NAME_LEN 32
+#define METRICS_CACHE_LINE 64
+#define METRICS_STATUS_URI "/server-status"
+
+/**
+ * Status codes counted individually; anything else is counted as other.
+ */
+#define METRICS_STATUS_CODES { 200, 304, 400, 404, 429, 500, 503 }
+#define METRICS_NUM_STATUS 8
+
+/**
+ * Counters owned by a single worker (thread or process). Only the owner
+ * writes them, so updates need no locks or atomic read-modify-writes. Each
+ * worker's counters start on their own cache line so workers never share one.
+ */
+typedef struct {
+    alignas(METRICS_CACHE_LINE) atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t bytes_sent;
+    atomic_uint_fast64_t timeouts;
+    atomic_uint_fast64_t status[METRICS_NUM_STATUS];
+    histogram latency_us;
+} metrics_worker;
+
+/**
+ * Counters for one transfer lane. Every worker that hands responses to the
+ * lane and every thread of it updates them, so they are updated with
+ * atomic read-modify-writes. queued and active are the responses now
+ * waiting for and being sent by the lane's threads, and in_flight their
+ * sum, which bounds the lane across every process of the pool; wait_us and
+ * send_us add up how long finished ones waited and took to send.
+ * overflowed counts responses the lane had no room for.
+ */
+typedef struct {
+    alignas(METRICS_CACHE_LINE) char name[METRICS_LANE_NAME_LEN];
+    atomic_int in_flight;
+    atomic_int queued;
+    atomic_int active;
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t bytes_sent;
+    atomic_uint_fast64_t overflowed;
+    atomic_uint_fast64_t wait_us;
+    atomic_uint_fast64_t send_us;
+} metrics_lane;
+
+/**
+ * Counters for every worker of a pool, with room for max_workers of them.
+ * In process mode the block lives in the pool's shared memory so any worker
+ * can report on all of them.
+ */
+typedef struct {
+    atomic_int num_workers;
+    int max_workers;
+    uint64_t started_us;
+    atomic_int num_lanes;
+    metrics_lane lanes[METRICS_MAX_LANES];
+    metrics_worker workers[];
+} metrics_block;
+
+/**
+ * Returns the size of a block with room for max_workers workers.
+ */
+size_t metrics_size(int max_workers);
+
+/**
+ * Allocates a zeroed, cache-line aligned metrics block with room for
+ * max_workers workers.
+ */
+metrics_block * metrics_create(int max_workers);
+
+/**
+ * Frees a block allocated by metrics_create.
+ */
+void metrics_destroy(metrics_block * block);
+
+/**
+ * Resets a block of metrics_size(max_workers) bytes in place, e.g. one
+ * placed in shared memory.
+ */
+void metrics_init(metrics_block * block, int max_workers);
+
+/**
+ * Claims the next worker slot in block for the calling thread. Every later
+ * metrics_record_* call on this thread updates that slot. If every slot is
+ * taken, the thread is left without one and its responses are not counted,
+ * since sharing a slot would race on its counters. Returns 0, or -1 if
+ * there was no slot left.
+ */
+int metrics_register(metrics_block * block);
+
+/**
+ * Returns the current CLOCK_MONOTONIC time in microseconds.
+ */
+uint64_t metrics_now_us(void);
+
+/**
+ * Records a finished response for the calling thread's worker.
+ * started_us is the metrics_now_us value taken when handling began.
+ */
+void metrics_record_response(int status_code, uint64_t bytes_sent, uint64_t started_us);
+
+/**
+ * Records a connection dropped because a deadline expired.
+ */
+void metrics_record_timeout(void);
+
+/**
+ * Names lane number lane, below METRICS_MAX_LANES, in the calling thread's
+ * block. Every process of a pool names its lanes alike.
+ */
+void metrics_define_lane(int lane, const char * name);
+
+/**
+ * Takes a place in a lane for a response about to be queued, unless limit
+ * responses are already in flight in it (0 for no limit). Returns 1 if it
+ * was taken, or 0, counting the response as overflowed, if not.
+ */
+int metrics_lane_enter(int lane, int limit);
+
+/**
+ * Gives back a place taken by metrics_lane_enter for a response that did
+ * not fit in the process's queue after all, counting it as overflowed.
+ */
+void metrics_lane_cancel(int lane);
+
+/**
+ * Records a lane's thread taking a response that waited wait_us.
+ */
+void metrics_lane_started(int lane, uint64_t wait_us);
+
+/**
+ * Records a lane's thread finishing a response of bytes_sent bytes that
+ * took send_us to send.
+ */
+void metrics_lane_finished(int lane, uint64_t bytes_sent, uint64_t send_us);
+
+/**
+ * Returns whether the request URI addresses the status endpoint.
+ */
+int metrics_is_status_uri(const char * request_uri);
+
+/**
+ * Aggregates every worker in the block the calling thread is registered with
+ * into a status page, returned in a new heap buffer of *len bytes. The page
+ * is JSON if the URI asks for it (e.g. /server-status?json), plain text
+ * otherwise, and *content_type is set to match.
+ */
+char * metrics_format_status(const char * request_uri, size_t * len, const char ** content_type);
+
+#endif
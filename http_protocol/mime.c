@@ -0,0 +1,71 @@
+#include "mime.h"
+
+#include <string.h>
+
+#define MIME_SLOTS 64
+#define MIME_EXTENSION_MAX 5
+
+// The table is indexed by MIME_HASH, which was chosen so that no two
+// extensions below share a slot. Adding an extension means checking that
+// its slot is free and picking new constants if it is not.
+#define MIME_HASH(e, len) (((len) * 26 + (e)[0] + (e)[1] + (e)[(len) - 1] * 24) % MIME_SLOTS)
+
+static const mime_entry table[MIME_SLOTS] = {
+        [1] = { "otf", "font/otf", 1 },
+        [2] = { "ico", "image/vnd.microsoft.icon", 1 },
+        [4] = { "webp", "image/webp", 0 },
+        [5] = { "gz", "application/gzip", 0 },
+        [6] = { "ttf", "font/ttf", 1 },
+        [11] = { "mp4", "video/mp4", 0 },
+        [12] = { "ogg", "audio/ogg", 0 },
+        [15] = { "avif", "image/avif", 0 },
+        [16] = { "jpg", "image/jpeg", 0 },
+        [19] = { "xml", "application/xml", 1 },
+        [20] = { "png", "image/png", 0 },
+        [21] = { "json", "application/json", 1 },
+        [24] = { "woff2", "font/woff2", 0 },
+        [25] = { "js", "text/javascript; charset=utf-8", 1 },
+        [26] = { "txt", "text/plain; charset=utf-8", 1 },
+        [28] = { "map", "application/json", 1 },
+        [29] = { "bmp", "image/bmp", 1 },
+        [30] = { "woff", "font/woff", 0 },
+        [31] = { "svg", "image/svg+xml", 1 },
+        [34] = { "htm", "text/html; charset=utf-8", 1 },
+        [36] = { "html", "text/html; charset=utf-8", 1 },
+        [37] = { "md", "text/markdown; charset=utf-8", 1 },
+        [42] = { "jpeg", "image/jpeg", 0 },
+        [44] = { "css", "text/css; charset=utf-8", 1 },
+        [45] = { "mjs", "text/javascript; charset=utf-8", 1 },
+        [46] = { "gif", "image/gif", 0 },
+        [49] = { "zip", "application/zip", 0 },
+        [50] = { "pdf", "application/pdf", 0 },
+        [51] = { "mp3", "audio/mpeg", 0 },
+        [52] = { "csv", "text/csv; charset=utf-8", 1 },
+        [54] = { "wav", "audio/wav", 1 },
+        [56] = { "wasm", "application/wasm", 1 },
+        [60] = { "webm", "video/webm", 0 },
+};
+
+const mime_entry * mime_lookup(const char * path, size_t len) {
+    size_t start = len;
+    while (start > 0 && path[start - 1] != '.' && path[start - 1] != '/') start--;
+    if (start == 0 || path[start - 1] != '.') return NULL;
+
+    size_t ext_len = len - start;
+    if (ext_len == 0 || ext_len > MIME_EXTENSION_MAX) return NULL;
+
+    unsigned char ext[MIME_EXTENSION_MAX + 1] = { 0 };
+    for (size_t i = 0; i < ext_len; i++) {
+        unsigned char c = (unsigned char) path[start + i];
+        ext[i] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+
+    const mime_entry * entry = &table[MIME_HASH(ext, ext_len)];
+    if (entry->extension == NULL || strcmp(entry->extension, (const char *) ext) != 0) return NULL;
+    return entry;
+}
+
+const char * mime_type(const char * path, size_t len) {
+    const mime_entry * entry = mime_lookup(path, len);
+    return entry != NULL ? entry->type : MIME_DEFAULT_TYPE;
+}
@@ -0,0 +1,31 @@
+#ifndef MIME_H
+#define MIME_H
+
+#include <stddef.h>
+
+#define MIME_DEFAULT_TYPE "application/octet-stream"
+
+/**
+ * A known file extension, without the dot, and what is served for it.
+ */
+typedef struct {
+    const char * extension;
+    const char * type;
+    int compressible;
+} mime_entry;
+
+/**
+ * Returns the entry for the extension of the first len bytes of path,
+ * matched case-insensitively, or NULL if the extension is unknown. The
+ * table is fixed at compile time and hashed perfectly, so a lookup is one
+ * hash and one string compare.
+ */
+const mime_entry * mime_lookup(const char * path, size_t len);
+
+/**
+ * Returns the Content-Type for the first len bytes of path, or
+ * MIME_DEFAULT_TYPE if its extension is unknown.
+ */
+const char * mime_type(const char * path, size_t len);
+
+#endif
@@ -0,0 +1,273 @@
+#define _XOPEN_SOURCE 700
+#include "negative_cache.h"
+
+#include <errno.h>
+#include <ftw.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <dc/pthread.h>
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE | \
+                    IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define POLL_INTERVAL_MS 100
+#define EVENT_BUFFER_LEN 4096
+#define MAX_OPEN_DIRS 16
+
+/**
+ * Misses remembered in this process, in a direct-mapped table. An entry is
+ * only valid while its generation is the block's current one, so a change
+ * under the root never has to touch the table. The not found response is
+ * kept here too, with the generation it was read in and the root directory
+ * and page it was read from.
+ */
+static struct {
+    pthread_rwlock_t lock;
+    response_header * not_found;
+    uint64_t not_found_generation;
+    char not_found_root[PATH_MAX];
+    char not_found_path[NEGATIVE_CACHE_PATH_LEN];
+    struct {
+        uint64_t generation;
+        char path[NEGATIVE_CACHE_PATH_LEN];
+    } slots[NEGATIVE_CACHE_SLOTS];
+} table = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+
+/**
+ * The inotify watcher of this process. paths maps watch descriptors to the
+ * directory they watch, to find the full path of new subdirectories.
+ */
+static struct {
+    negative_cache_block * block;
+    pthread_t thread;
+    atomic_bool running;
+    int fd;
+    char ** paths;
+    int num_paths;
+} watcher = { .fd = -1 };
+
+static _Thread_local negative_cache_block * current_block;
+
+static void * watcher_loop(void * arg);
+static int watch_tree(const char * dir);
+static int add_watch(const char * path, const struct stat * st, int type, struct FTW * ftw);
+static void release_watches(void);
+static int is_watched_root(const char * root_dir);
+static unsigned int hash_path(const char * path);
+
+negative_cache_block * negative_cache_create(void) {
+    negative_cache_block * block = malloc(sizeof(negative_cache_block));
+    if (block == NULL) {
+        perror("malloc()");
+        exit(EXIT_FAILURE);
+    }
+    negative_cache_init(block);
+    return block;
+}
+
+void negative_cache_destroy(negative_cache_block * block) {
+    if (current_block == block) current_block = NULL;
+    free(block);
+}
+
+void negative_cache_init(negative_cache_block * block) {
+    atomic_init(&block->generation, 1);
+    atomic_init(&block->watching, false);
+    block->root_dir[0] = '\0';
+}
+
+void negative_cache_register(negative_cache_block * block) {
+    current_block = block;
+}
+
+void negative_cache_start(negative_cache_block * block, config * conf) {
+    if (atomic_load(&watcher.running)) return;
+    if (strlen(conf->root_dir) >= PATH_MAX) return;
+
+    watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher.fd == -1) {
+        perror("inotify_init1()");
+        return;
+    }
+    if (watch_tree(conf->root_dir) == -1) {
+        fprintf(stderr, "negative cache: cannot watch %s, disabled\n", conf->root_dir);
+        release_watches();
+        return;
+    }
+
+    watcher.block = block;
+    strcpy(block->root_dir, conf->root_dir);
+    atomic_fetch_add(&block->generation, 1);
+    atomic_store(&block->watching, true);
+    atomic_store(&watcher.running, true);
+    dc_pthread_create(&watcher.thread, NULL, watcher_loop, NULL);
+}
+
+void negative_cache_stop(negative_cache_block * block) {
+    if (!atomic_load(&watcher.running) || watcher.block != block) return;
+
+    atomic_store(&block->watching, false);
+    atomic_store(&watcher.running, false);
+    dc_pthread_join(watcher.thread, NULL);
+    release_watches();
+    watcher.block = NULL;
+}
+
+uint64_t negative_cache_generation(void) {
+    if (current_block == NULL) return 0;
+    return atomic_load_explicit(&current_block->generation, memory_order_acquire);
+}
+
+int negative_cache_contains(const char * root_dir, const char * path) {
+    if (!is_watched_root(root_dir)) return 0;
+
+    uint64_t generation = atomic_load_explicit(&current_block->generation, memory_order_acquire);
+    unsigned int slot = hash_path(path) % NEGATIVE_CACHE_SLOTS;
+
+    pthread_rwlock_rdlock(&table.lock);
+    int found = table.slots[slot].generation == generation && strcmp(table.slots[slot].path, path) == 0;
+    pthread_rwlock_unlock(&table.lock);
+    return found;
+}
+
+void negative_cache_insert(const char * root_dir, const char * path, uint64_t generation) {
+    if (!is_watched_root(root_dir)) return;
+    if (strlen(path) >= NEGATIVE_CACHE_PATH_LEN) return;
+
+    unsigned int slot = hash_path(path) % NEGATIVE_CACHE_SLOTS;
+
+    pthread_rwlock_wrlock(&table.lock);
+    if (generation == atomic_load_explicit(&current_block->generation, memory_order_acquire)) {
+        strcpy(table.slots[slot].path, path);
+        table.slots[slot].generation = generation;
+    }
+    pthread_rwlock_unlock(&table.lock);
+}
+
+response_header * negative_cache_not_found(const char * root_dir, const char * path) {
+    if (!is_watched_root(root_dir)) return NULL;
+
+    uint64_t generation = atomic_load_explicit(&current_block->generation, memory_order_acquire);
+    response_header * not_found = NULL;
+
+    pthread_rwlock_rdlock(&table.lock);
+    if (table.not_found != NULL && table.not_found_generation == generation &&
+        strcmp(table.not_found_root, root_dir) == 0 && strcmp(table.not_found_path, path) == 0) {
+        not_found = table.not_found;
+        response_header_retain(not_found);
+    }
+    pthread_rwlock_unlock(&table.lock);
+    return not_found;
+}
+
+void negative_cache_set_not_found(const char * root_dir, const char * path, response_header * not_found,
+                                  uint64_t generation) {
+    if (!is_watched_root(root_dir)) return;
+    if (strlen(root_dir) >= PATH_MAX || strlen(path) >= NEGATIVE_CACHE_PATH_LEN) return;
+    if (not_found->body_len != (size_t) not_found->size) return;
+
+    response_header * replaced = NULL;
+
+    pthread_rwlock_wrlock(&table.lock);
+    if (generation == atomic_load_explicit(&current_block->generation, memory_order_acquire)) {
+        if (table.not_found != not_found) {
+            replaced = table.not_found;
+            response_header_retain(not_found);
+            table.not_found = not_found;
+        }
+        table.not_found_generation = generation;
+        strcpy(table.not_found_root, root_dir);
+        strcpy(table.not_found_path, path);
+    }
+    pthread_rwlock_unlock(&table.lock);
+
+    response_header_release(replaced);
+}
+
+// Bumps the generation on every batch of events. New directories are
+// watched as they appear; if one cannot be, or events were lost, the cache
+// is disabled rather than risk serving stale misses.
+static void * watcher_loop(void * arg) {
+    (void) arg;
+    negative_cache_block * block = watcher.block;
+    alignas(struct inotify_event) char buffer[EVENT_BUFFER_LEN];
+    struct pollfd pfd = { .fd = watcher.fd, .events = POLLIN };
+
+    while (atomic_load(&watcher.running)) {
+        if (poll(&pfd, 1, POLL_INTERVAL_MS) <= 0) continue;
+
+        ssize_t num_read;
+        while ((num_read = read(watcher.fd, buffer, sizeof(buffer))) > 0) {
+            for (char * p = buffer; p < buffer + num_read; ) {
+                struct inotify_event * event = (struct inotify_event *) p;
+                p += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    atomic_store(&block->watching, false);
+                } else if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+                           event->wd < watcher.num_paths && watcher.paths[event->wd] != NULL) {
+                    char dir[PATH_MAX];
+                    snprintf(dir, sizeof(dir), "%s/%s", watcher.paths[event->wd], event->name);
+                    if (watch_tree(dir) == -1 && errno != ENOENT) atomic_store(&block->watching, false);
+                }
+            }
+            atomic_fetch_add_explicit(&block->generation, 1, memory_order_release);
+        }
+    }
+    return NULL;
+}
+
+static int watch_tree(const char * dir) {
+    return nftw(dir, add_watch, MAX_OPEN_DIRS, FTW_PHYS);
+}
+
+static int add_watch(const char * path, const struct stat * st, int type, struct FTW * ftw) {
+    (void) st;
+    (void) ftw;
+    if (type == FTW_DNR) return -1;
+    if (type != FTW_D) return 0;
+
+    int wd = inotify_add_watch(watcher.fd, path, WATCH_MASK);
+    if (wd == -1) return -1;
+
+    if (wd >= watcher.num_paths) {
+        int num_paths = wd * 2 + 16;
+        char ** paths = realloc(watcher.paths, num_paths * sizeof(char *));
+        if (paths == NULL) return -1;
+        memset(paths + watcher.num_paths, 0, (num_paths - watcher.num_paths) * sizeof(char *));
+        watcher.paths = paths;
+        watcher.num_paths = num_paths;
+    }
+    free(watcher.paths[wd]);
+    watcher.paths[wd] = strdup(path);
+    return 0;
+}
+
+static void release_watches(void) {
+    close(watcher.fd);
+    watcher.fd = -1;
+    for (int i = 0; i < watcher.num_paths; i++) free(watcher.paths[i]);
+    free(watcher.paths);
+    watcher.paths = NULL;
+    watcher.num_paths = 0;
+}
+
+static int is_watched_root(const char * root_dir) {
+    return current_block != NULL &&
+           atomic_load_explicit(&current_block->watching, memory_order_relaxed) &&
+           strcmp(current_block->root_dir, root_dir) == 0;
+}
+
+static unsigned int hash_path(const char * path) {
+    unsigned int hash = 2166136261u;
+    for (const char * c = path; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char) *c) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,97 @@
+#ifndef NEGATIVE_CACHE_H
+#define NEGATIVE_CACHE_H
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "response_cache.h"
+
+#define NEGATIVE_CACHE_SLOTS 4096
+#define NEGATIVE_CACHE_PATH_LEN 128
+
+/**
+ * Invalidation state of the negative cache for a pool. An inotify thread
+ * in the accepting process watches every directory under root_dir and
+ * bumps generation on any change, which invalidates every cached miss at
+ * once. In process mode the block lives in the pool's shared memory, since
+ * the watcher thread is not inherited by forked workers.
+ */
+typedef struct {
+    atomic_uint_fast64_t generation;
+    atomic_bool watching;
+    char root_dir[PATH_MAX];
+} negative_cache_block;
+
+/**
+ * Allocates a block with watching disabled.
+ */
+negative_cache_block * negative_cache_create(void);
+
+/**
+ * Frees a block allocated by negative_cache_create.
+ */
+void negative_cache_destroy(negative_cache_block * block);
+
+/**
+ * Resets a block in place, e.g. one placed in shared memory.
+ */
+void negative_cache_init(negative_cache_block * block);
+
+/**
+ * Makes block the one the calling thread's lookups and inserts check.
+ */
+void negative_cache_register(negative_cache_block * block);
+
+/**
+ * Starts watching conf->root_dir in the calling process. If the tree
+ * cannot be watched completely (e.g. the inotify watch limit is reached)
+ * the cache stays disabled.
+ */
+void negative_cache_start(negative_cache_block * block, config * conf);
+
+/**
+ * Stops the watcher thread and disables the cache.
+ */
+void negative_cache_stop(negative_cache_block * block);
+
+/**
+ * Returns the current generation, to be taken before looking a path up on
+ * disk and passed to negative_cache_insert if the lookup misses.
+ */
+uint64_t negative_cache_generation(void);
+
+/**
+ * Returns whether path, a normalized path relative to root_dir, was
+ * missing and nothing under root_dir has changed since. Always 0 if
+ * root_dir is not the watched directory.
+ */
+int negative_cache_contains(const char * root_dir, const char * path);
+
+/**
+ * Remembers that path was missing. Ignored if anything changed since
+ * generation was taken.
+ */
+void negative_cache_insert(const char * root_dir, const char * path, uint64_t generation);
+
+/**
+ * Returns the 404 response remembered by negative_cache_set_not_found for
+ * the not found page at path, normalized and relative to root_dir, if
+ * nothing has changed since, with the page in memory. It must be released
+ * with response_header_release. Returns NULL otherwise, e.g. once the
+ * configured root_dir or not found page is another one.
+ */
+response_header * negative_cache_not_found(const char * root_dir, const char * path);
+
+/**
+ * Remembers the 404 response, read from the not found page at path under
+ * root_dir when generation was taken, for negative_cache_not_found. Ignored
+ * if not_found does not carry its body in memory or anything changed since
+ * generation was taken.
+ */
+void negative_cache_set_not_found(const char * root_dir, const char * path, response_header * not_found,
+                                  uint64_t generation);
+
+#endif
@@ -0,0 +1,109 @@
+#include "pacing.h"
+
+#include <limits.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define NS_PER_SEC 1000000000ULL
+
+static _Thread_local egress_control * current_egress;
+
+static uint64_t now_ns(void);
+static uint64_t effective_rate(pacer * p);
+static void refill(pacer * p, uint64_t burst);
+static int set_kernel_rate(int cfd, uint64_t rate);
+
+void egress_init(egress_control * egress) {
+    atomic_store(&egress->active, 0);
+}
+
+void pacing_register(egress_control * egress) {
+    current_egress = egress;
+}
+
+void pacer_begin(pacer * p, int cfd, uint64_t rate, uint64_t egress_rate) {
+    p->cfd = cfd;
+    p->rate = rate;
+    p->egress_rate = egress_rate;
+    p->egress = egress_rate > 0 ? current_egress : NULL;
+    if (p->egress != NULL) atomic_fetch_add_explicit(&p->egress->active, 1, memory_order_relaxed);
+
+    p->current = effective_rate(p);
+    p->kernel = p->current > 0 && set_kernel_rate(cfd, p->current);
+    p->tokens = PACING_MIN_BURST;
+    p->refilled_ns = now_ns();
+}
+
+size_t pacer_allow(pacer * p, size_t len) {
+    if (p->rate == 0 && p->egress == NULL) return len;
+
+    uint64_t rate = effective_rate(p);
+    if (rate != p->current && p->kernel) p->kernel = set_kernel_rate(p->cfd, rate);
+    p->current = rate;
+    if (p->kernel) return len;
+
+    uint64_t burst = rate * PACING_BURST_MS / 1000;
+    if (burst < PACING_MIN_BURST) burst = PACING_MIN_BURST;
+    size_t allowed = len < burst ? len : (size_t) burst;
+
+    refill(p, burst);
+    if (p->tokens < (int64_t) allowed) {
+        uint64_t wait_ns = (uint64_t) ((int64_t) allowed - p->tokens) * NS_PER_SEC / rate;
+        struct timespec wait = {(time_t) (wait_ns / NS_PER_SEC), (long) (wait_ns % NS_PER_SEC)};
+        nanosleep(&wait, NULL);
+        refill(p, burst);
+    }
+    return allowed;
+}
+
+void pacer_sent(pacer * p, size_t len) {
+    if (!p->kernel) p->tokens -= (int64_t) len;
+}
+
+void pacer_end(pacer * p) {
+    if (p->egress != NULL) atomic_fetch_sub_explicit(&p->egress->active, 1, memory_order_relaxed);
+    if (p->kernel) set_kernel_rate(p->cfd, UINT_MAX);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NS_PER_SEC + (uint64_t) ts.tv_nsec;
+}
+
+// Returns the connection's rate capped at its share of the egress rate, or
+// 0 if neither applies.
+static uint64_t effective_rate(pacer * p) {
+    uint64_t rate = p->rate;
+    if (p->egress == NULL) return rate;
+
+    int active = atomic_load_explicit(&p->egress->active, memory_order_relaxed);
+    uint64_t share = p->egress_rate / (uint64_t) (active > 1 ? active : 1);
+    if (share == 0) share = 1;
+    return rate == 0 || share < rate ? share : rate;
+}
+
+// Adds the tokens earned at the current rate since the last refill, up to
+// burst.
+static void refill(pacer * p, uint64_t burst) {
+    uint64_t now = now_ns();
+    uint64_t elapsed = now - p->refilled_ns;
+    if (elapsed > NS_PER_SEC) elapsed = NS_PER_SEC;
+    p->refilled_ns = now;
+
+    p->tokens += (int64_t) (elapsed * p->current / NS_PER_SEC);
+    if (p->tokens > (int64_t) burst) p->tokens = (int64_t) burst;
+}
+
+// Sets the socket's pacing rate, UINT_MAX for none. Returns whether the
+// kernel took it.
+static int set_kernel_rate(int cfd, uint64_t rate) {
+#ifdef SO_MAX_PACING_RATE
+    unsigned int value = rate < UINT_MAX ? (unsigned int) rate : UINT_MAX;
+    return setsockopt(cfd, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof(value)) == 0;
+#else
+    (void) cfd;
+    (void) rate;
+    return 0;
+#endif
+}
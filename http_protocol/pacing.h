@@ -0,0 +1,73 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PACING_BURST_MS 100
+#define PACING_MIN_BURST 4096
+
+/**
+ * The transfers of a pool paced under the egress cap, which split it evenly
+ * between them. Lock-free, so it can be placed in memory shared between
+ * processes.
+ */
+typedef struct {
+    atomic_int active;
+} egress_control;
+
+/**
+ * Paces the body of one response. The connection's own rate, if any, is
+ * capped at its share of the egress rate, recomputed as transfers come and
+ * go. Where the kernel supports SO_MAX_PACING_RATE the socket is paced by
+ * TCP itself; otherwise the sender waits on a token bucket holding up to
+ * PACING_BURST_MS of the rate.
+ */
+typedef struct {
+    int cfd;
+    uint64_t rate;
+    uint64_t egress_rate;
+    egress_control * egress;
+    uint64_t current;
+    int kernel;
+    int64_t tokens;
+    uint64_t refilled_ns;
+} pacer;
+
+/**
+ * Resets the count of paced transfers.
+ */
+void egress_init(egress_control * egress);
+
+/**
+ * Sets the egress control the calling thread's transfers share. egress may
+ * be NULL, in which case the egress cap does not apply to them.
+ */
+void pacing_register(egress_control * egress);
+
+/**
+ * Starts pacing a body sent on cfd at rate bytes per second, and at no more
+ * than an even share of egress_rate among the calling thread's pool. A rate
+ * of 0 leaves that limit off.
+ */
+void pacer_begin(pacer * p, int cfd, uint64_t rate, uint64_t egress_rate);
+
+/**
+ * Returns how many of the len bytes about to be sent may go now, waiting
+ * first if the token bucket is empty. Never returns 0 for a non-zero len.
+ */
+size_t pacer_allow(pacer * p, size_t len);
+
+/**
+ * Records that len bytes were sent.
+ */
+void pacer_sent(pacer * p, size_t len);
+
+/**
+ * Stops pacing, giving back the transfer's share of the egress rate and
+ * lifting the socket's pacing rate.
+ */
+void pacer_end(pacer * p);
+
+#endif
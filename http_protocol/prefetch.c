@@ -0,0 +1,354 @@
+#include "prefetch.h"
+#include "http.h"
+#include "mime.h"
+#include "resolve.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <dc/pthread.h>
+#include <dc/stdlib.h>
+
+/**
+ * A link waiting for the prefetch thread, and the Accept-Encoding of the
+ * client whose page referenced it.
+ */
+typedef struct {
+    char * path;
+    char * accept_encoding;
+} queued_link;
+
+/**
+ * Direct-mapped table of the pages scanned in this process, kept like the
+ * header cache: each slot holds one reference, and a colliding or changed
+ * page replaces it.
+ */
+static struct {
+    pthread_rwlock_t lock;
+    prefetch_links * slots[PREFETCH_SLOTS];
+} table = { PTHREAD_RWLOCK_INITIALIZER, { NULL } };
+
+/**
+ * The prefetch thread and the ring of links it works through.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_t thread;
+    atomic_bool running;
+    queued_link queue[PREFETCH_QUEUE_LEN];
+    unsigned int head;
+    unsigned int count;
+    config * cmd_cfg;
+    negative_cache_block * negative_cache;
+    content_cache_block * content_cache;
+} service = { .lock = PTHREAD_MUTEX_INITIALIZER, .queued = PTHREAD_COND_INITIALIZER };
+
+static _Thread_local bool prefetching;
+
+static prefetch_links * scan(const char * path, int fd, const struct stat * st);
+static const char * next_reference(const char * c, const char * end, const char ** value, size_t * value_len);
+static int resolve_reference(const char * page, const char * value, size_t value_len, char * out, size_t out_len);
+static int has_link(const prefetch_links * links, const char * path);
+static void add_preload(char * preload, size_t * preload_len, const char * path);
+static const char * preload_destination(const char * path);
+static unsigned int hash_path(const char * path);
+static int is_current(const prefetch_links * links, const char * path, const struct stat * st);
+static void * prefetch_loop(void * arg);
+static void warm_link(const queued_link * link);
+static uint64_t now_ms(void);
+
+prefetch_links * prefetch_scan(const char * path, int fd, const struct stat * st) {
+    if (strncmp(mime_type(path, strlen(path)), "text/html", 9) != 0) return NULL;
+    prefetch_links ** slot = &table.slots[hash_path(path) % PREFETCH_SLOTS];
+
+    pthread_rwlock_rdlock(&table.lock);
+    prefetch_links * links = *slot;
+    if (links != NULL && is_current(links, path, st)) {
+        atomic_fetch_add_explicit(&links->refs, 1, memory_order_relaxed);
+        pthread_rwlock_unlock(&table.lock);
+        return links;
+    }
+    pthread_rwlock_unlock(&table.lock);
+
+    links = scan(path, fd, st);
+    if (links == NULL) return NULL;
+    atomic_store_explicit(&links->refs, 2, memory_order_relaxed);
+
+    pthread_rwlock_wrlock(&table.lock);
+    prefetch_links * replaced = *slot;
+    *slot = links;
+    pthread_rwlock_unlock(&table.lock);
+
+    prefetch_links_release(replaced);
+    return links;
+}
+
+void prefetch_links_release(prefetch_links * links) {
+    if (links == NULL) return;
+    if (atomic_fetch_sub_explicit(&links->refs, 1, memory_order_acq_rel) == 1) {
+        for (int i = 0; i < links->num_links; i++) free(links->links[i]);
+        free(links->preload);
+        free(links->path);
+        free(links);
+    }
+}
+
+void prefetch_queue(prefetch_links * links, const char * accept_encoding) {
+    if (prefetching || links->num_links == 0 || !atomic_load(&service.running)) return;
+
+    // Only the request that moves queued_ms on queues the links.
+    uint64_t now = now_ms();
+    uint_fast64_t queued = atomic_load_explicit(&links->queued_ms, memory_order_relaxed);
+    if (queued != 0 && now - queued < PREFETCH_INTERVAL_MS) return;
+    if (!atomic_compare_exchange_strong(&links->queued_ms, &queued, now)) return;
+
+    pthread_mutex_lock(&service.lock);
+    for (int i = 0; i < links->num_links && service.count < PREFETCH_QUEUE_LEN; i++) {
+        queued_link * link = &service.queue[(service.head + service.count++) % PREFETCH_QUEUE_LEN];
+        link->path = strdup(links->links[i]);
+        link->accept_encoding = accept_encoding != NULL ? strdup(accept_encoding) : NULL;
+    }
+    pthread_cond_signal(&service.queued);
+    pthread_mutex_unlock(&service.lock);
+}
+
+void prefetch_service_start(config * cmd_cfg, negative_cache_block * negative_cache,
+                            content_cache_block * content_cache) {
+    if (atomic_load(&service.running)) return;
+
+    service.cmd_cfg = cmd_cfg;
+    service.negative_cache = negative_cache;
+    service.content_cache = content_cache;
+    atomic_store(&service.running, true);
+    dc_pthread_create(&service.thread, NULL, prefetch_loop, NULL);
+}
+
+void prefetch_service_stop(void) {
+    if (!atomic_load(&service.running)) return;
+
+    pthread_mutex_lock(&service.lock);
+    atomic_store(&service.running, false);
+    pthread_cond_signal(&service.queued);
+    pthread_mutex_unlock(&service.lock);
+    dc_pthread_join(service.thread, NULL);
+
+    for (; service.count > 0; service.count--) {
+        queued_link * link = &service.queue[service.head];
+        service.head = (service.head + 1) % PREFETCH_QUEUE_LEN;
+        free(link->path);
+        free(link->accept_encoding);
+    }
+}
+
+// Collects the distinct links of a page, skipping the page itself, and
+// the preload header for them. Returns NULL if the page cannot be read.
+static prefetch_links * scan(const char * path, int fd, const struct stat * st) {
+    size_t len = st->st_size < PREFETCH_SCAN_MAX ? (size_t) st->st_size : PREFETCH_SCAN_MAX;
+    char * html = dc_malloc(len + 1);
+    ssize_t num_read = pread(fd, html, len, 0);
+    if (num_read == -1) {
+        free(html);
+        return NULL;
+    }
+    html[num_read] = '\0';
+
+    prefetch_links * links = calloc(1, sizeof(prefetch_links));
+    links->path = strdup(path);
+    links->dev = st->st_dev;
+    links->ino = st->st_ino;
+    links->mtime = st->st_mtim;
+    links->size = st->st_size;
+
+    char preload[PREFETCH_PRELOAD_MAX];
+    size_t preload_len = 0;
+    const char * end = html + num_read;
+    const char * value;
+    size_t value_len;
+    for (const char * c = html; links->num_links < PREFETCH_MAX_LINKS &&
+                                (c = next_reference(c, end, &value, &value_len)) != NULL;) {
+        char target[MAX_URI_PATH_LEN];
+        if (resolve_reference(path, value, value_len, target, sizeof(target)) == -1) continue;
+        if (strcmp(target, path) == 0 || has_link(links, target)) continue;
+        links->links[links->num_links++] = strdup(target);
+        add_preload(preload, &preload_len, target);
+    }
+    links->preload = preload_len > 0 ? strdup(preload) : NULL;
+
+    free(html);
+    return links;
+}
+
+// Finds the next src or href attribute from c on and sets value to it,
+// without any quotes. Tags are not parsed, so the attribute name only has
+// to follow whitespace. Returns where to continue, or NULL at the end.
+static const char * next_reference(const char * c, const char * end, const char ** value, size_t * value_len) {
+    for (; c < end; c++) {
+        if (!isspace((unsigned char) *c)) continue;
+
+        const char * name = c + 1;
+        const char * p;
+        if (end - name > 3 && strncasecmp(name, "src", 3) == 0) {
+            p = name + 3;
+        } else if (end - name > 4 && strncasecmp(name, "href", 4) == 0) {
+            p = name + 4;
+        } else {
+            continue;
+        }
+
+        while (p < end && isspace((unsigned char) *p)) p++;
+        if (p == end || *p != '=') continue;
+        p++;
+        while (p < end && isspace((unsigned char) *p)) p++;
+
+        char quote = p < end && (*p == '"' || *p == '\'') ? *p++ : '\0';
+        const char * start = p;
+        while (p < end && (quote != '\0' ? *p != quote : !isspace((unsigned char) *p) && *p != '>')) p++;
+        if (p == end) return NULL;
+
+        *value = start;
+        *value_len = (size_t) (p - start);
+        return p;
+    }
+    return NULL;
+}
+
+// Resolves a reference against the page's directory into a path relative
+// to the root, as resolve_normalize would for a request. Fragments, other
+// hosts and other schemes, such as data: and mailto:, are not followed.
+// Returns -1 if the reference is not followed.
+static int resolve_reference(const char * page, const char * value, size_t value_len, char * out, size_t out_len) {
+    if (value_len == 0 || value[0] == '#' || (value_len > 1 && value[0] == '/' && value[1] == '/')) return -1;
+    for (size_t i = 0; i < value_len && strchr("/?#", value[i]) == NULL; i++) {
+        if (value[i] == ':') return -1;
+    }
+
+    char uri[MAX_URI_PATH_LEN];
+    size_t dir_len = 0;
+    if (value[0] != '/') {
+        const char * slash = strrchr(page, '/');
+        dir_len = slash != NULL ? (size_t) (slash - page) + 1 : 0;
+    }
+    if (1 + dir_len + value_len >= sizeof(uri)) return -1;
+    size_t len = 0;
+    if (value[0] != '/') uri[len++] = '/';
+    memcpy(uri + len, page, dir_len);
+    memcpy(uri + len + dir_len, value, value_len);
+    uri[len + dir_len + value_len] = '\0';
+
+    if (resolve_normalize(uri, out, out_len) == -1 || out[0] == '\0') return -1;
+    return 0;
+}
+
+static int has_link(const prefetch_links * links, const char * path) {
+    for (int i = 0; i < links->num_links; i++) {
+        if (strcmp(links->links[i], path) == 0) return 1;
+    }
+    return 0;
+}
+
+// Appends a preload of path to the header value, if browsers preload its
+// type and it fits.
+static void add_preload(char * preload, size_t * preload_len, const char * path) {
+    const char * destination = preload_destination(path);
+    char uri[MAX_URI_PATH_LEN];
+    if (destination == NULL || resolve_escape(path, uri, sizeof(uri)) == -1) return;
+
+    int len = snprintf(preload + *preload_len, PREFETCH_PRELOAD_MAX - *preload_len, "%s</%s>; rel=preload; as=%s",
+                       *preload_len > 0 ? ", " : "", uri, destination);
+    if (len < 0 || (size_t) len >= PREFETCH_PRELOAD_MAX - *preload_len) {
+        preload[*preload_len] = '\0';
+        return;
+    }
+    *preload_len += (size_t) len;
+}
+
+// Returns the "as" value a preload of path needs, or NULL for types that
+// are not subresources, such as other pages.
+static const char * preload_destination(const char * path) {
+    const char * type = mime_type(path, strlen(path));
+    if (strncmp(type, "image/", 6) == 0) return "image";
+    if (strncmp(type, "text/css", 8) == 0) return "style";
+    if (strncmp(type, "text/javascript", 15) == 0) return "script";
+    if (strncmp(type, "font/", 5) == 0) return "font";
+    return NULL;
+}
+
+static unsigned int hash_path(const char * path) {
+    unsigned int hash = 2166136261u;
+    for (const char * c = path; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char) *c) * 16777619u;
+    }
+    return hash;
+}
+
+static int is_current(const prefetch_links * links, const char * path, const struct stat * st) {
+    return links->ino == st->st_ino &&
+           links->dev == st->st_dev &&
+           links->size == st->st_size &&
+           links->mtime.tv_sec == st->st_mtim.tv_sec &&
+           links->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+           strcmp(links->path, path) == 0;
+}
+
+// Requests each queued link through the same path clients take, which
+// fills the header, content and negative caches and brings the file's
+// pages and dentries into the kernel's caches.
+static void * prefetch_loop(void * arg) {
+    (void) arg;
+    prefetching = true;
+    negative_cache_register(service.negative_cache);
+    content_cache_register(service.content_cache);
+
+    pthread_mutex_lock(&service.lock);
+    for (;;) {
+        while (service.count == 0 && atomic_load(&service.running)) {
+            pthread_cond_wait(&service.queued, &service.lock);
+        }
+        if (!atomic_load(&service.running)) break;
+
+        queued_link link = service.queue[service.head];
+        service.head = (service.head + 1) % PREFETCH_QUEUE_LEN;
+        service.count--;
+        pthread_mutex_unlock(&service.lock);
+
+        warm_link(&link);
+        free(link.path);
+        free(link.accept_encoding);
+        pthread_mutex_lock(&service.lock);
+    }
+    pthread_mutex_unlock(&service.lock);
+    return NULL;
+}
+
+static void warm_link(const queued_link * link) {
+    char uri[MAX_URI_PATH_LEN];
+    if (resolve_escape(link->path, uri, sizeof(uri)) == -1) return;
+
+    char request_text[MAX_REQUEST_LEN];
+    int len = link->accept_encoding == NULL
+            ? snprintf(request_text, sizeof(request_text), "GET /%s HTTP/1.0\r\n\r\n", uri)
+            : snprintf(request_text, sizeof(request_text), "GET /%s HTTP/1.0\r\nAccept-Encoding: %s\r\n\r\n",
+                       uri, link->accept_encoding);
+    if (len < 0 || (size_t) len >= sizeof(request_text)) return;
+
+    config * conf = get_config(service.cmd_cfg);
+    http_request * request = parse_request(request_text, (size_t) len);
+    http_response * response = build_response(conf, request);
+    http_response_destroy(response);
+    http_request_destroy(request);
+    destroy_config(conf);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
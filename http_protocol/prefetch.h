@@ -0,0 +1,79 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "content_cache.h"
+#include "negative_cache.h"
+
+#define PREFETCH_SLOTS 256
+#define PREFETCH_MAX_LINKS 16
+#define PREFETCH_SCAN_MAX 65536
+#define PREFETCH_QUEUE_LEN 256
+#define PREFETCH_INTERVAL_MS 1000
+#define PREFETCH_PRELOAD_MAX 384
+
+/**
+ * The files on this server an HTML page references with src or href, as
+ * paths relative to the root directory, in the order they appear. preload
+ * is the value of a Link header preloading the images, styles, scripts and
+ * fonts among them, or NULL if there are none. A page is scanned once per
+ * version, identified like a cached header, and the result shared by
+ * reference. queued_ms is when the links were last queued for prefetch.
+ */
+typedef struct {
+    atomic_int refs;
+    char * path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    atomic_uint_fast64_t queued_ms;
+    int num_links;
+    char * links[PREFETCH_MAX_LINKS];
+    char * preload;
+} prefetch_links;
+
+/**
+ * Returns the links of the HTML page at path, open as fd and described by
+ * st, scanning the first PREFETCH_SCAN_MAX bytes of it unless this process
+ * already has them for this version of the page. Returns NULL if path is
+ * not an HTML page or cannot be read. The links must be released with
+ * prefetch_links_release.
+ */
+prefetch_links * prefetch_scan(const char * path, int fd, const struct stat * st);
+
+/**
+ * Releases links returned by prefetch_scan. Does nothing if links is NULL.
+ */
+void prefetch_links_release(prefetch_links * links);
+
+/**
+ * Queues the links of a page being served for this process's prefetch
+ * thread, which requests each as a client sending accept_encoding (which
+ * may be NULL) would. A page's links are queued at most once every
+ * PREFETCH_INTERVAL_MS, and any that do not fit in the queue are dropped.
+ * Does nothing if the prefetch thread is not running, or when called from
+ * it, so prefetched pages are not followed in turn.
+ */
+void prefetch_queue(prefetch_links * links, const char * accept_encoding);
+
+/**
+ * Starts the prefetch thread for this process. It loads the config from
+ * cmd_cfg for every file it warms and uses the given negative and content
+ * caches, either of which may be NULL. Like the deadline thread, it must be
+ * started in every process that handles clients.
+ */
+void prefetch_service_start(config * cmd_cfg, negative_cache_block * negative_cache,
+                            content_cache_block * content_cache);
+
+/**
+ * Stops the thread started by prefetch_service_start and drops anything
+ * still queued.
+ */
+void prefetch_service_stop(void);
+
+#endif
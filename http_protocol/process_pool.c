@@ -7,6 +7,17 @@
 #define SHMEM_HAME "/sharedmem"
 #define DC_S_IRUSR 0400
 #define DC_S_IWUSR 0200
+#define SHMEM_ALIGN 4096
+
+/**
+ * What is sent to a worker process with a client fd: when the client was
+ * dispatched and the len bytes of its request already read.
+ */
+typedef struct {
+    uint64_t accepted_us;
+    uint32_t len;
+    char buf[MAX_REQUEST_LEN];
+} client_message;
 
 /**
  * Creates and listens to a domain socket for with the path of SOCKET_PATH.
@@ -14,12 +25,14 @@
  */
 static int worker_bind();
 /**
- * Waits to receive a msg containing the client fd over the passed
- * in socket. Once the msg is received it returns the client fd.
+ * Waits to receive a msg containing the client fd, the time it was
+ * dispatched and its request over the passed in socket. Once the msg is received
+ * it returns the client fd.
  * @param socked_fd
+ * @param message
  * @return client fd
  */
-static int worker_receive();
+static int worker_receive(int socked_fd, client_message * message);
 /**
  * The loop uses semaphores to post that a worker is ready for work then waits until a worker process
  * should be woken. Once woken the worker will exit if mode is not set to process else it binds to a socket
@@ -28,32 +41,76 @@ static int worker_receive();
  * @param pool
  */
 static void worker_loop(process_pool * pool);
+/**
+ * Registers a transfer thread of a worker in the pool's metrics, access log
+ * and egress control, so the responses it sends are recorded and paced like
+ * those the workers send.
+ * @param arg - the pool
+ */
+static void register_transfer_thread(void * arg);
 /**
  * Creates and connects to a domain socket at SOCKET_PATH. once connected
- * it sends the client fd to a worker process listening to the socket.
- * @param http_client_fd
+ * it sends the client fd, the time it was dispatched and its request to a
+ * worker process listening to the socket.
+ * @param request
+ * @param accepted_us
  */
-static void send_socket(int http_client_fd);
+static void send_socket(staged_request * request, uint64_t accepted_us);
 /**
  * Creates the required semaphores for managing the process pool.
  * @return semaphores
  */
 static semaphores * create_semaphores();
+/**
+ * Rounds a size in the shared memory up to a whole number of pages, so each
+ * block placed there starts on its own page.
+ * @param size
+ * @return the rounded size
+ */
+static size_t align_block(size_t size);
 
 process_pool * process_pool_create(config *cfg) {
     process_pool * pool = calloc(1, sizeof(process_pool));
     pool->sem = create_semaphores();
     pool->cfg = cfg;
+
+    // Every worker process and each of its transfer threads gets a slot in
+    // the metrics and the access log, as does the main process in the metrics
+    // for the clients it rejects. Transfer threads are not traced.
+    config *conf = get_config(cfg);
+    int process_threads = 1 + config_transfer_threads(conf);
+    int metrics_workers = 1 + NUM_PROCESSES * process_threads;
+    int access_log_workers = NUM_PROCESSES * process_threads;
+    int trace_workers = 1 + NUM_PROCESSES;
+    size_t metrics_offset = align_block(sizeof(memory));
+    size_t access_log_offset = metrics_offset + align_block(metrics_size(metrics_workers));
+    size_t trace_offset = access_log_offset + align_block(access_log_size(access_log_workers));
+    size_t len = trace_offset + align_block(trace_size(trace_workers));
+
     memory *ptr;
     int shared_mem_fd = dc_shm_open(SHMEM_HAME, O_CREAT | O_RDWR, 0666);
-    ftruncate(shared_mem_fd, sizeof(memory));
-    ptr = mmap(0, sizeof(memory), PROT_WRITE|PROT_READ, MAP_SHARED, shared_mem_fd, 0);
+    ftruncate(shared_mem_fd, (off_t) len);
+    ptr = mmap(0, len, PROT_WRITE|PROT_READ, MAP_SHARED, shared_mem_fd, 0);
+    admission_init(&ptr->admission);
+    egress_init(&ptr->egress);
+    ptr->metrics = (metrics_block *) ((char *) ptr + metrics_offset);
+    ptr->access_log = (access_log_block *) ((char *) ptr + access_log_offset);
+    ptr->trace = (trace_block *) ((char *) ptr + trace_offset);
+    metrics_init(ptr->metrics, metrics_workers);
+    access_log_init(ptr->access_log, access_log_workers);
+    trace_init(ptr->trace, trace_workers);
+    negative_cache_init(&ptr->negative_cache);
     pool->mem = ptr;
+
+    pool->content_cache = content_cache_create((size_t) conf->content_cache_size);
+    destroy_config(conf);
     return pool;
 }
 
 void process_pool_start(process_pool * pool) {
     pool->mem->is_running = true;
+    metrics_register(pool->mem->metrics);
+    trace_register(pool->mem->trace);
     for(int i = 0; i < NUM_PROCESSES; i++){
         int pid = fork();
         if(pid == -1){
@@ -64,6 +121,12 @@ void process_pool_start(process_pool * pool) {
             exit(EXIT_FAILURE);
         }
     }
+
+    config *conf = get_config(pool->cfg);
+    access_log_start(pool->mem->access_log, conf);
+    trace_start(pool->mem->trace, conf);
+    negative_cache_start(&pool->mem->negative_cache, conf);
+    destroy_config(conf);
 }
 
 void process_pool_stop(process_pool * pool) {
@@ -72,16 +135,25 @@ void process_pool_stop(process_pool * pool) {
         dc_sem_post(pool->sem->wake_worker);
 }
 
-void process_pool_notify(process_pool * pool, int http_client_fd) {
+int process_pool_notify(process_pool * pool, staged_request * request, uint64_t accepted_us) {
     semaphores * sem = pool->sem;
-    dc_sem_wait(sem->worker_ready);
+    if (sem_trywait(sem->worker_ready) == -1) {
+        return -1;
+    }
+
     dc_sem_post(sem->wake_worker);
     dc_sem_wait(sem->worker_binded);
-    send_socket(http_client_fd);
-    dc_close(http_client_fd);
+    send_socket(request, accepted_us);
+    dc_close(request->cfd);
+    free(request);
+    return 0;
 }
 
 void process_pool_destroy(process_pool * pool) {
+    access_log_stop(pool->mem->access_log);
+    trace_stop(pool->mem->trace);
+    negative_cache_stop(&pool->mem->negative_cache);
+    content_cache_destroy(pool->content_cache);
     free(pool);
 }
 
@@ -97,7 +169,7 @@ static semaphores * create_semaphores() {
 }
 
 
-static void send_socket(int http_client_fd) {
+static void send_socket(staged_request * request, uint64_t accepted_us) {
     struct sockaddr_un process_address;
     int process_sfd;
         
@@ -109,9 +181,13 @@ static void send_socket(int http_client_fd) {
 
     struct msghdr msg = {0};
     struct cmsghdr *cmsg;
-    char buf[CMSG_SPACE(sizeof(int))], *dup = "hello world";
+    char buf[CMSG_SPACE(sizeof(int))];
     memset(buf, '\0', sizeof(buf));
-    struct iovec io = { .iov_base = &dup, .iov_len = sizeof(dup) };
+    client_message message;
+    message.accepted_us = accepted_us;
+    message.len = (uint32_t) request->len;
+    memcpy(message.buf, request->buf, request->len);
+    struct iovec io = { .iov_base = &message, .iov_len = offsetof(client_message, buf) + request->len };
 
     msg.msg_iov = &io;
     msg.msg_iovlen = 1;
@@ -124,30 +200,45 @@ static void send_socket(int http_client_fd) {
     cmsg->cmsg_len = CMSG_LEN(sizeof(int));
 
     int *fdptr = (int *)CMSG_DATA(cmsg);
-    *fdptr = http_client_fd;
+    *fdptr = request->cfd;
 
     if (sendmsg(process_sfd, &msg, 0) == -1){
         perror("sendmsg()");
         exit(EXIT_FAILURE);
     }
+    dc_close(process_sfd);
 }
 
-static int worker_receive(int socked_fd) {
+static int worker_receive(int socked_fd, client_message * message) {
     struct msghdr msg = {0};
     struct cmsghdr *cmsg;
-    char buf[CMSG_SPACE(sizeof(int))], dup[256];
+    char buf[CMSG_SPACE(sizeof(int))];
     memset(buf, '\0', sizeof(buf));
-    struct iovec io = { .iov_base = &dup, .iov_len = sizeof(dup) };
+    struct iovec io = { .iov_base = message, .iov_len = sizeof(*message) };
 
     msg.msg_iov = &io;
     msg.msg_iovlen = 1;
     msg.msg_control = buf;
     msg.msg_controllen = sizeof(buf);
         
-    if (recvmsg(socked_fd, &msg, 0) < 0){
+    ssize_t received = recvmsg(socked_fd, &msg, 0);
+    if (received < 0){
         perror("recvmsg()");
         exit(EXIT_FAILURE);
     }
+
+    // The fd comes with the first bytes; on a stream socket the rest of the
+    // request may follow separately.
+    size_t header_len = offsetof(client_message, buf);
+    while ((size_t) received < header_len || (size_t) received < header_len + message->len) {
+        ssize_t num_read = read(socked_fd, (char *) message + received, sizeof(*message) - (size_t) received);
+        if (num_read <= 0) {
+            message->len = (size_t) received > header_len ? (uint32_t) ((size_t) received - header_len) : 0;
+            break;
+        }
+        received += num_read;
+    }
+    if (message->len > MAX_REQUEST_LEN - 1) message->len = MAX_REQUEST_LEN - 1;
     
     cmsg = CMSG_FIRSTHDR(&msg);
     int *fdptr = (int *)CMSG_DATA(cmsg);
@@ -174,26 +265,69 @@ static int worker_bind() {
     return socket_fd;
 }
 
+static void register_transfer_thread(void * arg) {
+    process_pool * pool = arg;
+    metrics_register(pool->mem->metrics);
+    access_log_register(pool->mem->access_log);
+    pacing_register(&pool->mem->egress);
+}
+
 static void worker_loop(process_pool * pool) {
     semaphores * sem = pool->sem;
+    admission_control * admission = &pool->mem->admission;
+
+    // The accepting process handles SIGINT and SIGTERM in a thread that is
+    // not forked; workers keep the default behaviour.
+    sigset_t shutdown_signals;
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGINT);
+    sigaddset(&shutdown_signals, SIGTERM);
+    sigprocmask(SIG_UNBLOCK, &shutdown_signals, NULL);
+    deadline_service_start();
+    metrics_register(pool->mem->metrics);
+    access_log_register(pool->mem->access_log);
+    trace_register(pool->mem->trace);
+    negative_cache_register(&pool->mem->negative_cache);
+    content_cache_register(pool->content_cache);
+    prefetch_service_start(pool->cfg, &pool->mem->negative_cache, pool->content_cache);
+    config * lane_conf = get_config(pool->cfg);
+    transfer_lanes * transfers = transfer_lanes_create(lane_conf, register_transfer_thread, pool);
+    destroy_config(lane_conf);
+    transfer_lanes_register(transfers);
+    pacing_register(&pool->mem->egress);
     for (;;) {
+        atomic_fetch_add(&admission->idle_workers, 1);
         dc_sem_post(sem->worker_ready);
         dc_sem_wait(sem->wake_worker);
+        atomic_fetch_sub(&admission->idle_workers, 1);
         if(!pool->mem->is_running) {
+            transfer_lanes_destroy(transfers);
             exit(EXIT_SUCCESS);
         } 
         int worker_fd = worker_bind();
         dc_sem_post(sem->worker_binded);
 
+        client_message message;
         int main_process_fd = dc_accept(worker_fd, NULL, NULL);
-        int http_client_fd = worker_receive(main_process_fd);
+        int http_client_fd = worker_receive(main_process_fd, &message);
+        uint64_t accepted_us = message.accepted_us;
+        admission_record_wait(admission, accepted_us);
 
+        trace_begin_request(accepted_us);
+        trace_record_elapsed(TRACE_HANDOFF, admission_now_us() - accepted_us);
+        uint64_t config_start = trace_now();
         config * conf = get_config(pool->cfg);
-        http_handle_client(conf, http_client_fd);
+        trace_record(TRACE_CONFIG, config_start, trace_now());
+        http_handle_request(conf, http_client_fd, message.buf, message.len);
         destroy_config(conf);
 
         close(worker_fd);
         close(main_process_fd);
         close(http_client_fd);
+        trace_end_request();
     }
 }
+
+static size_t align_block(size_t size) {
+    return (size + SHMEM_ALIGN - 1) & ~(size_t) (SHMEM_ALIGN - 1);
+}
@@ -3,6 +3,15 @@
 
 
 #include "./http.h"
+#include "./admission.h"
+#include "./access_log.h"
+#include "./trace.h"
+#include "./negative_cache.h"
+#include "./content_cache.h"
+#include "./prefetch.h"
+#include "./transfer_pool.h"
+#include "./pacing.h"
+#include "./staging.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -35,24 +44,40 @@ typedef struct {
 } semaphores;
 /**
  * The memory struct holds a is_running value that will be stored in shared memory
- * for the processes to check if they should continue running.
+ * for the processes to check if they should continue running, the load
+ * measurements the workers report for admission control, the transfers sharing
+ * the egress cap, every worker's metrics, the access log rings drained by the
+ * main process and the negative cache generation bumped by its watcher. The
+ * metrics, access log and trace blocks are sized for the configured threads and
+ * placed after it in the same mapping, before the workers are forked.
  */
 typedef struct memory {
     bool is_running;
+    admission_control admission;
+    egress_control egress;
+    metrics_block * metrics;
+    access_log_block * access_log;
+    trace_block * trace;
+    negative_cache_block negative_cache;
 } memory;
 
 /**
  * The process pool struct contains everything you need to control the processes.
+ * The content cache is mapped next to the memory struct, before the workers are
+ * forked, so they all share it; it is NULL if disabled.
  */
 typedef struct {
     semaphores * sem;
     memory * mem;
+    content_cache_block * content_cache;
     config * cfg;
 } process_pool;
 
 /**
  * Forks NUM_PROCESSES number of worker processes where each forked process will wait
- * the worker_loop function.
+ * the worker_loop function. The calling thread is registered as a worker in the
+ * shared metrics so the clients it rejects are counted, and the access log
+ * flusher is started in this process if configured.
  * @param pool
  */
 void process_pool_start(process_pool * pool);
@@ -63,7 +88,7 @@ void process_pool_start(process_pool * pool);
  */
 void process_pool_stop(process_pool * pool);
 /**
- * Frees the process pool struct.
+ * Flushes the access log, unmaps the content cache and frees the process pool struct.
  * @param pool
  */
 void process_pool_destroy(process_pool * pool);
@@ -77,10 +102,15 @@ void process_pool_destroy(process_pool * pool);
 process_pool * process_pool_create(config *cfg);
 
 /**
- * Used to pass a client to a process through the uses of semaphores and domain sockets.
+ * Used to pass a client to a process through the uses of semaphores and domain sockets,
+ * along with the request header read from it. Never waits for a worker to become ready;
+ * how long clients may wait is left to admission control. The client fd is closed and
+ * the request freed in this process once it has been passed.
  * @param pool
- * @param cfd
+ * @param request the client and the request header read from it
+ * @param accepted_us the admission_now_us time the client was dispatched
+ * @return 0 if the client was passed, -1 if no worker is ready
  */
-void process_pool_notify(process_pool * pool, int cfd);
+int process_pool_notify(process_pool * pool, staged_request * request, uint64_t accepted_us);
 
 #endif
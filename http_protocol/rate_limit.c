@@ -0,0 +1,154 @@
+#include "rate_limit.h"
+#include "http.h"
+
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MILLI_TOKENS 1000
+#define MAX_BURST (UINT32_MAX / MILLI_TOKENS)
+#define REJECT_DRAIN_LEN (4 * MAX_REQUEST_LEN)
+
+static const char reject_response[] =
+        "HTTP/1.0 429 Too Many Requests\r\n"
+        "Server: DataComm/0.1\r\n"
+        "Retry-After: 1\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n";
+
+static uint64_t now_ms(void);
+static uint64_t address_key(const struct sockaddr * addr);
+static uint64_t mix(uint64_t x);
+static int take_token(rate_limit_slot * slot, uint32_t now, uint64_t rate, uint64_t burst);
+
+rate_limiter * rate_limit_create(void) {
+    rate_limiter * limiter = calloc(1, sizeof(rate_limiter));
+    limiter->epoch_ms = now_ms();
+    return limiter;
+}
+
+void rate_limit_destroy(rate_limiter * limiter) {
+    free(limiter);
+}
+
+int rate_limit_admit(rate_limiter * limiter, config * conf, const struct sockaddr * addr) {
+    if (conf->rate_limit <= 0) return 1;
+    uint64_t key = address_key(addr);
+    if (key == 0) return 1;
+
+    uint64_t rate = (uint64_t) conf->rate_limit;
+    uint64_t burst = conf->rate_limit_burst > 0 ? (uint64_t) conf->rate_limit_burst : 1;
+    if (burst > MAX_BURST) burst = MAX_BURST;
+    uint32_t now = (uint32_t) (now_ms() - limiter->epoch_ms);
+    uint64_t refill_ms = burst * 1000 / rate;
+
+    // The address's own slot is looked for along the whole probe sequence
+    // first, so an earlier slot coming free never resets its bucket.
+    rate_limit_slot * free_slot = NULL;
+    uint64_t free_key = 0;
+    for (int i = 0; i < RATE_LIMIT_PROBES; i++) {
+        rate_limit_slot * slot = &limiter->slots[(key + (uint64_t) i) & (RATE_LIMIT_SLOTS - 1)];
+        uint64_t slot_key = atomic_load_explicit(&slot->key, memory_order_acquire);
+        if (slot_key == key) return take_token(slot, now, rate, burst);
+        if (free_slot != NULL) continue;
+
+        // A bucket left alone until it refilled is as good as a new one.
+        uint64_t state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+        uint32_t idle_ms = now - (uint32_t) (state >> 32);
+        if (slot_key == 0 || (idle_ms > refill_ms && idle_ms <= INT32_MAX)) {
+            free_slot = slot;
+            free_key = slot_key;
+        }
+    }
+    if (free_slot == NULL) return 1;
+
+    // Another thread may have taken the slot since, for this address or
+    // another one.
+    uint64_t slot_key = free_key;
+    if (atomic_compare_exchange_strong_explicit(&free_slot->key, &slot_key, key,
+                                                memory_order_acq_rel, memory_order_acquire)) {
+        uint64_t tokens = (burst - 1) * MILLI_TOKENS;
+        atomic_store_explicit(&free_slot->state, (uint64_t) now << 32 | tokens, memory_order_release);
+        return 1;
+    }
+    return slot_key == key ? take_token(free_slot, now, rate, burst) : 1;
+}
+
+void rate_limit_reject(int cfd) {
+    uint64_t started_us = metrics_now_us();
+    ssize_t sent = send(cfd, reject_response, sizeof(reject_response) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(cfd, SHUT_WR);
+
+    // Closing with unread bytes sends a reset, which may make the client
+    // drop the 429 unread, so the request already received is discarded.
+    char discard[MAX_REQUEST_LEN];
+    for (size_t total = 0; total < REJECT_DRAIN_LEN;) {
+        ssize_t num_read = recv(cfd, discard, sizeof(discard), MSG_DONTWAIT);
+        if (num_read <= 0) break;
+        total += (size_t) num_read;
+    }
+    close(cfd);
+
+    metrics_record_response(HTTP_TOO_MANY_REQUESTS, sent > 0 ? (uint64_t) sent : 0, started_us);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+// Returns a hash of the client's IP address, ignoring the port, or 0 for
+// an address family that is not limited.
+static uint64_t address_key(const struct sockaddr * addr) {
+    uint64_t key;
+    if (addr->sa_family == AF_INET) {
+        const struct sockaddr_in * in = (const struct sockaddr_in *) addr;
+        key = mix((uint64_t) in->sin_addr.s_addr | (uint64_t) AF_INET << 32);
+    } else if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 * in6 = (const struct sockaddr_in6 *) addr;
+        uint64_t high;
+        uint64_t low;
+        memcpy(&high, in6->sin6_addr.s6_addr, sizeof(high));
+        memcpy(&low, in6->sin6_addr.s6_addr + sizeof(high), sizeof(low));
+        key = mix(high ^ mix(low));
+    } else {
+        return 0;
+    }
+    return key != 0 ? key : 1;
+}
+
+// The splitmix64 finalizer: a bijection, so distinct IPv4 addresses never
+// share a key, that spreads them over the whole table.
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Refills the slot's bucket for the time since it was last refilled and
+// takes a token from it. Returns whether there was one.
+static int take_token(rate_limit_slot * slot, uint32_t now, uint64_t rate, uint64_t burst) {
+    uint64_t state = atomic_load_explicit(&slot->state, memory_order_acquire);
+    uint64_t updated;
+    int admitted;
+    do {
+        // Another thread may have refilled it at a later millisecond.
+        uint32_t idle_ms = now - (uint32_t) (state >> 32);
+        if (idle_ms > INT32_MAX) idle_ms = 0;
+        uint64_t tokens = (state & UINT32_MAX) + (uint64_t) idle_ms * rate;
+        uint32_t refilled = idle_ms > 0 ? now : (uint32_t) (state >> 32);
+        if (tokens > burst * MILLI_TOKENS) tokens = burst * MILLI_TOKENS;
+
+        admitted = tokens >= MILLI_TOKENS;
+        if (admitted) tokens -= MILLI_TOKENS;
+        updated = (uint64_t) refilled << 32 | tokens;
+    } while (!atomic_compare_exchange_weak_explicit(&slot->state, &state, updated,
+                                                    memory_order_acq_rel, memory_order_acquire));
+    return admitted;
+}
@@ -0,0 +1,59 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "config.h"
+
+#define RATE_LIMIT_SLOTS (1 << 16)
+#define RATE_LIMIT_PROBES 8
+
+/**
+ * A client address's token bucket. key is a hash of the address, 0 for a
+ * free slot. state packs the millisecond the bucket was last refilled, in
+ * the high 32 bits, with the thousandths of a token it held then.
+ */
+typedef struct {
+    atomic_uint_fast64_t key;
+    atomic_uint_fast64_t state;
+} rate_limit_slot;
+
+/**
+ * Token buckets for the client addresses seen recently, in an open
+ * addressing table updated only with compare-and-swap, so any number of
+ * accepting threads can share it. A bucket left alone long enough to
+ * refill completely is no different from a new one, so its slot is reused
+ * by the next address probing it; no sweep is needed.
+ */
+typedef struct {
+    uint64_t epoch_ms;
+    rate_limit_slot slots[RATE_LIMIT_SLOTS];
+} rate_limiter;
+
+/**
+ * Creates an empty table.
+ */
+rate_limiter * rate_limit_create(void);
+
+/**
+ * Frees the table. Does nothing if limiter is NULL.
+ */
+void rate_limit_destroy(rate_limiter * limiter);
+
+/**
+ * Takes a token from the bucket of the client at addr, which refills at
+ * rate_limit tokens per second up to rate_limit_burst. Returns 1 to admit
+ * the client and 0 if its bucket is empty. Clients are always admitted if
+ * rate_limit is 0, and when the table has no room for their address.
+ */
+int rate_limit_admit(rate_limiter * limiter, config * conf, const struct sockaddr * addr);
+
+/**
+ * Answers cfd with a preformatted 429 Too Many Requests, closes it and
+ * counts the response. Never blocks and never touches the filesystem.
+ */
+void rate_limit_reject(int cfd);
+
+#endif
@@ -0,0 +1,172 @@
+#include "resolve.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * The calling thread's descriptor for the root directory and the root_dir
+ * it was opened from. The key's destructor closes it when the thread exits.
+ */
+typedef struct {
+    char * path;
+    int fd;
+} root_handle;
+
+static _Thread_local root_handle * root;
+static pthread_key_t root_key;
+static pthread_once_t root_key_once = PTHREAD_ONCE_INIT;
+static atomic_int openat2_missing;
+
+static int get_root_fd(const char * root_dir);
+static void create_root_key(void);
+static void close_root(void * handle);
+static int open_beneath(int dir_fd, const char * path);
+static int hex_value(char c);
+
+int resolve_normalize(const char * uri, char * out, size_t out_len) {
+    if (uri == NULL || uri[0] != '/') return -1;
+
+    // Decode first, so encoded separators and dots are normalized like
+    // literal ones.
+    size_t len = 0;
+    for (const char * c = uri; *c != '\0' && *c != '?' && *c != '#'; c++) {
+        char decoded = *c;
+        if (decoded == '%') {
+            int high = hex_value(c[1]);
+            int low = high < 0 ? -1 : hex_value(c[2]);
+            if (low < 0) return -1;
+            decoded = (char) (high << 4 | low);
+            if (decoded == '\0') return -1;
+            c += 2;
+        }
+        if (len + 1 >= out_len) return -1;
+        out[len++] = decoded;
+    }
+    out[len] = '\0';
+
+    // Then rewrite the segments in place; the result is never longer.
+    size_t written = 0;
+    char * segment = out;
+    while (*segment != '\0') {
+        while (*segment == '/') segment++;
+        size_t segment_len = strcspn(segment, "/");
+
+        if (segment_len == 0 || (segment_len == 1 && segment[0] == '.')) {
+            // Empty and "." segments are dropped.
+        } else if (segment_len == 2 && segment[0] == '.' && segment[1] == '.') {
+            if (written == 0) return -1;
+            while (written > 0 && out[written - 1] != '/') written--;
+            if (written > 0) written--;
+        } else {
+            if (written > 0) out[written++] = '/';
+            memmove(out + written, segment, segment_len);
+            written += segment_len;
+        }
+        segment += segment_len;
+    }
+    out[written] = '\0';
+    return 0;
+}
+
+int resolve_escape(const char * path, char * uri, size_t uri_len) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t out = 0;
+    for (const unsigned char * c = (const unsigned char *) path; *c != '\0'; c++) {
+        int plain = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ||
+                    strchr("-._~/", *c) != NULL;
+        if (out + (plain ? 1 : 3) >= uri_len) return -1;
+        if (plain) {
+            uri[out++] = (char) *c;
+        } else {
+            uri[out++] = '%';
+            uri[out++] = hex[*c >> 4];
+            uri[out++] = hex[*c & 0xf];
+        }
+    }
+    uri[out] = '\0';
+    return 0;
+}
+
+int resolve_open(const char * root_dir, const char * path, struct stat * st) {
+    int root_fd = get_root_fd(root_dir);
+    if (root_fd == -1 || path[0] == '\0') return -1;
+
+    int fd = open_beneath(root_fd, path);
+    if (fd == -1) return -1;
+
+    if (fstat(fd, st) == -1 || !S_ISREG(st->st_mode)) {
+        close(fd);
+        return -1;
+    }
+    // O_NONBLOCK is the only status flag open_beneath sets.
+    if (fcntl(fd, F_SETFL, 0) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Returns the calling thread's root directory fd, reopening it if the
+// configured root_dir changed since it was opened.
+static int get_root_fd(const char * root_dir) {
+    if (root != NULL && strcmp(root->path, root_dir) == 0) return root->fd;
+
+    pthread_once(&root_key_once, create_root_key);
+    if (root == NULL) {
+        root = calloc(1, sizeof(root_handle));
+        if (root == NULL) return -1;
+        root->fd = -1;
+        pthread_setspecific(root_key, root);
+    }
+
+    if (root->fd != -1) close(root->fd);
+    free(root->path);
+    root->path = strdup(root_dir);
+    root->fd = open(root_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return root->fd;
+}
+
+static void create_root_key(void) {
+    pthread_key_create(&root_key, close_root);
+}
+
+static void close_root(void * handle) {
+    root_handle * r = handle;
+    if (r->fd != -1) close(r->fd);
+    free(r->path);
+    free(r);
+}
+
+// Opens with O_NONBLOCK, so a FIFO or device under the root cannot block
+// the worker before resolve_open finds it is not a regular file. Kernels
+// before 5.6 have no openat2. There the path, already free of "..", is
+// opened with openat and O_NOFOLLOW, which only covers the last component:
+// a symlinked directory earlier in the path is still followed, even out of
+// the root.
+static int open_beneath(int dir_fd, const char * path) {
+    if (!openat2_missing) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = O_RDONLY | O_CLOEXEC | O_NONBLOCK;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+        int fd = (int) syscall(SYS_openat2, dir_fd, path, &how, sizeof(how));
+        if (fd != -1 || errno != ENOSYS) return fd;
+        openat2_missing = 1;
+    }
+    return openat(dir_fd, path, O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOFOLLOW);
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
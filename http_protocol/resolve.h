@@ -0,0 +1,37 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/**
+ * Turns a request URI into a path relative to the root directory. The query
+ * and fragment are dropped, percent escapes are decoded, and empty, "." and
+ * ".." segments are resolved, so the result never starts with '/' and never
+ * contains a ".." segment. "/" becomes the empty string. Returns 0 on
+ * success, or -1 if the URI is not an absolute path, has a malformed escape
+ * or an encoded NUL, climbs above the root, or does not fit in out_len bytes.
+ */
+int resolve_normalize(const char * uri, char * out, size_t out_len);
+
+/**
+ * The reverse of resolve_normalize for a path it produced: percent-encodes
+ * everything but unreserved characters and '/' into uri, without a leading
+ * '/'. Returns 0 on success, or -1 if the result does not fit in uri_len
+ * bytes.
+ */
+int resolve_escape(const char * path, char * uri, size_t uri_len);
+
+/**
+ * Opens the regular file at path, a result of resolve_normalize, beneath
+ * root_dir and fills st with a single fstat. The lookup is relative to a
+ * directory fd for root_dir that each thread keeps open until root_dir
+ * changes, and uses openat2 with RESOLVE_BENEATH so neither ".." nor
+ * symlinks can reach outside the root; without openat2, only a symlink as
+ * the last component is refused. FIFOs and devices are opened without
+ * blocking and refused. Returns the open fd, or -1 if the file does not
+ * exist, is not a regular file, or lies outside the root.
+ */
+int resolve_open(const char * root_dir, const char * path, struct stat * st);
+
+#endif
@@ -0,0 +1,321 @@
+#include "response_cache.h"
+#include "http.h"
+#include "http_date.h"
+#include "encoding.h"
+#include "mime.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <dc/stdlib.h>
+
+#define SERVER_NAME "DataComm/0.1"
+#define MAX_HEADER_LEN 1024
+
+/**
+ * Direct-mapped table of the headers rendered in this process. Each slot
+ * holds one reference to its header; a colliding or changed file replaces
+ * it. Lookups only take the read lock for long enough to grab a reference.
+ * Process pool workers are forked before they serve anything, so each
+ * starts with an empty table and an unlocked lock.
+ */
+static struct {
+    pthread_rwlock_t lock;
+    response_header * slots[RESPONSE_CACHE_SLOTS];
+} cache = { PTHREAD_RWLOCK_INITIALIZER, { NULL } };
+
+static const cache_policy no_store = { NULL, "no-store", -1 };
+
+static pthread_once_t errors_once = PTHREAD_ONCE_INIT;
+static response_header * bad_request_header;
+static response_header * server_error_header;
+static response_header * unavailable_header;
+
+static pthread_mutex_t retry_lock = PTHREAD_MUTEX_INITIALIZER;
+static response_header * retry_header;
+static int retry_header_after = -1;
+
+static response_header * render(const response_spec * spec, int fd, const struct stat * st, const char * extra);
+static void render_errors(void);
+static const char * get_status_phrase(int status_code);
+static unsigned int hash_key(int status, const char * path, int encoding);
+static int policy_matches(response_header * header, int status, const cache_policy * policy);
+static int link_matches(response_header * header, int status, const char * link);
+static int is_current(response_header * header, const response_spec * spec, const struct stat * st);
+
+response_header * response_cache_get(const response_spec * spec, int fd, const struct stat * st, int * cache_hit) {
+    response_header ** slot = &cache.slots[hash_key(spec->status, spec->path, spec->encoding) % RESPONSE_CACHE_SLOTS];
+
+    pthread_rwlock_rdlock(&cache.lock);
+    response_header * header = *slot;
+    if (header != NULL && is_current(header, spec, st)) {
+        atomic_fetch_add_explicit(&header->refs, 1, memory_order_relaxed);
+        pthread_rwlock_unlock(&cache.lock);
+        *cache_hit = 1;
+        return header;
+    }
+    pthread_rwlock_unlock(&cache.lock);
+
+    *cache_hit = 0;
+    header = render(spec, fd, st, NULL);
+    atomic_store_explicit(&header->refs, 2, memory_order_relaxed);
+
+    pthread_rwlock_wrlock(&cache.lock);
+    response_header * replaced = *slot;
+    *slot = header;
+    pthread_rwlock_unlock(&cache.lock);
+
+    response_header_release(replaced);
+    return header;
+}
+
+response_header * response_cache_error(int status) {
+    pthread_once(&errors_once, render_errors);
+    if (status == HTTP_BAD_REQUEST) return bad_request_header;
+    if (status == HTTP_SERVICE_UNAVAILABLE) return unavailable_header;
+    return server_error_header;
+}
+
+// A reload that changes retry_after renders a new header; the old one is
+// never freed, as responses in flight may still be sending it.
+response_header * response_cache_unavailable(int retry_after) {
+    pthread_mutex_lock(&retry_lock);
+    if (retry_header == NULL || retry_header_after != retry_after) {
+        response_spec spec = { HTTP_SERVICE_UNAVAILABLE, NULL, -1, NULL, NULL, NULL, NULL };
+        char extra[32];
+        snprintf(extra, sizeof(extra), "Retry-After: %d\r\n", retry_after);
+        retry_header = render(&spec, -1, NULL, extra);
+        retry_header_after = retry_after;
+    }
+    response_header * header = retry_header;
+    pthread_mutex_unlock(&retry_lock);
+    return header;
+}
+
+response_header * response_cache_generated(const char * path, const char * content_type, size_t body_len) {
+    response_spec spec = { HTTP_OK, path, -1, &no_store, content_type, NULL, NULL };
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_size = (off_t) body_len;
+    return render(&spec, -1, &st, NULL);
+}
+
+void response_header_retain(response_header * header) {
+    if (header == NULL || header->path == NULL) return;
+    atomic_fetch_add_explicit(&header->refs, 1, memory_order_relaxed);
+}
+
+void response_header_release(response_header * header) {
+    if (header == NULL || header->path == NULL) return;
+    if (atomic_fetch_sub_explicit(&header->refs, 1, memory_order_acq_rel) == 1) {
+        free(header->path);
+        free(header);
+    }
+}
+
+uint64_t response_header_send(response_header * header, int cfd, int with_body) {
+    char date[HTTP_DATE_SIZE];
+    char expires[HTTP_DATE_SIZE];
+    http_date_now(date);
+
+    struct iovec iov[5];
+    int num_iov = 0;
+    size_t end = header->len - (with_body ? 0 : header->body_len);
+    iov[num_iov].iov_base = header->text;
+    iov[num_iov++].iov_len = header->date_offset;
+    iov[num_iov].iov_base = date;
+    iov[num_iov++].iov_len = HTTP_DATE_LEN;
+    size_t rest = header->date_offset + HTTP_DATE_LEN;
+
+    if (header->expires_offset > 0) {
+        http_date_format(time(NULL) + header->max_age, expires);
+        iov[num_iov].iov_base = header->text + rest;
+        iov[num_iov++].iov_len = header->expires_offset - rest;
+        iov[num_iov].iov_base = expires;
+        iov[num_iov++].iov_len = HTTP_DATE_LEN;
+        rest = header->expires_offset + HTTP_DATE_LEN;
+    }
+    iov[num_iov].iov_base = header->text + rest;
+    iov[num_iov++].iov_len = end - rest;
+
+    ssize_t num_written = writev(cfd, iov, num_iov);
+    return num_written > 0 ? (uint64_t) num_written : 0;
+}
+
+// Renders a header with blank Date and Expires values. Error headers,
+// which have no path, carry an empty body. Files may have coded siblings,
+// so caches are told the response varies with Accept-Encoding, and the
+// Content-Type is that of the file the sibling was made from. Only 200s
+// get caching and Link headers. A small enough not found page is read in after the
+// header.
+// extra, if not NULL, holds complete header lines added after the others.
+static response_header * render(const response_spec * spec, int fd, const struct stat * st, const char * extra) {
+    int status = spec->status;
+    const char * path = spec->path;
+    int encoding = spec->encoding;
+    const cache_policy * policy = spec->policy;
+    char text[MAX_HEADER_LEN];
+    int date_offset = snprintf(text, sizeof(text), "HTTP/1.0 %s\r\nServer: " SERVER_NAME "\r\nDate: ",
+                               get_status_phrase(status));
+    int len = snprintf(text + date_offset, sizeof(text) - date_offset, "%*s\r\nContent-Length: %ld\r\n",
+                       HTTP_DATE_LEN, "", st != NULL ? (long) st->st_size : 0L);
+    if (spec->content_type != NULL) {
+        len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "Content-Type: %s\r\n",
+                        spec->content_type);
+    } else if (path != NULL) {
+        size_t type_len = strlen(path);
+        if (encoding >= 0) {
+            size_t suffix_len = strlen(encoding_suffix(encoding));
+            if (type_len > suffix_len && strcmp(path + type_len - suffix_len, encoding_suffix(encoding)) == 0) {
+                type_len -= suffix_len;
+            }
+        }
+        len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "Content-Type: %s\r\n",
+                        mime_type(path, type_len));
+    }
+    if (spec->etag != NULL) {
+        len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "ETag: %s\r\n", spec->etag);
+    }
+    if (status == HTTP_OK) {
+        len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "Vary: Accept-Encoding\r\n");
+    }
+    if (encoding >= 0) {
+        len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "Content-Encoding: %s\r\n",
+                        encoding_name(encoding));
+    }
+
+    size_t link_offset = 0;
+    size_t link_len = 0;
+    if (status == HTTP_OK && spec->link != NULL) {
+        len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "Link: ");
+        link_offset = date_offset + len;
+        link_len = strlen(spec->link);
+        len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "%s\r\n", spec->link);
+    }
+
+    size_t cache_control_offset = 0;
+    size_t cache_control_len = 0;
+    size_t expires_offset = 0;
+    if (status != HTTP_OK) policy = NULL;
+    if (policy != NULL) {
+        len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "Cache-Control: ");
+        cache_control_offset = date_offset + len;
+        cache_control_len = strlen(policy->cache_control);
+        len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "%s\r\n", policy->cache_control);
+        if (policy->max_age >= 0) {
+            len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "Expires: ");
+            expires_offset = date_offset + len;
+            len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "%*s\r\n", HTTP_DATE_LEN, "");
+        }
+    }
+    if (extra != NULL) {
+        len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "%s", extra);
+    }
+    len += snprintf(text + date_offset + len, sizeof(text) - date_offset - len, "\r\n");
+
+    size_t body_len = 0;
+    if (status == HTTP_NOT_FOUND && st != NULL && st->st_size <= RESPONSE_INLINE_BODY_MAX) {
+        body_len = st->st_size;
+    }
+
+    response_header * header = dc_malloc(sizeof(response_header) + date_offset + len + body_len);
+    atomic_init(&header->refs, 1);
+    header->status = status;
+    header->encoding = encoding;
+    header->path = path != NULL ? strdup(path) : NULL;
+    header->dev = st != NULL ? st->st_dev : 0;
+    header->ino = st != NULL ? st->st_ino : 0;
+    header->mtime = st != NULL ? st->st_mtim : (struct timespec) { 0, 0 };
+    header->size = st != NULL ? st->st_size : 0;
+    header->date_offset = date_offset;
+    header->max_age = policy != NULL ? policy->max_age : -1;
+    header->expires_offset = expires_offset;
+    header->cache_control_offset = cache_control_offset;
+    header->cache_control_len = cache_control_len;
+    header->link_offset = link_offset;
+    header->link_len = link_len;
+    header->len = date_offset + len;
+    header->body_len = 0;
+    memcpy(header->text, text, header->len);
+
+    // A short read leaves the page to be sent from the file instead.
+    if (body_len > 0 && pread(fd, header->text + header->len, body_len, 0) == (ssize_t) body_len) {
+        header->len += body_len;
+        header->body_len = body_len;
+    }
+    return header;
+}
+
+static void render_errors(void) {
+    response_spec bad_request = { HTTP_BAD_REQUEST, NULL, -1, NULL, NULL, NULL, NULL };
+    response_spec server_error = { HTTP_SERVER_ERROR, NULL, -1, NULL, NULL, NULL, NULL };
+    response_spec unavailable = { HTTP_SERVICE_UNAVAILABLE, NULL, -1, NULL, NULL, NULL, NULL };
+    bad_request_header = render(&bad_request, -1, NULL, NULL);
+    server_error_header = render(&server_error, -1, NULL, NULL);
+    unavailable_header = render(&unavailable, -1, NULL, NULL);
+}
+
+static const char * get_status_phrase(int status_code) {
+    if (status_code == HTTP_OK) {
+        return "200 OK";
+    }
+
+    if (status_code == HTTP_NOT_FOUND) {
+        return "404 Not Found";
+    }
+
+    if (status_code == HTTP_BAD_REQUEST) {
+        return "400 Bad Request";
+    }
+
+    if (status_code == HTTP_SERVICE_UNAVAILABLE) {
+        return "503 Service Unavailable";
+    }
+
+    return "500 Internal Server Error";
+}
+
+// FNV-1a over the path, seeded with the status and coding so a page served
+// both as itself and as the not found page, or both plain and compressed on
+// the fly, gets an entry for each.
+static unsigned int hash_key(int status, const char * path, int encoding) {
+    unsigned int hash = 2166136261u ^ (unsigned int) status ^ ((unsigned int) (encoding + 1) << 16);
+    for (const char * c = path; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char) *c) * 16777619u;
+    }
+    return hash;
+}
+
+// The policy is compared by value, since the config it lives in is reloaded
+// for every request.
+static int policy_matches(response_header * header, int status, const cache_policy * policy) {
+    if (status != HTTP_OK || policy == NULL) return header->cache_control_len == 0;
+    return header->max_age == policy->max_age &&
+           header->cache_control_len == strlen(policy->cache_control) &&
+           memcmp(header->text + header->cache_control_offset, policy->cache_control, header->cache_control_len) == 0;
+}
+
+// The links come from the page itself, so they only change with it, but
+// preload headers can be switched on and off.
+static int link_matches(response_header * header, int status, const char * link) {
+    if (status != HTTP_OK || link == NULL) return header->link_len == 0;
+    return header->link_len == strlen(link) && memcmp(header->text + header->link_offset, link, header->link_len) == 0;
+}
+
+static int is_current(response_header * header, const response_spec * spec, const struct stat * st) {
+    return header->status == spec->status &&
+           header->encoding == spec->encoding &&
+           header->ino == st->st_ino &&
+           header->dev == st->st_dev &&
+           header->size == st->st_size &&
+           header->mtime.tv_sec == st->st_mtim.tv_sec &&
+           header->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+           strcmp(header->path, spec->path) == 0 &&
+           policy_matches(header, spec->status, spec->policy) &&
+           link_matches(header, spec->status, spec->link);
+}
@@ -0,0 +1,114 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+#define RESPONSE_CACHE_SLOTS 1024
+#define RESPONSE_INLINE_BODY_MAX 16384
+
+/**
+ * A fully rendered, immutable response header: status line, Server, Date,
+ * Content-Length and, for files, Content-Type, any ETag, Vary, any
+ * Content-Encoding, any Link and the Cache-Control and Expires of the
+ * file's cache policy. The Date value is a placeholder at date_offset that
+ * is replaced with the cached current date when the header is sent.
+ * Expires, if present, is a placeholder at expires_offset replaced with
+ * the date max_age seconds ahead. Not found pages up to
+ * RESPONSE_INLINE_BODY_MAX bytes are stored right after the header, so
+ * they are sent without touching the file.
+ */
+typedef struct {
+    atomic_int refs;
+    int status;
+    int encoding;
+    char * path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    size_t date_offset;
+    int max_age;
+    size_t expires_offset;
+    size_t cache_control_offset;
+    size_t cache_control_len;
+    size_t link_offset;
+    size_t link_len;
+    size_t len;
+    size_t body_len;
+    char text[];
+} response_header;
+
+/**
+ * What a response header describes besides the body's size and identity.
+ * encoding is the body's coding (-1 for none) and policy how clients may
+ * cache it (NULL for no caching headers). content_type defaults to the type
+ * of path's extension, less any coding suffix, and etag and link, the
+ * value of a Link header sent with 200s, to none.
+ */
+typedef struct {
+    int status;
+    const char * path;
+    int encoding;
+    const cache_policy * policy;
+    const char * content_type;
+    const char * etag;
+    const char * link;
+} response_spec;
+
+/**
+ * Returns the header for a response as spec describes, whose body is the
+ * file open as fd and described by st. Headers are kept per process, keyed
+ * by status, path and coding, and reused until the path names another
+ * file, the file's mtime or size changes, or the policy or link changes.
+ * *cache_hit is set to whether a cached header was reused. The header
+ * must be released with response_header_release.
+ */
+response_header * response_cache_get(const response_spec * spec, int fd, const struct stat * st, int * cache_hit);
+
+/**
+ * Returns the header of a body-less error response with the given status:
+ * HTTP_BAD_REQUEST, HTTP_SERVICE_UNAVAILABLE or, for any other,
+ * HTTP_SERVER_ERROR. These are rendered once per process and never freed;
+ * releasing them is a no-op.
+ */
+response_header * response_cache_error(int status);
+
+/**
+ * Returns the header of a body-less 503 Service Unavailable telling the
+ * client to retry after retry_after seconds. It is rendered once per
+ * process for each value and never freed; releasing it is a no-op.
+ */
+response_header * response_cache_unavailable(int retry_after);
+
+/**
+ * Renders the header of a 200 response whose body of body_len bytes is
+ * generated for each request, such as the status page: Content-Type is
+ * content_type and caches are told not to store it. The header is not kept
+ * in the cache and must be released with response_header_release.
+ */
+response_header * response_cache_generated(const char * path, const char * content_type, size_t body_len);
+
+/**
+ * Takes another reference to a header returned by response_cache_get.
+ */
+void response_header_retain(response_header * header);
+
+/**
+ * Drops a reference taken by response_cache_get, response_cache_generated or
+ * response_header_retain.
+ */
+void response_header_release(response_header * header);
+
+/**
+ * Writes header to cfd with the current date and any expiry patched in,
+ * followed by the body stored with it if with_body is set, using a single
+ * writev. Returns the number of bytes written.
+ */
+uint64_t response_header_send(response_header * header, int cfd, int with_body);
+
+#endif
@@ -0,0 +1,223 @@
+#include "staging.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <dc/stdlib.h>
+
+static uint64_t now_ms(void);
+static int max_conns(void);
+static void watch_server(staging * st, int op);
+static void accept_conns(staging * st, config * conf, rate_limiter * limiter);
+static void read_conn(staging * st, staged_conn * conn);
+static int header_complete(const staged_request * request);
+static void park(staging * st, staged_conn * conn);
+static void unpark(staging * st, staged_conn * conn);
+static void close_conn(staging * st, staged_conn * conn);
+static void expire_conns(staging * st, uint64_t now);
+
+staging * staging_create(int server_fd, int header_timeout) {
+    staging * st = calloc(1, sizeof(staging));
+    st->server_fd = server_fd;
+    st->max_conns = max_conns();
+    st->epoll_fd = epoll_create1(0);
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+#ifdef TCP_DEFER_ACCEPT
+    int defer_s = (header_timeout + 999) / 1000;
+    if (defer_s > 0) setsockopt(server_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_s, sizeof(defer_s));
+#else
+    (void) header_timeout;
+#endif
+
+    watch_server(st, EPOLL_CTL_ADD);
+    return st;
+}
+
+void staging_destroy(staging * st) {
+    while (st->oldest != NULL) close_conn(st, st->oldest);
+    for (int i = st->next_ready; i < st->num_ready; i++) {
+        close(st->ready[i]->cfd);
+        free(st->ready[i]);
+    }
+    close(st->epoll_fd);
+    free(st);
+}
+
+staged_request * staging_next(staging * st, config * conf, rate_limiter * limiter) {
+    uint64_t started = now_ms();
+    for (;;) {
+        if (st->next_ready < st->num_ready) return st->ready[st->next_ready++];
+        st->num_ready = 0;
+        st->next_ready = 0;
+
+        uint64_t now = now_ms();
+        expire_conns(st, now);
+        if (st->resume_ms != 0 && now >= st->resume_ms) {
+            st->resume_ms = 0;
+            watch_server(st, EPOLL_CTL_ADD);
+        }
+        if (now - started >= STAGING_WAIT_MS) return NULL;
+        uint64_t timeout = STAGING_WAIT_MS - (now - started);
+        if (st->oldest != NULL && st->oldest->deadline_ms - now < timeout) timeout = st->oldest->deadline_ms - now;
+        if (st->resume_ms != 0 && st->resume_ms - now < timeout) timeout = st->resume_ms - now;
+
+        struct epoll_event events[STAGING_MAX_EVENTS];
+        int num_events = epoll_wait(st->epoll_fd, events, STAGING_MAX_EVENTS, (int) timeout);
+        if (num_events == -1 && errno != EINTR) return NULL;
+
+        // Connections are read before new ones are accepted, since accepting
+        // may close the oldest ones, whose events would then be stale.
+        int accepting = 0;
+        for (int i = 0; i < num_events; i++) {
+            if (events[i].data.ptr != NULL) {
+                read_conn(st, events[i].data.ptr);
+            } else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                return NULL;
+            } else {
+                accepting = 1;
+            }
+        }
+        if (accepting) accept_conns(st, conf, limiter);
+    }
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+// The soft RLIMIT_NOFILE less the descriptors workers need for clients,
+// files, logs and caches, within [STAGING_MIN_CONNS, STAGING_MAX_CONNS].
+static int max_conns(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == RLIM_INFINITY) return STAGING_MAX_CONNS;
+    if (limit.rlim_cur < STAGING_MIN_CONNS + STAGING_FD_HEADROOM) return STAGING_MIN_CONNS;
+    rlim_t available = limit.rlim_cur - STAGING_FD_HEADROOM;
+    return available < STAGING_MAX_CONNS ? (int) available : STAGING_MAX_CONNS;
+}
+
+// Starts (EPOLL_CTL_ADD) or stops (EPOLL_CTL_DEL) watching for connections.
+static void watch_server(staging * st, int op) {
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(st->epoll_fd, op, st->server_fd, &event);
+}
+
+// Accepts up to STAGING_MAX_EVENTS waiting connections and parks them,
+// reading whatever they have sent already. The listening socket is level
+// triggered, so running out of descriptors must not leave a connection
+// waiting on it: the oldest parked connection is closed to make room, or,
+// with none parked, the socket is left alone for STAGING_PAUSE_MS.
+static void accept_conns(staging * st, config * conf, rate_limiter * limiter) {
+    uint64_t now = now_ms();
+    for (int i = 0; i < STAGING_MAX_EVENTS; i++) {
+        struct sockaddr_storage peer;
+        socklen_t peer_len = sizeof(peer);
+        int cfd = accept(st->server_fd, (struct sockaddr *) &peer, &peer_len);
+        if (cfd == -1 && (errno == EMFILE || errno == ENFILE)) {
+            if (st->oldest != NULL) {
+                close_conn(st, st->oldest);
+                continue;
+            }
+            watch_server(st, EPOLL_CTL_DEL);
+            st->resume_ms = now + STAGING_PAUSE_MS;
+            return;
+        }
+        if (cfd == -1) return;
+        if (!rate_limit_admit(limiter, conf, (struct sockaddr *) &peer)) {
+            rate_limit_reject(cfd);
+            continue;
+        }
+
+        fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+        if (st->num_conns >= st->max_conns) close_conn(st, st->oldest);
+        staged_conn * conn = dc_malloc(sizeof(staged_conn));
+        conn->request = dc_malloc(sizeof(staged_request));
+        conn->request->cfd = cfd;
+        conn->request->len = 0;
+        conn->request->buf[0] = '\0';
+        conn->deadline_ms = conf->header_timeout > 0 ? now + (uint64_t) conf->header_timeout : UINT64_MAX;
+        park(st, conn);
+        read_conn(st, conn);
+    }
+}
+
+// Reads what the client has sent. Once the header is complete, or the
+// client has closed its side after sending something, the request is
+// queued to be returned; if it closed without sending anything or the
+// read failed, the connection is closed.
+static void read_conn(staging * st, staged_conn * conn) {
+    staged_request * request = conn->request;
+    while (!header_complete(request)) {
+        ssize_t num_read = read(request->cfd, request->buf + request->len, MAX_REQUEST_LEN - 1 - request->len);
+        if (num_read > 0) {
+            request->len += (size_t) num_read;
+            request->buf[request->len] = '\0';
+            continue;
+        }
+        if (num_read == 0 && request->len > 0) break;
+        if (num_read == -1 && errno == EINTR) continue;
+        if (num_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        close_conn(st, conn);
+        return;
+    }
+
+    unpark(st, conn);
+    fcntl(request->cfd, F_SETFL, fcntl(request->cfd, F_GETFL) & ~O_NONBLOCK);
+    st->ready[st->num_ready++] = request;
+}
+
+// Matches where a worker reading the header itself stops.
+static int header_complete(const staged_request * request) {
+    if (request->len >= MAX_REQUEST_LEN - 1) return 1;
+    return strstr(request->buf, "\r\n\r\n") != NULL || strstr(request->buf, "\n\n") != NULL;
+}
+
+static void park(staging * st, staged_conn * conn) {
+    conn->prev = st->newest;
+    conn->next = NULL;
+    if (st->newest != NULL) st->newest->next = conn;
+    else st->oldest = conn;
+    st->newest = conn;
+    st->num_conns++;
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+    epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, conn->request->cfd, &event);
+}
+
+// Stops watching a connection and frees its entry, but not its request.
+static void unpark(staging * st, staged_conn * conn) {
+    epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, conn->request->cfd, NULL);
+    if (conn->prev != NULL) conn->prev->next = conn->next;
+    else st->oldest = conn->next;
+    if (conn->next != NULL) conn->next->prev = conn->prev;
+    else st->newest = conn->prev;
+    st->num_conns--;
+    free(conn);
+}
+
+static void close_conn(staging * st, staged_conn * conn) {
+    staged_request * request = conn->request;
+    unpark(st, conn);
+    close(request->cfd);
+    free(request);
+}
+
+// Closes the connections that have not sent a full header in time, counting
+// them as timeouts as a worker would have.
+static void expire_conns(staging * st, uint64_t now) {
+    while (st->oldest != NULL && st->oldest->deadline_ms <= now) {
+        metrics_record_timeout();
+        close_conn(st, st->oldest);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef STAGING_H
+#define STAGING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "http.h"
+#include "rate_limit.h"
+
+#define STAGING_MAX_CONNS 4096
+#define STAGING_MIN_CONNS 16
+#define STAGING_FD_HEADROOM 256
+#define STAGING_MAX_EVENTS 64
+#define STAGING_WAIT_MS 1000
+#define STAGING_PAUSE_MS 100
+
+/**
+ * A client whose request header has arrived: the len bytes read from cfd
+ * so far, which end the header unless the client closed its side first.
+ */
+typedef struct {
+    int cfd;
+    size_t len;
+    char buf[MAX_REQUEST_LEN];
+} staged_request;
+
+/**
+ * A connection parked until its request header arrives. Connections are
+ * kept in accept order, which is also the order their deadlines expire in.
+ */
+typedef struct staged_conn {
+    staged_request * request;
+    uint64_t deadline_ms;
+    struct staged_conn * prev;
+    struct staged_conn * next;
+} staged_conn;
+
+/**
+ * The connections accepted on the server socket whose request header has
+ * not fully arrived, watched with epoll, and those ready to be dispatched.
+ * One round of events readies at most one request per event plus one per
+ * connection it accepts. At most max_conns connections are parked. While
+ * the process is out of descriptors with none parked to close, server_fd
+ * is not watched until resume_ms. Only the accepting thread uses it, so it
+ * needs no locks.
+ */
+typedef struct {
+    int epoll_fd;
+    int server_fd;
+    int max_conns;
+    uint64_t resume_ms;
+    int num_conns;
+    staged_conn * oldest;
+    staged_conn * newest;
+    staged_request * ready[2 * STAGING_MAX_EVENTS];
+    int num_ready;
+    int next_ready;
+} staging;
+
+/**
+ * Starts watching server_fd, which is made non-blocking. Where supported,
+ * TCP_DEFER_ACCEPT is set on it so the kernel itself holds connections
+ * that have sent nothing for up to header_timeout ms. Up to
+ * STAGING_MAX_CONNS connections are parked, fewer if RLIMIT_NOFILE would
+ * not leave STAGING_FD_HEADROOM descriptors to the workers and caches.
+ */
+staging * staging_create(int server_fd, int header_timeout);
+
+/**
+ * Closes every parked connection and frees the staging.
+ */
+void staging_destroy(staging * st);
+
+/**
+ * Returns the next client whose request header has been read, switched
+ * back to blocking. Accepts new connections while waiting, answering those
+ * over the rate limit with a 429, and closes those that have not sent a
+ * full header within header_timeout ms, or the oldest ones when the cap
+ * is reached or the process runs out of descriptors. If it runs out with
+ * nothing parked, accepting pauses for STAGING_PAUSE_MS rather than
+ * spinning on the listening socket. Returns NULL after STAGING_WAIT_MS with
+ * nothing ready, or once server_fd is shut down. The request is freed with
+ * free once handled.
+ */
+staged_request * staging_next(staging * st, config * conf, rate_limiter * limiter);
+
+#endif
@@ -2,38 +2,111 @@
 
 #include "./config.h"
 /**
- * The loop uses semaphores to post that a thread is ready for work then waits until a thread
- * should be woken. Once woken the thread will exit if is_running is false in the thread_pool object.
- * It will proceed to grab the client fd from the shared data then posts that it has the client fd.
- * Once it has the client fd it will handle the http request.
+ * Registers a transfer thread in the pool's metrics, access log and egress
+ * control, so the responses it sends are recorded and paced like those the
+ * workers send.
+ * @param arg - the pool
+ */
+static void register_transfer_thread(void * arg) {
+    thread_pool *pool = arg;
+    metrics_register(pool->metrics);
+    access_log_register(pool->access_log);
+    pacing_register(&pool->egress);
+}
+/**
+ * Handles a client taken from the queue: answers the request already read from
+ * it, then closes it and frees the request.
+ * @param pool
+ * @param client
+ */
+static void handle_client(thread_pool *pool, queued_client client) {
+    admission_record_wait(&pool->admission, client.accepted_us);
+    int cfd = client.request->cfd;
+
+    trace_begin_request(client.accepted_us);
+    trace_record_elapsed(TRACE_HANDOFF, admission_now_us() - client.accepted_us);
+    uint64_t config_start = trace_now();
+    config * conf = get_config(pool->cfg);
+    trace_record(TRACE_CONFIG, config_start, trace_now());
+    http_handle_request(conf, cfd, client.request->buf, client.request->len);
+    destroy_config(conf);
+
+    close(cfd);
+    free(client.request);
+    trace_end_request();
+}
+/**
+ * Takes the client at the head of the queue, if there is one, and posts that a
+ * queue slot is free. queue_depth counts the clients queued, as it is raised before
+ * the occupied semaphore is posted.
+ * @param pool
+ * @param client - set to the client taken
+ * @return true if a client was taken
+ */
+static bool take_client(thread_pool *pool, queued_client *client) {
+    shared_data *data = pool->data;
+    dc_sem_wait(&data->get_semaphore);
+    bool taken = atomic_load(&pool->admission.queue_depth) > 0;
+    if(taken) {
+        *client = data->queue[data->head];
+        data->head = (data->head + 1) % THREAD_QUEUE_LEN;
+        atomic_fetch_sub(&pool->admission.queue_depth, 1);
+    }
+    dc_sem_post(&data->get_semaphore);
+    if(taken) {
+        dc_sem_post(&data->empty_semaphore);
+    }
+    return taken;
+}
+/**
+ * The loop counts itself as idle then waits until a client is queued. Once woken the thread
+ * will take the client at the head of the queue, recording how long the client waited, and
+ * handle the request already read from it. If is_running is false in the thread_pool object,
+ * the thread instead handles the clients still queued, so none are left unanswered, then exits.
  * @param pool
  */
 static void * thread_loop(void * arg){
     thread_pool *pool = arg;
     shared_data *data = pool->data;
+    metrics_register(pool->metrics);
+    access_log_register(pool->access_log);
+    trace_register(pool->trace);
+    negative_cache_register(pool->negative_cache);
+    content_cache_register(pool->content_cache);
+    transfer_lanes_register(pool->transfers);
+    pacing_register(&pool->egress);
 
+    queued_client client;
     for(;;) {
+        atomic_fetch_add(&pool->admission.idle_workers, 1);
         dc_sem_wait(&data->occupied_semaphore);
+        atomic_fetch_sub(&pool->admission.idle_workers, 1);
         if(pool->is_running == false) {
+            while(take_client(pool, &client)) {
+                handle_client(pool, client);
+            }
             dc_sem_post(&data->killed_semaphore);
             pthread_exit(NULL);
         }
-        dc_sem_wait(&data->get_semaphore);
-        
-        int cfd = data->client_fd;
-        
-        dc_sem_post(&data->get_semaphore);
-        dc_sem_post(&data->empty_semaphore);
-
-        config * conf = get_config(pool->cfg);
-        http_handle_client(conf, cfd);
-        destroy_config(conf);
-
-        close(cfd);
+        if(take_client(pool, &client)) {
+            handle_client(pool, client);
+        }
     }
 }
 void thread_pool_start(thread_pool* pool){
     pool->is_running = true;
+    deadline_service_start();
+    metrics_register(pool->metrics);
+    trace_register(pool->trace);
+
+    config *conf = get_config(pool->cfg);
+    access_log_start(pool->access_log, conf);
+    trace_start(pool->trace, conf);
+    negative_cache_start(pool->negative_cache, conf);
+    pool->transfers = transfer_lanes_create(conf, register_transfer_thread, pool);
+    destroy_config(conf);
+    prefetch_service_start(pool->cfg, pool->negative_cache, pool->content_cache);
+
     for(int i = 0; i < NUM_THREADS; i++) {
         dc_pthread_create(&pool->threads[i], NULL, thread_loop, pool);
     }
@@ -59,13 +132,24 @@ void thread_pool_destroy(thread_pool * pool) {
     for(int i = 0; i < NUM_THREADS; i++) {
         dc_sem_wait(&data->killed_semaphore);
     }
-    
+    transfer_lanes_destroy(pool->transfers);
+    deadline_service_stop();
+    prefetch_service_stop();
+    access_log_stop(pool->access_log);
+    trace_stop(pool->trace);
+    negative_cache_stop(pool->negative_cache);
+
     dc_sem_destroy(&data->occupied_semaphore);
     dc_sem_destroy(&data->empty_semaphore);
     dc_sem_destroy(&data->put_semaphore);
     dc_sem_destroy(&data->get_semaphore);
     dc_sem_destroy(&data->killed_semaphore);
 
+    metrics_destroy(pool->metrics);
+    access_log_destroy(pool->access_log);
+    trace_destroy(pool->trace);
+    negative_cache_destroy(pool->negative_cache);
+    content_cache_destroy(pool->content_cache);
     free(data);
     free(pool);
 }
@@ -75,9 +159,23 @@ thread_pool * thread_pool_create(config *cfg) {
     shared_data *data = calloc(1, sizeof(shared_data));
     pool->is_running = false;
     pool->cfg = cfg;
+    admission_init(&pool->admission);
+    egress_init(&pool->egress);
+    pool->negative_cache = negative_cache_create();
+
+    // Every worker and transfer thread gets a slot in the metrics and the
+    // access log, as does the accepting thread in the metrics for the clients
+    // it rejects. Transfer threads are not traced.
+    config *conf = get_config(cfg);
+    int transfer_threads = config_transfer_threads(conf);
+    pool->metrics = metrics_create(NUM_THREADS + transfer_threads + 1);
+    pool->access_log = access_log_create(NUM_THREADS + transfer_threads);
+    pool->trace = trace_create(NUM_THREADS + 1);
+    pool->content_cache = content_cache_create((size_t) conf->content_cache_size);
+    destroy_config(conf);
 
     dc_sem_init(&data->occupied_semaphore, 0, 0);
-    dc_sem_init(&data->empty_semaphore, 0, 1);
+    dc_sem_init(&data->empty_semaphore, 0, THREAD_QUEUE_LEN);
     dc_sem_init(&data->put_semaphore, 0, 1);
     dc_sem_init(&data->get_semaphore, 0, 1);
     dc_sem_init(&data->killed_semaphore, 0, 0);
@@ -86,14 +184,20 @@ thread_pool * thread_pool_create(config *cfg) {
     return pool;
 }
 
-void thread_pool_notify(thread_pool* pool, int cfd){
+int thread_pool_notify(thread_pool* pool, staged_request * request, uint64_t accepted_us){
     shared_data *data;
     data = pool->data;
-    dc_sem_wait(&data->empty_semaphore);
+    if(sem_trywait(&data->empty_semaphore) == -1) {
+        return -1;
+    }
     dc_sem_wait(&data->put_semaphore);
     
-    data->client_fd = cfd;
+    data->queue[data->tail].request = request;
+    data->queue[data->tail].accepted_us = accepted_us;
+    data->tail = (data->tail + 1) % THREAD_QUEUE_LEN;
+    atomic_fetch_add(&pool->admission.queue_depth, 1);
 
     dc_sem_post(&data->put_semaphore);
     dc_sem_post(&data->occupied_semaphore);
+    return 0;
 }
\ No newline at end of file
@@ -11,16 +11,36 @@
 #include <dc/pthread.h>
 #include <dc/unistd.h>
 #include "./http.h"
+#include "./admission.h"
+#include "./access_log.h"
+#include "./trace.h"
+#include "./negative_cache.h"
+#include "./content_cache.h"
+#include "./prefetch.h"
+#include "./transfer_pool.h"
+#include "./pacing.h"
+#include "./staging.h"
 
 #define NUM_THREADS 10
+#define THREAD_QUEUE_LEN 64
 /**
- * A client fd can be passed to a thread through the use of a shared_data struct.
- * The struct contains semaphores that should be used to allow only a single
- * thread to have access to the client_fd data at a time.
+ * A client waiting in the queue for a worker thread, with the request
+ * header read for it by the staging loop.
+ */
+typedef struct {
+    staged_request * request;
+    uint64_t accepted_us;
+} queued_client;
+/**
+ * Client fds are passed to threads through a bounded queue in the shared_data struct.
+ * The struct contains semaphores that count free and occupied queue slots and
+ * allow only a single thread at a time to add or take a client.
  */
 struct shared_data
 {
-    int client_fd;
+    queued_client queue[THREAD_QUEUE_LEN];
+    unsigned int head;
+    unsigned int tail;
     sem_t occupied_semaphore;
     sem_t empty_semaphore;
     sem_t put_semaphore;
@@ -37,24 +57,36 @@ struct thread_pool {
     pthread_t threads [NUM_THREADS];
     bool is_running;
     config *cfg;
+    admission_control admission;
+    egress_control egress;
+    metrics_block *metrics;
+    access_log_block *access_log;
+    trace_block *trace;
+    negative_cache_block *negative_cache;
+    content_cache_block *content_cache;
+    transfer_lanes *transfers;
 };
 typedef struct thread_pool thread_pool;
 
 /**
  * Creates NUM_THREADS number of worker threads where each thread will wait
- * the thread_loop function. Sets running to true in the thread_pool struct
+ * the thread_loop function. Sets running to true in the thread_pool struct.
+ * The calling thread is registered as a worker in the pool's metrics so the
+ * clients it rejects are counted, and the access log flusher is started if configured.
  * @param pool
  */
 void thread_pool_start(thread_pool* pool);
 /**
  * Detaches all of the running threads. Sets running to false in the thread_pool
  * struct. Posts occupied semaphore NUM_THREADS number of times to break each
- * thread out of their wait. Where they will see running is false and pthread_exit.
+ * thread out of their wait. Where they will see running is false, handle the clients
+ * still in the queue and pthread_exit.
  * @param pool
  */
 void thread_pool_stop(thread_pool* pool);
 /**
- * Destroys the semaphores, frees the thread pool struct and its contents.
+ * Waits for the threads to exit, flushes the access log, destroys the semaphores,
+ * frees the thread pool struct and its contents.
  * @param pool
  */
 void thread_pool_destroy(thread_pool* pool);
@@ -66,12 +98,14 @@ void thread_pool_destroy(thread_pool* pool);
  */
 thread_pool * thread_pool_create(config *cfg);
 /**
- * Used to pass a client over the thread pool struct and notify a single thread that
- * it can access the client fd through the uses of semaphores.
- * @param argc
- * @param argv
- * @return
+ * Used to queue a client in the thread pool struct and notify a single thread that
+ * it can take the client through the uses of semaphores. Never blocks. Once queued,
+ * the request is closed and freed by the thread that handles it.
+ * @param pool
+ * @param request the client and the request header read from it
+ * @param accepted_us the admission_now_us time the client was dispatched
+ * @return 0 if the client was queued, -1 if the queue is full
  */
-void thread_pool_notify(thread_pool* pool, int cfd);
+int thread_pool_notify(thread_pool* pool, staged_request * request, uint64_t accepted_us);
 
 #endif
\ No newline at end of file
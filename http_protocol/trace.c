@@ -0,0 +1,256 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <dc/pthread.h>
+
+#define QUEUE_TRACK_OFFSET 1000
+
+static const char * phase_names[TRACE_NUM_PHASES] = {
+        "accept", "handoff", "get_config", "read_request",
+        "parse_request", "resolve", "send_response", "request"
+};
+
+/**
+ * The block dumped on SIGUSR1 in this process, guarded by lock so a dump
+ * never races with the pool freeing it.
+ */
+static struct {
+    pthread_mutex_t lock;
+    trace_block * active;
+    char * path;
+} dumper = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static _Thread_local trace_block * current_block;
+static _Thread_local trace_ring * current_ring;
+static _Thread_local uint64_t request_id;
+static _Thread_local uint64_t request_start_ns;
+static _Thread_local int sampled;
+
+static uint64_t mix(uint64_t value);
+static void push_event(int phase, uint64_t start_ns, uint64_t end_ns, int queue_track);
+static void write_trace_json(FILE * out, trace_block * block);
+static void * signal_loop(void * arg);
+
+size_t trace_size(int max_workers) {
+    return sizeof(trace_block) + (size_t) max_workers * sizeof(trace_ring);
+}
+
+trace_block * trace_create(int max_workers) {
+    trace_block * block = aligned_alloc(TRACE_CACHE_LINE, trace_size(max_workers));
+    if (block == NULL) {
+        perror("aligned_alloc()");
+        exit(EXIT_FAILURE);
+    }
+    trace_init(block, max_workers);
+    return block;
+}
+
+void trace_destroy(trace_block * block) {
+    if (current_block == block) {
+        current_block = NULL;
+        current_ring = NULL;
+    }
+    free(block);
+}
+
+void trace_init(trace_block * block, int max_workers) {
+    memset(block, 0, trace_size(max_workers));
+    block->max_workers = max_workers;
+}
+
+int trace_register(trace_block * block) {
+    int slot = atomic_fetch_add(&block->num_workers, 1);
+    current_block = block;
+    if (slot >= block->max_workers) {
+        current_ring = NULL;
+        fprintf(stderr, "trace: all %d rings are taken, a thread is not traced\n", block->max_workers);
+        return -1;
+    }
+    current_ring = &block->rings[slot];
+    current_ring->pid = getpid();
+    return 0;
+}
+
+void trace_start(trace_block * block, config * conf) {
+    atomic_store(&block->sample_rate, conf->trace_sample_rate);
+
+    pthread_mutex_lock(&dumper.lock);
+    dumper.active = block;
+    pthread_mutex_unlock(&dumper.lock);
+}
+
+void trace_stop(trace_block * block) {
+    atomic_store(&block->sample_rate, 0);
+
+    pthread_mutex_lock(&dumper.lock);
+    if (dumper.active == block) dumper.active = NULL;
+    pthread_mutex_unlock(&dumper.lock);
+}
+
+void trace_install_signal_handler(config * conf) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    dumper.path = strdup(conf->trace_file);
+    pthread_t thread;
+    dc_pthread_create(&thread, NULL, signal_loop, NULL);
+    dc_pthread_detach(thread);
+}
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int trace_begin_request(uint64_t accepted_us) {
+    sampled = 0;
+    if (current_block == NULL || current_ring == NULL) return 0;
+
+    int rate = atomic_load_explicit(&current_block->sample_rate, memory_order_relaxed);
+    if (rate <= 0 || mix(accepted_us) % rate != 0) return 0;
+
+    sampled = 1;
+    request_id = accepted_us;
+    request_start_ns = trace_now();
+    return 1;
+}
+
+void trace_end_request(void) {
+    if (!sampled) return;
+    push_event(TRACE_REQUEST, request_start_ns, trace_now(), 0);
+    sampled = 0;
+}
+
+void trace_record(int phase, uint64_t start_ns, uint64_t end_ns) {
+    if (!sampled) return;
+    push_event(phase, start_ns, end_ns, 0);
+}
+
+void trace_record_elapsed(int phase, uint64_t duration_us) {
+    if (!sampled) return;
+    uint64_t now = trace_now();
+    uint64_t duration_ns = duration_us * 1000;
+    push_event(phase, now > duration_ns ? now - duration_ns : 0, now, 1);
+}
+
+int trace_is_trace_uri(const char * request_uri) {
+    if (request_uri == NULL) return 0;
+
+    size_t len = strlen(TRACE_URI);
+    if (strncmp(request_uri, TRACE_URI, len) != 0) return 0;
+    return request_uri[len] == '\0' || request_uri[len] == '?';
+}
+
+char * trace_format(size_t * len) {
+    char * body = NULL;
+    size_t body_len = 0;
+    FILE * out = open_memstream(&body, &body_len);
+    write_trace_json(out, current_block);
+    fclose(out);
+
+    *len = body_len;
+    return body;
+}
+
+// splitmix64 finalizer, so consecutive accept times sample evenly.
+static uint64_t mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+// Events on the queue track are stored with the high bit of phase set.
+static void push_event(int phase, uint64_t start_ns, uint64_t end_ns, int queue_track) {
+    trace_ring * ring = current_ring;
+    uint64_t index = atomic_load_explicit(&ring->next, memory_order_relaxed);
+    trace_event * event = &ring->events[index % TRACE_RING_LEN];
+
+    atomic_store_explicit(&event->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    event->start_ns = start_ns;
+    event->end_ns = end_ns;
+    event->request_id = request_id;
+    event->phase = (uint32_t) phase | (queue_track ? 0x80000000u : 0);
+    atomic_store_explicit(&event->seq, index + 1, memory_order_release);
+    atomic_store_explicit(&ring->next, index + 1, memory_order_release);
+}
+
+// Chrome trace event format, loadable in Perfetto or chrome://tracing.
+// Workers are threads of the process they run in; each gets a second track
+// for the queue wait that precedes its requests.
+static void write_trace_json(FILE * out, trace_block * block) {
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    int first = 1;
+    int num_workers = block != NULL ? atomic_load(&block->num_workers) : 0;
+    if (block != NULL && num_workers > block->max_workers) num_workers = block->max_workers;
+
+    for (int slot = 0; slot < num_workers; slot++) {
+        trace_ring * ring = &block->rings[slot];
+        uint64_t next = atomic_load_explicit(&ring->next, memory_order_acquire);
+        uint64_t oldest = next > TRACE_RING_LEN ? next - TRACE_RING_LEN : 0;
+
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}",
+                first ? "" : ",", ring->pid, slot, slot);
+        fprintf(out, ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"worker %d queue\"}}",
+                ring->pid, slot + QUEUE_TRACK_OFFSET, slot);
+        first = 0;
+
+        for (uint64_t index = oldest; index < next; index++) {
+            trace_event * event = &ring->events[index % TRACE_RING_LEN];
+            if (atomic_load_explicit(&event->seq, memory_order_acquire) != index + 1) continue;
+
+            uint64_t start_ns = event->start_ns;
+            uint64_t end_ns = event->end_ns;
+            uint64_t request = event->request_id;
+            uint32_t phase = event->phase;
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&event->seq, memory_order_relaxed) != index + 1) continue;
+
+            int tid = (phase & 0x80000000u) ? slot + QUEUE_TRACK_OFFSET : slot;
+            phase &= 0x7fffffffu;
+            if (phase >= TRACE_NUM_PHASES) continue;
+
+            fprintf(out, ",{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                         "\"pid\":%d,\"tid\":%d,\"args\":{\"request\":%lu}}",
+                    phase_names[phase], start_ns / 1000.0, (end_ns - start_ns) / 1000.0,
+                    ring->pid, tid, (unsigned long) request);
+        }
+    }
+    fprintf(out, "]}\n");
+}
+
+static void * signal_loop(void * arg) {
+    (void) arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+
+    for (;;) {
+        int sig;
+        if (sigwait(&set, &sig) != 0) continue;
+
+        pthread_mutex_lock(&dumper.lock);
+        FILE * out = fopen(dumper.path, "w");
+        if (out == NULL) {
+            perror(dumper.path);
+        } else {
+            write_trace_json(out, dumper.active);
+            fclose(out);
+            printf("Trace written to %s\n", dumper.path);
+        }
+        pthread_mutex_unlock(&dumper.lock);
+    }
+    return NULL;
+}
@@ -0,0 +1,153 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+#define TRACE_RING_LEN 2048
+#define TRACE_CACHE_LINE 64
+#define TRACE_URI "/server-trace"
+
+/**
+ * Phases of handling a client, in the order they happen.
+ */
+#define TRACE_ACCEPT 0
+#define TRACE_HANDOFF 1
+#define TRACE_CONFIG 2
+#define TRACE_READ 3
+#define TRACE_PARSE 4
+#define TRACE_RESOLVE 5
+#define TRACE_SEND 6
+#define TRACE_REQUEST 7
+#define TRACE_NUM_PHASES 8
+
+/**
+ * One timed phase. seq is written last so a reader can detect an event that
+ * was overwritten while it was being copied.
+ */
+typedef struct {
+    atomic_uint_fast64_t seq;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t request_id;
+    uint32_t phase;
+} trace_event;
+
+/**
+ * Flight-recorder ring owned by one worker: the newest TRACE_RING_LEN events
+ * are kept and older ones are overwritten.
+ */
+typedef struct {
+    alignas(TRACE_CACHE_LINE) atomic_uint_fast64_t next;
+    int pid;
+    trace_event events[TRACE_RING_LEN];
+} trace_ring;
+
+/**
+ * Rings for every worker of a pool, with room for max_workers of them. In
+ * process mode the block lives in the pool's shared memory so it can be
+ * dumped from any process.
+ */
+typedef struct {
+    atomic_int num_workers;
+    int max_workers;
+    atomic_int sample_rate;
+    trace_ring rings[];
+} trace_block;
+
+/**
+ * Returns the size of a block with room for max_workers rings.
+ */
+size_t trace_size(int max_workers);
+
+/**
+ * Allocates a cache-line aligned block with tracing disabled and room for
+ * max_workers rings.
+ */
+trace_block * trace_create(int max_workers);
+
+/**
+ * Frees a block allocated by trace_create.
+ */
+void trace_destroy(trace_block * block);
+
+/**
+ * Resets a block of trace_size(max_workers) bytes in place, e.g. one placed
+ * in shared memory.
+ */
+void trace_init(trace_block * block, int max_workers);
+
+/**
+ * Claims the next ring in block for the calling thread. If every ring is
+ * taken, the thread is left without one and samples nothing. Returns 0, or
+ * -1 if there was no ring left.
+ */
+int trace_register(trace_block * block);
+
+/**
+ * Enables sampling of every trace_sample_rate-th request (0 disables tracing)
+ * and makes block the one dumped on SIGUSR1 in this process.
+ */
+void trace_start(trace_block * block, config * conf);
+
+/**
+ * Stops dumping block on SIGUSR1.
+ */
+void trace_stop(trace_block * block);
+
+/**
+ * Blocks SIGUSR1 in the calling thread, and so in every thread and process
+ * created from it, and starts a thread that writes the active block to
+ * trace_file whenever the process receives SIGUSR1. Call once from main
+ * before any other thread is created.
+ */
+void trace_install_signal_handler(config * conf);
+
+/**
+ * Returns the CLOCK_MONOTONIC_RAW time in nanoseconds.
+ */
+uint64_t trace_now(void);
+
+/**
+ * Starts a new request on the calling thread and decides whether it is
+ * sampled. The decision is a hash of the time the client was accepted, so
+ * the accepting thread and the worker agree on it without sharing state,
+ * and that time identifies the request in the trace. Returns whether it is
+ * sampled.
+ */
+int trace_begin_request(uint64_t accepted_us);
+
+/**
+ * Ends the current request, recording its whole span if it is sampled.
+ */
+void trace_end_request(void);
+
+/**
+ * Records a phase of the current request if it is sampled.
+ */
+void trace_record(int phase, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * Records a phase that ended now and lasted duration_us, for phases timed
+ * with another clock (e.g. the queue wait measured by admission control).
+ * These are shown on a separate track per worker since they can overlap the
+ * worker's previous request.
+ */
+void trace_record_elapsed(int phase, uint64_t duration_us);
+
+/**
+ * Returns whether the request URI addresses the trace endpoint.
+ */
+int trace_is_trace_uri(const char * request_uri);
+
+/**
+ * Formats the calling thread's block as a Chrome trace JSON document,
+ * returned in a new heap buffer of *len bytes.
+ */
+char * trace_format(size_t * len);
+
+#endif
@@ -0,0 +1,154 @@
+#include "transfer_pool.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <dc/pthread.h>
+#include <dc/stdlib.h>
+
+#define COLD_LANE_NAME "cold"
+
+static _Thread_local transfer_lanes * current_lanes;
+
+static void * transfer_loop(void * arg);
+
+transfer_pool * transfer_pool_create(int num_threads, int queue_len, void (*init_thread)(void * arg),
+                                     void * init_arg) {
+    if (num_threads < 1 || queue_len < 1) return NULL;
+    if (num_threads > TRANSFER_POOL_MAX_THREADS) num_threads = TRANSFER_POOL_MAX_THREADS;
+
+    transfer_pool * pool = calloc(1, sizeof(transfer_pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->queued, NULL);
+    pool->running = true;
+    pool->queue = dc_malloc(sizeof(transfer_job) * (size_t) queue_len);
+    pool->queue_len = queue_len;
+    pool->num_threads = num_threads;
+    pool->init_thread = init_thread;
+    pool->init_arg = init_arg;
+    for (int i = 0; i < num_threads; i++) {
+        dc_pthread_create(&pool->threads[i], NULL, transfer_loop, pool);
+    }
+    return pool;
+}
+
+void transfer_pool_destroy(transfer_pool * pool) {
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running = false;
+    pthread_cond_broadcast(&pool->queued);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->num_threads; i++) {
+        dc_pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->queued);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->queue);
+    free(pool);
+}
+
+int transfer_pool_submit(transfer_pool * pool, transfer_fn fn, void * arg) {
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->running || pool->count == pool->queue_len) {
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+    }
+    transfer_job * job = &pool->queue[(pool->head + pool->count) % pool->queue_len];
+    job->fn = fn;
+    job->arg = arg;
+    pool->count++;
+    pthread_cond_signal(&pool->queued);
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+transfer_lanes * transfer_lanes_create(config * conf, void (*init_thread)(void * arg), void * init_arg) {
+    transfer_lanes * lanes = calloc(1, sizeof(transfer_lanes));
+    lanes->num_lanes = conf->num_lanes + 1;
+
+    lane * cold = &lanes->lanes[TRANSFER_COLD_LANE];
+    cold->name = strdup(COLD_LANE_NAME);
+    cold->threads = conf->io_threads;
+    cold->queue_len = conf->io_queue_len;
+    for (int i = 0; i < conf->num_lanes; i++) {
+        lane * l = &lanes->lanes[i + 1];
+        *l = conf->lanes[i];
+        l->name = strdup(conf->lanes[i].name);
+        l->match = conf->lanes[i].match != NULL ? strdup(conf->lanes[i].match) : NULL;
+    }
+
+    for (int i = 0; i < lanes->num_lanes; i++) {
+        metrics_define_lane(i, lanes->lanes[i].name);
+        lanes->pools[i] = transfer_pool_create(lanes->lanes[i].threads, lanes->lanes[i].queue_len, init_thread,
+                                               init_arg);
+    }
+    return lanes;
+}
+
+void transfer_lanes_destroy(transfer_lanes * lanes) {
+    if (lanes == NULL) return;
+
+    for (int i = 0; i < lanes->num_lanes; i++) {
+        transfer_pool_destroy(lanes->pools[i]);
+        free(lanes->lanes[i].name);
+        free(lanes->lanes[i].match);
+    }
+    free(lanes);
+}
+
+void transfer_lanes_register(transfer_lanes * lanes) {
+    current_lanes = lanes;
+}
+
+int transfer_lanes_classify(const char * path, off_t size) {
+    transfer_lanes * lanes = current_lanes;
+    if (lanes == NULL) return -1;
+
+    for (int i = TRANSFER_COLD_LANE + 1; i < lanes->num_lanes; i++) {
+        if (lanes->pools[i] != NULL && config_lane_matches(&lanes->lanes[i], path, (long) size)) return i;
+    }
+    return -1;
+}
+
+int transfer_lanes_active(int lane) {
+    transfer_lanes * lanes = current_lanes;
+    return lanes != NULL && lane >= 0 && lane < lanes->num_lanes && lanes->pools[lane] != NULL;
+}
+
+int transfer_lanes_limit(int lane) {
+    if (!transfer_lanes_active(lane)) return 0;
+    return current_lanes->pools[lane]->num_threads + current_lanes->pools[lane]->queue_len;
+}
+
+int transfer_lanes_submit(int lane, transfer_fn fn, void * arg) {
+    if (!transfer_lanes_active(lane)) return 0;
+    return transfer_pool_submit(current_lanes->pools[lane], fn, arg);
+}
+
+// Runs jobs until the pool is stopped and its queue is empty, so nothing
+// accepted is dropped.
+static void * transfer_loop(void * arg) {
+    transfer_pool * pool = arg;
+    if (pool->init_thread != NULL) pool->init_thread(pool->init_arg);
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->count == 0 && pool->running) {
+            pthread_cond_wait(&pool->queued, &pool->lock);
+        }
+        if (pool->count == 0) break;
+
+        transfer_job job = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->queue_len;
+        pool->count--;
+        pthread_mutex_unlock(&pool->lock);
+
+        job.fn(job.arg);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
@@ -0,0 +1,119 @@
+#ifndef TRANSFER_POOL_H
+#define TRANSFER_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+#define TRANSFER_POOL_MAX_THREADS 16
+#define TRANSFER_COLD_LANE 0
+#define TRANSFER_MAX_LANES (MAX_LANES + 1)
+
+typedef void (*transfer_fn)(void * arg);
+
+/**
+ * A transfer waiting for an I/O thread: fn is called with arg.
+ */
+typedef struct {
+    transfer_fn fn;
+    void * arg;
+} transfer_job;
+
+/**
+ * A bounded set of threads that take over transfers likely to take long,
+ * such as sending a file that is not in the page cache, so the request
+ * workers stay free for the rest. Jobs wait in a ring of queue_len; once
+ * it is full, the pool takes no more.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    bool running;
+    transfer_job * queue;
+    int queue_len;
+    int head;
+    int count;
+    int num_threads;
+    pthread_t threads[TRANSFER_POOL_MAX_THREADS];
+    void (*init_thread)(void * arg);
+    void * init_arg;
+} transfer_pool;
+
+/**
+ * The transfer pools of a process, one per lane. The cold lane, made of
+ * io_threads threads, takes files found not to be in the page cache; the
+ * configured lanes follow it in order. Lanes are fixed when the set is
+ * created, and a lane without threads has no pool.
+ */
+typedef struct {
+    int num_lanes;
+    lane lanes[TRANSFER_MAX_LANES];
+    transfer_pool * pools[TRANSFER_MAX_LANES];
+} transfer_lanes;
+
+/**
+ * Starts a pool of num_threads threads (at most TRANSFER_POOL_MAX_THREADS)
+ * with room for queue_len waiting jobs. Each thread first calls
+ * init_thread(init_arg), e.g. to register the worker's metrics and access
+ * log. Returns NULL if num_threads or queue_len is less than 1.
+ */
+transfer_pool * transfer_pool_create(int num_threads, int queue_len, void (*init_thread)(void * arg),
+                                     void * init_arg);
+
+/**
+ * Runs the jobs still queued, stops the threads and frees the pool. Does
+ * nothing if pool is NULL.
+ */
+void transfer_pool_destroy(transfer_pool * pool);
+
+/**
+ * Queues fn(arg) on the pool. Returns 1 if it was queued, or 0 if the
+ * pool's queue is full, leaving the transfer to the caller.
+ */
+int transfer_pool_submit(transfer_pool * pool, transfer_fn fn, void * arg);
+
+/**
+ * Starts a pool for the cold lane and for each lane in conf, and names the
+ * lanes in the calling thread's metrics. init_thread and init_arg are
+ * passed to every pool.
+ */
+transfer_lanes * transfer_lanes_create(config * conf, void (*init_thread)(void * arg), void * init_arg);
+
+/**
+ * Destroys every pool of the set and frees it. Does nothing if lanes is
+ * NULL.
+ */
+void transfer_lanes_destroy(transfer_lanes * lanes);
+
+/**
+ * Sets the lanes the calling thread hands responses to. lanes may be NULL.
+ */
+void transfer_lanes_register(transfer_lanes * lanes);
+
+/**
+ * Returns the first configured lane of the calling thread's set that a
+ * response for path with a body of size bytes belongs to, or -1 if none.
+ */
+int transfer_lanes_classify(const char * path, off_t size);
+
+/**
+ * Returns whether the calling thread's set has a pool for lane.
+ */
+int transfer_lanes_active(int lane);
+
+/**
+ * Returns how many responses a lane of the calling thread's set may have
+ * in flight across every process: its threads plus its queue_len, as in a
+ * single process.
+ */
+int transfer_lanes_limit(int lane);
+
+/**
+ * Queues fn(arg) on a lane of the calling thread's set. Returns 1 if it
+ * was queued, or 0 if the lane has no pool or its queue is full.
+ */
+int transfer_lanes_submit(int lane, transfer_fn fn, void * arg);
+
+#endif
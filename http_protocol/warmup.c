@@ -0,0 +1,325 @@
+#include "warmup.h"
+#include "encoding.h"
+#include "http.h"
+#include "resolve.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <dc/pthread.h>
+#include <dc/stdlib.h>
+
+/**
+ * A directory waiting to be walked, relative to the root ("" for the root).
+ */
+typedef struct queued_dir {
+    struct queued_dir * next;
+    char path[];
+} queued_dir;
+
+/**
+ * The state the walking threads share. dirs is a stack of directories not
+ * yet walked and busy the number of threads walking one; the walk is done
+ * when both are empty. The warmup's counters are updated under lock.
+ */
+typedef struct {
+    config * conf;
+    content_cache_block * content_cache;
+    uint64_t deadline_ms;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    queued_dir * dirs;
+    int busy;
+    bool expired;
+    warmup * warm;
+} walk;
+
+static void * walk_loop(void * arg);
+static void walk_dir(walk * w, const char * dir_path);
+static void push_dir(walk * w, const char * path);
+static void warm_file(walk * w, int dir_fd, const char * name, const char * path, const struct stat * st);
+static int build_responses(config * conf, const char * path);
+static void lock_file(walk * w, int dir_fd, const char * name, const struct stat * st);
+static int in_lock_set(const char * lock_set, const char * path);
+static void advise_archive(config * conf, warmup * warm);
+static uint64_t now_ms(void);
+
+warmup * warmup_run(config * conf, content_cache_block * content_cache) {
+    warmup * warm = calloc(1, sizeof(warmup));
+    uint64_t started_ms = now_ms();
+
+    if (conf->archive[0] != '\0') {
+        advise_archive(conf, warm);
+        warm->complete = true;
+        warm->elapsed_ms = now_ms() - started_ms;
+        return warm;
+    }
+
+    walk w;
+    w.conf = conf;
+    w.content_cache = content_cache;
+    w.deadline_ms = started_ms + (uint64_t) conf->warmup_budget;
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.changed, NULL);
+    w.dirs = NULL;
+    w.busy = 0;
+    w.expired = false;
+    w.warm = warm;
+    push_dir(&w, "");
+
+    int num_threads = conf->warmup_threads;
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > WARMUP_MAX_THREADS) num_threads = WARMUP_MAX_THREADS;
+    pthread_t threads[WARMUP_MAX_THREADS];
+    for (int i = 0; i < num_threads; i++) dc_pthread_create(&threads[i], NULL, walk_loop, &w);
+    for (int i = 0; i < num_threads; i++) dc_pthread_join(threads[i], NULL);
+
+    while (w.dirs != NULL) {
+        queued_dir * dir = w.dirs;
+        w.dirs = dir->next;
+        free(dir);
+    }
+    pthread_cond_destroy(&w.changed);
+    pthread_mutex_destroy(&w.lock);
+
+    warm->complete = !w.expired;
+    warm->elapsed_ms = now_ms() - started_ms;
+    return warm;
+}
+
+void warmup_report(const warmup * warm, FILE * out) {
+    fprintf(out, "Warmed %d files in %llu ms%s: %d advised (%llu KiB), %d responses built, %d locked (%llu KiB)",
+            warm->num_files, (unsigned long long) warm->elapsed_ms, warm->complete ? "" : ", budget exceeded",
+            warm->num_advised, (unsigned long long) (warm->bytes_advised / 1024), warm->num_responses,
+            warm->num_locked, (unsigned long long) (warm->bytes_locked / 1024));
+    if (warm->num_lock_failures > 0) fprintf(out, ", %d could not be locked", warm->num_lock_failures);
+    fprintf(out, "\n");
+    fflush(out);
+}
+
+void warmup_release(warmup * warm) {
+    if (warm == NULL) return;
+    for (int i = 0; i < warm->num_locked; i++) {
+        munlock(warm->locks[i].addr, warm->locks[i].len);
+        munmap(warm->locks[i].addr, warm->locks[i].len);
+    }
+    free(warm->locks);
+    free(warm);
+}
+
+// Takes directories off the stack until the walk is done or out of time.
+static void * walk_loop(void * arg) {
+    walk * w = arg;
+    content_cache_register(w->content_cache);
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->dirs == NULL && w->busy > 0 && !w->expired) pthread_cond_wait(&w->changed, &w->lock);
+        if (w->dirs == NULL || w->expired) break;
+
+        queued_dir * dir = w->dirs;
+        w->dirs = dir->next;
+        w->busy++;
+        pthread_mutex_unlock(&w->lock);
+
+        walk_dir(w, dir->path);
+        free(dir);
+
+        pthread_mutex_lock(&w->lock);
+        w->busy--;
+        if (w->busy == 0 && w->dirs == NULL) pthread_cond_broadcast(&w->changed);
+    }
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+    content_cache_register(NULL);
+    return NULL;
+}
+
+// Warms the files of a directory and queues its subdirectories. Symbolic
+// links are not followed, so the walk cannot loop.
+static void walk_dir(walk * w, const char * dir_path) {
+    char full_path[MAX_URI_PATH_LEN * 2];
+    snprintf(full_path, sizeof(full_path), "%s/%s", w->conf->root_dir, dir_path);
+    DIR * dir = opendir(full_path);
+    if (dir == NULL) return;
+
+    struct dirent * entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (now_ms() >= w->deadline_ms) {
+            pthread_mutex_lock(&w->lock);
+            w->expired = true;
+            pthread_cond_broadcast(&w->changed);
+            pthread_mutex_unlock(&w->lock);
+            break;
+        }
+
+        char path[MAX_URI_PATH_LEN];
+        int len = snprintf(path, sizeof(path), "%s%s%s", dir_path, dir_path[0] != '\0' ? "/" : "", entry->d_name);
+        if (len < 0 || (size_t) len >= sizeof(path)) continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) continue;
+        if (S_ISDIR(st.st_mode)) {
+            push_dir(w, path);
+        } else if (S_ISREG(st.st_mode)) {
+            warm_file(w, dirfd(dir), entry->d_name, path, &st);
+        }
+    }
+    closedir(dir);
+}
+
+static void push_dir(walk * w, const char * path) {
+    size_t len = strlen(path);
+    queued_dir * dir = dc_malloc(sizeof(queued_dir) + len + 1);
+    memcpy(dir->path, path, len + 1);
+
+    pthread_mutex_lock(&w->lock);
+    dir->next = w->dirs;
+    w->dirs = dir;
+    pthread_cond_signal(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Advises a small enough file into the page cache, builds its responses and
+// locks it if it is in the hot set. Precompressed siblings are advised but
+// get no responses of their own, as building the file's covers them.
+static void warm_file(walk * w, int dir_fd, const char * name, const char * path, const struct stat * st) {
+    int advised = 0;
+    if (st->st_size > 0 && st->st_size <= w->conf->warmup_max_size) {
+        int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+        if (fd != -1) {
+            advised = posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0;
+            close(fd);
+        }
+    }
+
+    int is_sibling = 0;
+    size_t path_len = strlen(path);
+    for (int e = 0; e < ENCODING_COUNT; e++) {
+        const char * suffix = encoding_suffix(e);
+        size_t suffix_len = strlen(suffix);
+        if (path_len > suffix_len && strcmp(path + path_len - suffix_len, suffix) == 0) is_sibling = 1;
+    }
+    int num_responses = is_sibling ? 0 : build_responses(w->conf, path);
+
+    if (in_lock_set(w->conf->warmup_lock, path)) lock_file(w, dir_fd, name, st);
+
+    pthread_mutex_lock(&w->lock);
+    w->warm->num_files++;
+    if (advised) {
+        w->warm->num_advised++;
+        w->warm->bytes_advised += (uint64_t) st->st_size;
+    }
+    w->warm->num_responses += num_responses;
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Builds the responses a client would get for path, as is and in each
+// coding, through the same path requests take. Returns how many succeeded.
+static int build_responses(config * conf, const char * path) {
+    char uri[MAX_URI_PATH_LEN];
+    if (resolve_escape(path, uri, sizeof(uri)) == -1) return 0;
+
+    int num_built = 0;
+    for (int e = -1; e < ENCODING_COUNT; e++) {
+        char request_text[MAX_REQUEST_LEN];
+        int len = e == -1
+                ? snprintf(request_text, sizeof(request_text), "GET /%s HTTP/1.0\r\n\r\n", uri)
+                : snprintf(request_text, sizeof(request_text), "GET /%s HTTP/1.0\r\nAccept-Encoding: %s\r\n\r\n",
+                           uri, encoding_name(e));
+        if (len < 0 || (size_t) len >= sizeof(request_text)) continue;
+
+        http_request * request = parse_request(request_text, (size_t) len);
+        http_response * response = build_response(conf, request);
+        if (response->response_code == HTTP_OK) num_built++;
+        http_response_destroy(response);
+        http_request_destroy(request);
+    }
+    return num_built;
+}
+
+// Maps the file and locks its pages in memory. Failures, e.g. past
+// RLIMIT_MEMLOCK, are counted for the report.
+static void lock_file(walk * w, int dir_fd, const char * name, const struct stat * st) {
+    if (st->st_size == 0) return;
+    void * addr = MAP_FAILED;
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        addr = mmap(NULL, (size_t) st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (addr != MAP_FAILED && mlock(addr, (size_t) st->st_size) == -1) {
+        munmap(addr, (size_t) st->st_size);
+        addr = MAP_FAILED;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    warmup * warm = w->warm;
+    if (addr != MAP_FAILED && warm->num_locked == warm->max_locks) {
+        int max_locks = warm->max_locks > 0 ? warm->max_locks * 2 : 16;
+        warmup_lock * locks = realloc(warm->locks, max_locks * sizeof(warmup_lock));
+        if (locks != NULL) {
+            warm->locks = locks;
+            warm->max_locks = max_locks;
+        } else {
+            munmap(addr, (size_t) st->st_size);
+            addr = MAP_FAILED;
+        }
+    }
+    if (addr == MAP_FAILED) {
+        warm->num_lock_failures++;
+    } else {
+        warm->locks[warm->num_locked].addr = addr;
+        warm->locks[warm->num_locked].len = (size_t) st->st_size;
+        warm->num_locked++;
+        warm->bytes_locked += (uint64_t) st->st_size;
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Whether path, relative to the root, matches an entry of lock_set: a
+// "/prefix", an ".ext" (case-insensitive) or "*", as cache policies match.
+static int in_lock_set(const char * lock_set, const char * path) {
+    size_t path_len = strlen(path);
+    const char * entry = lock_set;
+    while (*entry != '\0') {
+        const char * end = strchr(entry, ';');
+        size_t len = end != NULL ? (size_t) (end - entry) : strlen(entry);
+
+        if (len == 1 && entry[0] == '*') return 1;
+        if (len > 0 && entry[0] == '/' && len - 1 <= path_len && strncmp(path, entry + 1, len - 1) == 0) return 1;
+        if (len > 0 && entry[0] == '.' && len <= path_len && strncasecmp(path + path_len - len, entry, len) == 0) {
+            return 1;
+        }
+        if (end == NULL) break;
+        entry = end + 1;
+    }
+    return 0;
+}
+
+static void advise_archive(config * conf, warmup * warm) {
+    int fd = open(conf->archive, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0) {
+        warm->num_files = 1;
+        warm->num_advised = 1;
+        warm->bytes_advised = (uint64_t) st.st_size;
+    }
+    close(fd);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
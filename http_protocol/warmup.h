@@ -0,0 +1,65 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "content_cache.h"
+
+#define WARMUP_MAX_THREADS 32
+
+/**
+ * A file mapped and locked into memory by warmup, so its pages stay in the
+ * page cache while the server runs.
+ */
+typedef struct {
+    void * addr;
+    size_t len;
+} warmup_lock;
+
+/**
+ * What a warmup did. Files up to warmup_max_size were advised into the page
+ * cache, and responses built for every file, in each coding, to fill the
+ * header and content caches. complete is false if the time budget ran out
+ * before the walk finished.
+ */
+typedef struct {
+    int num_files;
+    int num_advised;
+    uint64_t bytes_advised;
+    int num_responses;
+    int num_locked;
+    uint64_t bytes_locked;
+    int num_lock_failures;
+    uint64_t elapsed_ms;
+    bool complete;
+    warmup_lock * locks;
+    int max_locks;
+} warmup;
+
+/**
+ * Walks root_dir with warmup_threads threads for at most warmup_budget
+ * milliseconds, warming the page cache, the dentry cache, this process's
+ * header cache and content_cache (which may be NULL). Files matching
+ * warmup_lock, a ';'-separated list of path prefixes and extensions, are
+ * locked into memory. When serving from an archive, the archive is advised
+ * into the page cache instead. Runs before the workers are started, so
+ * forked workers inherit the warm header cache.
+ */
+warmup * warmup_run(config * conf, content_cache_block * content_cache);
+
+/**
+ * Prints a one-line readiness report of a warmup to out.
+ */
+void warmup_report(const warmup * warm, FILE * out);
+
+/**
+ * Unlocks and unmaps the files a warmup locked and frees it. Does nothing
+ * if warm is NULL.
+ */
+void warmup_release(warmup * warm);
+
+#endif
@@ -0,0 +1,113 @@
+#include "histogram.h"
+
+#define HIST_MAX_VALUE ((1ULL << HIST_MAX_BITS) - 1)
+
+static unsigned int bucket_index(uint64_t value);
+static uint64_t bucket_highest_value(unsigned int index);
+static void add_relaxed(atomic_uint_fast64_t * counter, uint64_t amount);
+
+void hist_reset(histogram * hist) {
+    atomic_store(&hist->total_count, 0);
+    atomic_store(&hist->total_sum, 0);
+    atomic_store(&hist->max_value, 0);
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        atomic_store(&hist->counts[i], 0);
+    }
+}
+
+void hist_record(histogram * hist, uint64_t value) {
+    hist_record_n(hist, value, 1);
+}
+
+void hist_record_n(histogram * hist, uint64_t value, uint64_t count) {
+    if (value > HIST_MAX_VALUE) value = HIST_MAX_VALUE;
+
+    add_relaxed(&hist->counts[bucket_index(value)], count);
+    add_relaxed(&hist->total_count, count);
+    add_relaxed(&hist->total_sum, value * count);
+
+    if (value > atomic_load_explicit(&hist->max_value, memory_order_relaxed)) {
+        atomic_store_explicit(&hist->max_value, value, memory_order_relaxed);
+    }
+}
+
+void hist_record_corrected(histogram * hist, uint64_t value, uint64_t expected_interval) {
+    hist_record(hist, value);
+    if (expected_interval == 0 || value <= expected_interval) return;
+
+    for (uint64_t missing = value - expected_interval; missing >= expected_interval; missing -= expected_interval) {
+        hist_record(hist, missing);
+    }
+}
+
+void hist_merge(histogram * into, histogram * from) {
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        add_relaxed(&into->counts[i], atomic_load_explicit(&from->counts[i], memory_order_relaxed));
+    }
+    add_relaxed(&into->total_count, atomic_load_explicit(&from->total_count, memory_order_relaxed));
+    add_relaxed(&into->total_sum, atomic_load_explicit(&from->total_sum, memory_order_relaxed));
+
+    uint64_t from_max = atomic_load_explicit(&from->max_value, memory_order_relaxed);
+    if (from_max > atomic_load_explicit(&into->max_value, memory_order_relaxed)) {
+        atomic_store_explicit(&into->max_value, from_max, memory_order_relaxed);
+    }
+}
+
+uint64_t hist_count(histogram * hist) {
+    return atomic_load_explicit(&hist->total_count, memory_order_relaxed);
+}
+
+uint64_t hist_max(histogram * hist) {
+    return atomic_load_explicit(&hist->max_value, memory_order_relaxed);
+}
+
+double hist_mean(histogram * hist) {
+    uint64_t count = hist_count(hist);
+    if (count == 0) return 0;
+    return (double) atomic_load_explicit(&hist->total_sum, memory_order_relaxed) / count;
+}
+
+uint64_t hist_percentile(histogram * hist, double percentile) {
+    uint64_t count = hist_count(hist);
+    if (count == 0) return 0;
+    if (percentile > 100) percentile = 100;
+
+    uint64_t target = (uint64_t) (percentile / 100 * count + 0.5);
+    if (target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+        if (seen >= target) {
+            uint64_t highest = bucket_highest_value(i);
+            uint64_t max = hist_max(hist);
+            return highest < max ? highest : max;
+        }
+    }
+    return hist_max(hist);
+}
+
+// Values below HIST_SUB_COUNT get a bucket each. Above that, each power of two
+// [2^e, 2^(e+1)) is split into HIST_HALF_COUNT buckets of width 2^shift.
+static unsigned int bucket_index(uint64_t value) {
+    if (value < HIST_SUB_COUNT) return (unsigned int) value;
+
+    unsigned int exponent = 63 - __builtin_clzll(value);
+    unsigned int shift = exponent - (HIST_SUB_BITS - 1);
+    unsigned int sub_bucket = (unsigned int) (value >> shift) - HIST_HALF_COUNT;
+    return HIST_SUB_COUNT + (shift - 1) * HIST_HALF_COUNT + sub_bucket;
+}
+
+static uint64_t bucket_highest_value(unsigned int index) {
+    if (index < HIST_SUB_COUNT) return index;
+
+    unsigned int offset = index - HIST_SUB_COUNT;
+    unsigned int shift = offset / HIST_HALF_COUNT + 1;
+    uint64_t sub_bucket = offset % HIST_HALF_COUNT + HIST_HALF_COUNT;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+static void add_relaxed(atomic_uint_fast64_t * counter, uint64_t amount) {
+    uint64_t current = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, current + amount, memory_order_relaxed);
+}
@@ -0,0 +1,82 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define HIST_SUB_BITS 7
+#define HIST_MAX_BITS 40
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_HALF_COUNT (1 << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS (HIST_SUB_COUNT + (HIST_MAX_BITS - HIST_SUB_BITS) * HIST_HALF_COUNT)
+
+/**
+ * HDR-style log-linear histogram. Every power of two is split into
+ * HIST_HALF_COUNT linear buckets, so recorded values keep roughly two
+ * significant digits (at most 1/64 relative error) from 0 up to 2^HIST_MAX_BITS.
+ * Values above that are clamped into the last bucket.
+ *
+ * A histogram has a single writer. Recording uses relaxed atomic loads and
+ * stores rather than read-modify-write instructions, so it costs no more
+ * than a plain increment while still letting other threads or processes read
+ * consistent counts at any time.
+ */
+typedef struct {
+    atomic_uint_fast64_t total_count;
+    atomic_uint_fast64_t total_sum;
+    atomic_uint_fast64_t max_value;
+    atomic_uint_fast64_t counts[HIST_BUCKETS];
+} histogram;
+
+/**
+ * Clears all recorded values.
+ */
+void hist_reset(histogram * hist);
+
+/**
+ * Records a single value. Must only be called by the histogram's writer.
+ */
+void hist_record(histogram * hist, uint64_t value);
+
+/**
+ * Records value count times. Must only be called by the histogram's writer.
+ */
+void hist_record_n(histogram * hist, uint64_t value, uint64_t count);
+
+/**
+ * Records value, and if it is larger than expected_interval also the values
+ * a client sending every expected_interval would have seen while it was
+ * stalled (value - expected_interval, value - 2 * expected_interval, ...,
+ * down to expected_interval).
+ * This corrects for coordinated omission in closed-loop measurements. An
+ * expected_interval of 0 records value alone.
+ */
+void hist_record_corrected(histogram * hist, uint64_t value, uint64_t expected_interval);
+
+/**
+ * Adds every value recorded in from to into. into must not have another writer.
+ */
+void hist_merge(histogram * into, histogram * from);
+
+/**
+ * Returns the number of recorded values.
+ */
+uint64_t hist_count(histogram * hist);
+
+/**
+ * Returns the largest recorded value.
+ */
+uint64_t hist_max(histogram * hist);
+
+/**
+ * Returns the mean of the recorded values.
+ */
+double hist_mean(histogram * hist);
+
+/**
+ * Returns the value at the given percentile (0-100), reported as the highest
+ * value equivalent to the bucket it falls in.
+ */
+uint64_t hist_percentile(histogram * hist, double percentile);
+
+#endif
@@ -0,0 +1,122 @@
+#include <stddef.h>
+
+#include "timer_wheel.h"
+
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_MAX_DELTA ((1ULL << (TW_LEVEL_BITS * TW_LEVELS)) - 1)
+
+static void list_init(tw_timer * head);
+static void list_append(tw_timer * head, tw_timer * timer);
+static void list_splice(tw_timer * from, tw_timer * to);
+static void tw_add(timer_wheel * wheel, tw_timer * timer);
+static unsigned int tw_cascade(timer_wheel * wheel, int level);
+
+void tw_init(timer_wheel * wheel, uint64_t now) {
+    wheel->current_tick = now;
+    for (int level = 0; level < TW_LEVELS; level++) {
+        for (int slot = 0; slot < TW_SLOTS; slot++) {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+}
+
+void tw_arm(timer_wheel * wheel, tw_timer * timer, uint64_t expires) {
+    tw_cancel(timer);
+    timer->expires = expires;
+    tw_add(wheel, timer);
+}
+
+void tw_cancel(tw_timer * timer) {
+    if (timer->next == NULL) return;
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+// Same scheme as the classic Linux timer wheel: level 0 is drained one slot
+// per tick, and whenever its index wraps the next level's current slot is
+// cascaded down.
+void tw_advance(timer_wheel * wheel, uint64_t now) {
+    while (wheel->current_tick <= now) {
+        unsigned int index = wheel->current_tick & TW_MASK;
+
+        for (int level = 1; index == 0 && level < TW_LEVELS; level++) {
+            index = tw_cascade(wheel, level);
+        }
+
+        tw_timer expired;
+        list_init(&expired);
+        list_splice(&wheel->slots[0][wheel->current_tick & TW_MASK], &expired);
+        wheel->current_tick++;
+
+        while (expired.next != &expired) {
+            tw_timer * timer = expired.next;
+            tw_cancel(timer);
+            timer->callback(timer);
+        }
+    }
+}
+
+static void tw_add(timer_wheel * wheel, tw_timer * timer) {
+    uint64_t expires = timer->expires;
+    uint64_t current = wheel->current_tick;
+
+    if (expires < current) {
+        list_append(&wheel->slots[0][current & TW_MASK], timer);
+        return;
+    }
+
+    uint64_t delta = expires - current;
+    if (delta > TW_MAX_DELTA) {
+        delta = TW_MAX_DELTA;
+        expires = current + delta;
+    }
+
+    int level = 0;
+    while (delta >= (1ULL << (TW_LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+
+    unsigned int slot = (expires >> (TW_LEVEL_BITS * level)) & TW_MASK;
+    list_append(&wheel->slots[level][slot], timer);
+}
+
+static unsigned int tw_cascade(timer_wheel * wheel, int level) {
+    unsigned int index = (wheel->current_tick >> (TW_LEVEL_BITS * level)) & TW_MASK;
+
+    tw_timer pending;
+    list_init(&pending);
+    list_splice(&wheel->slots[level][index], &pending);
+
+    while (pending.next != &pending) {
+        tw_timer * timer = pending.next;
+        tw_cancel(timer);
+        tw_add(wheel, timer);
+    }
+
+    return index;
+}
+
+static void list_init(tw_timer * head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_append(tw_timer * head, tw_timer * timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void list_splice(tw_timer * from, tw_timer * to) {
+    if (from->next == from) return;
+
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    list_init(from);
+}
@@ -0,0 +1,56 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+#define TW_LEVEL_BITS 6
+#define TW_SLOTS (1 << TW_LEVEL_BITS)
+#define TW_LEVELS 4
+
+typedef struct tw_timer tw_timer;
+
+/**
+ * A single timer. Timers are intrusive: the owner embeds a tw_timer in its
+ * own struct and recovers it in the callback. A timer must be zeroed (or
+ * cancelled) before it is armed for the first time.
+ */
+struct tw_timer {
+    tw_timer * next;
+    tw_timer * prev;
+    uint64_t expires;
+    void (*callback)(tw_timer * timer);
+};
+
+/**
+ * Hierarchical timing wheel with TW_LEVELS levels of TW_SLOTS slots each.
+ * Level n has a resolution of TW_SLOTS^n ticks. Timers further away than the
+ * wheel can represent are clamped to its furthest slot.
+ */
+typedef struct {
+    uint64_t current_tick;
+    tw_timer slots[TW_LEVELS][TW_SLOTS];
+} timer_wheel;
+
+/**
+ * Initializes an empty wheel whose clock starts at now.
+ */
+void tw_init(timer_wheel * wheel, uint64_t now);
+
+/**
+ * Arms timer to fire at the absolute tick expires. If the timer is already
+ * armed it is moved. Runs in O(1).
+ */
+void tw_arm(timer_wheel * wheel, tw_timer * timer, uint64_t expires);
+
+/**
+ * Disarms timer if it is armed. Runs in O(1).
+ */
+void tw_cancel(tw_timer * timer);
+
+/**
+ * Advances the wheel clock to now, invoking the callback of every timer that
+ * expired along the way. Callbacks may re-arm or cancel any timer.
+ */
+void tw_advance(timer_wheel * wheel, uint64_t now);
+
+#endif
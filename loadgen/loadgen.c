@@ -0,0 +1,665 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include <dc/pthread.h>
+#include <dc/stdlib.h>
+
+#include "../libs/histogram.h"
+#include "url_mix.h"
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "80"
+#define DEFAULT_THREADS 2
+#define DEFAULT_CONNECTIONS 16
+#define DEFAULT_DURATION 10
+#define DEFAULT_TIMEOUT 5000
+#define DEFAULT_MIX "default"
+
+#define MAX_REQUEST_LEN 512
+#define MAX_HEADER_LEN 8192
+#define READ_BUFFER_LEN 65536
+#define MAX_EVENTS 64
+#define NS_PER_US 1000
+#define NS_PER_SEC 1000000000ULL
+
+#define CONN_IDLE 0
+#define CONN_CONNECTING 1
+#define CONN_SENDING 2
+#define CONN_READING 3
+
+/**
+ * Command line options.
+ */
+typedef struct {
+    char * host;
+    char * port;
+    int threads;
+    int connections;
+    int duration;
+    double rate;
+    bool keep_alive;
+    uint64_t expected_interval_us;
+    int timeout_ms;
+    char * mix_spec;
+    bool json;
+} loadgen_options;
+
+/**
+ * One client connection. In open-loop mode scheduled_ns is when its next
+ * request is due, whether or not the previous one has finished; latency is
+ * measured from then, so a stalled server is charged for the requests it
+ * delayed as well as the one it was slow on.
+ */
+typedef struct {
+    int fd;
+    int state;
+    uint64_t scheduled_ns;
+    uint64_t sent_ns;
+    char request[MAX_REQUEST_LEN];
+    size_t request_len;
+    size_t request_sent;
+    char header[MAX_HEADER_LEN];
+    size_t header_len;
+    bool header_done;
+    int status;
+    long content_length;
+    uint64_t body_received;
+    bool reusable;
+    bool reused;
+} connection;
+
+/**
+ * Per thread results, merged once every thread has finished.
+ */
+typedef struct {
+    histogram latency_us;
+    histogram service_us;
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t status[6];
+    uint64_t errors;
+    uint64_t timeouts;
+    uint64_t connects;
+} loadgen_stats;
+
+typedef struct {
+    loadgen_options * options;
+    struct addrinfo * address;
+    url_mix * mix;
+    pthread_barrier_t * barrier;
+    uint64_t * start_ns;
+    int num_connections;
+    int first_connection;
+    uint64_t interval_ns;
+    uint64_t random_state;
+    loadgen_stats * stats;
+} loadgen_thread;
+
+static void parse_options(loadgen_options * options, int argc, char ** argv);
+static void usage(const char * name, int status);
+static void * thread_loop(void * arg);
+static void issue_request(loadgen_thread * thread, connection * conn, int epoll_fd, uint64_t now);
+static void start_connect(loadgen_thread * thread, connection * conn, int epoll_fd);
+static void handle_writable(loadgen_thread * thread, connection * conn, int epoll_fd);
+static void handle_readable(loadgen_thread * thread, connection * conn, int epoll_fd, char * buffer, uint64_t now);
+static void consume(connection * conn, const char * data, size_t len);
+static void parse_header(connection * conn);
+static void complete_request(loadgen_thread * thread, connection * conn, int epoll_fd, uint64_t now);
+static void fail_request(loadgen_thread * thread, connection * conn, int epoll_fd, uint64_t now, bool timed_out);
+static void close_connection(connection * conn, int epoll_fd);
+static void schedule_next(loadgen_thread * thread, connection * conn, int epoll_fd, uint64_t now);
+static void arm_timer(loadgen_thread * thread, connection * conns, int timer_fd, uint64_t end_ns);
+static void report(loadgen_options * options, loadgen_stats * stats, double elapsed);
+static uint64_t now_ns(void);
+static uint64_t next_random(uint64_t * state);
+
+int main(int argc, char ** argv) {
+    loadgen_options options;
+    parse_options(&options, argc, argv);
+
+    url_mix * mix = url_mix_create(options.mix_spec);
+    if (mix == NULL) return EXIT_FAILURE;
+
+    struct addrinfo hints;
+    struct addrinfo * address;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int gai_status = getaddrinfo(options.host, options.port, &hints, &address);
+    if (gai_status != 0) {
+        fprintf(stderr, "%s:%s: %s\n", options.host, options.port, gai_strerror(gai_status));
+        return EXIT_FAILURE;
+    }
+
+    pthread_t * threads = dc_malloc(options.threads * sizeof(pthread_t));
+    loadgen_thread * args = dc_malloc(options.threads * sizeof(loadgen_thread));
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, options.threads + 1);
+    uint64_t start_ns = 0;
+    uint64_t interval_ns = options.rate > 0 ? (uint64_t) (options.connections * (double) NS_PER_SEC / options.rate) : 0;
+
+    int first_connection = 0;
+    for (int i = 0; i < options.threads; i++) {
+        loadgen_thread * thread = &args[i];
+        thread->options = &options;
+        thread->address = address;
+        thread->mix = mix;
+        thread->barrier = &barrier;
+        thread->start_ns = &start_ns;
+        thread->num_connections = options.connections / options.threads + (i < options.connections % options.threads);
+        thread->first_connection = first_connection;
+        thread->interval_ns = interval_ns;
+        thread->random_state = 0x9e3779b97f4a7c15ULL * (i + 1) ^ (uint64_t) getpid();
+        thread->stats = aligned_alloc(64, sizeof(loadgen_stats));
+        if (thread->stats == NULL) {
+            perror("aligned_alloc()");
+            exit(EXIT_FAILURE);
+        }
+        memset(thread->stats, 0, sizeof(loadgen_stats));
+        first_connection += thread->num_connections;
+        dc_pthread_create(&threads[i], NULL, thread_loop, thread);
+    }
+
+    start_ns = now_ns();
+    pthread_barrier_wait(&barrier);
+
+    loadgen_stats * total = aligned_alloc(64, sizeof(loadgen_stats));
+    if (total == NULL) {
+        perror("aligned_alloc()");
+        exit(EXIT_FAILURE);
+    }
+    memset(total, 0, sizeof(loadgen_stats));
+    for (int i = 0; i < options.threads; i++) {
+        dc_pthread_join(threads[i], NULL);
+        loadgen_stats * stats = args[i].stats;
+        hist_merge(&total->latency_us, &stats->latency_us);
+        hist_merge(&total->service_us, &stats->service_us);
+        total->requests += stats->requests;
+        total->bytes += stats->bytes;
+        for (int s = 0; s < 6; s++) total->status[s] += stats->status[s];
+        total->errors += stats->errors;
+        total->timeouts += stats->timeouts;
+        total->connects += stats->connects;
+        free(stats);
+    }
+    double elapsed = (double) (now_ns() - start_ns) / NS_PER_SEC;
+    report(&options, total, elapsed);
+    int status = total->requests > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    free(total);
+    free(args);
+    free(threads);
+    pthread_barrier_destroy(&barrier);
+    freeaddrinfo(address);
+    url_mix_destroy(mix);
+    return status;
+}
+
+static void parse_options(loadgen_options * options, int argc, char ** argv) {
+    memset(options, 0, sizeof(loadgen_options));
+    options->host = DEFAULT_HOST;
+    options->port = DEFAULT_PORT;
+    options->threads = DEFAULT_THREADS;
+    options->connections = DEFAULT_CONNECTIONS;
+    options->duration = DEFAULT_DURATION;
+    options->timeout_ms = DEFAULT_TIMEOUT;
+    options->mix_spec = DEFAULT_MIX;
+
+    struct option long_options[] = {
+            {"host",              required_argument, 0, 'H'},
+            {"port",              required_argument, 0, 'p'},
+            {"threads",           required_argument, 0, 't'},
+            {"connections",       required_argument, 0, 'c'},
+            {"duration",          required_argument, 0, 'd'},
+            {"rate",              required_argument, 0, 'r'},
+            {"keep-alive",        no_argument,       0, 'k'},
+            {"expected-interval", required_argument, 0, 'i'},
+            {"timeout",           required_argument, 0, 'T'},
+            {"mix",               required_argument, 0, 'm'},
+            {"json",              no_argument,       0, 'j'},
+            {"help",              no_argument,       0, 'h'},
+            {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "H:p:t:c:d:r:ki:T:m:jh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'H': options->host = optarg; break;
+            case 'p': options->port = optarg; break;
+            case 't': options->threads = atoi(optarg); break;
+            case 'c': options->connections = atoi(optarg); break;
+            case 'd': options->duration = atoi(optarg); break;
+            case 'r': options->rate = atof(optarg); break;
+            case 'k': options->keep_alive = true; break;
+            case 'i': options->expected_interval_us = strtoull(optarg, NULL, 10); break;
+            case 'T': options->timeout_ms = atoi(optarg); break;
+            case 'm': options->mix_spec = optarg; break;
+            case 'j': options->json = true; break;
+            case 'h': usage(argv[0], EXIT_SUCCESS); break;
+            default: usage(argv[0], EXIT_FAILURE);
+        }
+    }
+
+    if (options->threads <= 0 || options->connections <= 0 || options->duration <= 0 ||
+        options->rate < 0 || options->timeout_ms <= 0) {
+        usage(argv[0], EXIT_FAILURE);
+    }
+    if (options->threads > options->connections) options->threads = options->connections;
+}
+
+static void usage(const char * name, int status) {
+    FILE * out = status == EXIT_SUCCESS ? stdout : stderr;
+    fprintf(out, "Usage: %s [options]\n\n", name);
+    fprintf(out, "%s", "-H HOST, --host=HOST                 Server host (default 127.0.0.1).\n");
+    fprintf(out, "%s", "-p PORT, --port=PORT                 Server port (default 80).\n");
+    fprintf(out, "%s", "-t N,    --threads=N                 Client threads (default 2).\n");
+    fprintf(out, "%s", "-c N,    --connections=N             Concurrent connections over all threads (default 16).\n");
+    fprintf(out, "%s", "-d SEC,  --duration=SEC              Test duration in seconds (default 10).\n");
+    fprintf(out, "%s", "-r RATE, --rate=RATE                 Open loop: send RATE requests/s in total on a fixed\n");
+    fprintf(out, "%s", "                                     schedule. Without it every connection sends its next\n");
+    fprintf(out, "%s", "                                     request as soon as the last one finishes (closed loop).\n");
+    fprintf(out, "%s", "-k,      --keep-alive                Reuse connections when the server allows it.\n");
+    fprintf(out, "%s", "-i US,   --expected-interval=US      Closed loop: correct latencies for coordinated omission\n");
+    fprintf(out, "%s", "                                     assuming a request was due every US microseconds.\n");
+    fprintf(out, "%s", "-T MS,   --timeout=MS                Request timeout in ms (default 5000).\n");
+    fprintf(out, "%s", "-m MIX,  --mix=MIX                   URL mix: default, pages, images, notfound, or a list\n");
+    fprintf(out, "%s", "                                     like /index.html=3,/cat.jpg,/missing.html.\n");
+    fprintf(out, "%s", "-j,      --json                      Print the report as JSON.\n");
+    exit(status);
+}
+
+static void * thread_loop(void * arg) {
+    loadgen_thread * thread = arg;
+    connection * conns = dc_malloc(thread->num_connections * sizeof(connection));
+    char * buffer = dc_malloc(READ_BUFFER_LEN);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd == -1 || timer_fd == -1) {
+        perror("epoll_create1() / timerfd_create()");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event timer_event = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &timer_event);
+
+    pthread_barrier_wait(thread->barrier);
+    uint64_t start = *thread->start_ns;
+    uint64_t end_ns = start + (uint64_t) thread->options->duration * NS_PER_SEC;
+
+    // Open loop connections are staggered so the total rate is even.
+    for (int i = 0; i < thread->num_connections; i++) {
+        connection * conn = &conns[i];
+        memset(conn, 0, sizeof(connection));
+        conn->fd = -1;
+        conn->state = CONN_IDLE;
+        conn->scheduled_ns = start + thread->interval_ns * (thread->first_connection + i) / thread->options->connections;
+        if (conn->scheduled_ns <= start) issue_request(thread, conn, epoll_fd, start);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    uint64_t now = now_ns();
+    while (now < end_ns) {
+        arm_timer(thread, conns, timer_fd, end_ns);
+        int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        now = now_ns();
+        if (num_events == -1 && errno != EINTR) {
+            perror("epoll_wait()");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < num_events; i++) {
+            connection * conn = events[i].data.ptr;
+            if (conn == NULL) {
+                uint64_t expirations;
+                while (read(timer_fd, &expirations, sizeof(expirations)) > 0);
+                continue;
+            }
+            if (conn->state == CONN_IDLE) {
+                // The server closed a kept-alive connection between requests.
+                close_connection(conn, epoll_fd);
+            } else if (conn->state == CONN_CONNECTING || conn->state == CONN_SENDING) {
+                handle_writable(thread, conn, epoll_fd);
+            } else if (conn->state == CONN_READING) {
+                handle_readable(thread, conn, epoll_fd, buffer, now);
+            }
+        }
+
+        uint64_t timeout_ns = (uint64_t) thread->options->timeout_ms * 1000000;
+        for (int i = 0; i < thread->num_connections && now < end_ns; i++) {
+            connection * conn = &conns[i];
+            if (conn->state == CONN_IDLE && conn->scheduled_ns <= now) {
+                issue_request(thread, conn, epoll_fd, now);
+            } else if (conn->state != CONN_IDLE && now - conn->sent_ns >= timeout_ns) {
+                fail_request(thread, conn, epoll_fd, now, true);
+            }
+        }
+    }
+
+    for (int i = 0; i < thread->num_connections; i++) {
+        if (conns[i].fd != -1) close(conns[i].fd);
+    }
+    close(timer_fd);
+    close(epoll_fd);
+    free(buffer);
+    free(conns);
+    return NULL;
+}
+
+static void issue_request(loadgen_thread * thread, connection * conn, int epoll_fd, uint64_t now) {
+    const char * path = url_mix_pick(thread->mix, next_random(&thread->random_state));
+    if (thread->options->keep_alive) {
+        conn->request_len = snprintf(conn->request, MAX_REQUEST_LEN,
+                                     "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n",
+                                     path, thread->options->host);
+    } else {
+        conn->request_len = snprintf(conn->request, MAX_REQUEST_LEN,
+                                     "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                                     path, thread->options->host);
+    }
+    conn->request_sent = 0;
+    conn->header_len = 0;
+    conn->header_done = false;
+    conn->status = 0;
+    conn->content_length = -1;
+    conn->body_received = 0;
+    conn->sent_ns = now;
+    if (thread->interval_ns == 0) conn->scheduled_ns = now;
+
+    conn->reused = conn->fd != -1;
+    if (conn->fd == -1) {
+        start_connect(thread, conn, epoll_fd);
+        return;
+    }
+    conn->state = CONN_SENDING;
+    struct epoll_event event = { .events = EPOLLOUT, .data.ptr = conn };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    handle_writable(thread, conn, epoll_fd);
+}
+
+static void start_connect(loadgen_thread * thread, connection * conn, int epoll_fd) {
+    struct addrinfo * address = thread->address;
+    conn->fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+    if (conn->fd == -1) {
+        perror("socket()");
+        exit(EXIT_FAILURE);
+    }
+    int optval = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    thread->stats->connects++;
+
+    conn->state = CONN_CONNECTING;
+    struct epoll_event event = { .events = EPOLLOUT, .data.ptr = conn };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+    if (connect(conn->fd, address->ai_addr, address->ai_addrlen) == -1 && errno != EINPROGRESS) {
+        fail_request(thread, conn, epoll_fd, now_ns(), false);
+    }
+}
+
+static void handle_writable(loadgen_thread * thread, connection * conn, int epoll_fd) {
+    if (conn->state == CONN_CONNECTING) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        if (error != 0) {
+            fail_request(thread, conn, epoll_fd, now_ns(), false);
+            return;
+        }
+        conn->state = CONN_SENDING;
+    }
+
+    while (conn->request_sent < conn->request_len) {
+        ssize_t num_written = send(conn->fd, conn->request + conn->request_sent,
+                                   conn->request_len - conn->request_sent, MSG_NOSIGNAL);
+        if (num_written == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            fail_request(thread, conn, epoll_fd, now_ns(), false);
+            return;
+        }
+        conn->request_sent += num_written;
+    }
+
+    conn->state = CONN_READING;
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+static void handle_readable(loadgen_thread * thread, connection * conn, int epoll_fd, char * buffer, uint64_t now) {
+    for (;;) {
+        ssize_t num_read = recv(conn->fd, buffer, READ_BUFFER_LEN, 0);
+        if (num_read == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            fail_request(thread, conn, epoll_fd, now, false);
+            return;
+        }
+        if (num_read == 0) {
+            // Without a Content-Length the body ends when the server closes.
+            conn->reusable = false;
+            if (conn->header_done && conn->content_length == -1) {
+                complete_request(thread, conn, epoll_fd, now);
+            } else {
+                fail_request(thread, conn, epoll_fd, now, false);
+            }
+            return;
+        }
+
+        thread->stats->bytes += num_read;
+        consume(conn, buffer, num_read);
+        if (conn->header_done && conn->content_length >= 0 &&
+            conn->body_received >= (uint64_t) conn->content_length) {
+            complete_request(thread, conn, epoll_fd, now);
+            return;
+        }
+        if (!conn->header_done && conn->header_len == MAX_HEADER_LEN) {
+            fail_request(thread, conn, epoll_fd, now, false);
+            return;
+        }
+    }
+}
+
+// Collects bytes until the end of the header, then only counts body bytes.
+static void consume(connection * conn, const char * data, size_t len) {
+    if (conn->header_done) {
+        conn->body_received += len;
+        return;
+    }
+
+    size_t copy = len < MAX_HEADER_LEN - conn->header_len ? len : MAX_HEADER_LEN - conn->header_len;
+    memcpy(conn->header + conn->header_len, data, copy);
+    size_t search_from = conn->header_len > 3 ? conn->header_len - 3 : 0;
+    conn->header_len += copy;
+
+    for (size_t i = search_from; i + 3 < conn->header_len; i++) {
+        if (memcmp(conn->header + i, "\r\n\r\n", 4) == 0) {
+            size_t header_end = i + 4;
+            conn->header[i] = '\0';
+            conn->header_done = true;
+            conn->body_received = (conn->header_len - header_end) + (len - copy);
+            parse_header(conn);
+            return;
+        }
+    }
+}
+
+static void parse_header(connection * conn) {
+    int minor_version = 0;
+    if (sscanf(conn->header, "HTTP/1.%d %d", &minor_version, &conn->status) != 2) {
+        conn->status = 0;
+    }
+    conn->reusable = minor_version >= 1;
+
+    char * save_ptr;
+    strtok_r(conn->header, "\r\n", &save_ptr);
+    for (char * line = strtok_r(NULL, "\r\n", &save_ptr); line != NULL; line = strtok_r(NULL, "\r\n", &save_ptr)) {
+        char * value = strchr(line, ':');
+        if (value == NULL) continue;
+        *value++ = '\0';
+        while (*value == ' ' || *value == '\t') value++;
+
+        if (strcasecmp(line, "Content-Length") == 0) {
+            conn->content_length = strtol(value, NULL, 10);
+        } else if (strcasecmp(line, "Connection") == 0) {
+            if (strcasecmp(value, "close") == 0) conn->reusable = false;
+            if (strcasecmp(value, "keep-alive") == 0) conn->reusable = true;
+        }
+    }
+}
+
+static void complete_request(loadgen_thread * thread, connection * conn, int epoll_fd, uint64_t now) {
+    loadgen_stats * stats = thread->stats;
+    stats->requests++;
+    int status_class = conn->status / 100;
+    stats->status[status_class >= 1 && status_class <= 5 ? status_class : 0]++;
+
+    uint64_t latency_us = (now - conn->scheduled_ns) / NS_PER_US;
+    hist_record(&stats->service_us, (now - conn->sent_ns) / NS_PER_US);
+    if (thread->interval_ns == 0) {
+        hist_record_corrected(&stats->latency_us, latency_us, thread->options->expected_interval_us);
+    } else {
+        hist_record(&stats->latency_us, latency_us);
+    }
+
+    if (!thread->options->keep_alive || !conn->reusable) close_connection(conn, epoll_fd);
+    schedule_next(thread, conn, epoll_fd, now);
+    if (conn->scheduled_ns <= now) issue_request(thread, conn, epoll_fd, now);
+}
+
+static void fail_request(loadgen_thread * thread, connection * conn, int epoll_fd, uint64_t now, bool timed_out) {
+    // A reused connection the server closed before answering is retried on
+    // a fresh one, the way browsers retry idempotent requests.
+    if (!timed_out && conn->reused && conn->header_len == 0) {
+        close_connection(conn, epoll_fd);
+        conn->reused = false;
+        conn->request_sent = 0;
+        start_connect(thread, conn, epoll_fd);
+        return;
+    }
+
+    if (timed_out) {
+        thread->stats->timeouts++;
+    } else {
+        thread->stats->errors++;
+    }
+    close_connection(conn, epoll_fd);
+    schedule_next(thread, conn, epoll_fd, now);
+    // Back off briefly in closed loop so a refused connect does not spin.
+    if (thread->interval_ns == 0) conn->scheduled_ns = now + 10 * 1000000;
+}
+
+static void close_connection(connection * conn, int epoll_fd) {
+    if (conn->fd != -1) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    conn->state = CONN_IDLE;
+}
+
+static void schedule_next(loadgen_thread * thread, connection * conn, int epoll_fd, uint64_t now) {
+    conn->state = CONN_IDLE;
+    if (conn->fd != -1) {
+        struct epoll_event event = { .events = 0, .data.ptr = conn };
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    }
+    conn->scheduled_ns = thread->interval_ns == 0 ? now : conn->scheduled_ns + thread->interval_ns;
+}
+
+// Wakes the thread for the earliest scheduled request, request timeout or
+// the end of the test, whichever comes first.
+static void arm_timer(loadgen_thread * thread, connection * conns, int timer_fd, uint64_t end_ns) {
+    uint64_t timeout_ns = (uint64_t) thread->options->timeout_ms * 1000000;
+    uint64_t wake_ns = end_ns;
+    for (int i = 0; i < thread->num_connections; i++) {
+        uint64_t due = conns[i].state == CONN_IDLE ? conns[i].scheduled_ns : conns[i].sent_ns + timeout_ns;
+        if (due < wake_ns) wake_ns = due;
+    }
+    if (wake_ns == 0) wake_ns = 1;
+
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = (time_t) (wake_ns / NS_PER_SEC);
+    timer.it_value.tv_nsec = (long) (wake_ns % NS_PER_SEC);
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+static void report(loadgen_options * options, loadgen_stats * stats, double elapsed) {
+    histogram * latency = &stats->latency_us;
+    histogram * service = &stats->service_us;
+    double throughput = stats->requests / elapsed;
+    const char * mode = options->rate > 0 ? "open" : "closed";
+
+    if (options->json) {
+        printf("{\"mode\":\"%s\",\"rate\":%.1f,\"threads\":%d,\"connections\":%d,\"keep_alive\":%s,"
+               "\"mix\":\"%s\",\"duration_s\":%.3f,",
+               mode, options->rate, options->threads, options->connections,
+               options->keep_alive ? "true" : "false", options->mix_spec, elapsed);
+        printf("\"requests\":%lu,\"requests_per_s\":%.1f,\"bytes\":%lu,\"connects\":%lu,"
+               "\"errors\":%lu,\"timeouts\":%lu,",
+               (unsigned long) stats->requests, throughput, (unsigned long) stats->bytes,
+               (unsigned long) stats->connects, (unsigned long) stats->errors, (unsigned long) stats->timeouts);
+        printf("\"status\":{\"1xx\":%lu,\"2xx\":%lu,\"3xx\":%lu,\"4xx\":%lu,\"5xx\":%lu,\"other\":%lu},",
+               (unsigned long) stats->status[1], (unsigned long) stats->status[2], (unsigned long) stats->status[3],
+               (unsigned long) stats->status[4], (unsigned long) stats->status[5], (unsigned long) stats->status[0]);
+        histogram * hists[] = { latency, service };
+        const char * names[] = { "latency_us", "service_us" };
+        for (int i = 0; i < 2; i++) {
+            printf("\"%s\":{\"mean\":%.1f,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p999\":%lu,\"max\":%lu}%s",
+                   names[i], hist_mean(hists[i]),
+                   (unsigned long) hist_percentile(hists[i], 50), (unsigned long) hist_percentile(hists[i], 90),
+                   (unsigned long) hist_percentile(hists[i], 99), (unsigned long) hist_percentile(hists[i], 99.9),
+                   (unsigned long) hist_max(hists[i]), i == 0 ? "," : "}\n");
+        }
+        return;
+    }
+
+    printf("%s loop", mode);
+    if (options->rate > 0) printf(" at %.1f requests/s", options->rate);
+    printf(", %d connections on %d threads, keep-alive %s, mix %s\n",
+           options->connections, options->threads, options->keep_alive ? "on" : "off", options->mix_spec);
+    printf("%lu requests in %.2f s: %.1f requests/s, %.2f MB/s\n",
+           (unsigned long) stats->requests, elapsed, throughput, stats->bytes / elapsed / (1024 * 1024));
+    printf("status 2xx %lu, 3xx %lu, 4xx %lu, 5xx %lu, other %lu\n",
+           (unsigned long) stats->status[2], (unsigned long) stats->status[3], (unsigned long) stats->status[4],
+           (unsigned long) stats->status[5], (unsigned long) (stats->status[0] + stats->status[1]));
+    printf("connects %lu, errors %lu, timeouts %lu\n",
+           (unsigned long) stats->connects, (unsigned long) stats->errors, (unsigned long) stats->timeouts);
+    printf("\n%-28s %10s %10s %10s %10s %10s %10s\n", "", "mean", "p50", "p90", "p99", "p99.9", "max");
+    printf("%-28s %10.1f %10lu %10lu %10lu %10lu %10lu\n",
+           options->rate > 0 || options->expected_interval_us > 0 ? "latency (corrected, us)" : "latency (us)",
+           hist_mean(latency), (unsigned long) hist_percentile(latency, 50),
+           (unsigned long) hist_percentile(latency, 90), (unsigned long) hist_percentile(latency, 99),
+           (unsigned long) hist_percentile(latency, 99.9), (unsigned long) hist_max(latency));
+    printf("%-28s %10.1f %10lu %10lu %10lu %10lu %10lu\n", "service time (us)",
+           hist_mean(service), (unsigned long) hist_percentile(service, 50),
+           (unsigned long) hist_percentile(service, 90), (unsigned long) hist_percentile(service, 99),
+           (unsigned long) hist_percentile(service, 99.9), (unsigned long) hist_max(service));
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// xorshift64*, seeded per thread.
+static uint64_t next_random(uint64_t * state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
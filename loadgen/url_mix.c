@@ -0,0 +1,107 @@
+#include "url_mix.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dc/stdlib.h>
+
+static const char * presets[][2] = {
+        { "default",
+                "/index.html=10,/dogs.html=10,/cat.jpg=5,/dog.jpg=5,"
+                "/img/dogs/dog00.jpg=2,/img/dogs/dog01.jpg=2,/img/dogs/dog02.jpg=2,/img/dogs/dog03.jpg=2,"
+                "/img/dogs/dog04.jpg=2,/img/dogs/dog05.jpg=2,/img/dogs/dog06.jpg=2,/img/dogs/dog07.jpg=2,"
+                "/img/dogs/dog08.jpg=2,/img/dogs/dog09.jpg=2,/img/dogs/dog10.jpg=2,/img/dogs/dog11.jpg=2,"
+                "/img/dogs/dog12.jpg=2,/img/dogs/dog13.jpg=2,/img/dogs/dog14.jpg=2,"
+                "/missing.html=3,/img/dogs/dog15.jpg=2,/favicon.ico=3" },
+        { "pages", "/index.html,/dogs.html" },
+        { "images",
+                "/cat.jpg,/dog.jpg,"
+                "/img/dogs/dog00.jpg,/img/dogs/dog01.jpg,/img/dogs/dog02.jpg,/img/dogs/dog03.jpg,"
+                "/img/dogs/dog04.jpg,/img/dogs/dog05.jpg,/img/dogs/dog06.jpg,/img/dogs/dog07.jpg,"
+                "/img/dogs/dog08.jpg,/img/dogs/dog09.jpg,/img/dogs/dog10.jpg,/img/dogs/dog11.jpg,"
+                "/img/dogs/dog12.jpg,/img/dogs/dog13.jpg,/img/dogs/dog14.jpg" },
+        { "notfound", "/missing.html,/img/dogs/dog15.jpg,/favicon.ico,/a/b/c.html" },
+};
+
+static int parse_entry(char * token, url_mix_entry * entry);
+
+url_mix * url_mix_create(const char * spec) {
+    for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+        if (strcmp(spec, presets[i][0]) == 0) {
+            spec = presets[i][1];
+            break;
+        }
+    }
+
+    size_t capacity = 1;
+    for (const char * c = spec; *c != '\0'; c++) {
+        if (*c == ',') capacity++;
+    }
+
+    url_mix * mix = dc_malloc(sizeof(url_mix));
+    mix->entries = dc_malloc(capacity * sizeof(url_mix_entry));
+    mix->cumulative = dc_malloc(capacity * sizeof(uint64_t));
+    mix->size = 0;
+    mix->total_weight = 0;
+
+    char * copy = strdup(spec);
+    char * save_ptr;
+    for (char * token = strtok_r(copy, ",", &save_ptr); token != NULL; token = strtok_r(NULL, ",", &save_ptr)) {
+        url_mix_entry * entry = &mix->entries[mix->size];
+        if (parse_entry(token, entry) == -1) {
+            fprintf(stderr, "invalid url mix entry: %s\n", token);
+            free(copy);
+            url_mix_destroy(mix);
+            return NULL;
+        }
+        mix->total_weight += entry->weight;
+        mix->cumulative[mix->size] = mix->total_weight;
+        mix->size++;
+    }
+    free(copy);
+
+    if (mix->size == 0 || mix->total_weight == 0) {
+        fprintf(stderr, "url mix is empty\n");
+        url_mix_destroy(mix);
+        return NULL;
+    }
+    return mix;
+}
+
+void url_mix_destroy(url_mix * mix) {
+    free(mix->entries);
+    free(mix->cumulative);
+    free(mix);
+}
+
+const char * url_mix_pick(url_mix * mix, uint64_t random) {
+    uint64_t target = random % mix->total_weight;
+    size_t low = 0;
+    size_t high = mix->size - 1;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (mix->cumulative[mid] > target) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return mix->entries[low].path;
+}
+
+static int parse_entry(char * token, url_mix_entry * entry) {
+    char * weight = strchr(token, '=');
+    entry->weight = 1;
+    if (weight != NULL) {
+        *weight++ = '\0';
+        char * end;
+        unsigned long value = strtoul(weight, &end, 10);
+        if (*weight == '\0' || *end != '\0' || value > UINT32_MAX) return -1;
+        entry->weight = (uint32_t) value;
+    }
+
+    if (token[0] != '/' || strlen(token) >= URL_MIX_MAX_PATH) return -1;
+    strcpy(entry->path, token);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef URL_MIX_H
+#define URL_MIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define URL_MIX_MAX_PATH 256
+
+/**
+ * A path requested with the given relative weight.
+ */
+typedef struct {
+    char path[URL_MIX_MAX_PATH];
+    uint32_t weight;
+} url_mix_entry;
+
+/**
+ * A weighted set of paths. cumulative[i] is the sum of the weights of
+ * entries 0..i, so a path is picked with one binary search.
+ */
+typedef struct {
+    url_mix_entry * entries;
+    uint64_t * cumulative;
+    size_t size;
+    uint64_t total_weight;
+} url_mix;
+
+/**
+ * Creates a mix from a preset name or a spec.
+ * Presets (matching the files in server_directory):
+ *   default  - pages, images and 404s in roughly browser proportions
+ *   pages    - index.html and dogs.html
+ *   images   - cat.jpg, dog.jpg and the 15 dog gallery images
+ *   notfound - paths that do not exist
+ * A spec is a comma separated list of PATH[=WEIGHT], e.g.
+ * "/index.html=3,/cat.jpg,/missing.html". Weights default to 1.
+ * @param spec - the preset name or spec
+ * @return the mix, or NULL if the spec is invalid
+ */
+url_mix * url_mix_create(const char * spec);
+
+/**
+ * Frees a mix.
+ * @param mix - the mix
+ */
+void url_mix_destroy(url_mix * mix);
+
+/**
+ * Picks a path.
+ * @param mix - the mix
+ * @param random - a uniformly distributed random number
+ * @return the path
+ */
+const char * url_mix_pick(url_mix * mix, uint64_t random);
+
+#endif
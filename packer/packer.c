@@ -0,0 +1,367 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <dc/stdlib.h>
+
+#include "../http_protocol/archive.h"
+#include "../http_protocol/compression.h"
+#include "../http_protocol/encoding.h"
+#include "../http_protocol/mime.h"
+
+#define DEFAULT_MIN_SIZE 256
+#define MAX_OPEN_DIRS 64
+#define GZIP_LEVEL 9
+#define ZSTD_LEVEL 19
+#define MAX_TYPES 64
+
+/**
+ * A regular file found under the root.
+ */
+typedef struct {
+    char * path;
+    struct stat st;
+    int sibling_of;
+} packed_file;
+
+static struct {
+    char * root;
+    size_t root_len;
+    struct stat output_st;
+    int output_exists;
+    packed_file * files;
+    size_t num_files;
+    size_t cap_files;
+} walk;
+
+static void usage(const char * program, int status);
+static int visit(const char * fpath, const struct stat * st, int type, struct FTW * ftw);
+static int compare_files(const void * a, const void * b);
+static long find_file(const char * path);
+static void mark_siblings(void);
+static char * read_file(const char * path, size_t len);
+static uint64_t place(uint64_t * pos, uint64_t len);
+static void write_at(int fd, const void * buf, size_t len, uint64_t offset);
+static size_t add_string(char ** strings, size_t * len, size_t * cap, const char * string);
+static const char * relative(const packed_file * file);
+
+int main(int argc, char ** argv) {
+    long min_size = DEFAULT_MIN_SIZE;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:h")) != -1) {
+        switch (opt) {
+            case 'm': min_size = atol(optarg); break;
+            case 'h': usage(argv[0], EXIT_SUCCESS); break;
+            default: usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 2) usage(argv[0], EXIT_FAILURE);
+    walk.root = strdup(argv[optind]);
+    walk.root_len = strlen(walk.root);
+    while (walk.root_len > 1 && walk.root[walk.root_len - 1] == '/') walk.root[--walk.root_len] = '\0';
+    const char * output = argv[optind + 1];
+    walk.output_exists = stat(output, &walk.output_st) == 0;
+
+    if (nftw(walk.root, visit, MAX_OPEN_DIRS, FTW_PHYS) == -1) {
+        perror(walk.root);
+        return EXIT_FAILURE;
+    }
+    qsort(walk.files, walk.num_files, sizeof(packed_file), compare_files);
+    mark_siblings();
+
+    uint32_t num_entries = 0;
+    for (size_t i = 0; i < walk.num_files; i++) {
+        if (walk.files[i].sibling_of == -1) num_entries++;
+    }
+    uint32_t num_slots = 1;
+    while (num_slots < 2 * num_entries + 1) num_slots *= 2;
+
+    // The string table is sized before any body is written, so the index
+    // length, and with it where the bodies start, is known up front.
+    size_t strings_len = 0;
+    size_t strings_cap = 4096;
+    char * strings = dc_malloc(strings_cap);
+    archive_entry * entries = calloc(num_entries, sizeof(archive_entry));
+    uint32_t * slots = calloc(num_slots, sizeof(uint32_t));
+    long * entry_files = dc_malloc(sizeof(long) * (num_entries + 1));
+    // Types come from the MIME table, so they are shared by pointer.
+    const char * types[MAX_TYPES];
+    size_t type_offsets[MAX_TYPES];
+    int num_types = 0;
+
+    uint32_t e = 0;
+    for (size_t i = 0; i < walk.num_files; i++) {
+        if (walk.files[i].sibling_of != -1) continue;
+        packed_file * file = &walk.files[i];
+        archive_entry * entry = &entries[e];
+        const char * path = relative(file);
+        const char * type = mime_type(path, strlen(path));
+
+        entry->path_len = (uint32_t) strlen(path);
+        entry->hash = archive_hash(path, entry->path_len);
+        entry->path_offset = (uint32_t) add_string(&strings, &strings_len, &strings_cap, path);
+        entry->type_len = (uint32_t) strlen(type);
+        int t = 0;
+        while (t < num_types && types[t] != type) t++;
+        if (t == num_types) {
+            types[num_types] = type;
+            type_offsets[num_types++] = add_string(&strings, &strings_len, &strings_cap, type);
+        }
+        entry->type_offset = (uint32_t) type_offsets[t];
+        entry->mtime_sec = file->st.st_mtim.tv_sec;
+        entry->mtime_nsec = file->st.st_mtim.tv_nsec;
+        entry_files[e] = (long) i;
+
+        uint32_t slot = (uint32_t) entry->hash & (num_slots - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (num_slots - 1);
+        slots[slot] = ++e;
+    }
+
+    archive_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = ARCHIVE_VERSION;
+    header.num_entries = num_entries;
+    header.num_slots = num_slots;
+    header.slots_offset = sizeof(archive_header);
+    header.entries_offset = (header.slots_offset + (uint64_t) num_slots * sizeof(uint32_t) + 7) & ~(uint64_t) 7;
+    header.strings_offset = header.entries_offset + (uint64_t) num_entries * sizeof(archive_entry);
+    header.strings_len = strings_len;
+    header.data_offset = (header.strings_offset + strings_len + ARCHIVE_PAGE - 1) & ~(uint64_t) (ARCHIVE_PAGE - 1);
+
+    char * tmp_path;
+    if (asprintf(&tmp_path, "%s.tmp", output) == -1) return EXIT_FAILURE;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror(tmp_path);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t pos = header.data_offset;
+    uint64_t identity_bytes = 0;
+    uint64_t coded_bytes = 0;
+    int num_variants = 0;
+    for (uint32_t i = 0; i < num_entries; i++) {
+        archive_entry * entry = &entries[i];
+        packed_file * file = &walk.files[entry_files[i]];
+        size_t len = file->st.st_size;
+        char * body = read_file(file->path, len);
+        if (body == NULL) {
+            perror(file->path);
+            unlink(tmp_path);
+            return EXIT_FAILURE;
+        }
+
+        entry->etag = archive_hash(body, len);
+        entry->len[ARCHIVE_IDENTITY] = len;
+        entry->offset[ARCHIVE_IDENTITY] = place(&pos, len);
+        write_at(fd, body, len, entry->offset[ARCHIVE_IDENTITY]);
+        identity_bytes += len;
+
+        const mime_entry * mime = mime_lookup(relative(file), strlen(relative(file)));
+        if (mime != NULL && mime->compressible && (long) len >= min_size) {
+            for (int encoding = 0; encoding < ENCODING_COUNT; encoding++) {
+                // A fresh precompressed sibling is used as it is; otherwise the
+                // packer compresses the file itself if it can.
+                char sibling_path[PATH_MAX];
+                snprintf(sibling_path, sizeof(sibling_path), "%s%s", file->path, encoding_suffix(encoding));
+                long sibling = find_file(sibling_path);
+                char * coded = NULL;
+                size_t coded_len = 0;
+                if (sibling != -1 && walk.files[sibling].sibling_of == entry_files[i]) {
+                    coded_len = walk.files[sibling].st.st_size;
+                    coded = read_file(sibling_path, coded_len);
+                } else if (compression_supported(encoding)) {
+                    int level = encoding == ENCODING_ZSTD ? ZSTD_LEVEL : GZIP_LEVEL;
+                    coded = compression_compress(encoding, level, body, len, &coded_len);
+                }
+
+                if (coded != NULL && coded_len > 0 && coded_len < len) {
+                    entry->len[encoding + 1] = coded_len;
+                    entry->offset[encoding + 1] = place(&pos, coded_len);
+                    write_at(fd, coded, coded_len, entry->offset[encoding + 1]);
+                    coded_bytes += coded_len;
+                    num_variants++;
+                }
+                free(coded);
+            }
+        }
+        free(body);
+    }
+
+    write_at(fd, &header, sizeof(header), 0);
+    write_at(fd, slots, (size_t) num_slots * sizeof(uint32_t), header.slots_offset);
+    write_at(fd, entries, (size_t) num_entries * sizeof(archive_entry), header.entries_offset);
+    write_at(fd, strings, strings_len, header.strings_offset);
+    if (ftruncate(fd, (off_t) pos) == -1 || fsync(fd) == -1 || close(fd) == -1) {
+        perror(tmp_path);
+        unlink(tmp_path);
+        return EXIT_FAILURE;
+    }
+
+    // Renaming over the old archive is atomic, so a running server sees
+    // either the old archive or the new one.
+    if (rename(tmp_path, output) == -1) {
+        perror(output);
+        unlink(tmp_path);
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: %u files, %d coded variants, %lu bytes of files, %lu bytes coded, %lu bytes total\n",
+           output, num_entries, num_variants, (unsigned long) identity_bytes, (unsigned long) coded_bytes,
+           (unsigned long) pos);
+
+    free(tmp_path);
+    free(entry_files);
+    free(slots);
+    free(entries);
+    free(strings);
+    for (size_t i = 0; i < walk.num_files; i++) free(walk.files[i].path);
+    free(walk.files);
+    free(walk.root);
+    return EXIT_SUCCESS;
+}
+
+static void usage(const char * program, int status) {
+    fprintf(status == EXIT_SUCCESS ? stdout : stderr,
+            "Usage: %s [-m MIN_SIZE] ROOT_DIR OUTPUT\n"
+            "Packs every regular file under ROOT_DIR into the archive OUTPUT, replacing it atomically.\n"
+            "Text files of at least MIN_SIZE bytes (default %d) also get coded variants, taken from\n"
+            "fresh .br, .zst and .gz siblings or compressed here. Symbolic links are skipped.\n",
+            program, DEFAULT_MIN_SIZE);
+    exit(status);
+}
+
+static int visit(const char * fpath, const struct stat * st, int type, struct FTW * ftw) {
+    (void) ftw;
+    if (type != FTW_F || !S_ISREG(st->st_mode)) return 0;
+    if (walk.output_exists && st->st_dev == walk.output_st.st_dev && st->st_ino == walk.output_st.st_ino) return 0;
+
+    if (walk.num_files == walk.cap_files) {
+        walk.cap_files = walk.cap_files == 0 ? 64 : walk.cap_files * 2;
+        walk.files = realloc(walk.files, walk.cap_files * sizeof(packed_file));
+        if (walk.files == NULL) return -1;
+    }
+    packed_file * file = &walk.files[walk.num_files++];
+    file->path = strdup(fpath);
+    file->st = *st;
+    file->sibling_of = -1;
+    return 0;
+}
+
+// Orders files by their path relative to the root.
+static int compare_files(const void * a, const void * b) {
+    return strcmp(relative(a), relative(b));
+}
+
+static long find_file(const char * path) {
+    size_t lo = 0;
+    size_t hi = walk.num_files;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(walk.files[mid].path + walk.root_len + 1, path + walk.root_len + 1);
+        if (cmp == 0) return (long) mid;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+// A file named like another file plus a coding suffix, and not older than
+// it, is packed as that file's coded variant instead of as a file of its
+// own. Stale siblings are dropped, as the server would ignore them.
+static void mark_siblings(void) {
+    for (size_t i = 0; i < walk.num_files; i++) {
+        packed_file * file = &walk.files[i];
+        size_t len = strlen(file->path);
+        for (int encoding = 0; encoding < ENCODING_COUNT; encoding++) {
+            const char * suffix = encoding_suffix(encoding);
+            size_t suffix_len = strlen(suffix);
+            if (len <= suffix_len || strcmp(file->path + len - suffix_len, suffix) != 0) continue;
+
+            // The base path is looked up in a copy: cutting the suffix off
+            // in place would break the order the search relies on.
+            char base_path[PATH_MAX];
+            if (len - suffix_len >= sizeof(base_path)) continue;
+            memcpy(base_path, file->path, len - suffix_len);
+            base_path[len - suffix_len] = '\0';
+            long base = find_file(base_path);
+            if (base == -1 || base == (long) i) continue;
+
+            const struct timespec * mtime = &walk.files[base].st.st_mtim;
+            int stale = file->st.st_mtim.tv_sec < mtime->tv_sec ||
+                        (file->st.st_mtim.tv_sec == mtime->tv_sec && file->st.st_mtim.tv_nsec < mtime->tv_nsec);
+            file->sibling_of = stale ? -2 : (int) base;
+        }
+    }
+}
+
+static char * read_file(const char * path, size_t len) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    char * buf = dc_malloc(len > 0 ? len : 1);
+    size_t total = 0;
+    while (total < len) {
+        ssize_t num_read = pread(fd, buf + total, len - total, (off_t) total);
+        if (num_read <= 0) break;
+        total += num_read;
+    }
+    close(fd);
+    if (total < len) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+// Returns where a body of len bytes goes and advances pos past it. Bodies of
+// a page or more start on a page boundary; smaller ones are packed tightly
+// but never straddle a page boundary, so each costs at most one page read.
+static uint64_t place(uint64_t * pos, uint64_t len) {
+    uint64_t page_left = ARCHIVE_PAGE - *pos % ARCHIVE_PAGE;
+    if ((len >= ARCHIVE_PAGE || len > page_left) && page_left != ARCHIVE_PAGE) *pos += page_left;
+    uint64_t offset = *pos;
+    *pos += len;
+    return offset;
+}
+
+static void write_at(int fd, const void * buf, size_t len, uint64_t offset) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t num_written = pwrite(fd, (const char *) buf + total, len - total, (off_t) (offset + total));
+        if (num_written <= 0) {
+            perror("pwrite()");
+            exit(EXIT_FAILURE);
+        }
+        total += num_written;
+    }
+}
+
+static size_t add_string(char ** strings, size_t * len, size_t * cap, const char * string) {
+    size_t string_len = strlen(string);
+    while (*len + string_len + 1 > *cap) {
+        *cap *= 2;
+        *strings = realloc(*strings, *cap);
+        if (*strings == NULL) {
+            perror("realloc()");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(*strings + *len, string, string_len + 1);
+    size_t offset = *len;
+    *len += string_len + 1;
+    return offset;
+}
+
+// Returns a file's path relative to the root, as requests name it.
+static const char * relative(const packed_file * file) {
+    return file->path + walk.root_len + 1;
+}
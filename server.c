@@ -9,33 +9,77 @@
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <stdatomic.h>
 
+#include <dc/pthread.h>
 #include <dc/sys/socket.h>
 
 #include "http_protocol/thread_pool.h"
 #include "http_protocol/process_pool.h"
 #include "http_protocol/http.h"
+#include "http_protocol/warmup.h"
+#include "http_protocol/rate_limit.h"
+#include "http_protocol/staging.h"
 
 #define BACKLOG 5
 
+static atomic_bool shutting_down;
+
 static int create_server_fd();
+static warmup * start_listening(config * conf, int server_fd, content_cache_block * content_cache);
+static void * shutdown_loop(void * arg);
 
 int main(int argc, char **argv) {
     config * cmd_conf = get_cmd_config(argc, argv);
     config * conf = get_config(cmd_conf);
+
+    // SIGINT and SIGTERM are blocked in every thread and handled by
+    // shutdown_loop, so they must be blocked before any thread is created.
+    sigset_t shutdown_signals;
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGINT);
+    sigaddset(&shutdown_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &shutdown_signals, NULL);
+
+    trace_install_signal_handler(conf);
     int server_fd = create_server_fd(conf->port);
+    pthread_t shutdown_thread;
+    dc_pthread_create(&shutdown_thread, NULL, shutdown_loop, &server_fd);
+    dc_pthread_detach(shutdown_thread);
 
-    for(;;) {
+    // The first pool's caches are warmed before the socket listens.
+    bool listening = false;
+    warmup * warm = NULL;
+    rate_limiter * limiter = rate_limit_create();
+    // Connections are parked until their request header arrives, so idle
+    // ones never hold a worker.
+    staging * stage = staging_create(server_fd, conf->header_timeout);
+    while(!atomic_load(&shutting_down)) {
         process_pool * p_pool;
         thread_pool * t_pool;
 
         if(conf->mode == 'p'){
             p_pool = process_pool_create(cmd_conf);
+            if (!listening) {
+                warm = start_listening(conf, server_fd, p_pool->content_cache);
+                listening = true;
+            }
             process_pool_start(p_pool);
             printf("Starting processes\n");
-            while(conf->mode == 'p') {
-                int client_fd = accept(server_fd, NULL, NULL);
-                process_pool_notify(p_pool, client_fd);
+            while(conf->mode == 'p' && !atomic_load(&shutting_down)) {
+                staged_request * request = staging_next(stage, conf, limiter);
+                if(request != NULL) {
+                    uint64_t accepted_us = admission_now_us();
+                    uint64_t accepted_ns = trace_now();
+                    trace_begin_request(accepted_us);
+                    admission_control * admission = &p_pool->mem->admission;
+                    if(!admission_admit(admission, conf) ||
+                       process_pool_notify(p_pool, request, accepted_us) == -1) {
+                        admission_reject(admission, conf, request->cfd);
+                        free(request);
+                    }
+                    trace_record(TRACE_ACCEPT, accepted_ns, trace_now());
+                }
                 destroy_config(conf);
                 conf = get_config(cmd_conf);
             }
@@ -43,13 +87,27 @@ int main(int argc, char **argv) {
             process_pool_destroy(p_pool);
         }
 
-        if(conf->mode == 't') {
+        if(conf->mode == 't' && !atomic_load(&shutting_down)) {
             t_pool = thread_pool_create(cmd_conf);
+            if (!listening) {
+                warm = start_listening(conf, server_fd, t_pool->content_cache);
+                listening = true;
+            }
             thread_pool_start(t_pool);
             printf("Starting threads\n");
-            while(conf->mode == 't') {
-                int client_fd = accept(server_fd, NULL, NULL);
-                thread_pool_notify(t_pool, client_fd);
+            while(conf->mode == 't' && !atomic_load(&shutting_down)) {
+                staged_request * request = staging_next(stage, conf, limiter);
+                if(request != NULL) {
+                    uint64_t accepted_us = admission_now_us();
+                    uint64_t accepted_ns = trace_now();
+                    trace_begin_request(accepted_us);
+                    admission_control * admission = &t_pool->admission;
+                    if(!admission_admit(admission, conf) || thread_pool_notify(t_pool, request, accepted_us) == -1) {
+                        admission_reject(admission, conf, request->cfd);
+                        free(request);
+                    }
+                    trace_record(TRACE_ACCEPT, accepted_ns, trace_now());
+                }
                 destroy_config(conf);
                 conf = get_config(cmd_conf);
             }
@@ -57,7 +115,10 @@ int main(int argc, char **argv) {
             thread_pool_destroy(t_pool);
         }
     }
+    staging_destroy(stage);
     close(server_fd);
+    warmup_release(warm);
+    rate_limit_destroy(limiter);
     destroy_config(cmd_conf);
     destroy_config(conf);
     
@@ -77,6 +138,42 @@ static int create_server_fd(int port) {
     int optval = 1;
     setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
     dc_bind(sfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in));
-    dc_listen(sfd, BACKLOG);
     return sfd;
-}
\ No newline at end of file
+}
+
+/**
+ * Runs the startup warmup, if configured, then starts listening on the
+ * bound server socket. Until then connections are refused, so during a
+ * deploy clients keep going to a server that is already warm. Returns the
+ * warmup, or NULL if there was none.
+ */
+static warmup * start_listening(config * conf, int server_fd, content_cache_block * content_cache) {
+    warmup * warm = NULL;
+    if (conf->warmup) {
+        printf("Warming up\n");
+        warm = warmup_run(conf, content_cache);
+        warmup_report(warm, stdout);
+    }
+    dc_listen(server_fd, BACKLOG);
+    return warm;
+}
+
+/**
+ * Waits for SIGINT or SIGTERM, then stops the accept loop by shutting down
+ * the listening socket, which wakes a blocked accept. The pools are then
+ * stopped and the server exits normally.
+ */
+static void * shutdown_loop(void * arg) {
+    int sfd = *(int *) arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+
+    int sig;
+    while (sigwait(&set, &sig) != 0);
+    printf("Shutting down\n");
+    atomic_store(&shutting_down, true);
+    shutdown(sfd, SHUT_RD);
+    return NULL;
+}
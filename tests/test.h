@@ -0,0 +1,23 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+/**
+ * Minimal assertions for the unit tests. A failed CHECK reports the
+ * expression and keeps going, so one run shows every failure; TEST_RESULT
+ * turns the tally into the exit status ctest looks at.
+ */
+static int test_failures;
+
+#define CHECK(expr)                                                                  \
+    do {                                                                             \
+        if (!(expr)) {                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+            test_failures++;                                                         \
+        }                                                                            \
+    } while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? 0 : 1)
+
+#endif
@@ -0,0 +1,212 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../http_protocol/archive.h"
+
+#define MAX_ENTRIES 8
+#define MAX_SLOTS 16
+#define STRINGS_LEN 256
+#define TYPE "text/plain; charset=utf-8"
+
+/**
+ * An archive's index as the packer lays it out, built in memory so tests
+ * can corrupt it before writing it out. Bodies are left out, as only the
+ * index is checked.
+ */
+typedef struct {
+    archive_header header;
+    uint32_t slots[MAX_SLOTS];
+    archive_entry entries[MAX_ENTRIES];
+    char strings[STRINGS_LEN];
+} index_image;
+
+static char archive_path[] = "/tmp/test_archive.XXXXXX";
+
+static void build(index_image * image, const char ** paths, uint32_t num_paths, uint32_t num_slots);
+static archive * open_image(const index_image * image);
+static void find_colliding(uint32_t mask, const char ** paths, char names[][16], int count);
+static void test_hash(void);
+static void test_find(void);
+static void test_probe_wraps(void);
+static void test_malformed(void);
+
+int main(void) {
+    int fd = mkstemp(archive_path);
+    if (fd == -1) {
+        perror(archive_path);
+        return 1;
+    }
+    close(fd);
+
+    test_hash();
+    test_find();
+    test_probe_wraps();
+    test_malformed();
+
+    unlink(archive_path);
+    return TEST_RESULT();
+}
+
+// Inserts the paths in order with linear probing, as the packer does.
+static void build(index_image * image, const char ** paths, uint32_t num_paths, uint32_t num_slots) {
+    memset(image, 0, sizeof(index_image));
+    archive_header * header = &image->header;
+    memcpy(header->magic, ARCHIVE_MAGIC, sizeof(header->magic));
+    header->version = ARCHIVE_VERSION;
+    header->num_entries = num_paths;
+    header->num_slots = num_slots;
+    header->slots_offset = offsetof(index_image, slots);
+    header->entries_offset = offsetof(index_image, entries);
+    header->strings_offset = offsetof(index_image, strings);
+    header->data_offset = ARCHIVE_PAGE;
+
+    size_t strings_len = 0;
+    memcpy(image->strings, TYPE, sizeof(TYPE));
+    strings_len += sizeof(TYPE);
+    for (uint32_t i = 0; i < num_paths; i++) {
+        archive_entry * entry = &image->entries[i];
+        entry->path_len = (uint32_t) strlen(paths[i]);
+        entry->hash = archive_hash(paths[i], entry->path_len);
+        entry->path_offset = (uint32_t) strings_len;
+        memcpy(image->strings + strings_len, paths[i], entry->path_len + 1);
+        strings_len += entry->path_len + 1;
+        entry->type_offset = 0;
+        entry->type_len = (uint32_t) strlen(TYPE);
+
+        uint32_t slot = (uint32_t) entry->hash & (num_slots - 1);
+        while (image->slots[slot] != 0) slot = (slot + 1) & (num_slots - 1);
+        image->slots[slot] = i + 1;
+    }
+    header->strings_len = strings_len;
+}
+
+static archive * open_image(const index_image * image) {
+    int fd = open(archive_path, O_WRONLY | O_TRUNC);
+    if (fd == -1) return NULL;
+    int written = write(fd, image, sizeof(index_image)) == (ssize_t) sizeof(index_image) &&
+                  ftruncate(fd, ARCHIVE_PAGE) == 0;
+    close(fd);
+    return written ? archive_open(archive_path) : NULL;
+}
+
+// Fills paths with count names that all hash to the last slot under mask,
+// so probing for them has to wrap around the table.
+static void find_colliding(uint32_t mask, const char ** paths, char names[][16], int count) {
+    int found = 0;
+    for (int n = 0; found < count; n++) {
+        snprintf(names[found], 16, "f%d.txt", n);
+        if ((archive_hash(names[found], strlen(names[found])) & mask) == mask) {
+            paths[found] = names[found];
+            found++;
+        }
+    }
+}
+
+static void test_hash(void) {
+    // Published 64-bit FNV-1a test vectors.
+    CHECK(archive_hash("", 0) == 0xcbf29ce484222325ull);
+    CHECK(archive_hash("a", 1) == 0xaf63dc4c8601ec8cull);
+    CHECK(archive_hash("foobar", 6) == 0x85944171f73967e8ull);
+    // Only len bytes are hashed.
+    CHECK(archive_hash("foobar", 3) == archive_hash("foo", 3));
+}
+
+static void test_find(void) {
+    const char * paths[] = { "index.html", "css/style.css", "images/cat.jpg", "a" };
+    index_image image;
+    build(&image, paths, 4, 16);
+    archive * arch = open_image(&image);
+    CHECK(arch != NULL);
+    if (arch == NULL) return;
+
+    for (int i = 0; i < 4; i++) {
+        const archive_entry * entry = archive_find(arch, paths[i]);
+        CHECK(entry == &arch->entries[i]);
+        if (entry != NULL) CHECK(strcmp(archive_type(arch, entry), TYPE) == 0);
+    }
+    CHECK(archive_find(arch, "") == NULL);
+    CHECK(archive_find(arch, "index.htm") == NULL);
+    CHECK(archive_find(arch, "index.html.gz") == NULL);
+    CHECK(archive_find(arch, "/index.html") == NULL);
+    CHECK(archive_find(arch, "A") == NULL);
+    archive_release(arch);
+}
+
+static void test_probe_wraps(void) {
+    const char * paths[4];
+    char names[4][16];
+    find_colliding(7, paths, names, 4);
+
+    // The first three take slots 7, 0 and 1; the fourth is never added, and
+    // looking it up stops at the empty slot 2.
+    index_image image;
+    build(&image, paths, 3, 8);
+    CHECK(image.slots[7] == 1 && image.slots[0] == 2 && image.slots[1] == 3 && image.slots[2] == 0);
+    archive * arch = open_image(&image);
+    CHECK(arch != NULL);
+    if (arch == NULL) return;
+
+    for (int i = 0; i < 3; i++) CHECK(archive_find(arch, paths[i]) == &arch->entries[i]);
+    CHECK(archive_find(arch, paths[3]) == NULL);
+    archive_release(arch);
+}
+
+static void test_malformed(void) {
+    const char * paths[] = { "index.html", "about.html" };
+    index_image image;
+
+    build(&image, paths, 2, 8);
+    archive * arch = open_image(&image);
+    CHECK(arch != NULL);
+    archive_release(arch);
+
+    build(&image, paths, 2, 8);
+    image.header.magic[0] = 'X';
+    CHECK(open_image(&image) == NULL);
+
+    build(&image, paths, 2, 8);
+    image.header.version = ARCHIVE_VERSION + 1;
+    CHECK(open_image(&image) == NULL);
+
+    build(&image, paths, 2, 8);
+    image.header.num_slots = 6;
+    CHECK(open_image(&image) == NULL);
+
+    build(&image, paths, 2, 2);
+    CHECK(open_image(&image) == NULL);
+
+    // Repeating an entry in every slot leaves no empty slot to end a probe.
+    build(&image, paths, 2, 4);
+    for (int i = 0; i < 4; i++) image.slots[i] = 1;
+    CHECK(open_image(&image) == NULL);
+
+    build(&image, paths, 2, 8);
+    image.slots[3] = 3;
+    CHECK(open_image(&image) == NULL);
+
+    build(&image, paths, 2, 8);
+    image.header.num_slots = MAX_SLOTS * 1024;
+    CHECK(open_image(&image) == NULL);
+
+    build(&image, paths, 2, 8);
+    image.entries[1].path_offset = (uint32_t) image.header.strings_len;
+    CHECK(open_image(&image) == NULL);
+
+    build(&image, paths, 2, 8);
+    image.entries[0].path_len++;
+    CHECK(open_image(&image) == NULL);
+
+    build(&image, paths, 2, 8);
+    image.entries[0].offset[ARCHIVE_IDENTITY] = image.header.data_offset;
+    image.entries[0].len[ARCHIVE_IDENTITY] = 1;
+    CHECK(open_image(&image) == NULL);
+
+    build(&image, paths, 2, 8);
+    image.entries[0].offset[ARCHIVE_IDENTITY] = 0;
+    image.entries[0].len[ARCHIVE_IDENTITY] = 1;
+    CHECK(open_image(&image) == NULL);
+}
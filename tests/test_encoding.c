@@ -0,0 +1,85 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "test.h"
+#include "../http_protocol/encoding.h"
+
+#define NONE -1
+
+static int negotiates_to(const char * accept_encoding, int first, int second, int third);
+static void test_server_preference(void);
+static void test_q_values(void);
+static void test_wildcard(void);
+static void test_parsing(void);
+static void test_names(void);
+
+int main(void) {
+    test_server_preference();
+    test_q_values();
+    test_wildcard();
+    test_parsing();
+    test_names();
+    return TEST_RESULT();
+}
+
+// Checks the negotiated order against up to three codings, NONE ending it.
+static int negotiates_to(const char * accept_encoding, int first, int second, int third) {
+    int expected[ENCODING_COUNT] = { first, second, third };
+    int expected_count = 0;
+    while (expected_count < ENCODING_COUNT && expected[expected_count] != NONE) expected_count++;
+
+    int order[ENCODING_COUNT];
+    int count = encoding_negotiate(accept_encoding, order);
+    if (count != expected_count) return 0;
+    return memcmp(order, expected, count * sizeof(int)) == 0;
+}
+
+static void test_server_preference(void) {
+    CHECK(negotiates_to(NULL, NONE, NONE, NONE));
+    CHECK(negotiates_to("", NONE, NONE, NONE));
+    CHECK(negotiates_to("identity", NONE, NONE, NONE));
+    CHECK(negotiates_to("gzip", ENCODING_GZIP, NONE, NONE));
+    // Equal q-values keep the server's order whatever order the client used.
+    CHECK(negotiates_to("gzip, deflate, br, zstd", ENCODING_BR, ENCODING_ZSTD, ENCODING_GZIP));
+    CHECK(negotiates_to("gzip, br", ENCODING_BR, ENCODING_GZIP, NONE));
+}
+
+static void test_q_values(void) {
+    CHECK(negotiates_to("br;q=0.5, gzip", ENCODING_GZIP, ENCODING_BR, NONE));
+    CHECK(negotiates_to("br;q=0.5, zstd;q=0.8, gzip;q=0.1", ENCODING_ZSTD, ENCODING_BR, ENCODING_GZIP));
+    CHECK(negotiates_to("br;q=1.0, gzip;q=1", ENCODING_BR, ENCODING_GZIP, NONE));
+    CHECK(negotiates_to("br;q=0.001, gzip;q=0.002", ENCODING_GZIP, ENCODING_BR, NONE));
+    // q=0 means not acceptable, in any spelling.
+    CHECK(negotiates_to("br;q=0, gzip", ENCODING_GZIP, NONE, NONE));
+    CHECK(negotiates_to("br;q=0.000, gzip;q=0.", NONE, NONE, NONE));
+    // Digits past the third decimal are ignored.
+    CHECK(negotiates_to("br;q=0.0004, gzip", ENCODING_GZIP, NONE, NONE));
+    // A later listing of the same coding wins.
+    CHECK(negotiates_to("br, br;q=0", NONE, NONE, NONE));
+}
+
+static void test_wildcard(void) {
+    CHECK(negotiates_to("*", ENCODING_BR, ENCODING_ZSTD, ENCODING_GZIP));
+    CHECK(negotiates_to("gzip, *;q=0.5", ENCODING_GZIP, ENCODING_BR, ENCODING_ZSTD));
+    // "*" only covers the codings not listed.
+    CHECK(negotiates_to("br;q=0, *", ENCODING_ZSTD, ENCODING_GZIP, NONE));
+    CHECK(negotiates_to("gzip, *;q=0", ENCODING_GZIP, NONE, NONE));
+}
+
+static void test_parsing(void) {
+    CHECK(negotiates_to("  BR ;  Q=0.5 ,\tGzip\t", ENCODING_GZIP, ENCODING_BR, NONE));
+    CHECK(negotiates_to("x-gzip", ENCODING_GZIP, NONE, NONE));
+    CHECK(negotiates_to("br;level=5;q=0.2, zstd", ENCODING_ZSTD, ENCODING_BR, NONE));
+    CHECK(negotiates_to(",,br,,", ENCODING_BR, NONE, NONE));
+    // Tokens must match whole.
+    CHECK(negotiates_to("brotli, gzipped, zst", NONE, NONE, NONE));
+}
+
+static void test_names(void) {
+    CHECK(strcmp(encoding_name(ENCODING_BR), "br") == 0);
+    CHECK(strcmp(encoding_name(ENCODING_ZSTD), "zstd") == 0);
+    CHECK(strcmp(encoding_name(ENCODING_GZIP), "gzip") == 0);
+    CHECK(strcmp(encoding_suffix(ENCODING_BR), ".br") == 0);
+    CHECK(strcmp(encoding_suffix(ENCODING_ZSTD), ".zst") == 0);
+    CHECK(strcmp(encoding_suffix(ENCODING_GZIP), ".gz") == 0);
+}
@@ -0,0 +1,121 @@
+#include "test.h"
+#include "../libs/histogram.h"
+
+#define HIST_MAX_VALUE ((1ULL << HIST_MAX_BITS) - 1)
+
+static histogram hist;
+static histogram other;
+
+static void test_empty(void);
+static void test_exact_small_values(void);
+static void test_relative_error(void);
+static void test_clamp(void);
+static void test_totals(void);
+static void test_corrected(void);
+static void test_merge(void);
+
+int main(void) {
+    test_empty();
+    test_exact_small_values();
+    test_relative_error();
+    test_clamp();
+    test_totals();
+    test_corrected();
+    test_merge();
+    return TEST_RESULT();
+}
+
+static void test_empty(void) {
+    hist_reset(&hist);
+    CHECK(hist_count(&hist) == 0);
+    CHECK(hist_max(&hist) == 0);
+    CHECK(hist_mean(&hist) == 0);
+    CHECK(hist_percentile(&hist, 99) == 0);
+}
+
+// Every value below HIST_SUB_COUNT has a bucket of its own.
+static void test_exact_small_values(void) {
+    hist_reset(&hist);
+    for (uint64_t v = 0; v < HIST_SUB_COUNT; v++) hist_record(&hist, v);
+
+    CHECK(hist_count(&hist) == HIST_SUB_COUNT);
+    CHECK(hist_percentile(&hist, 0) == 0);
+    CHECK(hist_percentile(&hist, 50) == HIST_SUB_COUNT / 2 - 1);
+    CHECK(hist_percentile(&hist, 100) == HIST_SUB_COUNT - 1);
+    for (uint64_t v = 0; v < HIST_SUB_COUNT; v++) {
+        CHECK(hist_percentile(&hist, 100.0 * (v + 1) / HIST_SUB_COUNT) == v);
+    }
+}
+
+// Above that a value is reported as the top of its bucket, which is never
+// below it and at most 1/64 above it. A larger value is recorded alongside
+// so the report is not clamped to the maximum.
+static void test_relative_error(void) {
+    for (uint64_t v = HIST_SUB_COUNT; v < HIST_MAX_VALUE / 2; v += v / 7 + 1) {
+        hist_reset(&hist);
+        hist_record(&hist, v);
+        hist_record(&hist, HIST_MAX_VALUE);
+
+        uint64_t reported = hist_percentile(&hist, 50);
+        CHECK(reported >= v);
+        CHECK(reported - v <= v / 64);
+    }
+
+    // Both ends of a power of two land in different buckets.
+    for (unsigned int bits = HIST_SUB_BITS + 1; bits < HIST_MAX_BITS; bits++) {
+        uint64_t power = 1ULL << bits;
+        hist_reset(&hist);
+        hist_record(&hist, power - 1);
+        hist_record(&hist, power);
+        hist_record(&hist, HIST_MAX_VALUE);
+        CHECK(hist_percentile(&hist, 100.0 / 3) == power - 1);
+        CHECK(hist_percentile(&hist, 200.0 / 3) >= power);
+    }
+}
+
+static void test_clamp(void) {
+    hist_reset(&hist);
+    hist_record(&hist, UINT64_MAX);
+    CHECK(hist_count(&hist) == 1);
+    CHECK(hist_max(&hist) == HIST_MAX_VALUE);
+    CHECK(hist_percentile(&hist, 100) == HIST_MAX_VALUE);
+}
+
+static void test_totals(void) {
+    hist_reset(&hist);
+    hist_record(&hist, 10);
+    hist_record_n(&hist, 1000, 3);
+    CHECK(hist_count(&hist) == 4);
+    CHECK(hist_max(&hist) == 1000);
+    CHECK(hist_mean(&hist) == 3010.0 / 4);
+    CHECK(hist_percentile(&hist, 25) == 10);
+    CHECK(hist_percentile(&hist, 100) == 1000);
+}
+
+static void test_corrected(void) {
+    hist_reset(&hist);
+    // A 100 tick stall with a request due every 30 ticks also hid requests
+    // that would have waited 70 and 40.
+    hist_record_corrected(&hist, 100, 30);
+    CHECK(hist_count(&hist) == 3);
+    CHECK(hist_mean(&hist) == 70);
+
+    hist_reset(&hist);
+    hist_record_corrected(&hist, 100, 0);
+    hist_record_corrected(&hist, 20, 30);
+    CHECK(hist_count(&hist) == 2);
+}
+
+static void test_merge(void) {
+    hist_reset(&hist);
+    hist_reset(&other);
+    hist_record(&hist, 5);
+    hist_record(&other, 7);
+    hist_record(&other, 5000);
+
+    hist_merge(&hist, &other);
+    CHECK(hist_count(&hist) == 3);
+    CHECK(hist_max(&hist) == 5000);
+    CHECK(hist_percentile(&hist, 50) == 7);
+    CHECK(hist_count(&other) == 2);
+}
@@ -0,0 +1,121 @@
+#include <string.h>
+
+#include "test.h"
+#include "../http_protocol/mime.h"
+
+typedef struct {
+    const char * extension;
+    const char * type;
+    int compressible;
+} expected_entry;
+
+// Every extension in the table. A new one that collides with another's slot
+// fails here instead of shadowing it.
+static const expected_entry known[] = {
+        { "html", "text/html; charset=utf-8", 1 },
+        { "htm", "text/html; charset=utf-8", 1 },
+        { "css", "text/css; charset=utf-8", 1 },
+        { "js", "text/javascript; charset=utf-8", 1 },
+        { "mjs", "text/javascript; charset=utf-8", 1 },
+        { "json", "application/json", 1 },
+        { "map", "application/json", 1 },
+        { "xml", "application/xml", 1 },
+        { "txt", "text/plain; charset=utf-8", 1 },
+        { "md", "text/markdown; charset=utf-8", 1 },
+        { "csv", "text/csv; charset=utf-8", 1 },
+        { "svg", "image/svg+xml", 1 },
+        { "ico", "image/vnd.microsoft.icon", 1 },
+        { "bmp", "image/bmp", 1 },
+        { "png", "image/png", 0 },
+        { "jpg", "image/jpeg", 0 },
+        { "jpeg", "image/jpeg", 0 },
+        { "gif", "image/gif", 0 },
+        { "webp", "image/webp", 0 },
+        { "avif", "image/avif", 0 },
+        { "otf", "font/otf", 1 },
+        { "ttf", "font/ttf", 1 },
+        { "woff", "font/woff", 0 },
+        { "woff2", "font/woff2", 0 },
+        { "wasm", "application/wasm", 1 },
+        { "pdf", "application/pdf", 0 },
+        { "zip", "application/zip", 0 },
+        { "gz", "application/gzip", 0 },
+        { "mp3", "audio/mpeg", 0 },
+        { "mp4", "video/mp4", 0 },
+        { "ogg", "audio/ogg", 0 },
+        { "wav", "audio/wav", 1 },
+        { "webm", "video/webm", 0 },
+};
+
+static const mime_entry * lookup(const char * path);
+static void test_known(void);
+static void test_case(void);
+static void test_unknown(void);
+static void test_len(void);
+
+int main(void) {
+    test_known();
+    test_case();
+    test_unknown();
+    test_len();
+    return TEST_RESULT();
+}
+
+static const mime_entry * lookup(const char * path) {
+    return mime_lookup(path, strlen(path));
+}
+
+static void test_known(void) {
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+        char path[32] = "dir/file.";
+        strcat(path, known[i].extension);
+
+        const mime_entry * entry = lookup(path);
+        CHECK(entry != NULL);
+        if (entry == NULL) continue;
+        CHECK(strcmp(entry->extension, known[i].extension) == 0);
+        CHECK(strcmp(entry->type, known[i].type) == 0);
+        CHECK(entry->compressible == known[i].compressible);
+        CHECK(strcmp(mime_type(path, strlen(path)), known[i].type) == 0);
+    }
+}
+
+static void test_case(void) {
+    const mime_entry * entry = lookup("INDEX.HTML");
+    CHECK(entry != NULL && strcmp(entry->extension, "html") == 0);
+    entry = lookup("photo.JpEg");
+    CHECK(entry != NULL && strcmp(entry->extension, "jpeg") == 0);
+    entry = lookup("font.WOFF2");
+    CHECK(entry != NULL && strcmp(entry->extension, "woff2") == 0);
+}
+
+static void test_unknown(void) {
+    CHECK(lookup("") == NULL);
+    CHECK(lookup("README") == NULL);
+    CHECK(lookup("file.") == NULL);
+    CHECK(lookup("dir.d/README") == NULL);
+    CHECK(lookup(".html/file") == NULL);
+    CHECK(lookup("archive.tar") == NULL);
+    CHECK(lookup("file.htmlx") == NULL);
+    CHECK(lookup("file.woff22") == NULL);
+    CHECK(lookup("file.h") == NULL);
+    CHECK(lookup("file.exe") == NULL);
+    // These hash to the slots of woff2 and avif.
+    CHECK(lookup("file.jxg") == NULL);
+    CHECK(lookup("file.tmt") == NULL);
+    CHECK(strcmp(mime_type("file.exe", 8), MIME_DEFAULT_TYPE) == 0);
+
+    // A dotfile's name is taken as its extension.
+    const mime_entry * entry = lookup(".md");
+    CHECK(entry != NULL && strcmp(entry->extension, "md") == 0);
+}
+
+// Only the first len bytes count, so a path need not be terminated there.
+static void test_len(void) {
+    const char * path = "style.css.gz";
+    const mime_entry * entry = mime_lookup(path, strlen("style.css"));
+    CHECK(entry != NULL && strcmp(entry->extension, "css") == 0);
+    entry = mime_lookup(path, strlen(path));
+    CHECK(entry != NULL && strcmp(entry->extension, "gz") == 0);
+    CHECK(mime_lookup(path, strlen("style.cs")) == NULL);
+}
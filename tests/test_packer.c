@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../http_protocol/archive.h"
+
+#define PAGE_LEN 4096
+#define MAX_OPEN_DIRS 16
+
+static char root[] = "/tmp/test_packer.XXXXXX";
+
+static void write_file(const char * path, const char * data, size_t len, time_t mtime);
+static int pack(const char * packer, const char * output);
+static int variant_is(const archive * arch, const archive_entry * entry, int encoding, const char * data);
+static int remove_path(const char * path, const struct stat * st, int type, struct FTW * ftw);
+
+/**
+ * Packs a small tree with the packer given as the only argument and checks
+ * how precompressed siblings were linked to the files they belong to.
+ */
+int main(int argc, char ** argv) {
+    if (argc != 2 || mkdtemp(root) == NULL) {
+        fprintf(stderr, "Usage: %s PACKER\n", argv[0]);
+        return 1;
+    }
+
+    char page[PAGE_LEN];
+    for (size_t i = 0; i < sizeof(page); i++) page[i] = "<p>hello</p>\n"[i % 13];
+
+    // A fresh sibling is taken as the coded variant as it is, a stale one is
+    // dropped, and one without a base file is a file of its own.
+    write_file("index.html", page, sizeof(page), 1000);
+    write_file("index.html.gz", "fresh gzip", 10, 2000);
+    write_file("index.html.br", "fresh br", 8, 1000);
+    write_file("style.css", page, sizeof(page), 1000);
+    write_file("style.css.br", "stale br", 8, 500);
+    write_file("sub/only.tar.gz", "standalone", 10, 1000);
+    write_file("sub/only.tar", "base", 4, 1000);
+    write_file("notes.gz", "no base", 7, 1000);
+
+    char output[PATH_MAX];
+    snprintf(output, sizeof(output), "%s.arc", root);
+    CHECK(pack(argv[1], output) == 0);
+
+    archive * arch = archive_open(output);
+    CHECK(arch != NULL);
+    if (arch != NULL) {
+        const archive_entry * index = archive_find(arch, "index.html");
+        CHECK(index != NULL);
+        if (index != NULL) {
+            CHECK(index->len[ARCHIVE_IDENTITY] == sizeof(page));
+            CHECK(variant_is(arch, index, ENCODING_GZIP, "fresh gzip"));
+            CHECK(variant_is(arch, index, ENCODING_BR, "fresh br"));
+        }
+        CHECK(archive_find(arch, "index.html.gz") == NULL);
+        CHECK(archive_find(arch, "index.html.br") == NULL);
+
+        const archive_entry * style = archive_find(arch, "style.css");
+        CHECK(style != NULL);
+        if (style != NULL) {
+            CHECK(style->len[ENCODING_BR + 1] == 0);
+            CHECK(style->len[ENCODING_GZIP + 1] > 0);
+        }
+        CHECK(archive_find(arch, "style.css.br") == NULL);
+
+        // only.tar.gz is only.tar's gzip variant, but only.tar is no text, so
+        // it keeps none.
+        const archive_entry * tar = archive_find(arch, "sub/only.tar");
+        CHECK(tar != NULL);
+        if (tar != NULL) CHECK(tar->len[ENCODING_GZIP + 1] == 0);
+        CHECK(archive_find(arch, "sub/only.tar.gz") == NULL);
+
+        CHECK(archive_find(arch, "notes.gz") != NULL);
+        CHECK(arch->header->num_entries == 4);
+        archive_release(arch);
+    }
+
+    unlink(output);
+    nftw(root, remove_path, MAX_OPEN_DIRS, FTW_DEPTH | FTW_PHYS);
+    return TEST_RESULT();
+}
+
+// Writes a file under root, creating its directory, with the given mtime.
+static void write_file(const char * path, const char * data, size_t len, time_t mtime) {
+    char full[PATH_MAX];
+    snprintf(full, sizeof(full), "%s/%s", root, path);
+    char * slash = strrchr(full, '/');
+    *slash = '\0';
+    mkdir(full, 0755);
+    *slash = '/';
+
+    int fd = open(full, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd != -1);
+    if (fd == -1) return;
+    CHECK(write(fd, data, len) == (ssize_t) len);
+    struct timespec times[2] = { { mtime, 0 }, { mtime, 0 } };
+    CHECK(futimens(fd, times) == 0);
+    close(fd);
+}
+
+static int pack(const char * packer, const char * output) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(packer, packer, root, output, (char *) NULL);
+        perror(packer);
+        _exit(127);
+    }
+    int status;
+    if (pid == -1 || waitpid(pid, &status, 0) == -1) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int variant_is(const archive * arch, const archive_entry * entry, int encoding, const char * data) {
+    size_t len = strlen(data);
+    char buf[64];
+    if (entry->len[encoding + 1] != len || len > sizeof(buf)) return 0;
+    if (pread(arch->fd, buf, len, (off_t) entry->offset[encoding + 1]) != (ssize_t) len) return 0;
+    return memcmp(buf, data, len) == 0;
+}
+
+static int remove_path(const char * path, const struct stat * st, int type, struct FTW * ftw) {
+    (void) st;
+    (void) type;
+    (void) ftw;
+    remove(path);
+    return 0;
+}
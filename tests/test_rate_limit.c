@@ -0,0 +1,137 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/un.h>
+#include <time.h>
+
+#include "test.h"
+#include "../http_protocol/rate_limit.h"
+
+#define NUM_CLIENTS 10000
+
+static config conf;
+
+static struct sockaddr_in ipv4(const char * ip, int port);
+static int admitted(rate_limiter * limiter, const struct sockaddr_in * addr, int attempts);
+static void test_disabled(void);
+static void test_burst(void);
+static void test_addresses(void);
+static void test_refill(void);
+static void test_many_clients(void);
+
+int main(void) {
+    test_disabled();
+    test_burst();
+    test_addresses();
+    test_refill();
+    test_many_clients();
+    return TEST_RESULT();
+}
+
+static struct sockaddr_in ipv4(const char * ip, int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &addr.sin_addr);
+    return addr;
+}
+
+// Returns how many of attempts back to back connections were admitted.
+static int admitted(rate_limiter * limiter, const struct sockaddr_in * addr, int attempts) {
+    int count = 0;
+    for (int i = 0; i < attempts; i++) {
+        count += rate_limit_admit(limiter, &conf, (const struct sockaddr *) addr);
+    }
+    return count;
+}
+
+static void test_disabled(void) {
+    rate_limiter * limiter = rate_limit_create();
+    struct sockaddr_in addr = ipv4("10.0.0.1", 1234);
+    conf.rate_limit = 0;
+    conf.rate_limit_burst = 1;
+    CHECK(admitted(limiter, &addr, 100) == 100);
+    rate_limit_destroy(limiter);
+}
+
+// The rates are low enough that no token is refilled while a test runs.
+static void test_burst(void) {
+    rate_limiter * limiter = rate_limit_create();
+    struct sockaddr_in addr = ipv4("10.0.0.1", 1234);
+    conf.rate_limit = 1;
+    conf.rate_limit_burst = 5;
+    CHECK(admitted(limiter, &addr, 10) == 5);
+
+    // A burst of 0 still lets one connection through.
+    struct sockaddr_in other = ipv4("10.0.0.2", 1234);
+    conf.rate_limit_burst = 0;
+    CHECK(admitted(limiter, &other, 10) == 1);
+    rate_limit_destroy(limiter);
+}
+
+static void test_addresses(void) {
+    rate_limiter * limiter = rate_limit_create();
+    conf.rate_limit = 1;
+    conf.rate_limit_burst = 2;
+
+    // Buckets are per IP address, whatever the port.
+    struct sockaddr_in first = ipv4("192.168.1.10", 40000);
+    struct sockaddr_in same_ip = ipv4("192.168.1.10", 40001);
+    struct sockaddr_in other_ip = ipv4("192.168.1.11", 40000);
+    CHECK(admitted(limiter, &first, 2) == 2);
+    CHECK(admitted(limiter, &same_ip, 1) == 0);
+    CHECK(admitted(limiter, &other_ip, 3) == 2);
+
+    struct sockaddr_in6 v6;
+    memset(&v6, 0, sizeof(v6));
+    v6.sin6_family = AF_INET6;
+    inet_pton(AF_INET6, "2001:db8::1", &v6.sin6_addr);
+    int v6_admitted = 0;
+    for (int i = 0; i < 3; i++) v6_admitted += rate_limit_admit(limiter, &conf, (const struct sockaddr *) &v6);
+    CHECK(v6_admitted == 2);
+    inet_pton(AF_INET6, "2001:db8::2", &v6.sin6_addr);
+    CHECK(rate_limit_admit(limiter, &conf, (const struct sockaddr *) &v6) == 1);
+
+    // Other address families are not limited.
+    struct sockaddr_un local;
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    for (int i = 0; i < 5; i++) CHECK(rate_limit_admit(limiter, &conf, (const struct sockaddr *) &local) == 1);
+    rate_limit_destroy(limiter);
+}
+
+static void test_refill(void) {
+    rate_limiter * limiter = rate_limit_create();
+    struct sockaddr_in addr = ipv4("10.0.0.1", 1234);
+    conf.rate_limit = 10;
+    conf.rate_limit_burst = 2;
+    CHECK(admitted(limiter, &addr, 3) == 2);
+
+    // 250 ms refill 2.5 tokens, but the bucket holds only 2.
+    struct timespec pause = { 0, 250 * 1000 * 1000 };
+    nanosleep(&pause, NULL);
+    CHECK(admitted(limiter, &addr, 3) == 2);
+    rate_limit_destroy(limiter);
+}
+
+static void test_many_clients(void) {
+    rate_limiter * limiter = rate_limit_create();
+    conf.rate_limit = 1;
+    conf.rate_limit_burst = 1;
+
+    int first = 0;
+    int second = 0;
+    for (int round = 0; round < 2; round++) {
+        for (uint32_t i = 0; i < NUM_CLIENTS; i++) {
+            struct sockaddr_in addr = ipv4("0.0.0.0", 80);
+            addr.sin_addr.s_addr = htonl(0x0a000000 + i);
+            int ok = rate_limit_admit(limiter, &conf, (const struct sockaddr *) &addr);
+            if (round == 0) first += ok;
+            else second += ok;
+        }
+    }
+    CHECK(first == NUM_CLIENTS);
+    CHECK(second == 0);
+    rate_limit_destroy(limiter);
+}
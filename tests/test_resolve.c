@@ -0,0 +1,151 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../http_protocol/resolve.h"
+
+static int normalizes_to(const char * uri, const char * expected);
+static int rejects(const char * uri);
+static void test_segments(void);
+static void test_decoding(void);
+static void test_rejected(void);
+static void test_out_len(void);
+static void test_escape(void);
+static void test_open(void);
+
+int main(void) {
+    test_segments();
+    test_decoding();
+    test_rejected();
+    test_out_len();
+    test_escape();
+    test_open();
+    return TEST_RESULT();
+}
+
+static int normalizes_to(const char * uri, const char * expected) {
+    char out[PATH_MAX];
+    return resolve_normalize(uri, out, sizeof(out)) == 0 && strcmp(out, expected) == 0;
+}
+
+static int rejects(const char * uri) {
+    char out[PATH_MAX];
+    return resolve_normalize(uri, out, sizeof(out)) == -1;
+}
+
+static void test_segments(void) {
+    CHECK(normalizes_to("/", ""));
+    CHECK(normalizes_to("/index.html", "index.html"));
+    CHECK(normalizes_to("/a//b/./c/", "a/b/c"));
+    CHECK(normalizes_to("/a/b/../c", "a/c"));
+    CHECK(normalizes_to("/a/..", ""));
+    CHECK(normalizes_to("/a/b/../../c", "c"));
+    CHECK(normalizes_to("/./././a", "a"));
+    // Only a whole ".." segment climbs.
+    CHECK(normalizes_to("/a/.../..b/c..", "a/.../..b/c.."));
+    CHECK(normalizes_to("/a?path=../../b", "a"));
+    CHECK(normalizes_to("/a#../../b", "a"));
+    CHECK(normalizes_to("/?x", ""));
+}
+
+static void test_decoding(void) {
+    CHECK(normalizes_to("/a%20b.txt", "a b.txt"));
+    CHECK(normalizes_to("/caf%c3%A9", "caf\xc3\xa9"));
+    // Encoded separators and dots are resolved like literal ones.
+    CHECK(normalizes_to("/a%2Fb", "a/b"));
+    CHECK(normalizes_to("/a/%2e%2E/b", "b"));
+    CHECK(normalizes_to("/a%3Fb", "a?b"));
+    CHECK(normalizes_to("/a%23b", "a#b"));
+}
+
+static void test_rejected(void) {
+    char out[PATH_MAX];
+    CHECK(resolve_normalize(NULL, out, sizeof(out)) == -1);
+    CHECK(rejects(""));
+    CHECK(rejects("index.html"));
+    CHECK(rejects("/.."));
+    CHECK(rejects("/a/../.."));
+    CHECK(rejects("/../etc/passwd"));
+    CHECK(rejects("/%2e%2e/etc/passwd"));
+    CHECK(rejects("/a/..%2F..%2Fetc"));
+    CHECK(rejects("/a%00.html"));
+    CHECK(rejects("/a%zz"));
+    CHECK(rejects("/a%4"));
+    CHECK(rejects("/a%"));
+}
+
+// out also holds the decoded URI's leading '/' while it is normalized.
+static void test_out_len(void) {
+    char out[5];
+    CHECK(resolve_normalize("/abc", out, sizeof(out)) == 0);
+    CHECK(strcmp(out, "abc") == 0);
+    CHECK(resolve_normalize("/abcd", out, sizeof(out)) == -1);
+    // The decoded length is what counts.
+    CHECK(resolve_normalize("/%41%42%43", out, sizeof(out)) == 0);
+    CHECK(strcmp(out, "ABC") == 0);
+}
+
+static void test_escape(void) {
+    char uri[PATH_MAX];
+    CHECK(resolve_escape("a-b_c.d~e/f", uri, sizeof(uri)) == 0);
+    CHECK(strcmp(uri, "a-b_c.d~e/f") == 0);
+    CHECK(resolve_escape("a b/caf\xc3\xa9?#%", uri, sizeof(uri)) == 0);
+    CHECK(strcmp(uri, "a%20b/caf%C3%A9%3F%23%25") == 0);
+    CHECK(resolve_escape("", uri, sizeof(uri)) == 0);
+    CHECK(strcmp(uri, "") == 0);
+
+    char small[4];
+    CHECK(resolve_escape("abc", small, sizeof(small)) == 0);
+    CHECK(resolve_escape("abcd", small, sizeof(small)) == -1);
+    CHECK(resolve_escape("a b", small, sizeof(small)) == -1);
+
+    // Escaping a normalized path and normalizing it again gives it back.
+    const char * path = "dir with space/100%/file?.html";
+    uri[0] = '/';
+    CHECK(resolve_escape(path, uri + 1, sizeof(uri) - 1) == 0);
+    char out[PATH_MAX];
+    CHECK(resolve_normalize(uri, out, sizeof(out)) == 0);
+    CHECK(strcmp(out, path) == 0);
+}
+
+static void test_open(void) {
+    char root[] = "/tmp/test_resolve.XXXXXX";
+    if (mkdtemp(root) == NULL) {
+        CHECK(!"mkdtemp");
+        return;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/page.html", root);
+    FILE * page = fopen(path, "w");
+    CHECK(page != NULL);
+    if (page != NULL) {
+        fputs("<p>hi</p>", page);
+        fclose(page);
+    }
+    char fifo[PATH_MAX];
+    snprintf(fifo, sizeof(fifo), "%s/pipe", root);
+    CHECK(mkfifo(fifo, 0600) == 0);
+
+    struct stat st;
+    int fd = resolve_open(root, "page.html", &st);
+    CHECK(fd != -1);
+    if (fd != -1) {
+        CHECK(st.st_size == 9);
+        // Reads of the file block like those of any other.
+        CHECK((fcntl(fd, F_GETFL) & O_NONBLOCK) == 0);
+        close(fd);
+    }
+    // With no writer, a blocking open of the FIFO would never return.
+    CHECK(resolve_open(root, "pipe", &st) == -1);
+    CHECK(resolve_open(root, "missing.html", &st) == -1);
+    CHECK(resolve_open(root, "", &st) == -1);
+
+    unlink(fifo);
+    unlink(path);
+    rmdir(root);
+}
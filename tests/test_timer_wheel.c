@@ -0,0 +1,146 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "test.h"
+#include "../libs/timer_wheel.h"
+
+#define NUM_TIMERS 8
+
+typedef struct {
+    tw_timer timer;
+    int fired;
+    uint64_t fired_at;
+} test_timer;
+
+static uint64_t now;
+
+static void on_expire(tw_timer * timer);
+static void advance_to(timer_wheel * wheel, uint64_t until);
+static void arm(timer_wheel * wheel, test_timer * t, uint64_t expires);
+static void test_fires_on_time(void);
+static void test_cancel(void);
+static void test_rearm(void);
+static void test_cascade(void);
+static void test_past_and_far(void);
+
+int main(void) {
+    test_fires_on_time();
+    test_cancel();
+    test_rearm();
+    test_cascade();
+    test_past_and_far();
+    return TEST_RESULT();
+}
+
+static void on_expire(tw_timer * timer) {
+    test_timer * t = (test_timer *) ((char *) timer - offsetof(test_timer, timer));
+    t->fired++;
+    t->fired_at = now;
+}
+
+// Advances one tick at a time so fired_at records the exact expiry tick.
+static void advance_to(timer_wheel * wheel, uint64_t until) {
+    while (now < until) {
+        now++;
+        tw_advance(wheel, now);
+    }
+}
+
+static void arm(timer_wheel * wheel, test_timer * t, uint64_t expires) {
+    t->timer.callback = on_expire;
+    tw_arm(wheel, &t->timer, expires);
+}
+
+static void test_fires_on_time(void) {
+    timer_wheel wheel;
+    test_timer timers[NUM_TIMERS];
+    memset(timers, 0, sizeof(timers));
+    now = 0;
+    tw_init(&wheel, now);
+
+    // One timer per level-0 slot boundary and a couple in higher levels.
+    const uint64_t expires[NUM_TIMERS] = { 1, 2, 63, 64, 65, 100, 4095, 4096 };
+    for (int i = 0; i < NUM_TIMERS; i++) arm(&wheel, &timers[i], expires[i]);
+
+    advance_to(&wheel, 5000);
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        CHECK(timers[i].fired == 1);
+        CHECK(timers[i].fired_at == expires[i]);
+    }
+}
+
+static void test_cancel(void) {
+    timer_wheel wheel;
+    test_timer kept = { 0 };
+    test_timer cancelled = { 0 };
+    now = 10;
+    tw_init(&wheel, now);
+
+    arm(&wheel, &kept, 20);
+    arm(&wheel, &cancelled, 20);
+    tw_cancel(&cancelled.timer);
+    // Cancelling twice is harmless.
+    tw_cancel(&cancelled.timer);
+
+    advance_to(&wheel, 30);
+    CHECK(kept.fired == 1);
+    CHECK(cancelled.fired == 0);
+}
+
+static void test_rearm(void) {
+    timer_wheel wheel;
+    test_timer t = { 0 };
+    now = 0;
+    tw_init(&wheel, now);
+
+    arm(&wheel, &t, 5000);
+    // Moving an armed timer takes it out of its old slot.
+    arm(&wheel, &t, 7);
+    advance_to(&wheel, 6000);
+    CHECK(t.fired == 1);
+    CHECK(t.fired_at == 7);
+}
+
+// Timers armed from a clock that is not slot aligned still have to land on
+// their exact tick after being cascaded down through every level.
+static void test_cascade(void) {
+    timer_wheel wheel;
+    test_timer timers[NUM_TIMERS];
+    memset(timers, 0, sizeof(timers));
+    now = 1000003;
+    tw_init(&wheel, now);
+
+    const uint64_t delays[NUM_TIMERS] = { 1, 64, 130, 4097, 70000, 262143, 300001, 1000000 };
+    for (int i = 0; i < NUM_TIMERS; i++) arm(&wheel, &timers[i], now + delays[i]);
+
+    uint64_t start = now;
+    advance_to(&wheel, start + 1000001);
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        CHECK(timers[i].fired == 1);
+        CHECK(timers[i].fired_at == start + delays[i]);
+    }
+}
+
+static void test_past_and_far(void) {
+    timer_wheel wheel;
+    test_timer past = { 0 };
+    test_timer far = { 0 };
+    now = 500;
+    tw_init(&wheel, now);
+
+    // A timer already due fires on the next advance.
+    arm(&wheel, &past, 100);
+    // One beyond the wheel's range parks in its furthest slot and is
+    // cascaded again until it is due.
+    uint64_t range = 1ULL << (TW_LEVEL_BITS * TW_LEVELS);
+    uint64_t far_expires = now + 2 * range + 5;
+    arm(&wheel, &far, far_expires);
+
+    advance_to(&wheel, 501);
+    CHECK(past.fired == 1);
+    CHECK(far.fired == 0);
+
+    advance_to(&wheel, far_expires + 1);
+    CHECK(far.fired == 1);
+    CHECK(far.fired_at == far_expires);
+}
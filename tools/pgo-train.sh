@@ -0,0 +1,27 @@
+#!/bin/sh
+# Trains the PGO profile of a server built with -DPGO=GENERATE by running the
+# loadgen workload against it in thread and process mode. The server writes
+# its profile when it exits on SIGTERM.
+#
+# Usage: pgo-train.sh BUILD_DIR [PORT]
+# BUILD_DIR must be a directory inside the repository, like any build
+# directory the server is run from, so ../config.cfg and ../server_directory
+# resolve.
+
+set -e
+
+cd "$1"
+port=${2:-8089}
+
+for mode in t p; do
+    DC_HTTP_MODE=$mode DC_HTTP_ACCESS_LOG= ./server -p "$port" &
+    pid=$!
+    sleep 1
+
+    ./loadgen -p "$port" -c 32 -d 10 -m default
+    ./loadgen -p "$port" -c 16 -d 5 -r 2000 -m images
+    ./loadgen -p "$port" -c 8 -d 3 -m notfound
+
+    kill -TERM "$pid"
+    wait "$pid"
+done
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Writes precompressed siblings (.br, .zst, .gz) next to every compressible
+# file under ROOT_DIR, for the server to send to clients that accept them.
+# Each coding is skipped if its compressor is not installed. A sibling is
+# kept only if it is smaller than the file, and it is given the file's mtime;
+# the server ignores siblings older than their file, so rerun this after
+# editing content. Existing siblings that are up to date are left alone.
+#
+# Usage: precompress.sh [ROOT_DIR] [MIN_SIZE]
+# ROOT_DIR defaults to server_directory and MIN_SIZE, in bytes, to 256.
+
+set -e
+
+root=${1:-server_directory}
+min_size=${2:-256}
+
+compress() {
+    file=$1
+    suffix=$2
+    shift 2
+    command -v "$1" >/dev/null 2>&1 || return 0
+
+    out=$file$suffix
+    if [ -f "$out" ] && [ ! "$file" -nt "$out" ] && [ ! "$out" -nt "$file" ]; then
+        return 0
+    fi
+
+    "$@" < "$file" > "$out.tmp"
+    if [ "$(wc -c < "$out.tmp")" -lt "$(wc -c < "$file")" ]; then
+        touch -r "$file" "$out.tmp"
+        mv "$out.tmp" "$out"
+        echo "$out"
+    else
+        rm -f "$out.tmp" "$out"
+    fi
+}
+
+find "$root" -type f \( -name '*.html' -o -name '*.htm' -o -name '*.css' -o -name '*.js' -o -name '*.mjs' \
+        -o -name '*.json' -o -name '*.svg' -o -name '*.txt' -o -name '*.xml' -o -name '*.wasm' \) \
+        -size +"$((min_size - 1))"c |
+while IFS= read -r file; do
+    compress "$file" .br brotli -q 11 -c
+    compress "$file" .zst zstd -19 -q -c
+    compress "$file" .gz gzip -9 -n -c
+done